@@ -167,6 +167,32 @@ uint32_t curr_cflags(CPUState *cpu)
     return cflags;
 }
 
+uint32_t tb_superblock_threshold;
+
+/* TBs that must be executed exactly as requested are never promoted */
+#define CF_NO_PROMOTE_MASK (CF_COUNT_MASK | CF_NO_GOTO_TB | CF_SINGLE_STEP | \
+                            CF_LAST_IO | CF_MEMI_ONLY | CF_INVALID | \
+                            CF_SUPERBLOCK)
+
+/*
+ * Count a dispatch of @tb that did not come through a direct jump, and
+ * return true once it is hot enough to be retranslated as a superblock.
+ */
+static inline bool tb_count_exec(TranslationBlock *tb)
+{
+    uint32_t threshold = qatomic_read(&tb_superblock_threshold);
+    uint32_t count;
+
+    if (likely(threshold == 0) || (tb_cflags(tb) & CF_NO_PROMOTE_MASK)) {
+        return false;
+    }
+
+    /* Racy on purpose: promoting twice is harmless, see tb_promote */
+    count = qatomic_read(&tb->exec_count) + 1;
+    qatomic_set(&tb->exec_count, count);
+    return count >= threshold;
+}
+
 /* Might cause an exception, so have a longjmp destination ready */
 static inline TranslationBlock *tb_lookup(CPUState *cpu, target_ulong pc,
                                           target_ulong cs_base,
@@ -186,7 +212,7 @@ static inline TranslationBlock *tb_lookup(CPUState *cpu, target_ulong pc,
                tb->cs_base == cs_base &&
                tb->flags == flags &&
                tb->trace_vcpu_dstate == *cpu->trace_dstate &&
-               tb_cflags(tb) == cflags)) {
+               (tb_cflags(tb) & ~CF_SUPERBLOCK) == cflags)) {
         return tb;
     }
     tb = tb_htable_lookup(cpu, pc, cs_base, flags, cflags);
@@ -320,7 +346,8 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
     }
 
     tb = tb_lookup(cpu, pc, cs_base, flags, cflags);
-    if (tb == NULL) {
+    if (tb == NULL || tb_count_exec(tb)) {
+        /* Hot TBs are promoted from the exec loop, see tb_promote */
         return tcg_code_gen_epilogue;
     }
 
@@ -329,6 +356,27 @@ const void *HELPER(lookup_tb_ptr)(CPUArchState *env)
     return tb->tc.ptr;
 }
 
+/*
+ * Replace a hot TB with a superblock for the same pc.  The cold TB is
+ * invalidated first so that the superblock can take its place in the
+ * hash table; if another vCPU raced us, tb_gen_code returns the TB that
+ * won and nothing is lost.
+ */
+static TranslationBlock *tb_promote(CPUState *cpu, TranslationBlock *tb)
+{
+    uint32_t cflags = tb_cflags(tb) | CF_SUPERBLOCK;
+    TranslationBlock *sb;
+
+    mmap_lock();
+    tb_phys_invalidate(tb, -1);
+    sb = tb_gen_code(cpu, tb->pc, tb->cs_base, tb->flags, cflags);
+    mmap_unlock();
+
+    qatomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(sb->pc)], sb);
+    qatomic_set(&tb_ctx.tb_promote_count, tb_ctx.tb_promote_count + 1);
+    return sb;
+}
+
 /* Execute a TB, and fix up the CPU state afterwards if necessary */
 /*
  * Disable CFI checks.
@@ -491,7 +539,8 @@ static bool tb_lookup_cmp(const void *p, const void *d)
         tb->cs_base == desc->cs_base &&
         tb->flags == desc->flags &&
         tb->trace_vcpu_dstate == desc->trace_vcpu_dstate &&
-        (tb_cflags(tb) & ~CF_INVALID) == desc->cflags) {
+        (tb_cflags(tb) & ~(CF_INVALID | CF_SUPERBLOCK)) ==
+        (desc->cflags & ~CF_SUPERBLOCK)) {
         /* check next page if needed */
         if (tb->page_addr[1] == -1) {
             return true;
@@ -514,7 +563,9 @@ static bool inv_tb_lookup_cmp(const void *p, const void *d)
     const TranslationBlock *tb = p;
     const struct tb_desc *desc = d;
 
+    /* Only recycle a TB translated at the requested tier */
     return tb_lookup_cmp(p, d) &&
+           (tb_cflags(tb) & CF_SUPERBLOCK) == (desc->cflags & CF_SUPERBLOCK) &&
            tb->ihash == tb_code_hash_func(desc->env, tb->pc, tb->size);
 }
 
@@ -975,6 +1026,10 @@ int cpu_exec(CPUState *cpu)
                  * for the fast lookup
                  */
                 qatomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
+            } else if (unlikely(tb_count_exec(tb))) {
+                tb = tb_promote(cpu, tb);
+                /* The TB we came from may have been the one just replaced */
+                last_tb = NULL;
             }
 
 #ifndef CONFIG_USER_ONLY
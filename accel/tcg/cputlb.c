@@ -248,6 +248,7 @@ static void tlb_flush_one_mmuidx_locked(CPUArchState *env, int mmu_idx,
 
     tlb_mmu_resize_locked(desc, fast, now);
     tlb_mmu_flush_locked(desc, fast);
+    qatomic_set(&desc->flush_count, desc->flush_count + 1);
 }
 
 static void tlb_mmu_init(CPUTLBDesc *desc, CPUTLBDescFast *fast, int64_t now)
@@ -339,6 +340,34 @@ void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+int tlb_mmu_idx_stats(TLBMmuIdxStats *stats, int max)
+{
+    CPUState *cpu;
+    int n = MIN(max, NB_MMU_MODES);
+
+    memset(stats, 0, n * sizeof(*stats));
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+
+        for (int i = 0; i < n; i++) {
+            CPUTLBDesc *d = &env_tlb(env)->d[i];
+            CPUTLBDescFast *f = &env_tlb(env)->f[i];
+
+            stats[i].n_entries += tlb_n_entries(f);
+            stats[i].n_used_entries += qatomic_read(&d->n_used_entries);
+            stats[i].fills += qatomic_read(&d->fill_count);
+            stats[i].victim_hits += qatomic_read(&d->victim_hit_count);
+            stats[i].prefills += qatomic_read(&d->prefill_count);
+            stats[i].flushes += qatomic_read(&d->flush_count);
+            stats[i].large_page_flushes +=
+                qatomic_read(&d->large_page_flush_count);
+        }
+    }
+
+    return NB_MMU_MODES;
+}
+
 static void tlb_flush_by_mmuidx_async_work(CPUState *cpu, run_on_cpu_data data)
 {
     CPUArchState *env = cpu->env_ptr;
@@ -493,6 +522,47 @@ static inline void tlb_flush_vtlb_page_locked(CPUArchState *env, int mmu_idx,
     tlb_flush_vtlb_page_mask_locked(env, mmu_idx, page, -1);
 }
 
+/*
+ * Flush every entry within the region covered by large pages, leaving the
+ * rest of the tlb intact.  Scanning the table costs about as much as the
+ * memset of a full flush, but spares the refill of unrelated entries.
+ * Called with tlb_c.lock held.
+ */
+static void tlb_flush_large_page_locked(CPUArchState *env, int midx)
+{
+    CPUTLBDesc *d = &env_tlb(env)->d[midx];
+    CPUTLBDescFast *f = &env_tlb(env)->f[midx];
+    target_ulong lp_addr = d->large_page_addr;
+    target_ulong lp_mask = d->large_page_mask;
+    size_t i, n = tlb_n_entries(f);
+
+    tlb_debug("flushing large page region midx %d ("
+              TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
+              midx, lp_addr, lp_mask);
+
+    for (i = 0; i < n; i++) {
+        CPUTLBEntry *entry = &f->table[i];
+
+        if (!tlb_entry_is_empty(entry) &&
+            tlb_flush_entry_mask_locked(entry, lp_addr, lp_mask)) {
+            tlb_n_used_entries_dec(env, midx);
+        }
+    }
+    for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        CPUTLBEntry *entry = &d->vtable[i];
+
+        if (!tlb_entry_is_empty(entry) &&
+            tlb_flush_entry_mask_locked(entry, lp_addr, lp_mask)) {
+            tlb_n_used_entries_dec(env, midx);
+        }
+    }
+
+    /* No large page is left in the tlb.  */
+    d->large_page_addr = -1;
+    d->large_page_mask = -1;
+    qatomic_set(&d->large_page_flush_count, d->large_page_flush_count + 1);
+}
+
 static void tlb_flush_page_locked(CPUArchState *env, int midx,
                                   target_ulong page)
 {
@@ -501,10 +571,7 @@ static void tlb_flush_page_locked(CPUArchState *env, int midx,
 
     /* Check if we need to flush due to large pages.  */
     if ((page & lp_mask) == lp_addr) {
-        tlb_debug("forcing full flush midx %d ("
-                  TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
-                  midx, lp_addr, lp_mask);
-        tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
+        tlb_flush_large_page_locked(env, midx);
     } else {
         if (tlb_flush_entry_locked(tlb_entry(env, midx, page), page)) {
             tlb_n_used_entries_dec(env, midx);
@@ -739,11 +806,7 @@ static void tlb_flush_range_locked(CPUArchState *env, int midx,
      * we only need to test the end of the range.
      */
     if (((addr + len - 1) & d->large_page_mask) == d->large_page_addr) {
-        tlb_debug("forcing full flush midx %d ("
-                  TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
-                  midx, d->large_page_addr, d->large_page_mask);
-        tlb_flush_one_mmuidx_locked(env, midx, get_clock_realtime());
-        return;
+        tlb_flush_large_page_locked(env, midx);
     }
 
     for (target_ulong i = 0; i < len; i += TARGET_PAGE_SIZE) {
@@ -1086,6 +1149,38 @@ static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
     env_tlb(env)->d[mmu_idx].large_page_mask = lp_mask;
 }
 
+uint32_t tlb_prefill_pages;
+
+/*
+ * After a miss within a large page, fill the entries for the pages that
+ * follow it in the same large page, as long as their tlb slots are empty.
+ * They share the page table entry that was just walked, so this trades a
+ * handful of section lookups now for the same number of misses later.
+ */
+static void tlb_prefill_large_page(CPUState *cpu, target_ulong vaddr,
+                                   hwaddr paddr, MemTxAttrs attrs, int prot,
+                                   int mmu_idx, target_ulong size)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
+    target_ulong vaddr_page = vaddr & TARGET_PAGE_MASK;
+    target_ulong lp_end = (vaddr_page | (size - 1)) & TARGET_PAGE_MASK;
+    target_ulong page = vaddr_page;
+    hwaddr paddr_page = paddr & TARGET_PAGE_MASK;
+    uint32_t n;
+
+    for (n = 0; n < tlb_prefill_pages && page != lp_end; n++) {
+        page += TARGET_PAGE_SIZE;
+        paddr_page += TARGET_PAGE_SIZE;
+        if (!tlb_entry_is_empty(tlb_entry(env, mmu_idx, page))) {
+            continue;
+        }
+        tlb_set_page_with_attrs(cpu, page, paddr_page, attrs, prot,
+                                mmu_idx, TARGET_PAGE_SIZE);
+        qatomic_set(&desc->prefill_count, desc->prefill_count + 1);
+    }
+}
+
 /* Add a new TLB entry. At most one entry for a given virtual address
  * is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
  * supplied size is only used by tlb_flush_page.
@@ -1110,6 +1205,7 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     target_ulong vaddr_page;
     int asidx = cpu_asidx_from_attrs(cpu, attrs);
     int wp_flags;
+    int page_prot = prot;
     bool is_ram, is_romd;
 
     assert_cpu_is_self(cpu);
@@ -1266,6 +1362,11 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     copy_tlb_helper_locked(te, &tn);
     tlb_n_used_entries_inc(env, mmu_idx);
     qemu_spin_unlock(&tlb->c.lock);
+
+    if (size > TARGET_PAGE_SIZE && tlb_prefill_pages) {
+        tlb_prefill_large_page(cpu, vaddr, paddr, attrs, page_prot,
+                               mmu_idx, size);
+    }
 }
 
 /* Add a new TLB entry, but without specifying the memory
@@ -1300,8 +1401,12 @@ static void tlb_fill(CPUState *cpu, target_ulong addr, int size,
                      MMUAccessType access_type, int mmu_idx, uintptr_t retaddr)
 {
     CPUClass *cc = CPU_GET_CLASS(cpu);
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
     bool ok;
 
+    qatomic_set(&desc->fill_count, desc->fill_count + 1);
+
     /*
      * This is not a probe, so only valid return is success; failure
      * should result in exception + longjmp to the cpu loop.
@@ -1357,7 +1462,7 @@ static uint64_t io_readx(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
         cpu_io_recompile(cpu, retaddr);
     }
 
-    if (!qemu_mutex_iothread_locked()) {
+    if (!mr->lockless_io && !qemu_mutex_iothread_locked()) {
         qemu_mutex_lock_iothread();
         locked = true;
     }
@@ -1418,7 +1523,7 @@ static void io_writex(CPUArchState *env, CPUIOTLBEntry *iotlbentry,
      */
     save_iotlb_data(cpu, iotlbentry->addr, section, mr_offset);
 
-    if (!qemu_mutex_iothread_locked()) {
+    if (!mr->lockless_io && !qemu_mutex_iothread_locked()) {
         qemu_mutex_lock_iothread();
         locked = true;
     }
@@ -1468,8 +1573,11 @@ static bool victim_tlb_hit(CPUArchState *env, size_t mmu_idx, size_t index,
 
         if (cmp == page) {
             /* Found entry in victim tlb, swap tlb and iotlb.  */
+            CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
             CPUTLBEntry tmptlb, *tlb = &env_tlb(env)->f[mmu_idx].table[index];
 
+            qatomic_set(&desc->victim_hit_count, desc->victim_hit_count + 1);
+
             qemu_spin_lock(&env_tlb(env)->c.lock);
             copy_tlb_helper_locked(&tmptlb, tlb);
             copy_tlb_helper_locked(tlb, vtlb);
@@ -1603,7 +1711,9 @@ static int probe_access_internal(CPUArchState *env, target_ulong addr,
         if (!victim_tlb_hit(env, mmu_idx, index, elt_ofs, page_addr)) {
             CPUState *cs = env_cpu(env);
             CPUClass *cc = CPU_GET_CLASS(cs);
+            CPUTLBDesc *desc = &env_tlb(env)->d[mmu_idx];
 
+            qatomic_set(&desc->fill_count, desc->fill_count + 1);
             if (!cc->tcg_ops->tlb_fill(cs, addr, fault_size, access_type,
                                        mmu_idx, nonfault, retaddr)) {
                 /* Non-faulting page table read failed.  */
@@ -1684,7 +1794,7 @@ void *probe_access(CPUArchState *env, target_ulong addr, int size,
 
         /* Handle clean RAM pages.  */
         if (flags & TLB_NOTDIRTY) {
-            notdirty_write(env_cpu(env), addr, 1, iotlbentry, retaddr);
+            notdirty_write(env_cpu(env), addr, size, iotlbentry, retaddr);
         }
     }
 
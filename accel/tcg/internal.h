@@ -19,4 +19,12 @@ void QEMU_NORETURN cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 void page_init(void);
 void tb_htable_init(void);
 
+/* Dispatch count at which a TB is retranslated as a superblock, 0 = off */
+extern uint32_t tb_superblock_threshold;
+
+#ifdef CONFIG_SOFTMMU
+/* Pages filled ahead of a miss within a guest large page, 0 = off */
+extern uint32_t tlb_prefill_pages;
+#endif
+
 #endif /* ACCEL_TCG_INTERNAL_H */
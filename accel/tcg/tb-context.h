@@ -36,6 +36,7 @@ struct TBContext {
     /* statistics */
     unsigned tb_flush_count;
     unsigned tb_phys_invalidate_count;
+    unsigned tb_promote_count;
 };
 
 extern TBContext tb_ctx;
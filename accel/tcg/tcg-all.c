@@ -44,6 +44,8 @@ struct TCGState {
     bool mttcg_enabled;
     int splitwx_enabled;
     unsigned long tb_size;
+    uint32_t superblock_threshold;
+    uint32_t tlb_prefill;
 };
 typedef struct TCGState TCGState;
 
@@ -125,6 +127,7 @@ static int tcg_init_machine(MachineState *ms)
     page_init();
     tb_htable_init();
     tcg_init(s->tb_size * MiB, s->splitwx_enabled, max_cpus);
+    tb_superblock_threshold = s->superblock_threshold;
 
 #if defined(CONFIG_SOFTMMU)
     /*
@@ -132,6 +135,7 @@ static int tcg_init_machine(MachineState *ms)
      * initialize the prologue now.
      */
     tcg_prologue_init(tcg_ctx);
+    tlb_prefill_pages = s->tlb_prefill;
 #endif
 
     return 0;
@@ -196,6 +200,54 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_superblock_threshold(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->superblock_threshold;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_superblock_threshold(Object *obj, Visitor *v,
+                                         const char *name, void *opaque,
+                                         Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->superblock_threshold = value;
+}
+
+static void tcg_get_tlb_prefill(Object *obj, Visitor *v,
+                                const char *name, void *opaque,
+                                Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->tlb_prefill;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_tlb_prefill(Object *obj, Visitor *v,
+                                const char *name, void *opaque,
+                                Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->tlb_prefill = value;
+}
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -225,6 +277,18 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "superblock-threshold", "int",
+        tcg_get_superblock_threshold, tcg_set_superblock_threshold,
+        NULL, NULL);
+    object_class_property_set_description(oc, "superblock-threshold",
+        "Dispatches before a TB is retranslated as a superblock (0 = off)");
+
+    object_class_property_add(oc, "tlb-prefill", "int",
+        tcg_get_tlb_prefill, tcg_set_tlb_prefill,
+        NULL, NULL);
+    object_class_property_set_description(oc, "tlb-prefill",
+        "Pages filled ahead of a TLB miss within a guest large page (0 = off)");
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
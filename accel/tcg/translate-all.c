@@ -893,7 +893,8 @@ static bool tb_cmp(const void *ap, const void *bp)
     return a->pc == b->pc &&
         a->cs_base == b->cs_base &&
         a->flags == b->flags &&
-        (tb_cflags(a) & ~CF_INVALID) == (tb_cflags(b) & ~CF_INVALID) &&
+        (tb_cflags(a) & ~(CF_INVALID | CF_SUPERBLOCK)) ==
+        (tb_cflags(b) & ~(CF_INVALID | CF_SUPERBLOCK)) &&
         a->trace_vcpu_dstate == b->trace_vcpu_dstate &&
         a->page_addr[0] == b->page_addr[0] &&
         a->page_addr[1] == b->page_addr[1];
@@ -902,7 +903,9 @@ static bool tb_cmp(const void *ap, const void *bp)
 static bool inv_tb_cmp(const void *ap, const void *bp)
 {
     const TranslationBlock *a = ap, *b = bp;
-    return tb_cmp(ap, bp) && a->ihash == b->ihash;
+    return tb_cmp(ap, bp) &&
+        (tb_cflags(a) & CF_SUPERBLOCK) == (tb_cflags(b) & CF_SUPERBLOCK) &&
+        a->ihash == b->ihash;
 }
 
 void tb_htable_init(void)
@@ -1454,6 +1457,8 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
                                   tb->trace_vcpu_dstate);
         bool removed = qht_remove(&tb_ctx.inv_htable, tb, h);
         g_assert(removed);
+        /* Count from scratch, or a recycled TB is promoted straight away */
+        qatomic_set(&tb->exec_count, 0);
         goto recycle_tb;
     }
 
@@ -1475,6 +1480,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->flags = flags;
     tb->cflags = cflags;
     tb->trace_vcpu_dstate = *cpu->trace_dstate;
+    tb->exec_count = 0;
     tcg_ctx->tb_cflags = cflags;
  tb_overflow:
 
@@ -2158,6 +2164,8 @@ void dump_exec_info(void)
                 qatomic_read(&tb_ctx.tb_flush_count));
     qemu_printf("TB invalidate count %u\n",
                 qatomic_read(&tb_ctx.tb_phys_invalidate_count));
+    qemu_printf("TB promote count    %u\n",
+                qatomic_read(&tb_ctx.tb_promote_count));
 
     tlb_flush_counts(&flush_full, &flush_part, &flush_elide);
     qemu_printf("TLB full flushes    %zu\n", flush_full);
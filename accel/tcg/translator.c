@@ -43,6 +43,115 @@ bool translator_use_goto_tb(DisasContextBase *db, target_ulong dest)
     return ((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0;
 }
 
+bool translator_use_superblock(DisasContextBase *db, target_ulong pc_next,
+                               target_ulong dest)
+{
+    uint32_t cflags = tb_cflags(db->tb);
+
+    if (!(cflags & CF_SUPERBLOCK) || (cflags & CF_NO_GOTO_TB)) {
+        return false;
+    }
+
+    /*
+     * Only follow forward jumps, so that [pc_first, pc_next) still covers
+     * every guest byte that was translated.  Page invalidation and the
+     * code hash of the TB both rely on that range.
+     */
+    if (dest <= pc_next) {
+        return false;
+    }
+
+    return ((db->pc_first ^ dest) & TARGET_PAGE_MASK) == 0;
+}
+
+bool translator_use_inline_lookup(DisasContextBase *db)
+{
+    uint32_t cflags = tb_cflags(db->tb);
+
+    if (!(cflags & CF_SUPERBLOCK) || (cflags & CF_NO_GOTO_PTR)) {
+        return false;
+    }
+
+    /* HELPER(lookup_tb_ptr) logs every TB it returns */
+    return !qemu_loglevel_mask(CPU_LOG_EXEC);
+}
+
+void translator_gen_lookup_and_goto_ptr(DisasContextBase *db, TCGv pc,
+                                        TCGv cs_base, TCGv_i32 flags)
+{
+    TCGLabel *miss = gen_new_label();
+    TCGv l_pc = tcg_temp_local_new();
+    TCGv l_cs_base = tcg_temp_local_new();
+    TCGv_i32 l_flags = tcg_temp_local_new_i32();
+    TCGv_ptr tb = tcg_temp_local_new_ptr();
+    TCGv_ptr ptr = tcg_temp_new_ptr();
+    TCGv_i32 hash = tcg_temp_new_i32();
+    TCGv_i32 t32 = tcg_temp_new_i32();
+    TCGv t = tcg_temp_new();
+
+    plugin_gen_disable_mem_helpers();
+
+    tcg_gen_mov_tl(l_pc, pc);
+    tcg_gen_mov_tl(l_cs_base, cs_base);
+    tcg_gen_mov_i32(l_flags, flags);
+
+    /*
+     * Must match tb_jmp_cache_hash_func().  Neither variant looks at pc
+     * bits above 23, so the hash can be computed on the low 32 bits.
+     */
+    tcg_gen_trunc_tl_i32(hash, pc);
+#ifdef CONFIG_SOFTMMU
+    tcg_gen_shri_i32(t32, hash, TARGET_PAGE_BITS - TB_JMP_PAGE_BITS);
+    tcg_gen_xor_i32(hash, hash, t32);
+    tcg_gen_shri_i32(t32, hash, TARGET_PAGE_BITS - TB_JMP_PAGE_BITS);
+    tcg_gen_andi_i32(t32, t32, TB_JMP_PAGE_MASK);
+    tcg_gen_andi_i32(hash, hash, TB_JMP_ADDR_MASK);
+    tcg_gen_or_i32(hash, hash, t32);
+#else
+    tcg_gen_shri_i32(t32, hash, TB_JMP_CACHE_BITS);
+    tcg_gen_xor_i32(hash, hash, t32);
+    tcg_gen_andi_i32(hash, hash, TB_JMP_CACHE_SIZE - 1);
+#endif
+    tcg_gen_shli_i32(hash, hash, ctz32(sizeof(TranslationBlock *)));
+    tcg_gen_ext_i32_ptr(ptr, hash);
+    tcg_gen_add_ptr(ptr, ptr, cpu_env);
+    tcg_gen_ld_ptr(tb, ptr, offsetof(ArchCPU, parent_obj.tb_jmp_cache) -
+                   offsetof(ArchCPU, env));
+
+    /*
+     * Same checks as tb_lookup().  cflags must match exactly, so only
+     * other superblocks are entered from here: a cold TB still goes
+     * through the helper to be counted and promoted, and an invalidated
+     * one has CF_INVALID set.
+     */
+    tcg_gen_brcondi_ptr(TCG_COND_EQ, tb, 0, miss);
+    tcg_gen_ld_tl(t, tb, offsetof(TranslationBlock, pc));
+    tcg_gen_brcond_tl(TCG_COND_NE, t, l_pc, miss);
+    tcg_gen_ld_tl(t, tb, offsetof(TranslationBlock, cs_base));
+    tcg_gen_brcond_tl(TCG_COND_NE, t, l_cs_base, miss);
+    tcg_gen_ld_i32(t32, tb, offsetof(TranslationBlock, flags));
+    tcg_gen_brcond_i32(TCG_COND_NE, t32, l_flags, miss);
+    tcg_gen_ld_i32(t32, tb, offsetof(TranslationBlock, trace_vcpu_dstate));
+    tcg_gen_brcondi_i32(TCG_COND_NE, t32, db->tb->trace_vcpu_dstate, miss);
+    tcg_gen_ld_i32(t32, tb, offsetof(TranslationBlock, cflags));
+    tcg_gen_brcondi_i32(TCG_COND_NE, t32, tb_cflags(db->tb), miss);
+
+    tcg_gen_ld_ptr(ptr, tb, offsetof(TranslationBlock, tc.ptr));
+    tcg_gen_op1i(INDEX_op_goto_ptr, tcgv_ptr_arg(ptr));
+
+    gen_set_label(miss);
+    tcg_gen_lookup_and_goto_ptr();
+
+    tcg_temp_free(t);
+    tcg_temp_free_i32(t32);
+    tcg_temp_free_i32(hash);
+    tcg_temp_free_ptr(ptr);
+    tcg_temp_free_ptr(tb);
+    tcg_temp_free_i32(l_flags);
+    tcg_temp_free(l_cs_base);
+    tcg_temp_free(l_pc);
+}
+
 void translator_loop(const TranslatorOps *ops, DisasContextBase *db,
                      CPUState *cpu, TranslationBlock *tb, int max_insns)
 {
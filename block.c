@@ -5525,6 +5525,20 @@ bool bdrv_is_sg(BlockDriverState *bs)
     return bs->sg;
 }
 
+/**
+ * Return whether reads from the given node end up in a memory mapped
+ * image, looking through the primary children down to the protocol node.
+ */
+bool bdrv_is_memory_mapped(BlockDriverState *bs)
+{
+    for (; bs && bs->drv; bs = bdrv_primary_bs(bs)) {
+        if (bs->drv->is_memory_mapped) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /**
  * Return whether the given node supports compressed writes.
  */
@@ -0,0 +1,380 @@
+/*
+ * Read-only memory mapped image protocol driver
+ *
+ * Maps the whole image into the address space and serves reads with a
+ * single copy out of the mapping, skipping the syscall and the bounce
+ * through the block layer's buffers the file driver needs per request.
+ * Meant for immutable disc images (ISO/XISO); the image must not shrink
+ * while it is mapped.
+ *
+ * A copy may fault pages in from the disk, so until the image is known to
+ * be resident the copy runs in the thread pool like a file driver read.
+ * Unless populate=off, a background thread reads the image in, and once it
+ * is done reads are copied in place.
+ *
+ * An I/O error while faulting a page in (failing disk, network share gone,
+ * removable media pulled) raises SIGBUS and kills the process, where the
+ * file driver would fail the request with -EIO. Only map images on storage
+ * that can be trusted to stay readable.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/thread.h"
+#include "block/thread-pool.h"
+#include "block/block_int.h"
+#include "trace.h"
+
+#define MMAP_OPT_POPULATE "populate"
+
+typedef struct BDRVMmapState {
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+    uint8_t *map;
+    int64_t length;
+
+    QemuThread populate_thread;
+    bool populating;      /* populate_thread needs joining */
+    bool populate_stop;   /* Set to make populate_thread give up */
+    bool populated;       /* Whole image read in, set by populate_thread */
+} BDRVMmapState;
+
+typedef struct MmapCopyData {
+    BDRVMmapState *s;
+    uint64_t offset;
+    uint64_t bytes;
+    QEMUIOVector *qiov;
+} MmapCopyData;
+
+static QemuOptsList runtime_opts = {
+    .name = "mmap",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = "filename",
+            .type = QEMU_OPT_STRING,
+            .help = "File name of the image",
+        },
+        {
+            .name = MMAP_OPT_POPULATE,
+            .type = QEMU_OPT_BOOL,
+            .help = "read the whole image into the page cache in the "
+                    "background (default: on)",
+        },
+        { /* end of list */ }
+    },
+};
+
+static const char *const mmap_strong_runtime_opts[] = {
+    "filename",
+
+    NULL
+};
+
+static void mmap_parse_filename(const char *filename, QDict *options,
+                                Error **errp)
+{
+    bdrv_parse_filename_strip_prefix(filename, "mmap:", options);
+}
+
+#ifdef _WIN32
+static int mmap_map(BDRVMmapState *s, const char *filename, Error **errp)
+{
+    LARGE_INTEGER size;
+
+    s->file = CreateFile(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (s->file == INVALID_HANDLE_VALUE) {
+        error_setg_win32(errp, GetLastError(), "Could not open '%s'",
+                         filename);
+        return -EIO;
+    }
+    if (!GetFileSizeEx(s->file, &size)) {
+        error_setg_win32(errp, GetLastError(), "Could not get size of '%s'",
+                         filename);
+        return -EIO;
+    }
+    s->length = size.QuadPart;
+    if (!s->length) {
+        return 0;
+    }
+
+    s->mapping = CreateFileMapping(s->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!s->mapping) {
+        error_setg_win32(errp, GetLastError(), "Could not map '%s'",
+                         filename);
+        return -EIO;
+    }
+    s->map = MapViewOfFile(s->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!s->map) {
+        error_setg_win32(errp, GetLastError(), "Could not map '%s'",
+                         filename);
+        return -EIO;
+    }
+    return 0;
+}
+
+static void mmap_unmap(BDRVMmapState *s)
+{
+    if (s->map) {
+        UnmapViewOfFile(s->map);
+    }
+    if (s->mapping) {
+        CloseHandle(s->mapping);
+    }
+    if (s->file != INVALID_HANDLE_VALUE) {
+        CloseHandle(s->file);
+    }
+}
+#else
+static int mmap_map(BDRVMmapState *s, const char *filename, Error **errp)
+{
+    void *map;
+    int ret;
+
+    s->fd = qemu_open(filename, O_RDONLY, errp);
+    if (s->fd < 0) {
+        return -errno;
+    }
+    s->length = lseek(s->fd, 0, SEEK_END);
+    if (s->length < 0) {
+        ret = -errno;
+        error_setg_errno(errp, -ret, "Could not get size of '%s'", filename);
+        return ret;
+    }
+    if (!s->length) {
+        return 0;
+    }
+
+    map = mmap(NULL, s->length, PROT_READ, MAP_SHARED, s->fd, 0);
+    if (map == MAP_FAILED) {
+        ret = -errno;
+        error_setg_errno(errp, -ret, "Could not map '%s'", filename);
+        return ret;
+    }
+    s->map = map;
+    return 0;
+}
+
+static void mmap_unmap(BDRVMmapState *s)
+{
+    if (s->map) {
+        munmap(s->map, s->length);
+    }
+    if (s->fd >= 0) {
+        qemu_close(s->fd);
+    }
+}
+#endif
+
+/* Fault the image in up front so guest reads never wait on the disk */
+static void *mmap_populate_thread(void *opaque)
+{
+    BDRVMmapState *s = opaque;
+    size_t pagesize = qemu_real_host_page_size;
+    volatile uint8_t sink;
+    int64_t off;
+
+    qemu_madvise(s->map, s->length, QEMU_MADV_WILLNEED);
+    for (off = 0; off < s->length; off += pagesize) {
+        if (qatomic_read(&s->populate_stop)) {
+            break;
+        }
+        sink = s->map[off];
+    }
+    (void)sink;
+
+    trace_mmap_populate_done(s, off >= s->length);
+    if (off >= s->length) {
+        qatomic_store_release(&s->populated, true);
+    }
+    return NULL;
+}
+
+static void mmap_populate_start(BDRVMmapState *s)
+{
+    s->populating = true;
+    qemu_thread_create(&s->populate_thread, "mmap-populate",
+                       mmap_populate_thread, s, QEMU_THREAD_JOINABLE);
+}
+
+static void mmap_populate_stop(BDRVMmapState *s)
+{
+    if (!s->populating) {
+        return;
+    }
+    qatomic_set(&s->populate_stop, true);
+    qemu_thread_join(&s->populate_thread);
+    s->populating = false;
+}
+
+static int mmap_file_open(BlockDriverState *bs, QDict *options, int flags,
+                          Error **errp)
+{
+    BDRVMmapState *s = bs->opaque;
+    const char *filename;
+    QemuOpts *opts;
+    int ret;
+
+#ifdef _WIN32
+    s->file = INVALID_HANDLE_VALUE;
+#else
+    s->fd = -1;
+#endif
+
+    ret = bdrv_apply_auto_read_only(bs, "The mmap driver is read-only", errp);
+    if (ret < 0) {
+        return ret;
+    }
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    filename = qemu_opt_get(opts, "filename");
+    if (!filename) {
+        error_setg(errp, "The mmap driver requires a filename");
+        ret = -EINVAL;
+        goto fail;
+    }
+
+    ret = mmap_map(s, filename, errp);
+    if (ret < 0) {
+        mmap_unmap(s);
+        goto fail;
+    }
+
+    if (s->map && qemu_opt_get_bool(opts, MMAP_OPT_POPULATE, true)) {
+        mmap_populate_start(s);
+    }
+    trace_mmap_file_open(bs, filename, s->length, s->map);
+
+fail:
+    qemu_opts_del(opts);
+    return ret;
+}
+
+static void mmap_close(BlockDriverState *bs)
+{
+    BDRVMmapState *s = bs->opaque;
+
+    mmap_populate_stop(s);
+    mmap_unmap(s);
+}
+
+static int64_t mmap_getlength(BlockDriverState *bs)
+{
+    BDRVMmapState *s = bs->opaque;
+
+    return s->length;
+}
+
+static int mmap_copy(void *opaque)
+{
+    MmapCopyData *data = opaque;
+    BDRVMmapState *s = data->s;
+    uint64_t n = 0;
+
+    /* The block layer rounds the length up, zero what lies past the end */
+    if (data->offset < s->length) {
+        n = MIN(data->bytes, s->length - data->offset);
+        qemu_iovec_from_buf(data->qiov, 0, s->map + data->offset, n);
+    }
+    if (n < data->bytes) {
+        qemu_iovec_memset(data->qiov, n, 0, data->bytes - n);
+    }
+    return 0;
+}
+
+static coroutine_fn int mmap_co_preadv(BlockDriverState *bs,
+                                       uint64_t offset, uint64_t bytes,
+                                       QEMUIOVector *qiov, int flags)
+{
+    BDRVMmapState *s = bs->opaque;
+    MmapCopyData data = {
+        .s = s,
+        .offset = offset,
+        .bytes = bytes,
+        .qiov = qiov,
+    };
+    ThreadPool *pool;
+
+    if (qatomic_load_acquire(&s->populated)) {
+        return mmap_copy(&data);
+    }
+
+    /* Faulting pages in would stall the AioContext */
+    pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
+    return thread_pool_submit_co(pool, mmap_copy, &data);
+}
+
+static ImageInfoSpecific *mmap_get_specific_info(BlockDriverState *bs,
+                                                 Error **errp)
+{
+    BDRVMmapState *s = bs->opaque;
+    ImageInfoSpecific *spec_info = g_new(ImageInfoSpecific, 1);
+
+    *spec_info = (ImageInfoSpecific){
+        .type = IMAGE_INFO_SPECIFIC_KIND_MMAP,
+        .u.mmap.data = g_new0(ImageInfoSpecificMmap, 1),
+    };
+    spec_info->u.mmap.data->populated = qatomic_load_acquire(&s->populated);
+    return spec_info;
+}
+
+static int mmap_reopen_prepare(BDRVReopenState *reopen_state,
+                               BlockReopenQueue *queue, Error **errp)
+{
+    if (reopen_state->flags & BDRV_O_RDWR) {
+        error_setg(errp, "The mmap driver is read-only");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static BlockDriver bdrv_mmap = {
+    .format_name            = "mmap",
+    .protocol_name          = "mmap",
+    .instance_size          = sizeof(BDRVMmapState),
+    .is_memory_mapped       = true,
+
+    .bdrv_file_open         = mmap_file_open,
+    .bdrv_parse_filename    = mmap_parse_filename,
+    .bdrv_close             = mmap_close,
+    .bdrv_getlength         = mmap_getlength,
+    .bdrv_get_specific_info = mmap_get_specific_info,
+    .bdrv_reopen_prepare    = mmap_reopen_prepare,
+
+    .bdrv_co_preadv         = mmap_co_preadv,
+
+    .strong_runtime_opts    = mmap_strong_runtime_opts,
+};
+
+static void bdrv_mmap_init(void)
+{
+    bdrv_register(&bdrv_mmap);
+}
+
+block_init(bdrv_mmap_init);
@@ -0,0 +1,294 @@
+/*
+ * System Link relay
+ *
+ * Forwards every datagram it receives from an emulator instance's syslink
+ * netdev to all other instances it has heard from recently, so several
+ * instances on one machine or a LAN can share a virtual link segment
+ * without host bridging. Run it anywhere all instances can reach and point
+ * their netdevs at it, e.g. -netdev syslink,id=sl0,relay=192.168.1.2:9369
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qemu/sockets.h"
+#include "net/syslink.h"
+
+#define RELAY_BATCH         32
+#define RELAY_PEER_TIMEOUT  (30 * G_USEC_PER_SEC)
+
+typedef struct RelayPeer {
+    struct sockaddr_in addr;
+    uint32_t id;
+    int64_t last_seen;
+} RelayPeer;
+
+static RelayPeer peers[SYSLINK_MAX_PEERS];
+static bool verbose;
+
+static void relay_usage(const char *progname)
+{
+    printf("Usage: %s [OPTION]...\n"
+           "  -h: show this help\n"
+           "  -v: verbose mode\n"
+           "  -b <address>: local address to listen on\n"
+           "     default 0.0.0.0\n"
+           "  -p <port>: UDP port to listen on\n"
+           "     default %d\n",
+           progname, SYSLINK_DEFAULT_PORT);
+}
+
+static bool addr_equal(const struct sockaddr_in *a,
+                       const struct sockaddr_in *b)
+{
+    return a->sin_addr.s_addr == b->sin_addr.s_addr &&
+           a->sin_port == b->sin_port;
+}
+
+/*
+ * Find the sender of a datagram in the peer table, adding it if there is
+ * room. Returns NULL when the table is full.
+ */
+static RelayPeer *relay_lookup_peer(const struct sockaddr_in *addr,
+                                    uint32_t id, int64_t now)
+{
+    RelayPeer *free_slot = NULL;
+
+    for (int i = 0; i < SYSLINK_MAX_PEERS; i++) {
+        RelayPeer *p = &peers[i];
+        if (p->last_seen && now - p->last_seen > RELAY_PEER_TIMEOUT) {
+            if (verbose) {
+                printf("peer %08x (%s:%d) timed out\n", p->id,
+                       inet_ntoa(p->addr.sin_addr), ntohs(p->addr.sin_port));
+            }
+            p->last_seen = 0;
+        }
+        if (p->last_seen && addr_equal(&p->addr, addr)) {
+            p->id = id;
+            p->last_seen = now;
+            return p;
+        }
+        if (!p->last_seen && !free_slot) {
+            free_slot = p;
+        }
+    }
+
+    if (free_slot) {
+        free_slot->addr = *addr;
+        free_slot->id = id;
+        free_slot->last_seen = now;
+        if (verbose) {
+            printf("peer %08x (%s:%d) joined\n", id,
+                   inet_ntoa(addr->sin_addr), ntohs(addr->sin_port));
+        }
+    }
+
+    return free_slot;
+}
+
+typedef struct RelayMsg {
+    const uint8_t *buf;
+    size_t len;
+    /* A copy: the peer slot may be reused later in the same batch */
+    struct sockaddr_in dst;
+} RelayMsg;
+
+static void relay_send(int fd, RelayMsg *msgs, int count)
+{
+#ifdef CONFIG_LINUX
+    struct mmsghdr mmsgs[RELAY_BATCH];
+    struct iovec iov[RELAY_BATCH];
+
+    for (int base = 0; base < count; base += RELAY_BATCH) {
+        int n = MIN(count - base, RELAY_BATCH);
+        for (int i = 0; i < n; i++) {
+            iov[i].iov_base = (void *)msgs[base + i].buf;
+            iov[i].iov_len = msgs[base + i].len;
+            memset(&mmsgs[i], 0, sizeof(mmsgs[i]));
+            mmsgs[i].msg_hdr.msg_name = &msgs[base + i].dst;
+            mmsgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+            mmsgs[i].msg_hdr.msg_iov = &iov[i];
+            mmsgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        int sent = 0;
+        while (sent < n) {
+            int ret = sendmmsg(fd, &mmsgs[sent], n - sent, 0);
+            if (ret < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                /* Skip a datagram the kernel refuses, e.g. unreachable */
+                ret = 1;
+            }
+            sent += ret;
+        }
+    }
+#else
+    for (int i = 0; i < count; i++) {
+        sendto(fd, (const void *)msgs[i].buf, msgs[i].len, 0,
+               (struct sockaddr *)&msgs[i].dst, sizeof(struct sockaddr_in));
+    }
+#endif
+}
+
+/*
+ * Receive up to a batch of datagrams, blocking for the first one.
+ */
+static int relay_recv(int fd, uint8_t bufs[][SYSLINK_MAX_DATAGRAM],
+                      size_t *lens, struct sockaddr_in *addrs)
+{
+#ifdef CONFIG_LINUX
+    struct mmsghdr mmsgs[RELAY_BATCH];
+    struct iovec iov[RELAY_BATCH];
+
+    for (int i = 0; i < RELAY_BATCH; i++) {
+        iov[i].iov_base = bufs[i];
+        iov[i].iov_len = SYSLINK_MAX_DATAGRAM;
+        memset(&mmsgs[i], 0, sizeof(mmsgs[i]));
+        mmsgs[i].msg_hdr.msg_name = &addrs[i];
+        mmsgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        mmsgs[i].msg_hdr.msg_iov = &iov[i];
+        mmsgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    int count = recvmmsg(fd, mmsgs, RELAY_BATCH, MSG_WAITFORONE, NULL);
+    for (int i = 0; i < count; i++) {
+        lens[i] = mmsgs[i].msg_len;
+    }
+    return count;
+#else
+    socklen_t addrlen = sizeof(addrs[0]);
+    ssize_t ret = recvfrom(fd, (void *)bufs[0], SYSLINK_MAX_DATAGRAM, 0,
+                           (struct sockaddr *)&addrs[0], &addrlen);
+    if (ret < 0) {
+        return -1;
+    }
+    lens[0] = ret;
+    return 1;
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    static uint8_t bufs[RELAY_BATCH][SYSLINK_MAX_DATAGRAM];
+    static RelayMsg out[RELAY_BATCH * SYSLINK_MAX_PEERS];
+    size_t lens[RELAY_BATCH];
+    struct sockaddr_in addrs[RELAY_BATCH];
+    struct sockaddr_in laddr;
+    const char *bind_addr = "0.0.0.0";
+    unsigned long long port = SYSLINK_DEFAULT_PORT;
+    int c, fd;
+
+    while ((c = getopt(argc, argv, "hvb:p:")) != -1) {
+        switch (c) {
+        case 'h':
+            relay_usage(argv[0]);
+            return 0;
+
+        case 'v':
+            verbose = true;
+            break;
+
+        case 'b':
+            bind_addr = optarg;
+            break;
+
+        case 'p':
+            if (parse_uint_full(optarg, &port, 0) < 0 || port > 65535) {
+                fprintf(stderr, "cannot parse port\n");
+                return 1;
+            }
+            break;
+
+        default:
+            fprintf(stderr, "Try '%s -h' for more information.\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (socket_init() < 0) {
+        fprintf(stderr, "cannot initialize sockets\n");
+        return 1;
+    }
+
+    memset(&laddr, 0, sizeof(laddr));
+    laddr.sin_family = AF_INET;
+    laddr.sin_port = htons(port);
+    if (!inet_aton(bind_addr, &laddr.sin_addr)) {
+        fprintf(stderr, "cannot parse address %s\n", bind_addr);
+        return 1;
+    }
+
+    fd = qemu_socket(PF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return 1;
+    }
+
+    if (bind(fd, (struct sockaddr *)&laddr, sizeof(laddr)) < 0) {
+        perror("bind");
+        return 1;
+    }
+
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    printf("syslink relay listening on %s:%llu\n", bind_addr, port);
+
+    for (;;) {
+        int count = relay_recv(fd, bufs, lens, addrs);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("recv");
+            return 1;
+        }
+
+        int64_t now = g_get_monotonic_time();
+        int num_out = 0;
+
+        for (int i = 0; i < count; i++) {
+            const SyslinkHeader *hdr = (const SyslinkHeader *)bufs[i];
+            if (lens[i] < sizeof(SyslinkHeader) ||
+                be32_to_cpu(hdr->magic) != SYSLINK_MAGIC) {
+                continue;
+            }
+
+            RelayPeer *src = relay_lookup_peer(&addrs[i],
+                                               be32_to_cpu(hdr->src), now);
+            if (!src) {
+                /* Full; newcomers wait for a slot to time out */
+                continue;
+            }
+
+            for (int j = 0; j < SYSLINK_MAX_PEERS; j++) {
+                RelayPeer *p = &peers[j];
+                /* Slots past the sender were not checked for expiry */
+                if (p == src || !p->last_seen ||
+                    now - p->last_seen > RELAY_PEER_TIMEOUT) {
+                    continue;
+                }
+                out[num_out++] = (RelayMsg) {
+                    .buf = bufs[i],
+                    .len = lens[i],
+                    .dst = p->addr,
+                };
+            }
+        }
+
+        relay_send(fd, out, num_out);
+    }
+
+    return 0;
+}
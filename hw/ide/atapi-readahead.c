@@ -0,0 +1,765 @@
+/*
+ * ATAPI read-ahead cache
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include <math.h>
+#include "qemu/coroutine.h"
+#include "qemu/timer.h"
+#include "sysemu/block-backend.h"
+#include "hw/ide/atapi-readahead.h"
+#include "trace.h"
+
+#define ATAPI_RA_MIN_CHUNKS   32    /* 1 MiB */
+#define ATAPI_RA_MAX_CHUNKS   32768 /* 1 GiB */
+#define ATAPI_RA_MAX_RUN      8     /* Chunks read by one fetch */
+#define ATAPI_RA_MAX_PREFETCH 4     /* Read-ahead fetches in flight */
+#define ATAPI_RA_STREAMS      4     /* Games interleave music and levels */
+#define ATAPI_RA_STREAK       2     /* Sequential reads before reading ahead */
+#define ATAPI_RA_MIN_WINDOW   2     /* Chunks, doubled on each further read */
+#define ATAPI_RA_MAX_WINDOW   64
+
+/*
+ * Access time of a stock drive: settling on the track, plus a full stroke
+ * scaled by the square root of the fraction of the disc crossed.
+ */
+#define ATAPI_RA_SEEK_SETTLE_NS (15 * SCALE_MS)
+#define ATAPI_RA_SEEK_STROKE_NS (140 * SCALE_MS)
+
+typedef enum ATAPIReadaheadSlotState {
+    RA_SLOT_EMPTY,
+    RA_SLOT_LOADING,
+    RA_SLOT_VALID,
+} ATAPIReadaheadSlotState;
+
+typedef struct ATAPIReadaheadSlot {
+    int64_t chunk; /* -1 when free, or invalidated while loading */
+    ATAPIReadaheadSlotState state;
+    bool prefetched; /* Read ahead, and not requested since */
+    uint64_t last_use;
+    uint8_t *buf;
+} ATAPIReadaheadSlot;
+
+typedef struct ATAPIReadaheadStream {
+    int64_t next_lba; /* Where a sequential read would continue */
+    int streak;
+    int window;       /* Chunks kept cached from next_lba on */
+    uint64_t last_use;
+} ATAPIReadaheadStream;
+
+typedef struct ATAPIReadaheadRequest {
+    BlockAIOCB common;
+    ATAPIReadahead *ra;
+    int64_t lba;
+    int nb_sectors;
+    QEMUIOVector *qiov;
+    int ret;
+    bool scheduled; /* Completion BH queued */
+    bool orphaned;  /* Cancelled, the callback has already run */
+    int64_t start_ns;
+    int64_t ready_ns; /* Held back until then by seek emulation */
+} ATAPIReadaheadRequest;
+
+typedef struct ATAPIReadaheadFetch {
+    ATAPIReadahead *ra;
+    int64_t chunk;
+    int nb_chunks;
+    int slots[ATAPI_RA_MAX_RUN];
+    bool prefetch;
+    QEMUIOVector qiov;
+} ATAPIReadaheadFetch;
+
+struct ATAPIReadahead {
+    BlockBackend *blk;
+    uint32_t seek_scale;
+    int64_t nb_sectors;
+
+    uint8_t *buf;
+    ATAPIReadaheadSlot *slots;
+    int nb_slots;
+    GHashTable *map; /* Chunk to slot index + 1 */
+    uint64_t clock;
+    int nb_loading;
+    int nb_prefetches;
+
+    ATAPIReadaheadStream streams[ATAPI_RA_STREAMS];
+    int max_window;
+    int64_t head_lba; /* Where the emulated pickup rests */
+
+    ATAPIReadaheadRequest *pending;
+    QEMUTimer *seek_timer;
+
+    ATAPIReadaheadStats stats;
+    int64_t tp_start_ns;
+    uint64_t tp_bytes;
+};
+
+static void atapi_ra_prefetch(ATAPIReadahead *ra);
+static void atapi_ra_check_pending(ATAPIReadahead *ra);
+
+static int64_t atapi_ra_nb_chunks(ATAPIReadahead *ra)
+{
+    return DIV_ROUND_UP(ra->nb_sectors, ATAPI_RA_CHUNK_SECTORS);
+}
+
+static int atapi_ra_lookup(ATAPIReadahead *ra, int64_t chunk)
+{
+    gpointer v = g_hash_table_lookup(ra->map, GINT_TO_POINTER(chunk));
+    return v ? GPOINTER_TO_INT(v) - 1 : -1;
+}
+
+static bool atapi_ra_is_valid(ATAPIReadahead *ra, int64_t chunk)
+{
+    int idx = atapi_ra_lookup(ra, chunk);
+    return idx >= 0 && ra->slots[idx].state == RA_SLOT_VALID;
+}
+
+static void atapi_ra_unmap(ATAPIReadahead *ra, ATAPIReadaheadSlot *slot)
+{
+    if (slot->chunk < 0) {
+        return;
+    }
+    g_hash_table_remove(ra->map, GINT_TO_POINTER(slot->chunk));
+    if (slot->prefetched) {
+        ra->stats.wasted_chunks++;
+    }
+    slot->chunk = -1;
+    slot->prefetched = false;
+}
+
+/* Chunks of the outstanding read must stay until it has been copied out */
+static bool atapi_ra_pinned(ATAPIReadahead *ra, int64_t chunk)
+{
+    ATAPIReadaheadRequest *req = ra->pending;
+
+    return req &&
+           chunk >= req->lba / ATAPI_RA_CHUNK_SECTORS &&
+           chunk <= (req->lba + req->nb_sectors - 1) / ATAPI_RA_CHUNK_SECTORS;
+}
+
+/*
+ * Find a slot for @chunk: a free one if there is any, else the least
+ * recently used chunk the guest has read, else the oldest read-ahead.
+ */
+static int atapi_ra_alloc(ATAPIReadahead *ra, int64_t chunk)
+{
+    ATAPIReadaheadSlot *slot;
+    int i, victim = -1;
+
+    for (i = 0; i < ra->nb_slots; i++) {
+        slot = &ra->slots[i];
+        if (slot->state == RA_SLOT_EMPTY) {
+            victim = i;
+            break;
+        }
+        if (slot->state == RA_SLOT_LOADING ||
+            atapi_ra_pinned(ra, slot->chunk)) {
+            continue;
+        }
+        if (victim < 0 ||
+            (ra->slots[victim].prefetched && !slot->prefetched) ||
+            (ra->slots[victim].prefetched == slot->prefetched &&
+             slot->last_use < ra->slots[victim].last_use)) {
+            victim = i;
+        }
+    }
+    if (victim < 0) {
+        return -1;
+    }
+
+    slot = &ra->slots[victim];
+    atapi_ra_unmap(ra, slot);
+    slot->chunk = chunk;
+    slot->state = RA_SLOT_LOADING;
+    slot->last_use = ++ra->clock;
+    g_hash_table_insert(ra->map, GINT_TO_POINTER(chunk),
+                        GINT_TO_POINTER(victim + 1));
+    ra->nb_loading++;
+    return victim;
+}
+
+/*
+ * Whether every chunk of [@first, @last] not already cached or loading can
+ * get a slot without evicting another chunk of the same range.
+ */
+static bool atapi_ra_has_room(ATAPIReadahead *ra, int64_t first, int64_t last)
+{
+    int64_t chunk;
+    int i, need = 0;
+
+    for (chunk = first; chunk <= last; chunk++) {
+        need += atapi_ra_lookup(ra, chunk) < 0;
+    }
+    for (i = 0; i < ra->nb_slots && need; i++) {
+        ATAPIReadaheadSlot *slot = &ra->slots[i];
+
+        if (slot->state == RA_SLOT_EMPTY ||
+            (slot->state == RA_SLOT_VALID &&
+             (slot->chunk < first || slot->chunk > last))) {
+            need--;
+        }
+    }
+    return !need;
+}
+
+static void atapi_ra_stop_streams(ATAPIReadahead *ra)
+{
+    int i;
+
+    for (i = 0; i < ATAPI_RA_STREAMS; i++) {
+        ra->streams[i] = (ATAPIReadaheadStream) { .next_lba = -1 };
+    }
+}
+
+static void coroutine_fn atapi_ra_fetch_co(void *opaque)
+{
+    ATAPIReadaheadFetch *f = opaque;
+    ATAPIReadahead *ra = f->ra;
+    ATAPIReadaheadRequest *req;
+    int i, ret;
+
+    ret = blk_co_preadv(ra->blk, f->chunk * ATAPI_RA_CHUNK_SIZE,
+                        f->qiov.size, &f->qiov, 0);
+    trace_atapi_readahead_fetch_done(f->chunk, f->nb_chunks, ret);
+
+    for (i = 0; i < f->nb_chunks; i++) {
+        ATAPIReadaheadSlot *slot = &ra->slots[f->slots[i]];
+
+        assert(slot->state == RA_SLOT_LOADING);
+        ra->nb_loading--;
+        if (slot->chunk != f->chunk + i) {
+            /* Invalidated while in flight */
+            slot->state = RA_SLOT_EMPTY;
+        } else if (ret < 0) {
+            slot->prefetched = false;
+            atapi_ra_unmap(ra, slot);
+            slot->state = RA_SLOT_EMPTY;
+        } else {
+            slot->state = RA_SLOT_VALID;
+        }
+    }
+    if (f->prefetch) {
+        ra->nb_prefetches--;
+    }
+
+    if (ret < 0) {
+        /* Don't keep hammering a failing image, wait for a new stream */
+        atapi_ra_stop_streams(ra);
+        req = ra->pending;
+        if (req && !req->ret &&
+            req->lba < (f->chunk + f->nb_chunks) * ATAPI_RA_CHUNK_SECTORS &&
+            req->lba + req->nb_sectors > f->chunk * ATAPI_RA_CHUNK_SECTORS) {
+            req->ret = ret;
+        }
+    } else {
+        ra->stats.fetch_bytes += f->qiov.size;
+    }
+
+    qemu_iovec_destroy(&f->qiov);
+    g_free(f);
+
+    atapi_ra_check_pending(ra);
+    atapi_ra_prefetch(ra);
+}
+
+static void atapi_ra_fetch(ATAPIReadahead *ra, int64_t chunk, int nb_chunks,
+                           const int *slots, bool prefetch)
+{
+    ATAPIReadaheadFetch *f;
+    int64_t disc_bytes = ra->nb_sectors * ATAPI_RA_SECTOR_SIZE;
+    Coroutine *co;
+    int i;
+
+    if (!nb_chunks) {
+        return;
+    }
+
+    f = g_new0(ATAPIReadaheadFetch, 1);
+    f->ra = ra;
+    f->chunk = chunk;
+    f->nb_chunks = nb_chunks;
+    f->prefetch = prefetch;
+    qemu_iovec_init(&f->qiov, nb_chunks);
+    for (i = 0; i < nb_chunks; i++) {
+        ATAPIReadaheadSlot *slot = &ra->slots[slots[i]];
+        int64_t len = MIN(ATAPI_RA_CHUNK_SIZE,
+                          disc_bytes - (chunk + i) * ATAPI_RA_CHUNK_SIZE);
+
+        f->slots[i] = slots[i];
+        slot->prefetched = prefetch;
+        qemu_iovec_add(&f->qiov, slot->buf, len);
+    }
+
+    if (prefetch) {
+        ra->nb_prefetches++;
+        ra->stats.prefetch_chunks += nb_chunks;
+    }
+    ra->head_lba = (chunk + nb_chunks) * ATAPI_RA_CHUNK_SECTORS;
+
+    trace_atapi_readahead_fetch(chunk, nb_chunks, prefetch);
+    co = qemu_coroutine_create(atapi_ra_fetch_co, f);
+    aio_co_enter(blk_get_aio_context(ra->blk), co);
+}
+
+/* Keep every detected stream's window cached ahead of the guest */
+static void atapi_ra_prefetch(ATAPIReadahead *ra)
+{
+    int64_t nb_chunks = atapi_ra_nb_chunks(ra);
+    int i;
+
+    for (i = 0; i < ATAPI_RA_STREAMS; i++) {
+        ATAPIReadaheadStream *st = &ra->streams[i];
+        int run[ATAPI_RA_MAX_RUN];
+        int64_t chunk, first, last, run_start = 0;
+        int idx, run_len = 0;
+
+        if (!st->window) {
+            continue;
+        }
+        first = st->next_lba / ATAPI_RA_CHUNK_SECTORS;
+        last = MIN(first + st->window, nb_chunks) - 1;
+
+        for (chunk = first; chunk <= last; chunk++) {
+            if (atapi_ra_lookup(ra, chunk) >= 0) {
+                atapi_ra_fetch(ra, run_start, run_len, run, true);
+                run_len = 0;
+                continue;
+            }
+            if (!run_len && ra->nb_prefetches >= ATAPI_RA_MAX_PREFETCH) {
+                return;
+            }
+            /* Leave room for demand reads */
+            if (ra->nb_loading >= ra->nb_slots / 2) {
+                break;
+            }
+            idx = atapi_ra_alloc(ra, chunk);
+            if (idx < 0) {
+                break;
+            }
+            if (!run_len) {
+                run_start = chunk;
+            }
+            run[run_len++] = idx;
+            if (run_len == ATAPI_RA_MAX_RUN) {
+                atapi_ra_fetch(ra, run_start, run_len, run, true);
+                run_len = 0;
+            }
+        }
+        atapi_ra_fetch(ra, run_start, run_len, run, true);
+    }
+}
+
+static void atapi_ra_update_streams(ATAPIReadahead *ra, int64_t lba,
+                                    int nb_sectors)
+{
+    ATAPIReadaheadStream *st = NULL, *lru = &ra->streams[0];
+    int i;
+
+    for (i = 0; i < ATAPI_RA_STREAMS; i++) {
+        ATAPIReadaheadStream *s = &ra->streams[i];
+
+        /* Small skips forward still count, e.g. over padding in a file */
+        if (s->next_lba >= 0 && lba >= s->next_lba &&
+            lba - s->next_lba <= ATAPI_RA_CHUNK_SECTORS) {
+            st = s;
+            break;
+        }
+        if (s->last_use < lru->last_use) {
+            lru = s;
+        }
+    }
+
+    if (st) {
+        if (++st->streak >= ATAPI_RA_STREAK) {
+            st->window = st->window ? MIN(st->window * 2, ra->max_window)
+                                    : ATAPI_RA_MIN_WINDOW;
+        }
+    } else {
+        st = lru;
+        st->streak = 0;
+        st->window = 0;
+    }
+    st->next_lba = lba + nb_sectors;
+    st->last_use = ++ra->clock;
+}
+
+static int64_t atapi_ra_seek_ns(ATAPIReadahead *ra, int64_t lba)
+{
+    int64_t dist = ABS(lba - ra->head_lba);
+    double frac;
+
+    if (!ra->seek_scale || dist <= ATAPI_RA_CHUNK_SECTORS) {
+        return 0;
+    }
+    frac = MIN((double)dist / MAX(ra->nb_sectors, 1), 1.0);
+    return (ATAPI_RA_SEEK_SETTLE_NS + ATAPI_RA_SEEK_STROKE_NS * sqrt(frac)) *
+           ra->seek_scale / 100;
+}
+
+static void atapi_ra_copy(ATAPIReadahead *ra, ATAPIReadaheadRequest *req)
+{
+    int64_t lba = req->lba;
+    int left = req->nb_sectors;
+    size_t offset = 0;
+
+    while (left) {
+        int first = lba % ATAPI_RA_CHUNK_SECTORS;
+        int n = MIN(left, ATAPI_RA_CHUNK_SECTORS - first);
+        int idx = atapi_ra_lookup(ra, lba / ATAPI_RA_CHUNK_SECTORS);
+        ATAPIReadaheadSlot *slot = &ra->slots[idx];
+
+        assert(idx >= 0 && slot->state == RA_SLOT_VALID);
+        qemu_iovec_from_buf(req->qiov, offset,
+                            slot->buf + first * ATAPI_RA_SECTOR_SIZE,
+                            n * ATAPI_RA_SECTOR_SIZE);
+        slot->prefetched = false;
+        slot->last_use = ++ra->clock;
+
+        lba += n;
+        left -= n;
+        offset += n * ATAPI_RA_SECTOR_SIZE;
+    }
+}
+
+static void atapi_ra_account(ATAPIReadahead *ra, ATAPIReadaheadRequest *req)
+{
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t latency = now - req->start_ns;
+    ATAPIReadaheadStats *stats = &ra->stats;
+
+    stats->avg_latency_ns = stats->avg_latency_ns ?
+        (stats->avg_latency_ns * 7 + latency) / 8 : latency;
+
+    ra->tp_bytes += req->nb_sectors * ATAPI_RA_SECTOR_SIZE;
+    if (now - ra->tp_start_ns >= NANOSECONDS_PER_SECOND) {
+        stats->throughput = ra->tp_bytes * NANOSECONDS_PER_SECOND /
+                            (now - ra->tp_start_ns);
+        ra->tp_start_ns = now;
+        ra->tp_bytes = 0;
+    }
+}
+
+static void atapi_ra_complete_bh(void *opaque)
+{
+    ATAPIReadaheadRequest *req = opaque;
+    ATAPIReadahead *ra = req->ra;
+
+    if (!req->orphaned) {
+        assert(ra->pending == req);
+        if (!req->ret) {
+            atapi_ra_copy(ra, req);
+            atapi_ra_account(ra, req);
+        }
+        ra->pending = NULL;
+        trace_atapi_readahead_complete(req->lba, req->nb_sectors, req->ret);
+        req->common.cb(req->common.opaque, req->ret);
+    }
+
+    blk_dec_in_flight(ra->blk);
+    qemu_aio_unref(req);
+}
+
+static void atapi_ra_schedule_complete(ATAPIReadahead *ra,
+                                       ATAPIReadaheadRequest *req)
+{
+    req->scheduled = true;
+    timer_del(ra->seek_timer);
+    aio_bh_schedule_oneshot(blk_get_aio_context(ra->blk),
+                            atapi_ra_complete_bh, req);
+}
+
+static void atapi_ra_check_pending(ATAPIReadahead *ra)
+{
+    ATAPIReadaheadRequest *req = ra->pending;
+    int64_t chunk, last;
+
+    if (!req || req->scheduled) {
+        return;
+    }
+
+    if (!req->ret) {
+        last = (req->lba + req->nb_sectors - 1) / ATAPI_RA_CHUNK_SECTORS;
+        for (chunk = req->lba / ATAPI_RA_CHUNK_SECTORS; chunk <= last;
+             chunk++) {
+            if (!atapi_ra_is_valid(ra, chunk)) {
+                return;
+            }
+        }
+        if (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) < req->ready_ns) {
+            timer_mod(ra->seek_timer, req->ready_ns);
+            return;
+        }
+    }
+
+    atapi_ra_schedule_complete(ra, req);
+}
+
+static void atapi_ra_seek_timer_cb(void *opaque)
+{
+    atapi_ra_check_pending(opaque);
+}
+
+static void atapi_ra_cancel_async(BlockAIOCB *acb)
+{
+    ATAPIReadaheadRequest *req = container_of(acb, ATAPIReadaheadRequest,
+                                              common);
+
+    if (req->orphaned || req->scheduled) {
+        return;
+    }
+    req->ret = -ECANCELED;
+    atapi_ra_check_pending(req->ra);
+}
+
+static AioContext *atapi_ra_get_aio_context(BlockAIOCB *acb)
+{
+    ATAPIReadaheadRequest *req = container_of(acb, ATAPIReadaheadRequest,
+                                              common);
+
+    return blk_get_aio_context(req->ra->blk);
+}
+
+static const AIOCBInfo atapi_ra_aiocb_info = {
+    .aiocb_size         = sizeof(ATAPIReadaheadRequest),
+    .cancel_async       = atapi_ra_cancel_async,
+    .get_aio_context    = atapi_ra_get_aio_context,
+};
+
+BlockAIOCB *atapi_readahead_readv(ATAPIReadahead *ra, int64_t lba,
+                                  int nb_sectors, QEMUIOVector *qiov,
+                                  BlockCompletionFunc *cb, void *opaque)
+{
+    ATAPIReadaheadRequest *req;
+    int64_t chunk, first, last, run_start = 0;
+    int64_t hit = 0, wait = 0, miss = 0, seek_ns = 0;
+    int run[ATAPI_RA_MAX_RUN];
+    int idx, run_len = 0;
+
+    assert(nb_sectors > 0);
+    assert(qiov->size == nb_sectors * ATAPI_RA_SECTOR_SIZE);
+
+    first = lba / ATAPI_RA_CHUNK_SECTORS;
+    last = (lba + nb_sectors - 1) / ATAPI_RA_CHUNK_SECTORS;
+    if (ra->pending || last - first >= ra->nb_slots / 4 ||
+        !atapi_ra_has_room(ra, first, last)) {
+        /*
+         * Never issued by the drive emulation, or every slot is loading,
+         * but stay correct and read around the cache
+         */
+        trace_atapi_readahead_bypass(lba, nb_sectors);
+        return blk_aio_preadv(ra->blk, lba * ATAPI_RA_SECTOR_SIZE, qiov, 0,
+                              cb, opaque);
+    }
+
+    req = blk_aio_get(&atapi_ra_aiocb_info, ra->blk, cb, opaque);
+    req->ra = ra;
+    req->lba = lba;
+    req->nb_sectors = nb_sectors;
+    req->qiov = qiov;
+    req->ret = 0;
+    req->scheduled = false;
+    req->orphaned = false;
+    req->start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    req->ready_ns = 0;
+    blk_inc_in_flight(ra->blk);
+    ra->pending = req;
+
+    ra->stats.requests++;
+    ra->stats.sectors += nb_sectors;
+    atapi_ra_update_streams(ra, lba, nb_sectors);
+
+    for (chunk = first; chunk <= last; chunk++) {
+        int64_t start = MAX(lba, chunk * ATAPI_RA_CHUNK_SECTORS);
+        int64_t end = MIN(lba + nb_sectors,
+                          (chunk + 1) * ATAPI_RA_CHUNK_SECTORS);
+
+        idx = atapi_ra_lookup(ra, chunk);
+        if (idx >= 0) {
+            if (ra->slots[idx].state == RA_SLOT_VALID) {
+                hit += end - start;
+            } else {
+                wait += end - start;
+            }
+            atapi_ra_fetch(ra, run_start, run_len, run, false);
+            run_len = 0;
+            continue;
+        }
+
+        if (!miss) {
+            seek_ns = atapi_ra_seek_ns(ra, start);
+        }
+        miss += end - start;
+
+        /* Checked by atapi_ra_has_room() before the request was queued */
+        idx = atapi_ra_alloc(ra, chunk);
+        assert(idx >= 0);
+        if (!run_len) {
+            run_start = chunk;
+        }
+        run[run_len++] = idx;
+        if (run_len == ATAPI_RA_MAX_RUN) {
+            atapi_ra_fetch(ra, run_start, run_len, run, false);
+            run_len = 0;
+        }
+    }
+    atapi_ra_fetch(ra, run_start, run_len, run, false);
+
+    ra->stats.hit_sectors += hit;
+    ra->stats.wait_sectors += wait;
+    ra->stats.miss_sectors += miss;
+    if (seek_ns) {
+        req->ready_ns = req->start_ns + seek_ns;
+        ra->stats.seeks++;
+        ra->stats.seek_ns += seek_ns;
+    }
+    trace_atapi_readahead_read(lba, nb_sectors, hit, wait, miss, seek_ns);
+
+    atapi_ra_prefetch(ra);
+    atapi_ra_check_pending(ra);
+    return &req->common;
+}
+
+bool atapi_readahead_read_cached(ATAPIReadahead *ra, int64_t lba, void *buf)
+{
+    int idx = atapi_ra_lookup(ra, lba / ATAPI_RA_CHUNK_SECTORS);
+    ATAPIReadaheadSlot *slot;
+
+    ra->stats.requests++;
+    ra->stats.sectors++;
+    atapi_ra_update_streams(ra, lba, 1);
+
+    if (idx < 0 || ra->slots[idx].state != RA_SLOT_VALID) {
+        ra->stats.miss_sectors++;
+        atapi_ra_prefetch(ra);
+        return false;
+    }
+
+    slot = &ra->slots[idx];
+    memcpy(buf,
+           slot->buf + (lba % ATAPI_RA_CHUNK_SECTORS) * ATAPI_RA_SECTOR_SIZE,
+           ATAPI_RA_SECTOR_SIZE);
+    slot->prefetched = false;
+    slot->last_use = ++ra->clock;
+    ra->stats.hit_sectors++;
+
+    atapi_ra_prefetch(ra);
+    return true;
+}
+
+void atapi_readahead_cancel(ATAPIReadahead *ra)
+{
+    ATAPIReadaheadRequest *req = ra->pending;
+
+    if (!req) {
+        return;
+    }
+
+    trace_atapi_readahead_cancel(req->lba, req->nb_sectors);
+    ra->pending = NULL;
+    req->orphaned = true;
+    req->common.cb(req->common.opaque, -ECANCELED);
+    if (!req->scheduled) {
+        atapi_ra_schedule_complete(ra, req);
+    }
+}
+
+void atapi_readahead_invalidate(ATAPIReadahead *ra)
+{
+    int64_t len;
+    int i;
+
+    for (i = 0; i < ra->nb_slots; i++) {
+        ATAPIReadaheadSlot *slot = &ra->slots[i];
+
+        atapi_ra_unmap(ra, slot);
+        if (slot->state == RA_SLOT_VALID) {
+            slot->state = RA_SLOT_EMPTY;
+        }
+    }
+
+    atapi_ra_stop_streams(ra);
+    ra->head_lba = 0;
+
+    len = blk_getlength(ra->blk);
+    ra->nb_sectors = len > 0 ? len / ATAPI_RA_SECTOR_SIZE : 0;
+
+    /* What the outstanding read waits for is gone */
+    if (ra->pending) {
+        ra->pending->ret = -ENOMEDIUM;
+        atapi_ra_check_pending(ra);
+    }
+}
+
+void atapi_readahead_get_stats(ATAPIReadahead *ra, ATAPIReadaheadStats *stats)
+{
+    int i;
+
+    *stats = ra->stats;
+    stats->cache_chunks = ra->nb_slots;
+    stats->valid_chunks = 0;
+    for (i = 0; i < ra->nb_slots; i++) {
+        stats->valid_chunks += ra->slots[i].state == RA_SLOT_VALID;
+    }
+    stats->streams = 0;
+    for (i = 0; i < ATAPI_RA_STREAMS; i++) {
+        stats->streams += ra->streams[i].window > 0;
+    }
+}
+
+ATAPIReadahead *atapi_readahead_new(BlockBackend *blk, uint64_t size,
+                                    uint32_t seek_scale)
+{
+    ATAPIReadahead *ra = g_new0(ATAPIReadahead, 1);
+    int i;
+
+    ra->blk = blk;
+    ra->seek_scale = seek_scale;
+    ra->nb_slots = MIN(MAX(size / ATAPI_RA_CHUNK_SIZE, ATAPI_RA_MIN_CHUNKS),
+                       ATAPI_RA_MAX_CHUNKS);
+    ra->max_window = MIN(ATAPI_RA_MAX_WINDOW, ra->nb_slots / 4);
+    ra->buf = blk_blockalign(blk, (size_t)ra->nb_slots * ATAPI_RA_CHUNK_SIZE);
+    ra->slots = g_new0(ATAPIReadaheadSlot, ra->nb_slots);
+    for (i = 0; i < ra->nb_slots; i++) {
+        ra->slots[i].chunk = -1;
+        ra->slots[i].buf = ra->buf + (size_t)i * ATAPI_RA_CHUNK_SIZE;
+    }
+    ra->map = g_hash_table_new(NULL, NULL);
+    ra->seek_timer = aio_timer_new(blk_get_aio_context(blk),
+                                   QEMU_CLOCK_REALTIME, SCALE_NS,
+                                   atapi_ra_seek_timer_cb, ra);
+    ra->tp_start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    atapi_readahead_invalidate(ra);
+    return ra;
+}
+
+void atapi_readahead_free(ATAPIReadahead *ra)
+{
+    if (!ra) {
+        return;
+    }
+
+    /* Let the outstanding read and fetches finish, without reading on */
+    atapi_ra_stop_streams(ra);
+    blk_drain(ra->blk);
+    assert(!ra->pending && !ra->nb_loading);
+
+    timer_free(ra->seek_timer);
+    g_hash_table_destroy(ra->map);
+    g_free(ra->slots);
+    qemu_vfree(ra->buf);
+    g_free(ra);
+}
@@ -86,9 +86,21 @@ static void cd_data_to_raw(uint8_t *buf, int lba)
     memset(buf, 0, 288);
 }
 
+static BlockAIOCB *cd_readv(IDEState *s, QEMUIOVector *qiov, int nb_sectors,
+                            BlockCompletionFunc *cb)
+{
+    if (s->readahead) {
+        return atapi_readahead_readv(s->readahead, s->lba, nb_sectors, qiov,
+                                     cb, s);
+    }
+    return ide_buffered_readv(s, (int64_t)s->lba << 2, qiov, nb_sectors * 4,
+                              cb, s);
+}
+
 static int
 cd_read_sector_sync(IDEState *s)
 {
+    uint8_t *buf = s->io_buffer;
     int ret;
     block_acct_start(blk_get_stats(s->blk), &s->acct,
                      ATAPI_SECTOR_SIZE, BLOCK_ACCT_READ);
@@ -97,21 +109,25 @@ cd_read_sector_sync(IDEState *s)
 
     switch (s->cd_sector_size) {
     case 2048:
-        ret = blk_pread(s->blk, (int64_t)s->lba << ATAPI_SECTOR_BITS,
-                        s->io_buffer, ATAPI_SECTOR_SIZE);
         break;
     case 2352:
-        ret = blk_pread(s->blk, (int64_t)s->lba << ATAPI_SECTOR_BITS,
-                        s->io_buffer + 16, ATAPI_SECTOR_SIZE);
-        if (ret >= 0) {
-            cd_data_to_raw(s->io_buffer, s->lba);
-        }
+        buf += 16;
         break;
     default:
         block_acct_invalid(blk_get_stats(s->blk), BLOCK_ACCT_READ);
         return -EIO;
     }
 
+    if (s->readahead && atapi_readahead_read_cached(s->readahead, s->lba, buf)) {
+        ret = 0;
+    } else {
+        ret = blk_pread(s->blk, (int64_t)s->lba << ATAPI_SECTOR_BITS,
+                        buf, ATAPI_SECTOR_SIZE);
+    }
+    if (ret >= 0 && s->cd_sector_size == 2352) {
+        cd_data_to_raw(s->io_buffer, s->lba);
+    }
+
     if (ret < 0) {
         block_acct_failed(blk_get_stats(s->blk), &s->acct);
     } else {
@@ -165,8 +181,7 @@ static int cd_read_sector(IDEState *s)
     block_acct_start(blk_get_stats(s->blk), &s->acct,
                      ATAPI_SECTOR_SIZE, BLOCK_ACCT_READ);
 
-    ide_buffered_readv(s, (int64_t)s->lba << 2, &s->qiov, 4,
-                       cd_read_sector_cb, s);
+    cd_readv(s, &s->qiov, 1, cd_read_sector_cb);
 
     s->status |= BUSY_STAT;
     return 0;
@@ -403,9 +418,72 @@ static void ide_atapi_cmd_read_dma_cb(void *opaque, int ret)
     qemu_iovec_init_buf(&s->bus->dma->qiov, s->io_buffer + data_offset,
                         n * ATAPI_SECTOR_SIZE);
 
-    s->bus->dma->aiocb = ide_buffered_readv(s, (int64_t)s->lba << 2,
-                                            &s->bus->dma->qiov, n * 4,
-                                            ide_atapi_cmd_read_dma_cb, s);
+    s->bus->dma->aiocb = cd_readv(s, &s->bus->dma->qiov, n,
+                                  ide_atapi_cmd_read_dma_cb);
+    return;
+
+eot:
+    if (ret < 0) {
+        block_acct_failed(blk_get_stats(s->blk), &s->acct);
+    } else {
+        block_acct_done(blk_get_stats(s->blk), &s->acct);
+    }
+    ide_set_inactive(s, false);
+}
+
+/*
+ * 2048 byte sector reads need no conversion, so when the image is memory
+ * mapped, rather than bouncing each chunk through s->io_buffer, the whole
+ * transfer is copied straight from the mapping into the guest memory
+ * described by the PRDs, like a disk DMA read. The mapping already is a
+ * cache of the whole disc, so the read-ahead cache is left out.
+ */
+static void ide_atapi_cmd_read_dma_sg_cb(void *opaque, int ret)
+{
+    IDEState *s = opaque;
+    int32_t prep_size;
+
+    if (ret < 0) {
+        if (ide_handle_rw_error(s, -ret, ide_dma_cmd_to_retry(s->dma_cmd))) {
+            dma_buf_commit(s, 0);
+            if (s->bus->error_status) {
+                s->bus->dma->aiocb = NULL;
+                return;
+            }
+            goto eot;
+        }
+    }
+
+    if (s->io_buffer_size > 0) {
+        dma_buf_commit(s, s->sg.size);
+        s->lba += s->packet_transfer_size >> 11;
+        s->packet_transfer_size = 0;
+        s->status = READY_STAT | SEEK_STAT;
+        s->nsector = (s->nsector & ~7) | ATAPI_INT_REASON_IO | ATAPI_INT_REASON_CD;
+        ide_set_irq(s->bus);
+        goto eot;
+    }
+
+    prep_size = s->bus->dma->ops->prepare_buf(s->bus->dma,
+                                              s->packet_transfer_size);
+    /* prepare_buf() must succeed and respect the limit */
+    assert(prep_size >= 0 && prep_size <= s->packet_transfer_size);
+
+    if (prep_size < s->packet_transfer_size) {
+        /*
+         * The PRDs are too short for this request. Error condition!
+         * Reset the Active bit and don't raise the interrupt.
+         */
+        s->status = READY_STAT | SEEK_STAT;
+        dma_buf_commit(s, 0);
+        goto eot;
+    }
+
+    trace_ide_atapi_cmd_read_dma_cb_aio(s, s->lba,
+                                        s->packet_transfer_size >> 11);
+    s->bus->dma->aiocb = dma_blk_read(s->blk, &s->sg, (int64_t)s->lba << 11,
+                                      ATAPI_SECTOR_SIZE,
+                                      ide_atapi_cmd_read_dma_sg_cb, s);
     return;
 
 eot:
@@ -434,7 +512,11 @@ static void ide_atapi_cmd_read_dma(IDEState *s, int lba, int nb_sectors,
 
     /* XXX: check if BUSY_STAT should be set */
     s->status = READY_STAT | SEEK_STAT | DRQ_STAT | BUSY_STAT;
-    ide_start_dma(s, ide_atapi_cmd_read_dma_cb);
+    if (sector_size == 2048 && blk_is_memory_mapped(s->blk)) {
+        ide_start_dma(s, ide_atapi_cmd_read_dma_sg_cb);
+    } else {
+        ide_start_dma(s, ide_atapi_cmd_read_dma_cb);
+    }
 }
 
 static void ide_atapi_cmd_read(IDEState *s, int lba, int nb_sectors,
@@ -719,6 +719,9 @@ void ide_cancel_dma_sync(IDEState *s)
         }
         req->orphaned = true;
     }
+    if (s->readahead) {
+        atapi_readahead_cancel(s->readahead);
+    }
 
     /*
      * We can't cancel Scatter Gather DMA in the middle of the
@@ -1178,6 +1181,9 @@ static void ide_cd_change_cb(void *opaque, bool load, Error **errp)
     s->tray_open = !load;
     blk_get_geometry(s->blk, &nb_sectors);
     s->nb_sectors = nb_sectors;
+    if (s->readahead) {
+        atapi_readahead_invalidate(s->readahead);
+    }
 
     /*
      * First indicate to the guest that a CD has been removed.  That's
@@ -2746,6 +2752,8 @@ void ide_init2(IDEBus *bus, qemu_irq irq)
 
 void ide_exit(IDEState *s)
 {
+    atapi_readahead_free(s->readahead);
+    s->readahead = NULL;
     timer_free(s->sector_write_timer);
     qemu_vfree(s->smart_selftest_data);
     qemu_vfree(s->io_buffer);
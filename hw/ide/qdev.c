@@ -217,6 +217,11 @@ static void ide_dev_initfn(IDEDevice *dev, IDEDriveKind kind, Error **errp)
         return;
     }
 
+    if (kind == IDE_CD && (dev->readahead_size || dev->seek_timing)) {
+        s->readahead = atapi_readahead_new(dev->conf.blk, dev->readahead_size,
+                                           dev->seek_timing);
+    }
+
     if (!dev->version) {
         dev->version = g_strdup(s->version);
     }
@@ -233,6 +238,25 @@ static void ide_dev_initfn(IDEDevice *dev, IDEDriveKind kind, Error **errp)
                          dev->conf.lsecs);
 }
 
+bool ide_cd_get_readahead_stats(BlockBackend *blk, ATAPIReadaheadStats *stats)
+{
+    DeviceState *qdev = blk ? blk_get_attached_dev(blk) : NULL;
+    IDEDevice *dev;
+    IDEState *s;
+
+    if (!qdev || !object_dynamic_cast(OBJECT(qdev), TYPE_IDE_DEVICE)) {
+        return false;
+    }
+    dev = IDE_DEVICE(qdev);
+    s = IDE_BUS(qdev->parent_bus)->ifs + dev->unit;
+    if (!s->readahead) {
+        return false;
+    }
+
+    atapi_readahead_get_stats(s->readahead, stats);
+    return true;
+}
+
 static void ide_dev_get_bootindex(Object *obj, Visitor *v, const char *name,
                                   void *opaque, Error **errp)
 {
@@ -322,6 +346,8 @@ static const TypeInfo ide_hd_info = {
 
 static Property ide_cd_properties[] = {
     DEFINE_IDE_DEV_PROPERTIES(),
+    DEFINE_PROP_SIZE("readahead-size", IDEDrive, dev.readahead_size, 0),
+    DEFINE_PROP_UINT32("seek-timing", IDEDrive, dev.seek_timing, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -0,0 +1,248 @@
+/*
+ * QEMU Xbox lock-free MMIO register fast path
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitops.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "hw/core/cpu.h"
+#include "hw/xbox/fast_mmio.h"
+
+/* Identical polls from the same translated code before the vCPU is parked */
+#define FAST_MMIO_SPIN_THRESHOLD 64
+
+/* Polls further apart than this are not a spin loop, e.g. a per frame check */
+#define FAST_MMIO_SPIN_WINDOW_NS (5 * SCALE_US)
+
+/*
+ * Upper bound on a single park. Interrupts cut it short through
+ * qemu_cpu_kick(), this only covers work that arrives without a kick.
+ */
+#define FAST_MMIO_PARK_TIMEOUT_MS 1
+
+/* Every register ever registered, they live as long as their device */
+static QSLIST_HEAD(, FastMMIORegister) fast_mmio_registers =
+    QSLIST_HEAD_INITIALIZER(fast_mmio_registers);
+
+static void fast_mmio_park(FastMMIORegister *r, uint32_t val)
+{
+    FastMMIOWaitQueue *wq = r->wq;
+    CPUState *cpu = current_cpu;
+    uint32_t cur;
+
+    /* Never sleep with the BQL held */
+    if (qemu_mutex_iothread_locked()) {
+        return;
+    }
+
+    int64_t start = get_clock();
+
+    qemu_mutex_lock(&wq->lock);
+    qatomic_inc(&wq->waiters);
+    if (cpu) {
+        /* Let an interrupt raised from here on wake us */
+        qatomic_set(&cpu->park_cond, &wq->cond);
+        qatomic_set(&cpu->park_lock, &wq->lock);
+    }
+    /*
+     * Pairs with smp_mb() in fast_mmio_wait_queue_notify and in
+     * qemu_cpu_kick(): either they see us parked, or we see their update
+     */
+    smp_mb();
+    if ((!cpu || (!qatomic_read(&cpu->interrupt_request) &&
+                  !qatomic_read(&cpu->exit_request))) &&
+        r->read(r->opaque, r->offset, &cur) && cur == val) {
+        qemu_cond_timedwait(&wq->cond, &wq->lock, FAST_MMIO_PARK_TIMEOUT_MS);
+    }
+    if (cpu) {
+        qatomic_set(&cpu->park_lock, NULL);
+        qatomic_set(&cpu->park_cond, NULL);
+    }
+    qatomic_dec(&wq->waiters);
+    wq->parks++;
+    wq->parked_ns += get_clock() - start;
+    qemu_mutex_unlock(&wq->lock);
+}
+
+/*
+ * A vCPU re-reading the same value from the same spot in the translated
+ * code is waiting for the device, so there is nothing to be gained by
+ * letting it spin. Returns true if the vCPU was parked.
+ */
+static bool fast_mmio_check_spin(FastMMIORegister *r, uint32_t val)
+{
+    CPUState *cpu = current_cpu;
+    uintptr_t pc = cpu ? cpu->mem_io_pc : 0;
+    int64_t now = get_clock();
+    int64_t last = r->spin_ns;
+
+    r->spin_ns = now;
+    if (val != r->spin_val || pc != r->spin_pc ||
+        now - last > FAST_MMIO_SPIN_WINDOW_NS) {
+        r->spin_pc = pc;
+        r->spin_val = val;
+        r->spin_count = 0;
+        return false;
+    }
+
+    if (++r->spin_count < FAST_MMIO_SPIN_THRESHOLD) {
+        return false;
+    }
+
+    r->spin_count = 0;
+    fast_mmio_park(r, val);
+    return true;
+}
+
+static uint64_t fast_mmio_read(void *opaque, hwaddr addr, unsigned int size)
+{
+    FastMMIORegister *r = opaque;
+    uint32_t val;
+    uint64_t ret;
+
+    if (likely(r->read(r->opaque, r->offset, &val))) {
+        qatomic_inc(&r->fast_reads);
+        if (r->wq && fast_mmio_check_spin(r, val) &&
+            !r->read(r->opaque, r->offset, &val)) {
+            goto slow;
+        }
+        return extract64(val, addr * 8, size * 8);
+    }
+
+slow:
+    qatomic_inc(&r->slow_reads);
+
+    bool locked = qemu_mutex_iothread_locked();
+    if (!locked) {
+        qemu_mutex_lock_iothread();
+    }
+    ret = r->fallback->read(r->opaque, r->offset + addr, size);
+    if (!locked) {
+        qemu_mutex_unlock_iothread();
+    }
+
+    return ret;
+}
+
+static void fast_mmio_write(void *opaque, hwaddr addr, uint64_t val,
+                            unsigned int size)
+{
+    FastMMIORegister *r = opaque;
+
+    bool locked = qemu_mutex_iothread_locked();
+    if (!locked) {
+        qemu_mutex_lock_iothread();
+    }
+    r->fallback->write(r->opaque, r->offset + addr, val, size);
+    if (!locked) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
+static const MemoryRegionOps fast_mmio_ops = {
+    .read = fast_mmio_read,
+    .write = fast_mmio_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+    .impl = {
+        .min_access_size = 1,
+        .max_access_size = 4,
+    },
+};
+
+void fast_mmio_register(FastMMIORegister *r, Object *owner,
+                        MemoryRegion *parent, hwaddr offset, const char *name,
+                        FastMMIOReadFunc read,
+                        const MemoryRegionOps *fallback, void *opaque)
+{
+    r->fallback = fallback;
+    r->opaque = opaque;
+    r->offset = offset;
+    r->read = read;
+    r->wq = NULL;
+    r->spin_pc = 0;
+    r->spin_val = 0;
+    r->spin_count = 0;
+    r->spin_ns = 0;
+    r->fast_reads = 0;
+    r->slow_reads = 0;
+
+    memory_region_init_io(&r->mr, owner, &fast_mmio_ops, r, name, 4);
+    memory_region_enable_lockless_io(&r->mr);
+    memory_region_add_subregion_overlap(parent, offset, &r->mr, 1);
+
+    QSLIST_INSERT_HEAD_ATOMIC(&fast_mmio_registers, r, next);
+}
+
+void fast_mmio_set_wait_queue(FastMMIORegister *r, FastMMIOWaitQueue *wq)
+{
+    r->wq = wq;
+}
+
+void fast_mmio_wait_queue_init(FastMMIOWaitQueue *wq)
+{
+    qemu_mutex_init(&wq->lock);
+    qemu_cond_init(&wq->cond);
+    wq->waiters = 0;
+    wq->parks = 0;
+    wq->parked_ns = 0;
+}
+
+void fast_mmio_wait_queue_destroy(FastMMIOWaitQueue *wq)
+{
+    qemu_cond_destroy(&wq->cond);
+    qemu_mutex_destroy(&wq->lock);
+}
+
+void fast_mmio_wait_queue_notify(FastMMIOWaitQueue *wq)
+{
+    /* Order the register update before the waiters check */
+    smp_mb();
+    if (qatomic_read(&wq->waiters)) {
+        qemu_mutex_lock(&wq->lock);
+        qemu_cond_broadcast(&wq->cond);
+        qemu_mutex_unlock(&wq->lock);
+    }
+}
+
+void fast_mmio_wait_queue_get_stats(FastMMIOWaitQueue *wq, uint64_t *parks,
+                                    uint64_t *parked_ns)
+{
+    qemu_mutex_lock(&wq->lock);
+    *parks = wq->parks;
+    *parked_ns = wq->parked_ns;
+    qemu_mutex_unlock(&wq->lock);
+}
+
+void fast_mmio_get_stats(FastMMIORegister *r, uint64_t *fast_reads,
+                         uint64_t *slow_reads)
+{
+    *fast_reads = qatomic_read(&r->fast_reads);
+    *slow_reads = qatomic_read(&r->slow_reads);
+}
+
+void fast_mmio_get_total_stats(uint64_t *fast_reads, uint64_t *slow_reads)
+{
+    FastMMIORegister *r;
+
+    *fast_reads = 0;
+    *slow_reads = 0;
+    for (r = qatomic_load_acquire(&fast_mmio_registers.slh_first); r;
+         r = qatomic_read(&r->next.sle_next)) {
+        *fast_reads += qatomic_read(&r->fast_reads);
+        *slow_reads += qatomic_read(&r->slow_reads);
+    }
+}
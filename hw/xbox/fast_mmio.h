@@ -0,0 +1,103 @@
+/*
+ * QEMU Xbox lock-free MMIO register fast path
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_XBOX_FAST_MMIO_H
+#define HW_XBOX_FAST_MMIO_H
+
+#include "qemu/osdep.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "exec/memory.h"
+
+/*
+ * Read the register at @addr (relative to the parent region) without
+ * holding the BQL. Returns false if the value cannot be produced lock-free
+ * right now, in which case the access is forwarded to the device's regular
+ * handler with the BQL held.
+ */
+typedef bool (*FastMMIOReadFunc)(void *opaque, hwaddr addr, uint32_t *val);
+
+/*
+ * Threads polling a register that has not changed for a while are parked
+ * here until the device signals that the register may have changed, or a
+ * short timeout expires.
+ */
+typedef struct FastMMIOWaitQueue {
+    QemuMutex lock;
+    QemuCond cond;
+    unsigned int waiters;
+
+    /* statistics, protected by lock */
+    uint64_t parks;
+    uint64_t parked_ns;
+} FastMMIOWaitQueue;
+
+typedef struct FastMMIORegister {
+    MemoryRegion mr;
+    const MemoryRegionOps *fallback;
+    void *opaque;
+    hwaddr offset;
+    FastMMIOReadFunc read;
+    FastMMIOWaitQueue *wq;
+
+    /* spin-wait detection */
+    uintptr_t spin_pc;
+    uint32_t spin_val;
+    unsigned int spin_count;
+    int64_t spin_ns;    /* When the last poll was seen */
+
+    /* statistics */
+    uint64_t fast_reads;
+    uint64_t slow_reads;
+
+    QSLIST_ENTRY(FastMMIORegister) next;
+} FastMMIORegister;
+
+/*
+ * Overlay the 32-bit register at @offset of @parent with a lock-free read
+ * handler. Writes, and reads that @read declines, are passed on to
+ * @fallback (the ops @parent was created with) at the same offset.
+ */
+void fast_mmio_register(FastMMIORegister *r, Object *owner,
+                        MemoryRegion *parent, hwaddr offset, const char *name,
+                        FastMMIOReadFunc read,
+                        const MemoryRegionOps *fallback, void *opaque);
+
+void fast_mmio_wait_queue_init(FastMMIOWaitQueue *wq);
+void fast_mmio_wait_queue_destroy(FastMMIOWaitQueue *wq);
+
+/*
+ * Park vCPUs that keep reading the same value from @r in a tight loop on
+ * @wq. The device must call fast_mmio_wait_queue_notify() whenever the
+ * register value may have changed.
+ */
+void fast_mmio_set_wait_queue(FastMMIORegister *r, FastMMIOWaitQueue *wq);
+
+/* Cheap unless a vCPU is parked on @wq */
+void fast_mmio_wait_queue_notify(FastMMIOWaitQueue *wq);
+
+void fast_mmio_wait_queue_get_stats(FastMMIOWaitQueue *wq, uint64_t *parks,
+                                    uint64_t *parked_ns);
+
+/* Reads served lock-free and reads passed on to the fallback handler */
+void fast_mmio_get_stats(FastMMIORegister *r, uint64_t *fast_reads,
+                         uint64_t *slow_reads);
+
+/* The same, summed over every register of every device */
+void fast_mmio_get_total_stats(uint64_t *fast_reads, uint64_t *slow_reads);
+
+#endif
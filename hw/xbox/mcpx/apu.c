@@ -31,6 +31,7 @@
 #include "audio/audio.h"
 #include "qemu/fifo8.h"
 #include "ui/xemu-settings.h"
+#include "hw/xbox/fast_mmio.h"
 
 #include "dsp/dsp.h"
 #include "dsp/dsp_dma.h"
@@ -96,6 +97,7 @@ typedef struct MCPXAPUState {
     MemoryRegion *ram;
     uint8_t *ram_ptr;
     MemoryRegion mmio;
+    FastMMIORegister xgscnt_mmio;
 
     /* Setup Engine */
     struct {
@@ -351,6 +353,11 @@ static void update_irq(MCPXAPUState *d)
     }
 }
 
+static uint32_t mcpx_apu_get_xgscnt(void)
+{
+    return qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) / 100; //???
+}
+
 static uint64_t mcpx_apu_read(void *opaque, hwaddr addr, unsigned int size)
 {
     MCPXAPUState *d = opaque;
@@ -358,7 +365,7 @@ static uint64_t mcpx_apu_read(void *opaque, hwaddr addr, unsigned int size)
     uint64_t r = 0;
     switch (addr) {
     case NV_PAPU_XGSCNT:
-        r = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) / 100; //???
+        r = mcpx_apu_get_xgscnt();
         break;
     default:
         if (addr < 0x20000) {
@@ -414,6 +421,13 @@ static const MemoryRegionOps mcpx_apu_mmio_ops = {
     .write = mcpx_apu_write,
 };
 
+static bool mcpx_apu_fast_read(void *opaque, hwaddr addr, uint32_t *val)
+{
+    assert(addr == NV_PAPU_XGSCNT);
+    *val = mcpx_apu_get_xgscnt();
+    return true;
+}
+
 static void voice_off(MCPXAPUState *d, uint16_t v)
 {
     voice_set_mask(d, v, NV_PAVS_VOICE_PAR_STATE,
@@ -2272,6 +2286,10 @@ static void mcpx_apu_realize(PCIDevice *dev, Error **errp)
     memory_region_init_io(&d->mmio, OBJECT(dev), &mcpx_apu_mmio_ops, d,
                           "mcpx-apu-mmio", 0x80000);
 
+    fast_mmio_register(&d->xgscnt_mmio, OBJECT(dev), &d->mmio, NV_PAPU_XGSCNT,
+                       "mcpx-apu-xgscnt", mcpx_apu_fast_read,
+                       &mcpx_apu_mmio_ops, d);
+
     memory_region_init_io(&d->vp.mmio, OBJECT(dev), &vp_ops, d,
                           "mcpx-apu-vp", 0x10000);
     memory_region_add_subregion(&d->mmio, 0x20000, &d->vp.mmio);
@@ -21,6 +21,7 @@
 #ifndef HW_NV2A_DEBUG_H
 #define HW_NV2A_DEBUG_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #define NV2A_XPRINTF(x, ...) do { \
@@ -60,6 +61,9 @@ void gl_debug_frame_terminator(void);
     gl_debug_label(target, name, "nv2a: { " format " }", ## __VA_ARGS__)
 #define NV2A_GL_DFRAME_TERMINATOR() \
     gl_debug_frame_terminator()
+/* glGetError() may stall the driver, so hot paths only check it here */
+# define NV2A_GL_CHECK_ERROR() \
+    assert(glGetError() == GL_NO_ERROR)
 
 #else
 # define NV2A_GL_DPRINTF(cc, format, ...)          do { \
@@ -69,6 +73,7 @@ void gl_debug_frame_terminator(void);
 # define NV2A_GL_DGROUP_END()                      do { } while (0)
 # define NV2A_GL_DLABEL(target, name, format, ...) do { } while (0)
 # define NV2A_GL_DFRAME_TERMINATOR()               do { } while (0)
+# define NV2A_GL_CHECK_ERROR()                     do { } while (0)
 #endif
 
 /* Debug prints to identify when unimplemented or unconfirmed features
@@ -117,8 +122,22 @@ void gl_debug_frame_terminator(void);
     _X(NV2A_PROF_GEOM_BUFFER_UPDATE_4_NOTDIRTY) \
     _X(NV2A_PROF_SURF_DOWNLOAD) \
     _X(NV2A_PROF_SURF_UPLOAD) \
+    _X(NV2A_PROF_SURF_SWIZZLE_CS) \
     _X(NV2A_PROF_SURF_TO_TEX) \
     _X(NV2A_PROF_SURF_TO_TEX_FALLBACK) \
+    _X(NV2A_PROF_SURF_TO_TEX_REINTERPRET) \
+    _X(NV2A_PROF_SURF_BLIT_GPU) \
+    _X(NV2A_PROF_SURF_BLIT_CPU) \
+    _X(NV2A_PROF_SPIN_PARKS) \
+    _X(NV2A_PROF_SPIN_PARKED_US) \
+    _X(NV2A_PROF_MMIO_FAST_READS) \
+    _X(NV2A_PROF_MMIO_SLOW_READS) \
+    _X(NV2A_PROF_PUSHER_WORDS) \
+    _X(NV2A_PROF_PUSHER_QUEUE_FULL) \
+    _X(NV2A_PROF_UNIFORM_UPLOAD_BYTES) \
+    _X(NV2A_PROF_DISPLAY_DROPPED) \
+    _X(NV2A_PROF_DISPLAY_REPEATED) \
+    _X(NV2A_PROF_DISPLAY_LATENCY_US) \
 
 enum NV2A_PROF_COUNTERS_ENUM {
     #define _X(x) x,
@@ -149,6 +168,22 @@ extern NV2AStats g_nv2a_stats;
 const char *nv2a_profile_get_counter_name(unsigned int cnt);
 int nv2a_profile_get_counter_value(unsigned int cnt);
 
+typedef struct NV2ARegStat {
+    const char *block;
+    uint32_t addr;      /* Within the block */
+    uint64_t reads;
+} NV2ARegStat;
+
+/* Count slow path MMIO reads per register, restarting from zero on enable */
+void nv2a_reg_stats_set_enabled(bool enabled);
+bool nv2a_reg_stats_get_enabled(void);
+
+/*
+ * Fill @stats with up to @max of the most read registers, busiest first.
+ * @overflow receives reads of registers that did not fit in the table.
+ */
+int nv2a_reg_stats_get(NV2ARegStat *stats, int max, uint64_t *overflow);
+
 #ifdef __cplusplus
 }
 #endif
@@ -20,6 +20,7 @@
  */
 
 #include "hw/xbox/nv2a/nv2a_int.h"
+#include "hw/qdev-properties.h"
 
 #define DBG_IRQ 0
 #define DBG_DMA 0
@@ -120,11 +121,127 @@ const struct NV2ABlockInfo blocktable[] = {
 };
 #undef ENTRY
 
+/*
+ * Slow path MMIO reads per register, counted while enabled from the HUD.
+ * Drivers poll a handful of registers, so a small open addressed table
+ * keyed by BAR offset is enough. Slow path reads hold the BQL, so there is
+ * a single writer and the HUD only needs atomic loads.
+ */
+#define NV2A_REG_STATS_SLOTS 256
+
+typedef struct NV2ARegStatsSlot {
+    uint32_t key; /* BAR offset + 1, 0 if free */
+    uint64_t reads;
+} NV2ARegStatsSlot;
+
+static struct {
+    bool enabled;
+    bool reset;
+    NV2ARegStatsSlot slots[NV2A_REG_STATS_SLOTS];
+    uint64_t overflow; /* Reads of registers that found the table full */
+} nv2a_reg_stats;
+
+static void nv2a_reg_stats_read(int block, hwaddr addr)
+{
+    uint32_t key = blocktable[block].offset + addr + 1;
+    uint32_t h = (key * 0x9e3779b1u) >> 24;
+
+    if (qatomic_xchg(&nv2a_reg_stats.reset, false)) {
+        for (int i = 0; i < NV2A_REG_STATS_SLOTS; i++) {
+            qatomic_set(&nv2a_reg_stats.slots[i].key, 0);
+        }
+        qatomic_set(&nv2a_reg_stats.overflow, 0);
+    }
+
+    for (int i = 0; i < NV2A_REG_STATS_SLOTS; i++) {
+        NV2ARegStatsSlot *slot =
+            &nv2a_reg_stats.slots[(h + i) % NV2A_REG_STATS_SLOTS];
+
+        if (!slot->key) {
+            qatomic_set(&slot->reads, 0);
+            qatomic_store_release(&slot->key, key);
+        }
+        if (slot->key == key) {
+            qatomic_inc(&slot->reads);
+            return;
+        }
+    }
+    qatomic_inc(&nv2a_reg_stats.overflow);
+}
+
+void nv2a_reg_stats_set_enabled(bool enabled)
+{
+    if (enabled && !qatomic_read(&nv2a_reg_stats.enabled)) {
+        qatomic_set(&nv2a_reg_stats.reset, true);
+    }
+    qatomic_set(&nv2a_reg_stats.enabled, enabled);
+}
+
+bool nv2a_reg_stats_get_enabled(void)
+{
+    return qatomic_read(&nv2a_reg_stats.enabled);
+}
+
+static int nv2a_reg_stat_cmp(const void *a, const void *b)
+{
+    uint64_t ra = ((const NV2ARegStat *)a)->reads;
+    uint64_t rb = ((const NV2ARegStat *)b)->reads;
+
+    return ra < rb ? 1 : ra > rb ? -1 : 0;
+}
+
+int nv2a_reg_stats_get(NV2ARegStat *stats, int max, uint64_t *overflow)
+{
+    NV2ARegStat all[NV2A_REG_STATS_SLOTS];
+    int n = 0;
+
+    if (qatomic_read(&nv2a_reg_stats.reset)) {
+        *overflow = 0;
+        return 0;
+    }
+
+    for (int i = 0; i < NV2A_REG_STATS_SLOTS; i++) {
+        NV2ARegStatsSlot *slot = &nv2a_reg_stats.slots[i];
+        uint32_t key = qatomic_load_acquire(&slot->key);
+        hwaddr naddr;
+
+        if (!key) {
+            continue;
+        }
+        naddr = key - 1;
+        all[n] = (NV2ARegStat) {
+            .block = "?",
+            .addr = naddr,
+            .reads = qatomic_read(&slot->reads),
+        };
+        for (int j = 0; j < ARRAY_SIZE(blocktable); j++) {
+            if (blocktable[j].name && naddr >= blocktable[j].offset &&
+                naddr < blocktable[j].offset + blocktable[j].size) {
+                all[n].block = blocktable[j].name;
+                all[n].addr = naddr - blocktable[j].offset;
+                break;
+            }
+        }
+        n++;
+    }
+
+    qsort(all, n, sizeof(all[0]), nv2a_reg_stat_cmp);
+    n = MIN(n, max);
+    memcpy(stats, all, n * sizeof(all[0]));
+    *overflow = qatomic_read(&nv2a_reg_stats.overflow);
+    return n;
+}
+
 #ifdef DEBUG_NV2A_REG
 static const char *nv2a_reg_names[] = {};
+#endif
 
 void nv2a_reg_log_read(int block, hwaddr addr, uint64_t val)
 {
+    if (qatomic_read(&nv2a_reg_stats.enabled)) {
+        nv2a_reg_stats_read(block, addr);
+    }
+#ifdef DEBUG_NV2A_REG
     if (blocktable[block].name) {
         hwaddr naddr = blocktable[block].offset + addr;
         if (naddr < ARRAY_SIZE(nv2a_reg_names) && nv2a_reg_names[naddr]) {
@@ -138,8 +255,10 @@ void nv2a_reg_log_read(int block, hwaddr addr, uint64_t val)
         NV2A_DPRINTF("(%d?): read [%" HWADDR_PRIx "] -> 0x%" PRIx64 "\n",
                      block, addr, val);
     }
+#endif
 }
 
+#ifdef DEBUG_NV2A_REG
 void nv2a_reg_log_write(int block, hwaddr addr, uint64_t val)
 {
     if (blocktable[block].name) {
@@ -250,6 +369,8 @@ static void nv2a_init_memory(NV2AState *d, MemoryRegion *ram)
 
     d->vram_ptr = memory_region_get_ram_ptr(d->vram);
     d->ramin_ptr = memory_region_get_ram_ptr(&d->ramin);
+    /* Guest RAMHT updates invalidate the PFIFO handle cache */
+    memory_region_set_log(&d->ramin, true, DIRTY_MEMORY_NV2A);
 
     memory_region_set_log(d->vram, true, DIRTY_MEMORY_NV2A);
     memory_region_set_log(d->vram, true, DIRTY_MEMORY_NV2A_TEX);
@@ -260,6 +381,8 @@ static void nv2a_init_memory(NV2AState *d, MemoryRegion *ram)
     /* fire up pfifo */
     qemu_thread_create(&d->pfifo.thread, "nv2a.pfifo_thread",
                        pfifo_thread, d, QEMU_THREAD_JOINABLE);
+    qemu_thread_create(&d->pfifo.pusher_thread, "nv2a.pusher_thread",
+                       pfifo_pusher_thread, d, QEMU_THREAD_JOINABLE);
 }
 
 static void nv2a_init_vga(NV2AState *d)
@@ -322,6 +445,7 @@ static void nv2a_reset(NV2AState *d)
 
     memset(d->pfifo.regs, 0, sizeof(d->pfifo.regs));
     memset(d->pgraph.regs, 0, sizeof(d->pgraph.regs));
+    pfifo_reset_queue(d);
 
     d->pcrtc.start = 0;
     d->pramdac.core_clock_coeff = 0x00011C01; /* 189MHz...? */
@@ -353,6 +477,45 @@ static void nv2a_reset(NV2AState *d)
     nv2a_unlock_fifo(d);
 }
 
+static void nv2a_init_fast_mmio(NV2AState *d)
+{
+    Object *owner = OBJECT(d);
+
+    fast_mmio_wait_queue_init(&d->fast_mmio.dma_get_wait);
+
+    for (int i = 0; i < 2; i++) {
+        hwaddr addr = i ? NV_PTIMER_TIME_1 : NV_PTIMER_TIME_0;
+        fast_mmio_register(&d->fast_mmio.ptimer_time[i], owner,
+                           &d->block_mmio[NV_PTIMER], addr, "nv2a-ptimer-time",
+                           ptimer_fast_read, &blocktable[NV_PTIMER].ops, d);
+    }
+
+    fast_mmio_register(&d->fast_mmio.pfifo_dma_put, owner,
+                       &d->block_mmio[NV_PFIFO], NV_PFIFO_CACHE1_DMA_PUT,
+                       "nv2a-pfifo-dma-put", pfifo_fast_read,
+                       &blocktable[NV_PFIFO].ops, d);
+    fast_mmio_register(&d->fast_mmio.pfifo_dma_get, owner,
+                       &d->block_mmio[NV_PFIFO], NV_PFIFO_CACHE1_DMA_GET,
+                       "nv2a-pfifo-dma-get", pfifo_fast_read,
+                       &blocktable[NV_PFIFO].ops, d);
+    fast_mmio_set_wait_queue(&d->fast_mmio.pfifo_dma_get,
+                             &d->fast_mmio.dma_get_wait);
+
+    for (int i = 0; i < NV2A_NUM_CHANNELS; i++) {
+        hwaddr base = (hwaddr)i << 16;
+        fast_mmio_register(&d->fast_mmio.user_dma_put[i], owner,
+                           &d->block_mmio[NV_USER], base + NV_USER_DMA_PUT,
+                           "nv2a-user-dma-put", user_fast_read,
+                           &blocktable[NV_USER].ops, d);
+        fast_mmio_register(&d->fast_mmio.user_dma_get[i], owner,
+                           &d->block_mmio[NV_USER], base + NV_USER_DMA_GET,
+                           "nv2a-user-dma-get", user_fast_read,
+                           &blocktable[NV_USER].ops, d);
+        fast_mmio_set_wait_queue(&d->fast_mmio.user_dma_get[i],
+                                 &d->fast_mmio.dma_get_wait);
+    }
+}
+
 static void nv2a_realize(PCIDevice *dev, Error **errp)
 {
     NV2AState *d = NV2A_DEVICE(dev);
@@ -375,9 +538,14 @@ static void nv2a_realize(PCIDevice *dev, Error **errp)
                                     &d->block_mmio[i]);
     }
 
+    nv2a_init_fast_mmio(d);
+
     qemu_mutex_init(&d->pfifo.lock);
     qemu_cond_init(&d->pfifo.fifo_cond);
     qemu_cond_init(&d->pfifo.fifo_idle_cond);
+    qemu_cond_init(&d->pfifo.pusher_cond);
+    d->pfifo.queue = g_new0(PFIFOCommandQueue, 1);
+    d->pfifo.pusher_resync = true;
 }
 
 static void nv2a_exitfn(PCIDevice *dev)
@@ -385,12 +553,17 @@ static void nv2a_exitfn(PCIDevice *dev)
     NV2AState *d;
     d = NV2A_DEVICE(dev);
 
+    qemu_mutex_lock(&d->pfifo.lock);
     d->exiting = true;
-
     qemu_cond_broadcast(&d->pfifo.fifo_cond);
+    qemu_cond_broadcast(&d->pfifo.pusher_cond);
+    qemu_mutex_unlock(&d->pfifo.lock);
+    qemu_thread_join(&d->pfifo.pusher_thread);
     qemu_thread_join(&d->pfifo.thread);
+    g_free(d->pfifo.queue);
 
     pgraph_destroy(&d->pgraph);
+    fast_mmio_wait_queue_destroy(&d->fast_mmio.dma_get_wait);
 }
 
 static void qdev_nv2a_reset(DeviceState *dev)
@@ -440,6 +613,8 @@ static int nv2a_pre_load(void *opaque)
 static int nv2a_post_load(void *opaque, int version_id)
 {
     NV2AState *d = opaque;
+    /* Anything still queued was decoded from the state being replaced */
+    pfifo_reset_queue(d);
     qatomic_set(&d->pfifo.halt, false);
     qatomic_set(&d->pgraph.flush_pending, true);
     nv2a_unlock_fifo(d);
@@ -577,6 +752,12 @@ static const VMStateDescription vmstate_nv2a = {
     },
 };
 
+static Property nv2a_properties[] = {
+    DEFINE_PROP_STRING("replay", NV2AState, replay_path),
+    DEFINE_PROP_UINT32("replay-loops", NV2AState, replay_loops, 10),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
 static void nv2a_class_init(ObjectClass *klass, void *data)
 {
     DeviceClass *dc = DEVICE_CLASS(klass);
@@ -597,6 +778,7 @@ static void nv2a_class_init(ObjectClass *klass, void *data)
     dc->desc = "GeForce NV2A Integrated Graphics";
     dc->vmsd = &vmstate_nv2a;
     dc->reset = qdev_nv2a_reset;
+    device_class_set_props(dc, nv2a_properties);
 }
 
 static const TypeInfo nv2a_info = {
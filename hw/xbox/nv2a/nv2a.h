@@ -23,9 +23,12 @@
 
 void nv2a_init(PCIBus *bus, int devfn, MemoryRegion *ram);
 void nv2a_gl_context_init(void);
-int nv2a_get_framebuffer_surface(void);
+int nv2a_get_framebuffer_surface(int *width, int *height, bool *updated);
 void nv2a_set_surface_scale_factor(unsigned int scale);
 unsigned int nv2a_get_surface_scale_factor(void);
 const uint8_t *nv2a_get_dac_palette(void);
+double nv2a_get_refresh_rate(void);
+void nv2a_capture_frames(const char *path, unsigned int frames);
+void nv2a_save_shader_corpus(const char *path);
 
 #endif
@@ -41,6 +41,8 @@
 #include "hw/pci/pci.h"
 #include "cpu.h"
 
+#include "hw/xbox/fast_mmio.h"
+
 #include "swizzle.h"
 #include "lru.h"
 #include "gl/gloffscreen.h"
@@ -68,6 +70,54 @@ enum FIFOEngine {
     ENGINE_DVD = 2,
 };
 
+typedef struct RAMHTEntry {
+    uint32_t handle;
+    hwaddr instance;
+    enum FIFOEngine engine;
+    unsigned int channel_id : 5;
+    bool valid;
+} RAMHTEntry;
+
+#define NV2A_RAMHT_CACHE_SIZE 256
+
+/* Host copy of a RAMHT lookup for a handle on a channel */
+typedef struct RAMHTCacheEntry {
+    uint32_t handle;
+    unsigned int channel_id;
+    RAMHTEntry entry;
+} RAMHTCacheEntry;
+
+/* PFIFO CACHE1 DMA state as of the start of a command queue entry */
+typedef struct PFIFOCommit {
+    uint32_t dma_get;
+    uint32_t dma_state;
+    uint32_t dma_dcount;
+    uint32_t dma_subroutine;
+    uint32_t channel_id;
+} PFIFOCommit;
+
+#define NV2A_COMMAND_QUEUE_WORDS (16 * 1024)
+
+/*
+ * Decoded methods passed from the pusher thread to the PGRAPH thread.
+ *
+ * Entries keep the pushbuffer layout, an increasing/non-increasing method
+ * header followed by its data words, so the lookahead in pgraph_method()
+ * sees the same words it would in guest memory. commit[] is only valid at
+ * header indices. The pusher owns head, the puller owns tail and done.
+ */
+typedef struct PFIFOCommandQueue {
+    uint32_t words[NV2A_COMMAND_QUEUE_WORDS];
+    PFIFOCommit commit[NV2A_COMMAND_QUEUE_WORDS];
+    unsigned int head;
+    unsigned int tail;
+    unsigned int done;
+
+    /* Running totals, sampled per frame for the profiler */
+    uint64_t words_queued;
+    uint64_t full_stalls;
+} PFIFOCommandQueue;
+
 typedef struct DMAObject {
     unsigned int dma_class;
     unsigned int dma_target;
@@ -173,7 +223,6 @@ typedef struct TextureBinding {
     GLuint gl_texture;
     unsigned int refcnt;
     int draw_time;
-    uint64_t data_hash;
     unsigned int scale;
 } TextureBinding;
 
@@ -188,10 +237,27 @@ typedef struct TextureKey {
 typedef struct TextureLruNode {
     LruNode node;
     TextureKey key;
-    TextureBinding *binding;
+    TextureBinding *binding; /* Owned by the renderer */
+    bool populated;
     bool possibly_dirty;
+    uint64_t data_hash;
 } TextureLruNode;
 
+typedef enum PGRAPHTextureLookup {
+    PGRAPH_TEXTURE_DISABLED,
+    PGRAPH_TEXTURE_UNCHANGED,
+    PGRAPH_TEXTURE_FOUND,
+} PGRAPHTextureLookup;
+
+typedef struct TextureLookup {
+    TextureShape state;
+    uint8_t *texture_data;
+    uint8_t *palette_data;
+    SurfaceBinding *surface; /* Render target to copy from, if any */
+    TextureLruNode *node;
+    bool regenerate;         /* The node's texture must be (re)created */
+} TextureLookup;
+
 typedef struct VertexKey {
     size_t count;
     GLuint gl_type;
@@ -200,6 +266,8 @@ typedef struct VertexKey {
     hwaddr addr;
 } VertexKey;
 
+#define NV2A_ELEMENT_CACHE_SIZE (50 * 1024)
+
 typedef struct VertexLruNode {
     LruNode node;
     VertexKey key;
@@ -207,6 +275,30 @@ typedef struct VertexLruNode {
     bool initialized;
 } VertexLruNode;
 
+#define NV2A_DISPLAY_BUFFERS 3
+#define NV2A_DISPLAY_BUFFER_INDEX_MASK 0x3
+#define NV2A_DISPLAY_BUFFER_FRESH 0x4
+
+typedef struct DisplayBuffer {
+    GLuint gl_texture;
+    GLint internal_format;
+    GLsizei width, height;
+    GLenum format, type;
+    GLsync fence;         /* Display render done, waited on by the UI */
+    GLsync release_fence; /* UI done sampling, waited on by PGRAPH */
+    int64_t flip_time;
+} DisplayBuffer;
+
+/* Everything a display render depends on besides guest memory */
+typedef struct DisplayKey {
+    SurfaceBinding *surface;
+    GLuint gl_buffer;
+    int draw_time;
+    uint32_t pline_offset;
+    int width, height;
+    unsigned int scale;
+} DisplayKey;
+
 typedef struct KelvinState {
     hwaddr object_instance;
 } KelvinState;
@@ -242,9 +334,30 @@ typedef struct QueryReport {
     GLuint *queries;
 } QueryReport;
 
+struct NV2AState;
+
+/* Host side of PGRAPH. Method decoding and state tracking are shared, and
+ * the renderer consumes that state at the points where work is submitted. */
+typedef struct PGRAPHRenderer {
+    const char *name;
+    void (*init)(struct NV2AState *d);
+    void (*destroy)(struct NV2AState *d);
+    void (*init_thread)(struct NV2AState *d);
+    void (*flush)(struct NV2AState *d);
+    void (*update_surface)(struct NV2AState *d, bool upload,
+                           bool color_write, bool zeta_write);
+    void (*draw_begin)(struct NV2AState *d);
+    void (*draw_end)(struct NV2AState *d);
+    void (*clear_surface)(struct NV2AState *d, uint32_t parameter);
+    /* Waits for submitted work to finish, for frame timing */
+    void (*finish)(struct NV2AState *d);
+} PGRAPHRenderer;
+
 typedef struct PGRAPHState {
     QemuMutex lock;
 
+    const PGRAPHRenderer *renderer;
+
     uint32_t pending_interrupts;
     uint32_t enabled_interrupts;
 
@@ -254,8 +367,31 @@ typedef struct PGRAPHState {
     struct s2t_rndr {
         GLuint fbo, vao, vbo, prog;
         GLuint tex_loc, surface_size_loc;
+        GLuint flip_tex, pbo;
+        GLint flip_internal_format;
+        unsigned int flip_width, flip_height;
+        size_t pbo_size;
     } s2t_rndr;
 
+    struct blit_rndr {
+        GLuint read_fbo, draw_fbo, vao, prog;
+        GLint src_offset_loc, dest_offset_loc, beta_loc;
+        GLuint dest_copy_tex;
+        GLint dest_copy_internal_format;
+        unsigned int dest_copy_width, dest_copy_height;
+    } blit_rndr;
+
+    struct swizzle_cs {
+        bool available;
+        GLuint prog;
+        GLuint buffers[2];
+        size_t buffer_size[2];
+        GLint bytes_per_pixel_loc;
+        GLint src_size_loc, src_pitch_loc, src_swizzled_loc, src_mask_loc;
+        GLint dst_size_loc, dst_swizzled_loc, dst_mask_loc;
+        GLint downscale_loc, upscale_loc, flip_loc;
+    } swizzle_cs;
+
     struct disp_rndr {
         GLuint fbo, vao, vbo, prog;
         GLuint display_size_loc;
@@ -305,12 +441,17 @@ typedef struct PGRAPHState {
 
     GLuint gl_framebuffer;
 
-    GLuint gl_display_buffer;
-    GLint gl_display_buffer_internal_format;
-    GLsizei gl_display_buffer_width;
-    GLsizei gl_display_buffer_height;
-    GLenum gl_display_buffer_format;
-    GLenum gl_display_buffer_type;
+    /* Completed display frames handed to the UI thread. PGRAPH renders into
+     * the write buffer, the UI samples the read buffer, and the two trade
+     * buffers through ready without waiting on each other. */
+    struct {
+        DisplayBuffer buffers[NV2A_DISPLAY_BUFFERS];
+        unsigned int write, read, ready;
+        bool read_valid;
+        DisplayKey last_key; /* What the last published frame showed */
+        uint64_t dropped, repeated;
+        uint64_t latency_us, latency_samples;
+    } display;
 
     hwaddr dma_state;
     hwaddr dma_notifies;
@@ -336,6 +477,18 @@ typedef struct PGRAPHState {
     uint32_t vsh_constants[NV2A_VERTEXSHADER_CONSTANTS][4];
     bool vsh_constants_dirty[NV2A_VERTEXSHADER_CONSTANTS];
 
+    /* Contents of the constant uniform blocks last bound */
+    uint32_t vsh_constants_uploaded[NV2A_VERTEXSHADER_CONSTANTS][4];
+    float psh_constants_uploaded[9][2][4];
+    bool uniform_blocks_dirty;
+
+    /* Stream buffer the constant uniform blocks are allocated from */
+    struct {
+        GLuint buffer;
+        GLint align;
+        size_t offset;
+    } uniform_ring;
+
     /* lighting constant arrays */
     uint32_t ltctxa[NV2A_LTCTXA_COUNT][4];
     bool ltctxa_dirty[NV2A_LTCTXA_COUNT];
@@ -391,10 +544,14 @@ typedef struct PGRAPHState {
     QemuEvent downloads_complete;
     QemuEvent dirty_surfaces_download_complete;
     QemuEvent flush_complete;
-    QemuEvent gl_sync_complete;
 
     unsigned int surface_scale_factor;
     uint8_t *scale_buf;
+
+    /* Pushbuffer capture, started at the next flip once requested */
+    struct PGRAPHCapture *capture;
+    char *capture_request_path;
+    unsigned int capture_request_frames;
 } PGRAPHState;
 
 typedef struct NV2AState {
@@ -405,6 +562,10 @@ typedef struct NV2AState {
     qemu_irq irq;
     bool exiting;
 
+    /* Capture replayed by the PFIFO thread in place of the guest */
+    char *replay_path;
+    uint32_t replay_loops;
+
     VGACommonState vga;
     GraphicHwOps hw_ops;
     QEMUTimer *vblank_timer;
@@ -433,6 +594,23 @@ typedef struct NV2AState {
         QemuCond fifo_idle_cond;
         bool fifo_kick;
         bool halt;
+
+        /* Pushbuffer parsing runs ahead of PGRAPH on its own thread. The
+         * CACHE1 DMA registers only advance as PGRAPH executes, so the
+         * pusher decodes from a private copy, reloaded when resync is set
+         * and the queue has drained. */
+        QemuThread pusher_thread;
+        QemuCond pusher_cond;
+        PFIFOCommandQueue *queue;
+        bool pusher_resync;
+        bool pusher_sync_pending;
+        uint32_t pusher_dma_get;
+        uint32_t pusher_dma_state;
+        uint32_t pusher_dma_dcount;
+        uint32_t pusher_dma_subroutine;
+
+        /* Pusher-side RAMHT lookups, protected by lock */
+        RAMHTCacheEntry ramht_cache[NV2A_RAMHT_CACHE_SIZE];
     } pfifo;
 
     struct {
@@ -480,6 +658,18 @@ typedef struct NV2AState {
         uint8_t palette[256*3];
     } puserdac;
 
+    /* Hot polled registers, read without the BQL */
+    struct {
+        FastMMIORegister ptimer_time[2];
+        FastMMIORegister pfifo_dma_put;
+        FastMMIORegister pfifo_dma_get;
+        FastMMIORegister user_dma_put[NV2A_NUM_CHANNELS];
+        FastMMIORegister user_dma_get[NV2A_NUM_CHANNELS];
+
+        /* vCPUs spinning on DMA_GET, woken as the pusher advances */
+        FastMMIOWaitQueue dma_get_wait;
+    } fast_mmio;
+
 } NV2AState;
 
 typedef struct NV2ABlockInfo {
@@ -494,11 +684,12 @@ extern GloContext *g_nv2a_context_display;
 
 void nv2a_update_irq(NV2AState *d);
 
-#ifdef DEBUG_NV2A_REG
+/* Also counts the read for the HUD's register statistics when enabled */
 void nv2a_reg_log_read(int block, hwaddr addr, uint64_t val);
+
+#ifdef DEBUG_NV2A_REG
 void nv2a_reg_log_write(int block, hwaddr addr, uint64_t val);
 #else
-#define nv2a_reg_log_read(block, addr, val) do {} while (0)
 #define nv2a_reg_log_write(block, addr, val) do {} while (0)
 #endif
 
@@ -528,9 +719,16 @@ DEFINE_PROTO(prmdio)
 DEFINE_PROTO(user)
 #undef DEFINE_PROTO
 
+bool pfifo_fast_read(void *opaque, hwaddr addr, uint32_t *val);
+bool ptimer_fast_read(void *opaque, hwaddr addr, uint32_t *val);
+bool user_fast_read(void *opaque, hwaddr addr, uint32_t *val);
+
 DMAObject nv_dma_load(NV2AState *d, hwaddr dma_obj_address);
 void *nv_dma_map(NV2AState *d, hwaddr dma_obj_address, hwaddr *len);
 
+extern const PGRAPHRenderer pgraph_gl_renderer;
+extern const PGRAPHRenderer pgraph_null_renderer;
+
 void pgraph_init(NV2AState *d);
 void pgraph_destroy(PGRAPHState *pg);
 void pgraph_context_switch(NV2AState *d, unsigned int channel_id);
@@ -543,8 +741,31 @@ void pgraph_process_pending_reports(NV2AState *d);
 void pgraph_process_pending_downloads(NV2AState *d);
 void pgraph_download_dirty_surfaces(NV2AState *d);
 void pgraph_flush(NV2AState *d);
+const char *pgraph_kelvin_method_name(unsigned int method);
+PGRAPHTextureLookup pgraph_lookup_texture(NV2AState *d, int i, bool bound,
+                                          TextureLookup *t);
+VertexLruNode *pgraph_lookup_inline_elements(NV2AState *d, bool *upload);
+
+void pgraph_capture_frame(NV2AState *d);
+void pgraph_capture_method(NV2AState *d, unsigned int subchannel,
+                           unsigned int method, uint32_t parameter,
+                           uint32_t *parameters, size_t num_words_available,
+                           size_t max_lookahead_words, bool inc);
+void pgraph_capture_memory(NV2AState *d, hwaddr addr, hwaddr size);
+void pgraph_replay(NV2AState *d, const char *path, unsigned int loops);
+
+static inline void pgraph_capture_touch(NV2AState *d, hwaddr addr,
+                                        hwaddr size)
+{
+    if (unlikely(d->pgraph.capture)) {
+        pgraph_capture_memory(d, addr, size);
+    }
+}
 
 void *pfifo_thread(void *arg);
+void *pfifo_pusher_thread(void *arg);
 void pfifo_kick(NV2AState *d);
+void pfifo_reset_queue(NV2AState *d);
+void pfifo_reset_dma_state(NV2AState *d);
 
 #endif
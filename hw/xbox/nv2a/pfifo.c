@@ -20,17 +20,12 @@
  */
 
 #include "nv2a_int.h"
-
-typedef struct RAMHTEntry {
-    uint32_t handle;
-    hwaddr instance;
-    enum FIFOEngine engine;
-    unsigned int channel_id : 5;
-    bool valid;
-} RAMHTEntry;
+#include "sysemu/cpus.h"
 
 static void pfifo_run_pusher(NV2AState *d);
 static uint32_t ramht_hash(NV2AState *d, uint32_t handle);
+static void ramht_cache_invalidate(NV2AState *d);
+static void ramht_cache_check_dirty(NV2AState *d);
 static RAMHTEntry ramht_lookup(NV2AState *d, uint32_t handle);
 
 /* PFIFO - MMIO and DMA FIFO submission to PGRAPH and VPE */
@@ -62,6 +57,20 @@ uint64_t pfifo_read(void *opaque, hwaddr addr, unsigned int size)
     return r;
 }
 
+bool pfifo_fast_read(void *opaque, hwaddr addr, uint32_t *val)
+{
+    NV2AState *d = (NV2AState *)opaque;
+
+    switch (addr) {
+    case NV_PFIFO_CACHE1_DMA_PUT:
+    case NV_PFIFO_CACHE1_DMA_GET:
+        *val = qatomic_read(&d->pfifo.regs[addr]);
+        return true;
+    default:
+        return false;
+    }
+}
+
 void pfifo_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
 {
     NV2AState *d = (NV2AState *)opaque;
@@ -79,6 +88,17 @@ void pfifo_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
         d->pfifo.enabled_interrupts = val;
         nv2a_update_irq(d);
         break;
+    case NV_PFIFO_RAMHT:
+        d->pfifo.regs[addr] = val;
+        ramht_cache_invalidate(d);
+        break;
+    case NV_PFIFO_CACHE1_DMA_GET:
+    case NV_PFIFO_CACHE1_DMA_STATE:
+    case NV_PFIFO_CACHE1_DMA_DCOUNT:
+    case NV_PFIFO_CACHE1_DMA_SUBROUTINE:
+        d->pfifo.regs[addr] = val;
+        pfifo_reset_dma_state(d);
+        break;
     default:
         d->pfifo.regs[addr] = val;
         break;
@@ -93,6 +113,54 @@ void pfifo_kick(NV2AState *d)
 {
     d->pfifo.fifo_kick = true;
     qemu_cond_broadcast(&d->pfifo.fifo_cond);
+    qemu_cond_broadcast(&d->pfifo.pusher_cond);
+}
+
+/* Header written when an entry does not fit before the end of the queue.
+ * Never a valid method header, so pgraph_method() lookahead cannot match
+ * it. */
+#define COMMAND_QUEUE_WRAP 0x00020000
+
+#define COMMAND_QUEUE_MAX_ENTRY_WORDS 0x7ff
+
+/* Entries executed per hold of the PGRAPH lock */
+#define PULLER_BATCH_ENTRIES 64
+
+/* Must be called with both the PFIFO and PGRAPH locks held */
+void pfifo_reset_queue(NV2AState *d)
+{
+    PFIFOCommandQueue *q = d->pfifo.queue;
+
+    qatomic_set(&q->head, 0);
+    qatomic_set(&q->tail, 0);
+    q->done = 0;
+    d->pfifo.pusher_sync_pending = false;
+    d->pfifo.pusher_resync = true;
+    ramht_cache_invalidate(d);
+}
+
+/* Guest wrote the CACHE1 DMA state. Entries still queued were decoded from
+ * the old state and their commits would overwrite the new values, so they
+ * are dropped and the pusher restarts from what was written. Must be
+ * called with the PFIFO lock held. */
+void pfifo_reset_dma_state(NV2AState *d)
+{
+    qemu_mutex_lock(&d->pgraph.lock);
+    pfifo_reset_queue(d);
+    qemu_mutex_unlock(&d->pgraph.lock);
+
+    d->pfifo.regs[NV_PFIFO_CACHE1_STATUS] |= NV_PFIFO_CACHE1_STATUS_LOW_MARK;
+}
+
+static unsigned int pfifo_queue_next(unsigned int index)
+{
+    return index == NV2A_COMMAND_QUEUE_WORDS ? 0 : index;
+}
+
+static bool pfifo_queue_empty(NV2AState *d)
+{
+    PFIFOCommandQueue *q = d->pfifo.queue;
+    return qatomic_read(&q->head) == qatomic_load_acquire(&q->tail);
 }
 
 static bool pgraph_can_fifo_access(NV2AState *d) {
@@ -120,59 +188,282 @@ static bool pgraph_is_flip_stall_complete(NV2AState *d)
     return false;
 }
 
-static bool pfifo_stall_for_flip(NV2AState *d)
+/* Must be called with the PGRAPH lock held */
+static bool pfifo_puller_should_stall(NV2AState *d)
 {
-    bool should_stall = false;
+    PGRAPHState *pg = &d->pgraph;
 
-    if (qatomic_read(&d->pgraph.waiting_for_flip)) {
-        qemu_mutex_lock(&d->pgraph.lock);
+    if (pg->waiting_for_flip) {
         if (!pgraph_is_flip_stall_complete(d)) {
-            should_stall = true;
-        } else {
-            d->pgraph.waiting_for_flip = false;
+            return true;
         }
-        qemu_mutex_unlock(&d->pgraph.lock);
+        pg->waiting_for_flip = false;
     }
 
-    return should_stall;
+    return pg->waiting_for_nop || pg->waiting_for_context_switch ||
+           !pgraph_can_fifo_access(d);
 }
 
-static bool pfifo_puller_should_stall(NV2AState *d)
+/* Publish the CACHE1 DMA state reached after executing the first `words`
+ * data words of an entry */
+static void pfifo_commit(NV2AState *d, const PFIFOCommit *c,
+                         unsigned int words)
 {
-    return pfifo_stall_for_flip(d) || qatomic_read(&d->pgraph.waiting_for_nop) ||
-           qatomic_read(&d->pgraph.waiting_for_context_switch) ||
-           !pgraph_can_fifo_access(d);
+    uint32_t dma_state = c->dma_state;
+    uint32_t method_count =
+        GET_MASK(dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT);
+
+    if (GET_MASK(dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE) ==
+        NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE_INC) {
+        SET_MASK(dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD,
+                 GET_MASK(dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD) +
+                     words);
+    }
+    SET_MASK(dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT,
+             method_count - MIN(method_count, words));
+
+    qatomic_set(&d->pfifo.regs[NV_PFIFO_CACHE1_DMA_STATE], dma_state);
+    qatomic_set(&d->pfifo.regs[NV_PFIFO_CACHE1_DMA_DCOUNT],
+                c->dma_dcount + words);
+    qatomic_set(&d->pfifo.regs[NV_PFIFO_CACHE1_DMA_SUBROUTINE],
+                c->dma_subroutine);
+    qatomic_set(&d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET],
+                c->dma_get + words * 4);
+    fast_mmio_wait_queue_notify(&d->fast_mmio.dma_get_wait);
 }
 
-static ssize_t pfifo_run_puller(NV2AState *d, uint32_t method_entry,
-                                uint32_t parameter, uint32_t *parameters,
-                                size_t num_words_available,
-                                size_t max_lookahead_words)
+/* Execute one queue entry, or what is left of it. Returns false if PGRAPH
+ * stalled before the entry could be started or finished. */
+static bool pfifo_run_puller_entry(NV2AState *d, unsigned int head)
 {
+    PFIFOCommandQueue *q = d->pfifo.queue;
+    unsigned int tail = q->tail;
+    uint32_t header = q->words[tail];
+
+    if (header == COMMAND_QUEUE_WRAP) {
+        qatomic_store_release(&q->tail, 0);
+        return true;
+    }
+
+    assert(tail + 1 + ((header >> 18) & 0x7ff) <= NV2A_COMMAND_QUEUE_WORDS);
+
+    const PFIFOCommit *c = &q->commit[tail];
+    unsigned int num_words = (header >> 18) & 0x7ff;
+
+    if (num_words == 0) {
+        /* Jumps, calls and returns with no method following them */
+        pfifo_commit(d, c, 0);
+        qatomic_store_release(&q->tail, pfifo_queue_next(tail + 1));
+        return true;
+    }
+
     if (pfifo_puller_should_stall(d)) {
-        return -1;
+        return false;
+    }
+
+    uint32_t method = header & 0x1ffc;
+    uint32_t subchannel = (header >> 13) & 7;
+    bool inc = !(header & 0x40000000);
+
+    unsigned int first = tail + 1 + q->done;
+    uint32_t *parameters = &q->words[first];
+    uint32_t parameter = ldl_le_p(parameters);
+    size_t num_words_available = num_words - q->done;
+    /* Everything up to the end of the queue is valid once the pusher has
+     * wrapped, as the unused tail is filled with wrap markers */
+    size_t max_lookahead_words = (head > tail) ? head - first
+                                               : NV2A_COMMAND_QUEUE_WORDS - first;
+    if (inc) {
+        method += q->done * 4;
+    }
+
+    ssize_t num_proc;
+    if (method == 0) {
+        pgraph_context_switch(d, c->channel_id);
+        if (d->pgraph.waiting_for_context_switch) {
+            return false;
+        }
+        num_proc = pgraph_method(d, subchannel, 0, parameter, parameters,
+                                 num_words_available, max_lookahead_words,
+                                 inc);
+    } else {
+        /* Run the whole entry back to back, only publishing progress once
+         * it is done or PGRAPH needs the puller to wait */
+        num_proc = 0;
+        do {
+            num_proc += pgraph_method(d, subchannel,
+                                      inc ? method + num_proc * 4 : method,
+                                      ldl_le_p(parameters + num_proc),
+                                      parameters + num_proc,
+                                      num_words_available - num_proc,
+                                      max_lookahead_words - num_proc, inc);
+        } while (num_proc < num_words_available &&
+                 !pfifo_puller_should_stall(d));
     }
+    assert(num_proc > 0);
 
+    if (num_proc < num_words_available) {
+        q->done += num_proc;
+        pfifo_commit(d, c, q->done);
+        return true;
+    }
+
+    /* Method finished. PGRAPH may also have consumed the whole entries
+     * following it (see the BEGIN/DRAW_ARRAYS/END squashing). */
+    size_t extra = num_proc - num_words_available;
+    unsigned int consumed = num_words;
+    tail = pfifo_queue_next(tail + 1 + num_words);
+    q->done = 0;
+
+    while (extra > 0) {
+        assert(tail != head && q->words[tail] != COMMAND_QUEUE_WRAP);
+        c = &q->commit[tail];
+        num_words = (q->words[tail] >> 18) & 0x7ff;
+        extra -= 1;
+        consumed = MIN(extra, num_words);
+        extra -= consumed;
+        if (consumed < num_words) {
+            q->done = consumed;
+            break;
+        }
+        tail = pfifo_queue_next(tail + 1 + num_words);
+    }
+
+    pfifo_commit(d, c, consumed);
+    qatomic_store_release(&q->tail, tail);
+    return true;
+}
+
+/* Execute queued methods. Called with the PFIFO lock held, which is dropped
+ * while PGRAPH runs. Returns true if any progress was made. */
+static bool pfifo_run_puller(NV2AState *d)
+{
+    PFIFOCommandQueue *q = d->pfifo.queue;
     uint32_t *pull0 = &d->pfifo.regs[NV_PFIFO_CACHE1_PULL0];
-    uint32_t *pull1 = &d->pfifo.regs[NV_PFIFO_CACHE1_PULL1];
-    uint32_t *engine_reg = &d->pfifo.regs[NV_PFIFO_CACHE1_ENGINE];
     uint32_t *status = &d->pfifo.regs[NV_PFIFO_CACHE1_STATUS];
-    ssize_t num_proc = -1;
+    bool progress = false;
+
+    if (!GET_MASK(*pull0, NV_PFIFO_CACHE1_PULL0_ACCESS)) {
+        return false;
+    }
 
-    // TODO think more about locking
+    qemu_mutex_unlock(&d->pfifo.lock);
+    qemu_mutex_lock(&d->pgraph.lock);
+
+    for (int i = 0; i < PULLER_BATCH_ENTRIES; i++) {
+        unsigned int head = qatomic_load_acquire(&q->head);
+        if (q->tail == head) {
+            break;
+        }
+        if (!pfifo_run_puller_entry(d, head)) {
+            break;
+        }
+        progress = true;
+    }
 
-    if (!GET_MASK(*pull0, NV_PFIFO_CACHE1_PULL0_ACCESS) ||
-        (*status & NV_PFIFO_CACHE1_STATUS_LOW_MARK)) {
-        return -1;
+    qemu_mutex_unlock(&d->pgraph.lock);
+    qemu_mutex_lock(&d->pfifo.lock);
+
+    if (pfifo_queue_empty(d)) {
+        *status |= NV_PFIFO_CACHE1_STATUS_LOW_MARK;
+    }
+    if (progress) {
+        /* Space was freed, or the queue drained for a resync */
+        qemu_cond_broadcast(&d->pfifo.pusher_cond);
     }
 
-    uint32_t method = method_entry & 0x1FFC;
+    return progress;
+}
+
+/* Reserve room for an entry with up to *num_words data words, wrapping to
+ * the start of the queue if needed. On success *num_words is clamped to
+ * what fits; returns false if the queue is full. */
+static bool pfifo_queue_reserve(NV2AState *d, unsigned int *num_words)
+{
+    PFIFOCommandQueue *q = d->pfifo.queue;
+    unsigned int head = q->head;
+    unsigned int tail = qatomic_load_acquire(&q->tail);
+    unsigned int needed = 1 + MIN(*num_words, 1);
+    unsigned int space;
+
+    if (head < tail) {
+        space = tail - head - 1;
+    } else {
+        space = NV2A_COMMAND_QUEUE_WORDS - head - (tail == 0);
+        if (space < needed && tail > needed) {
+            for (unsigned int i = head; i < NV2A_COMMAND_QUEUE_WORDS; i++) {
+                q->words[i] = COMMAND_QUEUE_WRAP;
+            }
+            qatomic_store_release(&q->head, 0);
+            space = tail - 1;
+        }
+    }
+
+    if (space < needed) {
+        return false;
+    }
+
+    *num_words = MIN(*num_words, space - 1);
+    return true;
+}
+
+static void pfifo_queue_push(NV2AState *d, uint32_t header,
+                             const uint32_t *words, unsigned int num_words,
+                             uint32_t channel_id)
+{
+    PFIFOCommandQueue *q = d->pfifo.queue;
+    unsigned int head = q->head;
+
+    q->words[head] = header;
+    q->commit[head] = (PFIFOCommit){
+        .dma_get = d->pfifo.pusher_dma_get,
+        .dma_state = d->pfifo.pusher_dma_state,
+        .dma_dcount = d->pfifo.pusher_dma_dcount,
+        .dma_subroutine = d->pfifo.pusher_dma_subroutine,
+        .channel_id = channel_id,
+    };
+    if (num_words) {
+        memcpy(&q->words[head + 1], words, num_words * sizeof(uint32_t));
+    }
+
+    qatomic_store_release(&q->head, pfifo_queue_next(head + 1 + num_words));
+    qatomic_set(&q->words_queued, q->words_queued + 1 + num_words);
+}
+
+static bool pfifo_pusher_should_stall(NV2AState *d)
+{
+    return !pgraph_can_fifo_access(d) ||
+           qatomic_read(&d->pgraph.waiting_for_nop);
+}
+
+/* Decode one run of method data words into the queue. Returns false if the
+ * queue is full. */
+static bool pfifo_push_method(NV2AState *d, uint32_t *word_ptr,
+                              size_t num_words_available)
+{
+    uint32_t *dma_state = &d->pfifo.pusher_dma_state;
+    uint32_t *engine_reg = &d->pfifo.regs[NV_PFIFO_CACHE1_ENGINE];
+    uint32_t *pull1 = &d->pfifo.regs[NV_PFIFO_CACHE1_PULL1];
+
+    uint32_t method_type =
+        GET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE);
     uint32_t subchannel =
-        GET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_SUBCHANNEL);
-    bool inc = !GET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_TYPE);
+        GET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_SUBCHANNEL);
+    uint32_t method =
+        GET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD) << 2;
+    uint32_t method_count =
+        GET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT);
+    uint32_t channel_id = 0;
+    unsigned int num_words = MIN(MIN(method_count, num_words_available),
+                                 COMMAND_QUEUE_MAX_ENTRY_WORDS);
+    uint32_t object_word;
+
+    assert((method & 3) == 0);
+
+    d->pfifo.regs[NV_PFIFO_CACHE1_DMA_DATA_SHADOW] = ldl_le_p(word_ptr);
 
     if (method == 0) {
-        RAMHTEntry entry = ramht_lookup(d, parameter);
+        RAMHTEntry entry = ramht_lookup(d, ldl_le_p(word_ptr));
         assert(entry.valid);
         // assert(entry.channel_id == state->channel_id);
         assert(entry.engine == ENGINE_GRAPHICS);
@@ -182,81 +473,67 @@ static ssize_t pfifo_run_puller(NV2AState *d, uint32_t method_entry,
         SET_MASK(*engine_reg, 3 << (4*subchannel), entry.engine);
         SET_MASK(*pull1, NV_PFIFO_CACHE1_PULL1_ENGINE, entry.engine);
 
-        // TODO: this is fucked
-        qemu_mutex_unlock(&d->pfifo.lock);
-        qemu_mutex_lock(&d->pgraph.lock);
-
-        // Switch contexts if necessary
-        if (pgraph_can_fifo_access(d)) {
-            pgraph_context_switch(d, entry.channel_id);
-            if (!d->pgraph.waiting_for_context_switch) {
-                num_proc =
-                    pgraph_method(d, subchannel, 0, entry.instance, parameters,
-                                  num_words_available, max_lookahead_words, inc);
-            }
-        }
-
-        qemu_mutex_unlock(&d->pgraph.lock);
-        qemu_mutex_lock(&d->pfifo.lock);
-
+        stl_le_p(&object_word, entry.instance);
+        word_ptr = &object_word;
+        channel_id = entry.channel_id;
+        num_words = 1;
     } else if (method >= 0x100) {
         // method passed to engine
 
         /* methods that take objects.
          * TODO: Check this range is correct for the nv2a */
         if (method >= 0x180 && method < 0x200) {
-            //qemu_mutex_lock_iothread();
-            RAMHTEntry entry = ramht_lookup(d, parameter);
+            RAMHTEntry entry = ramht_lookup(d, ldl_le_p(word_ptr));
             assert(entry.valid);
             // assert(entry.channel_id == state->channel_id);
-            parameter = entry.instance;
-            //qemu_mutex_unlock_iothread();
+            stl_le_p(&object_word, entry.instance);
+            word_ptr = &object_word;
+            num_words = 1;
         }
 
         enum FIFOEngine engine = GET_MASK(*engine_reg, 3 << (4*subchannel));
         assert(engine == ENGINE_GRAPHICS);
         SET_MASK(*pull1, NV_PFIFO_CACHE1_PULL1_ENGINE, engine);
-
-        // TODO: this is fucked
-        qemu_mutex_unlock(&d->pfifo.lock);
-        qemu_mutex_lock(&d->pgraph.lock);
-
-        if (pgraph_can_fifo_access(d)) {
-            num_proc =
-                pgraph_method(d, subchannel, method, parameter, parameters,
-                              num_words_available, max_lookahead_words, inc);
-        }
-
-        qemu_mutex_unlock(&d->pgraph.lock);
-        qemu_mutex_lock(&d->pfifo.lock);
     } else {
         assert(false);
     }
 
-    if (num_proc > 0) {
-        *status |= NV_PFIFO_CACHE1_STATUS_LOW_MARK;
+    if (!pfifo_queue_reserve(d, &num_words)) {
+        qatomic_set(&d->pfifo.queue->full_stalls,
+                    d->pfifo.queue->full_stalls + 1);
+        return false;
     }
 
-    return num_proc;
-}
+    uint32_t header = method | (subchannel << 13) | (num_words << 18);
+    if (method_type == NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE_NON_INC) {
+        header |= 0x40000000;
+    }
+    pfifo_queue_push(d, header, word_ptr, num_words, channel_id);
 
-static bool pfifo_pusher_should_stall(NV2AState *d)
-{
-    return !pgraph_can_fifo_access(d) ||
-           qatomic_read(&d->pgraph.waiting_for_nop);
+    if (method_type == NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE_INC) {
+        SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD,
+                 (method + 4*num_words) >> 2);
+    }
+    SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT,
+             method_count - num_words);
+    d->pfifo.pusher_dma_get += num_words * 4;
+    d->pfifo.pusher_dma_dcount += num_words;
+    d->pfifo.pusher_sync_pending = false;
+
+    return true;
 }
 
 static void pfifo_run_pusher(NV2AState *d)
 {
     uint32_t *push0 = &d->pfifo.regs[NV_PFIFO_CACHE1_PUSH0];
     uint32_t *push1 = &d->pfifo.regs[NV_PFIFO_CACHE1_PUSH1];
-    uint32_t *dma_subroutine = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_SUBROUTINE];
-    uint32_t *dma_state = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_STATE];
     uint32_t *dma_push = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_PUSH];
-    uint32_t *dma_get = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET];
     uint32_t *dma_put = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_PUT];
-    uint32_t *dma_dcount = &d->pfifo.regs[NV_PFIFO_CACHE1_DMA_DCOUNT];
     uint32_t *status = &d->pfifo.regs[NV_PFIFO_CACHE1_STATUS];
+    uint32_t *dma_subroutine = &d->pfifo.pusher_dma_subroutine;
+    uint32_t *dma_state = &d->pfifo.pusher_dma_state;
+    uint32_t *dma_dcount = &d->pfifo.pusher_dma_dcount;
+    bool pushed = false;
 
     if (!GET_MASK(*push0, NV_PFIFO_CACHE1_PUSH0_ACCESS) ||
         !GET_MASK(*dma_push, NV_PFIFO_CACHE1_DMA_PUSH_ACCESS) ||
@@ -264,6 +541,19 @@ static void pfifo_run_pusher(NV2AState *d)
         return;
     }
 
+    if (d->pfifo.pusher_resync) {
+        /* Guest or savestate changed the DMA state; the queue decoded
+         * from the old state was dropped by pfifo_reset_queue() */
+        d->pfifo.pusher_dma_get = d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET];
+        d->pfifo.pusher_dma_state = d->pfifo.regs[NV_PFIFO_CACHE1_DMA_STATE];
+        d->pfifo.pusher_dma_dcount = d->pfifo.regs[NV_PFIFO_CACHE1_DMA_DCOUNT];
+        d->pfifo.pusher_dma_subroutine =
+            d->pfifo.regs[NV_PFIFO_CACHE1_DMA_SUBROUTINE];
+        d->pfifo.pusher_resync = false;
+    }
+
+    ramht_cache_check_dirty(d);
+
     // TODO: should we become busy here??
     // NV_PFIFO_CACHE1_DMA_PUSH_STATE _BUSY
 
@@ -290,7 +580,7 @@ static void pfifo_run_pusher(NV2AState *d)
     uint8_t *dma = nv_dma_map(d, dma_instance, &dma_len);
 
     while (!pfifo_pusher_should_stall(d)) {
-        uint32_t dma_get_v = *dma_get;
+        uint32_t dma_get_v = d->pfifo.pusher_dma_get;
         uint32_t dma_put_v = *dma_put;
         if (dma_get_v == dma_put_v) break;
         if (dma_get_v >= dma_len) {
@@ -305,133 +595,119 @@ static void pfifo_run_pusher(NV2AState *d)
         num_words_available /= 4;
 
         uint32_t *word_ptr = (uint32_t*)(dma + dma_get_v);
-        uint32_t word = ldl_le_p(word_ptr);
-        dma_get_v += 4;
 
-        uint32_t method_type =
-            GET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE);
-        uint32_t method_subchannel =
-            GET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_SUBCHANNEL);
-        uint32_t method =
-            GET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD) << 2;
         uint32_t method_count =
             GET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT);
 
-        uint32_t subroutine_state =
-            GET_MASK(*dma_subroutine, NV_PFIFO_CACHE1_DMA_SUBROUTINE_STATE);
-
         if (method_count) {
-            /* data word of methods command */
-            d->pfifo.regs[NV_PFIFO_CACHE1_DMA_DATA_SHADOW] = word;
-
-            assert((method & 3) == 0);
-            uint32_t method_entry = 0;
-            SET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_ADDRESS, method >> 2);
-            SET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_TYPE, method_type);
-            SET_MASK(method_entry, NV_PFIFO_CACHE1_METHOD_SUBCHANNEL,
-                     method_subchannel);
-
-            *status &= ~NV_PFIFO_CACHE1_STATUS_LOW_MARK;
-
-            ssize_t num_words_processed =
-                pfifo_run_puller(d, method_entry, word, word_ptr,
-                                 MIN(method_count, num_words_available),
-                                 num_words_available);
-            if (num_words_processed < 0) {
+            /* data words of methods command */
+            if (!pfifo_push_method(d, word_ptr, num_words_available)) {
                 break;
             }
+            pushed = true;
+            continue;
+        }
 
-            dma_get_v += (num_words_processed-1)*4;
+        /* no command active - this is the first word of a new one */
+        uint32_t word = ldl_le_p(word_ptr);
+        dma_get_v += 4;
 
-            if (method_type == NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE_INC) {
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD,
-                         (method + 4*num_words_processed) >> 2);
-            }
-            SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT,
-                     method_count - MIN(method_count, num_words_processed));
+        uint32_t subroutine_state =
+            GET_MASK(*dma_subroutine, NV_PFIFO_CACHE1_DMA_SUBROUTINE_STATE);
 
-            (*dma_dcount) += num_words_processed;
-        } else {
-            /* no command active - this is the first word of a new one */
-            d->pfifo.regs[NV_PFIFO_CACHE1_DMA_RSVD_SHADOW] = word;
-
-            /* match all forms */
-            if ((word & 0xe0000003) == 0x20000000) {
-                /* old jump */
-                d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET_JMP_SHADOW] =
-                    dma_get_v;
-                dma_get_v = word & 0x1fffffff;
-                NV2A_DPRINTF("pb OLD_JMP 0x%x\n", dma_get_v);
-            } else if ((word & 3) == 1) {
-                /* jump */
-                d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET_JMP_SHADOW] =
-                    dma_get_v;
-                dma_get_v = word & 0xfffffffc;
-                NV2A_DPRINTF("pb JMP 0x%x\n", dma_get_v);
-            } else if ((word & 3) == 2) {
-                /* call */
-                if (subroutine_state) {
-                    SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR,
-                             NV_PFIFO_CACHE1_DMA_STATE_ERROR_CALL);
-                    break;
-                } else {
-                    *dma_subroutine = dma_get_v;
-                    SET_MASK(*dma_subroutine,
-                             NV_PFIFO_CACHE1_DMA_SUBROUTINE_STATE, 1);
-                    dma_get_v = word & 0xfffffffc;
-                    NV2A_DPRINTF("pb CALL 0x%x\n", dma_get_v);
-                }
-            } else if (word == 0x00020000) {
-                /* return */
-                if (!subroutine_state) {
-                    SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR,
-                             NV_PFIFO_CACHE1_DMA_STATE_ERROR_RETURN);
-                    // break;
-                } else {
-                    dma_get_v = *dma_subroutine & 0xfffffffc;
-                    SET_MASK(*dma_subroutine,
-                             NV_PFIFO_CACHE1_DMA_SUBROUTINE_STATE, 0);
-                    NV2A_DPRINTF("pb RET 0x%x\n", dma_get_v);
-                }
-            } else if ((word & 0xe0030003) == 0) {
-                /* increasing methods */
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD,
-                         (word & 0x1fff) >> 2 );
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_SUBCHANNEL,
-                         (word >> 13) & 7);
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT,
-                         (word >> 18) & 0x7ff);
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE,
-                         NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE_INC);
-                *dma_dcount = 0;
-            } else if ((word & 0xe0030003) == 0x40000000) {
-                /* non-increasing methods */
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD,
-                         (word & 0x1fff) >> 2 );
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_SUBCHANNEL,
-                         (word >> 13) & 7);
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT,
-                         (word >> 18) & 0x7ff);
-                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE,
-                         NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE_NON_INC);
-                *dma_dcount = 0;
+        d->pfifo.regs[NV_PFIFO_CACHE1_DMA_RSVD_SHADOW] = word;
+
+        /* match all forms */
+        if ((word & 0xe0000003) == 0x20000000) {
+            /* old jump */
+            d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET_JMP_SHADOW] =
+                dma_get_v;
+            dma_get_v = word & 0x1fffffff;
+            NV2A_DPRINTF("pb OLD_JMP 0x%x\n", dma_get_v);
+        } else if ((word & 3) == 1) {
+            /* jump */
+            d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET_JMP_SHADOW] =
+                dma_get_v;
+            dma_get_v = word & 0xfffffffc;
+            NV2A_DPRINTF("pb JMP 0x%x\n", dma_get_v);
+        } else if ((word & 3) == 2) {
+            /* call */
+            if (subroutine_state) {
+                SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR,
+                         NV_PFIFO_CACHE1_DMA_STATE_ERROR_CALL);
+                break;
             } else {
-                NV2A_DPRINTF("pb reserved cmd 0x%x - 0x%x\n",
-                             dma_get_v, word);
+                *dma_subroutine = dma_get_v;
+                SET_MASK(*dma_subroutine,
+                         NV_PFIFO_CACHE1_DMA_SUBROUTINE_STATE, 1);
+                dma_get_v = word & 0xfffffffc;
+                NV2A_DPRINTF("pb CALL 0x%x\n", dma_get_v);
+            }
+        } else if (word == 0x00020000) {
+            /* return */
+            if (!subroutine_state) {
                 SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR,
-                         NV_PFIFO_CACHE1_DMA_STATE_ERROR_RESERVED_CMD);
+                         NV_PFIFO_CACHE1_DMA_STATE_ERROR_RETURN);
                 // break;
-                assert(false);
+            } else {
+                dma_get_v = *dma_subroutine & 0xfffffffc;
+                SET_MASK(*dma_subroutine,
+                         NV_PFIFO_CACHE1_DMA_SUBROUTINE_STATE, 0);
+                NV2A_DPRINTF("pb RET 0x%x\n", dma_get_v);
             }
+        } else if ((word & 0xe0030003) == 0) {
+            /* increasing methods */
+            SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD,
+                     (word & 0x1fff) >> 2 );
+            SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_SUBCHANNEL,
+                     (word >> 13) & 7);
+            SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT,
+                     (word >> 18) & 0x7ff);
+            SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE,
+                     NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE_INC);
+            *dma_dcount = 0;
+        } else if ((word & 0xe0030003) == 0x40000000) {
+            /* non-increasing methods */
+            SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD,
+                     (word & 0x1fff) >> 2 );
+            SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_SUBCHANNEL,
+                     (word >> 13) & 7);
+            SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_COUNT,
+                     (word >> 18) & 0x7ff);
+            SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE,
+                     NV_PFIFO_CACHE1_DMA_STATE_METHOD_TYPE_NON_INC);
+            *dma_dcount = 0;
+        } else {
+            NV2A_DPRINTF("pb reserved cmd 0x%x - 0x%x\n",
+                         dma_get_v, word);
+            SET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR,
+                     NV_PFIFO_CACHE1_DMA_STATE_ERROR_RESERVED_CMD);
+            // break;
+            assert(false);
         }
 
-        *dma_get = dma_get_v;
+        d->pfifo.pusher_dma_get = dma_get_v;
+        d->pfifo.pusher_sync_pending = true;
 
         if (GET_MASK(*dma_state, NV_PFIFO_CACHE1_DMA_STATE_ERROR)) {
             break;
         }
     }
 
+    /* Let the puller publish state reached without a method to follow,
+     * e.g. a trailing jump, so DMA_GET still catches up with DMA_PUT */
+    unsigned int no_words = 0;
+    if (d->pfifo.pusher_sync_pending && pfifo_queue_reserve(d, &no_words)) {
+        pfifo_queue_push(d, 0, NULL, 0, 0);
+        d->pfifo.pusher_sync_pending = false;
+        pushed = true;
+    }
+
+    if (pushed) {
+        *status &= ~NV_PFIFO_CACHE1_STATUS_LOW_MARK;
+        pfifo_kick(d);
+    }
+
     // NV2A_DPRINTF("DMA pusher done: max 0x%" HWADDR_PRIx ", 0x%" HWADDR_PRIx " - 0x%" HWADDR_PRIx "\n",
     //      dma_len, control->dma_get, control->dma_put);
 
@@ -440,6 +716,7 @@ static void pfifo_run_pusher(NV2AState *d)
         NV2A_DPRINTF("pb error: %d\n", error);
         assert(false);
 
+        d->pfifo.regs[NV_PFIFO_CACHE1_DMA_STATE] = *dma_state;
         SET_MASK(*dma_push, NV_PFIFO_CACHE1_DMA_PUSH_STATUS, 1); /* suspended */
 
         // d->pfifo.pending_interrupts |= NV_PFIFO_INTR_0_DMA_PUSHER;
@@ -472,21 +749,36 @@ static void process_requests(NV2AState *d)
     }
 }
 
+/* PGRAPH side: executes the command queue filled by pfifo_pusher_thread */
 void *pfifo_thread(void *arg)
 {
     NV2AState *d = (NV2AState *)arg;
-    glo_set_current(g_nv2a_context_render);
+    d->pgraph.renderer->init_thread(d);
 
     rcu_register_thread();
 
+    if (d->replay_path) {
+        /* Keep the guest off RAMIN and VRAM while the capture overwrites
+         * them. The vCPUs stay paused until the shutdown below, and this
+         * is done before taking the PGRAPH lock that vCPU MMIO may need. */
+        qemu_mutex_lock_iothread();
+        pause_all_vcpus();
+        qemu_mutex_unlock_iothread();
+
+        qemu_mutex_lock(&d->pgraph.lock);
+        pgraph_replay(d, d->replay_path, d->replay_loops);
+        qemu_mutex_unlock(&d->pgraph.lock);
+        qemu_system_shutdown_request(SHUTDOWN_CAUSE_HOST_UI);
+    }
+
     qemu_mutex_lock(&d->pfifo.lock);
     while (true) {
         d->pfifo.fifo_kick = false;
 
         process_requests(d);
 
-        if (!d->pfifo.halt) {
-            pfifo_run_pusher(d);
+        if (!d->pfifo.halt && pfifo_run_puller(d)) {
+            d->pfifo.fifo_kick = true;
         }
 
         pgraph_process_pending_reports(d);
@@ -509,6 +801,27 @@ void *pfifo_thread(void *arg)
     return NULL;
 }
 
+/* PFIFO side: parses the DMA pushbuffer into the command queue */
+void *pfifo_pusher_thread(void *arg)
+{
+    NV2AState *d = (NV2AState *)arg;
+
+    rcu_register_thread();
+
+    qemu_mutex_lock(&d->pfifo.lock);
+    while (!d->exiting) {
+        if (!d->pfifo.halt) {
+            pfifo_run_pusher(d);
+        }
+        qemu_cond_wait(&d->pfifo.pusher_cond, &d->pfifo.lock);
+    }
+    qemu_mutex_unlock(&d->pfifo.lock);
+
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
 static uint32_t ramht_hash(NV2AState *d, uint32_t handle)
 {
     unsigned int ramht_size =
@@ -530,8 +843,7 @@ static uint32_t ramht_hash(NV2AState *d, uint32_t handle)
     return hash;
 }
 
-
-static RAMHTEntry ramht_lookup(NV2AState *d, uint32_t handle)
+static RAMHTEntry ramht_read(NV2AState *d, uint32_t handle)
 {
     hwaddr ramht_size =
         1 << (GET_MASK(d->pfifo.regs[NV_PFIFO_RAMHT], NV_PFIFO_RAMHT_SIZE)+12);
@@ -558,3 +870,52 @@ static RAMHTEntry ramht_lookup(NV2AState *d, uint32_t handle)
         .valid = entry_context & NV_RAMHT_STATUS,
     };
 }
+
+static void ramht_cache_invalidate(NV2AState *d)
+{
+    memset(d->pfifo.ramht_cache, 0, sizeof(d->pfifo.ramht_cache));
+}
+
+/* RAMIN is plain RAM to the guest, so RAMHT updates are only seen through
+ * dirty tracking. Checked once per pusher run: a guest adds objects before
+ * kicking the pushbuffer that uses them. */
+static void ramht_cache_check_dirty(NV2AState *d)
+{
+    hwaddr ramht_size =
+        1 << (GET_MASK(d->pfifo.regs[NV_PFIFO_RAMHT], NV_PFIFO_RAMHT_SIZE)+12);
+    hwaddr ramht_address =
+        GET_MASK(d->pfifo.regs[NV_PFIFO_RAMHT],
+                 NV_PFIFO_RAMHT_BASE_ADDRESS) << 12;
+
+    if (ramht_address + ramht_size > memory_region_size(&d->ramin)) {
+        return;
+    }
+
+    if (memory_region_test_and_clear_dirty(&d->ramin, ramht_address,
+                                           ramht_size, DIRTY_MEMORY_NV2A)) {
+        ramht_cache_invalidate(d);
+    }
+}
+
+static RAMHTEntry ramht_lookup(NV2AState *d, uint32_t handle)
+{
+    unsigned int channel_id = GET_MASK(d->pfifo.regs[NV_PFIFO_CACHE1_PUSH1],
+                                       NV_PFIFO_CACHE1_PUSH1_CHID);
+    unsigned int index = ((handle * 0x9e3779b1) >> 24 ^ channel_id) %
+                         NV2A_RAMHT_CACHE_SIZE;
+    RAMHTCacheEntry *cached = &d->pfifo.ramht_cache[index];
+
+    if (cached->entry.valid && cached->handle == handle &&
+        cached->channel_id == channel_id) {
+        return cached->entry;
+    }
+
+    RAMHTEntry entry = ramht_read(d, handle);
+    if (entry.valid) {
+        cached->handle = handle;
+        cached->channel_id = channel_id;
+        cached->entry = entry;
+    }
+
+    return entry;
+}
@@ -21,8 +21,10 @@
 
 #include "nv2a_int.h"
 #include "s3tc.h"
+#include "shader_corpus.h"
 #include "ui/xemu-settings.h"
 #include "qemu/fast-hash.h"
+#include "qemu/host-utils.h"
 
 #define DBG_SURFACES 0
 #define DBG_SURFACE_SYNC 0
@@ -51,14 +53,94 @@ static void nv2a_profile_increment(void)
     }
 }
 
-static void nv2a_profile_flip_stall(void)
+/* Host time saved by parking vCPUs that spin on DMA_GET, per frame */
+static void nv2a_profile_spin_park(void)
 {
-    glFinish();
+    static uint64_t last_parks, last_parked_ns;
+    uint64_t parks, parked_ns;
+
+    fast_mmio_wait_queue_get_stats(&g_nv2a->fast_mmio.dma_get_wait, &parks,
+                                   &parked_ns);
+    g_nv2a_stats.frame_working.counters[NV2A_PROF_SPIN_PARKS] =
+        parks - last_parks;
+    g_nv2a_stats.frame_working.counters[NV2A_PROF_SPIN_PARKED_US] =
+        (parked_ns - last_parked_ns) / 1000;
+    last_parks = parks;
+    last_parked_ns = parked_ns;
+}
+
+/*
+ * Polled register reads served without and with the BQL, per frame. This
+ * covers every lock-free register, the APU's XGSCNT included.
+ */
+static void nv2a_profile_fast_mmio(void)
+{
+    static uint64_t last_fast, last_slow;
+    uint64_t fast, slow;
+
+    fast_mmio_get_total_stats(&fast, &slow);
+    g_nv2a_stats.frame_working.counters[NV2A_PROF_MMIO_FAST_READS] =
+        fast - last_fast;
+    g_nv2a_stats.frame_working.counters[NV2A_PROF_MMIO_SLOW_READS] =
+        slow - last_slow;
+    last_fast = fast;
+    last_slow = slow;
+}
+
+/* Words decoded ahead by the pusher thread, and how often it found the
+ * command queue full, per frame */
+static void nv2a_profile_pusher(void)
+{
+    static uint64_t last_words, last_full;
+    PFIFOCommandQueue *q = g_nv2a->pfifo.queue;
+    uint64_t words = qatomic_read(&q->words_queued);
+    uint64_t full = qatomic_read(&q->full_stalls);
+
+    g_nv2a_stats.frame_working.counters[NV2A_PROF_PUSHER_WORDS] =
+        words - last_words;
+    g_nv2a_stats.frame_working.counters[NV2A_PROF_PUSHER_QUEUE_FULL] =
+        full - last_full;
+    last_words = words;
+    last_full = full;
+}
+
+/* Display frames the UI never showed or showed again, and the average time
+ * from the guest flip to the UI picking up the frame, per frame */
+static void nv2a_profile_display(void)
+{
+    static uint64_t last_dropped, last_repeated, last_latency, last_samples;
+    PGRAPHState *pg = &g_nv2a->pgraph;
+    uint64_t dropped = qatomic_read(&pg->display.dropped);
+    uint64_t repeated = qatomic_read(&pg->display.repeated);
+    uint64_t latency = qatomic_read(&pg->display.latency_us);
+    uint64_t samples = qatomic_read(&pg->display.latency_samples);
+
+    g_nv2a_stats.frame_working.counters[NV2A_PROF_DISPLAY_DROPPED] =
+        dropped - last_dropped;
+    g_nv2a_stats.frame_working.counters[NV2A_PROF_DISPLAY_REPEATED] =
+        repeated - last_repeated;
+    if (samples != last_samples) {
+        g_nv2a_stats.frame_working.counters[NV2A_PROF_DISPLAY_LATENCY_US] =
+            (latency - last_latency) / (samples - last_samples);
+    }
+    last_dropped = dropped;
+    last_repeated = repeated;
+    last_latency = latency;
+    last_samples = samples;
+}
+
+static void nv2a_profile_flip_stall(NV2AState *d)
+{
+    d->pgraph.renderer->finish(d);
 
     int64_t now = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     int64_t render_time = (now-g_nv2a_stats.last_flip_time)/1000;
 
     g_nv2a_stats.frame_working.mspf = render_time;
+    nv2a_profile_spin_park();
+    nv2a_profile_fast_mmio();
+    nv2a_profile_pusher();
+    nv2a_profile_display();
     g_nv2a_stats.frame_history[g_nv2a_stats.frame_ptr] =
         g_nv2a_stats.frame_working;
     g_nv2a_stats.frame_ptr =
@@ -359,13 +441,15 @@ static const SurfaceFormatInfo kelvin_surface_zeta_int_format_map[] = {
 
 
 // static void pgraph_set_context_user(NV2AState *d, uint32_t val);
-static void pgraph_gl_fence(void);
 static GLuint pgraph_compile_shader(const char *vs_src, const char *fs_src);
 static void pgraph_init_render_to_texture(NV2AState *d);
+static void pgraph_init_image_blit(NV2AState *d);
+static void pgraph_init_swizzle_cs(NV2AState *d);
 static void pgraph_init_display_renderer(NV2AState *d);
 static void pgraph_method_log(unsigned int subchannel, unsigned int graphics_class, unsigned int method, uint32_t parameter);
 static void pgraph_allocate_inline_buffer_vertices(PGRAPHState *pg, unsigned int attr);
 static void pgraph_finish_inline_buffer_vertex(PGRAPHState *pg);
+static void pgraph_init_uniform_ring(PGRAPHState *pg);
 static void pgraph_shader_update_constants(PGRAPHState *pg, ShaderBinding *binding, bool binding_changed, bool vertex_program, bool fixed_function);
 static void pgraph_bind_shaders(PGRAPHState *pg);
 static bool pgraph_framebuffer_dirty(PGRAPHState *pg);
@@ -612,7 +696,7 @@ void pgraph_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
     qemu_mutex_unlock(&d->pfifo.lock);
 }
 
-void pgraph_flush(NV2AState *d)
+static void pgraph_gl_flush(NV2AState *d)
 {
     PGRAPHState *pg = &d->pgraph;
 
@@ -640,9 +724,17 @@ void pgraph_flush(NV2AState *d)
 
     pgraph_reload_surface_scale_factor(d);
 
+    /* Constants may have been replaced without being marked dirty */
+    pg->uniform_blocks_dirty = true;
+
     if (update_surface) {
         pgraph_update_surface(d, true, true, true);
     }
+}
+
+void pgraph_flush(NV2AState *d)
+{
+    d->pgraph.renderer->flush(d);
 
     qatomic_set(&d->pgraph.flush_pending, false);
     qemu_event_set(&d->pgraph.flush_complete);
@@ -680,60 +772,128 @@ void pgraph_flush(NV2AState *d)
 #undef DEF_METHOD_CASE_4
 
 typedef void (*MethodFunc)(METHOD_HANDLER_ARG_DECL);
-static const struct {
+typedef struct MethodEntry {
     uint32_t base;
     const char *name;
     MethodFunc handler;
-} pgraph_kelvin_methods[0x800] = {
-#define DEF_METHOD(gclass, name)                        \
-    [METHOD_ADDR_TO_INDEX(METHOD_ADDR(gclass, name))] = \
+} MethodEntry;
+
+/* Each class gets its own table, indexed by method >> 2, built from the
+ * entries in pgraph_methods.h. METHOD_IF_<class> only passes its argument
+ * through while the table for that class is being generated. */
+#define METHOD_IF_NV012(...)
+#define METHOD_IF_NV044(...)
+#define METHOD_IF_NV062(...)
+#define METHOD_IF_NV097(...)
+#define METHOD_IF_NV09F(...)
+
+#define METHOD_ENTRY(gclass, name) \
     { \
         METHOD_ADDR(gclass, name), \
         METHOD_NAME_STR(gclass, name), \
         METHOD_FUNC_NAME(gclass, name), \
-    },
+    }
+#define DEF_METHOD(gclass, name) \
+    METHOD_IF_ ## gclass( \
+        [METHOD_ADDR_TO_INDEX(METHOD_ADDR(gclass, name))] = \
+            METHOD_ENTRY(gclass, name),)
 #define DEF_METHOD_RANGE(gclass, name, range) \
-    [METHOD_ADDR_TO_INDEX(METHOD_ADDR(gclass, name)) \
-     ... METHOD_ADDR_TO_INDEX(METHOD_ADDR(gclass, name) + 4*range - 1)] = \
-    { \
-        METHOD_ADDR(gclass, name), \
-        METHOD_NAME_STR(gclass, name), \
-        METHOD_FUNC_NAME(gclass, name), \
-    },
+    METHOD_IF_ ## gclass( \
+        [METHOD_ADDR_TO_INDEX(METHOD_ADDR(gclass, name)) \
+         ... METHOD_ADDR_TO_INDEX(METHOD_ADDR(gclass, name) + 4*range - 1)] = \
+            METHOD_ENTRY(gclass, name),)
 #define DEF_METHOD_CASE_4_OFFSET(gclass, name, offset, stride) \
-    [METHOD_ADDR_TO_INDEX(METHOD_ADDR(gclass, name) + offset)] = \
-    { \
-        METHOD_ADDR(gclass, name), \
-        METHOD_NAME_STR(gclass, name), \
-        METHOD_FUNC_NAME(gclass, name), \
-    }, \
-    [METHOD_ADDR_TO_INDEX(METHOD_ADDR(gclass, name) + offset + stride)] = \
-    { \
-        METHOD_ADDR(gclass, name), \
-        METHOD_NAME_STR(gclass, name), \
-        METHOD_FUNC_NAME(gclass, name), \
-    }, \
-    [METHOD_ADDR_TO_INDEX(METHOD_ADDR(gclass, name) + offset + stride * 2)] = \
-    { \
-        METHOD_ADDR(gclass, name), \
-        METHOD_NAME_STR(gclass, name), \
-        METHOD_FUNC_NAME(gclass, name), \
-    }, \
-    [METHOD_ADDR_TO_INDEX(METHOD_ADDR(gclass, name) + offset + stride * 3)] = \
-    { \
-        METHOD_ADDR(gclass, name), \
-        METHOD_NAME_STR(gclass, name), \
-        METHOD_FUNC_NAME(gclass, name), \
-    },
+    METHOD_IF_ ## gclass( \
+        [METHOD_ADDR_TO_INDEX(METHOD_ADDR(gclass, name) + offset)] = \
+            METHOD_ENTRY(gclass, name), \
+        [METHOD_ADDR_TO_INDEX(METHOD_ADDR(gclass, name) + offset + stride)] = \
+            METHOD_ENTRY(gclass, name), \
+        [METHOD_ADDR_TO_INDEX(METHOD_ADDR(gclass, name) + offset + stride * 2)] = \
+            METHOD_ENTRY(gclass, name), \
+        [METHOD_ADDR_TO_INDEX(METHOD_ADDR(gclass, name) + offset + stride * 3)] = \
+            METHOD_ENTRY(gclass, name),)
 #define DEF_METHOD_CASE_4(gclass, name, stride) \
     DEF_METHOD_CASE_4_OFFSET(gclass, name, 0, stride)
+
+#undef METHOD_IF_NV012
+#define METHOD_IF_NV012(...) __VA_ARGS__
+static const MethodEntry pgraph_beta_methods[0x100] = {
+#include "pgraph_methods.h"
+};
+#undef METHOD_IF_NV012
+#define METHOD_IF_NV012(...)
+
+#undef METHOD_IF_NV044
+#define METHOD_IF_NV044(...) __VA_ARGS__
+static const MethodEntry pgraph_context_pattern_methods[0x100] = {
+#include "pgraph_methods.h"
+};
+#undef METHOD_IF_NV044
+#define METHOD_IF_NV044(...)
+
+#undef METHOD_IF_NV062
+#define METHOD_IF_NV062(...) __VA_ARGS__
+static const MethodEntry pgraph_context_surfaces_2d_methods[0x100] = {
 #include "pgraph_methods.h"
+};
+#undef METHOD_IF_NV062
+#define METHOD_IF_NV062(...)
+
+#undef METHOD_IF_NV097
+#define METHOD_IF_NV097(...) __VA_ARGS__
+static const MethodEntry pgraph_kelvin_methods[0x800] = {
+#include "pgraph_methods.h"
+};
+#undef METHOD_IF_NV097
+#define METHOD_IF_NV097(...)
+
+#undef METHOD_IF_NV09F
+#define METHOD_IF_NV09F(...) __VA_ARGS__
+static const MethodEntry pgraph_image_blit_methods[0x100] = {
+#include "pgraph_methods.h"
+};
+#undef METHOD_IF_NV09F
+#define METHOD_IF_NV09F(...)
+
 #undef DEF_METHOD
 #undef DEF_METHOD_RANGE
 #undef DEF_METHOD_CASE_4_OFFSET
 #undef DEF_METHOD_CASE_4
+#undef METHOD_ENTRY
+#undef METHOD_IF_NV012
+#undef METHOD_IF_NV044
+#undef METHOD_IF_NV062
+#undef METHOD_IF_NV097
+#undef METHOD_IF_NV09F
+
+static const struct {
+    const MethodEntry *methods;
+    size_t num_methods;
+} pgraph_classes[NV_PGRAPH_CTX_SWITCH1_GRCLASS + 1] = {
+#define CLASS_ENTRY(gclass, methods) \
+    [gclass] = { methods, ARRAY_SIZE(methods) }
+    CLASS_ENTRY(NV_BETA, pgraph_beta_methods),
+    CLASS_ENTRY(NV_CONTEXT_PATTERN, pgraph_context_pattern_methods),
+    CLASS_ENTRY(NV_CONTEXT_SURFACES_2D, pgraph_context_surfaces_2d_methods),
+    CLASS_ENTRY(NV_KELVIN_PRIMITIVE, pgraph_kelvin_methods),
+    CLASS_ENTRY(NV_IMAGE_BLIT, pgraph_image_blit_methods),
+#undef CLASS_ENTRY
 };
 
+static const MethodEntry *pgraph_method_entry(uint32_t graphics_class,
+                                              unsigned int method)
+{
+    unsigned int idx = METHOD_ADDR_TO_INDEX(method);
+
+    assert(graphics_class < ARRAY_SIZE(pgraph_classes));
+    if (idx >= pgraph_classes[graphics_class].num_methods) {
+        return NULL;
+    }
+
+    const MethodEntry *entry = &pgraph_classes[graphics_class].methods[idx];
+    return entry->handler ? entry : NULL;
+}
+
 #define METHOD_RANGE_END_NAME(gclass, name) \
     pgraph_ ## gclass ## _ ## name ## __END
 #define DEF_METHOD(gclass, name) \
@@ -814,6 +974,241 @@ static void pgraph_method_non_inc(MethodFunc handler, METHOD_HANDLER_ARG_DECL)
     DEF_METHOD_INT(gclass, name)
 
 // TODO: Optimize. Ideally this should all be done via OpenGL.
+static bool pgraph_image_blit_alpha_override(ContextSurfaces2DState *cs,
+                                             uint8_t *alpha)
+{
+    switch (cs->color_format) {
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8:
+        *alpha = 0xff;
+        return true;
+    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_Z8R8G8B8:
+        *alpha = 0;
+        return true;
+    default:
+        return false;
+    }
+}
+
+/* Execute a blit between two tracked surfaces on the GPU, so that neither
+ * has to make a round-trip through VRAM. Returns false if the blit has to
+ * take the CPU path instead.
+ */
+static bool pgraph_image_blit_gpu(NV2AState *d, SurfaceBinding *src,
+                                  SurfaceBinding *dest,
+                                  unsigned int bytes_per_pixel)
+{
+    PGRAPHState *pg = &d->pgraph;
+    ContextSurfaces2DState *context_surfaces = &pg->context_surfaces_2d;
+    ImageBlitState *image_blit = &pg->image_blit;
+    BetaState *beta = &pg->beta;
+
+    if (!src || !dest || !src->color || !dest->color ||
+        src->swizzle || dest->swizzle) {
+        return false;
+    }
+
+    if (src->fmt.bytes_per_pixel != bytes_per_pixel ||
+        src->fmt.gl_internal_format != dest->fmt.gl_internal_format ||
+        src->pitch != context_surfaces->source_pitch ||
+        dest->pitch != context_surfaces->dest_pitch) {
+        return false;
+    }
+
+    if (image_blit->in_x + image_blit->width > src->width ||
+        image_blit->in_y + image_blit->height > src->height ||
+        image_blit->out_x + image_blit->width > dest->width ||
+        image_blit->out_y + image_blit->height > dest->height) {
+        return false;
+    }
+
+    bool blend;
+    switch (image_blit->operation) {
+    case NV09F_SET_OPERATION_SRCCOPY:
+        blend = false;
+        break;
+    case NV09F_SET_OPERATION_BLEND_AND:
+        blend = true;
+        if (bytes_per_pixel != 4) {
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+
+    if (src == dest) {
+        /* Sampling the texture being rendered to is a feedback loop, and a
+         * framebuffer blit is only defined if the rectangles don't overlap */
+        bool overlap =
+            image_blit->in_x < image_blit->out_x + image_blit->width &&
+            image_blit->out_x < image_blit->in_x + image_blit->width &&
+            image_blit->in_y < image_blit->out_y + image_blit->height &&
+            image_blit->out_y < image_blit->in_y + image_blit->height;
+        if (blend || overlap) {
+            return false;
+        }
+    }
+
+    NV2A_GL_DGROUP_BEGIN("NV09F image blit 0x%" HWADDR_PRIx
+                         " -> 0x%" HWADDR_PRIx, src->vram_addr,
+                         dest->vram_addr);
+
+    /* Pick up anything the CPU wrote since the surfaces were last used */
+    pgraph_upload_surface_data(d, src, false);
+    pgraph_upload_surface_data(d, dest, false);
+
+    /* Surfaces are stored scaled and upside down */
+    unsigned int scale = pg->surface_scale_factor;
+    GLint src_x = image_blit->in_x * scale;
+    GLint src_y =
+        (src->height - image_blit->in_y - image_blit->height) * scale;
+    GLint dest_x = image_blit->out_x * scale;
+    GLint dest_y =
+        (dest->height - image_blit->out_y - image_blit->height) * scale;
+    GLsizei width = image_blit->width * scale;
+    GLsizei height = image_blit->height * scale;
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, pg->blit_rndr.draw_fbo);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, dest->gl_buffer, 0);
+    assert(glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) ==
+           GL_FRAMEBUFFER_COMPLETE);
+
+    glColorMask(true, true, true, true);
+    glDisable(GL_SCISSOR_TEST);
+
+    if (!blend) {
+        NV2A_GL_DPRINTF(true, "NV09F_SET_OPERATION_SRCCOPY");
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, pg->blit_rndr.read_fbo);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, src->gl_buffer, 0);
+        assert(glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) ==
+               GL_FRAMEBUFFER_COMPLETE);
+        glBlitFramebuffer(src_x, src_y, src_x + width, src_y + height,
+                          dest_x, dest_y, dest_x + width, dest_y + height,
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, 0, 0);
+    } else {
+        NV2A_GL_DPRINTF(true, "NV09F_SET_OPERATION_BLEND_AND");
+
+        // FIXME: Don't query GL for texture binding
+        GLint active_texture, last_texture_binding[2];
+        glGetIntegerv(GL_ACTIVE_TEXTURE, &active_texture);
+        for (int i = 0; i < 2; i++) {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glGetIntegerv(GL_TEXTURE_BINDING_2D, &last_texture_binding[i]);
+        }
+
+        /* The blend reads the destination, which can't be sampled while it
+         * is being rendered to, so it works from a copy of the rectangle */
+        glBindTexture(GL_TEXTURE_2D, pg->blit_rndr.dest_copy_tex);
+        if (pg->blit_rndr.dest_copy_width < width ||
+            pg->blit_rndr.dest_copy_height < height ||
+            pg->blit_rndr.dest_copy_internal_format !=
+                dest->fmt.gl_internal_format) {
+            pg->blit_rndr.dest_copy_width =
+                MAX(pg->blit_rndr.dest_copy_width, width);
+            pg->blit_rndr.dest_copy_height =
+                MAX(pg->blit_rndr.dest_copy_height, height);
+            pg->blit_rndr.dest_copy_internal_format =
+                dest->fmt.gl_internal_format;
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+            glTexImage2D(GL_TEXTURE_2D, 0, dest->fmt.gl_internal_format,
+                         pg->blit_rndr.dest_copy_width,
+                         pg->blit_rndr.dest_copy_height, 0,
+                         dest->fmt.gl_format, dest->fmt.gl_type, NULL);
+        }
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, pg->blit_rndr.read_fbo);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, dest->gl_buffer, 0);
+        assert(glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) ==
+               GL_FRAMEBUFFER_COMPLETE);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, dest_x, dest_y, width,
+                            height);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, 0, 0);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, src->gl_buffer);
+        glBindVertexArray(pg->blit_rndr.vao);
+        glUseProgram(pg->blit_rndr.prog);
+        glProgramUniform2i(pg->blit_rndr.prog, pg->blit_rndr.src_offset_loc,
+                           src_x - dest_x, src_y - dest_y);
+        glProgramUniform2i(pg->blit_rndr.prog, pg->blit_rndr.dest_offset_loc,
+                           -dest_x, -dest_y);
+        glProgramUniform1ui(pg->blit_rndr.prog, pg->blit_rndr.beta_loc,
+                            beta->beta >> 16);
+
+        glViewport(dest_x, dest_y, width, height);
+        glDisable(GL_DITHER);
+        glDisable(GL_STENCIL_TEST);
+        glDisable(GL_CULL_FACE);
+        glDisable(GL_DEPTH_TEST);
+        glDisable(GL_BLEND);
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        for (int i = 0; i < 2; i++) {
+            glActiveTexture(GL_TEXTURE0 + i);
+            glBindTexture(GL_TEXTURE_2D, last_texture_binding[i]);
+        }
+        glActiveTexture(active_texture);
+        glBindVertexArray(pg->gl_vertex_array);
+        glUseProgram(
+            pg->shader_binding ? pg->shader_binding->gl_program : 0);
+    }
+
+    uint8_t alpha_override;
+    if (pgraph_image_blit_alpha_override(context_surfaces, &alpha_override)) {
+        glEnable(GL_SCISSOR_TEST);
+        glScissor(dest_x, dest_y, width, height);
+        glColorMask(false, false, false, true);
+        glClearColor(0.0f, 0.0f, 0.0f, alpha_override / 255.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, 0, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, pg->gl_framebuffer);
+
+    NV2A_GL_DGROUP_END();
+
+    pg->draw_time++;
+    dest->draw_time = pg->draw_time;
+    dest->frame_time = pg->frame_time;
+    dest->draw_dirty = true;
+    dest->cleared = false;
+
+    if (!tcg_enabled()) {
+        /* FIXME: Cannot monitor for reads/writes; flush now */
+        pgraph_download_surface_data(d, dest, true);
+    }
+
+    /* Let the display see the new pixels, as it does after a CPU blit. The
+     * other dirty logs are set when the surface is written back to VRAM. */
+    hwaddr dest_addr = dest->vram_addr +
+                       image_blit->out_y * dest->pitch +
+                       image_blit->out_x * bytes_per_pixel;
+    hwaddr dest_size = (image_blit->height - 1) * dest->pitch +
+                       image_blit->width * bytes_per_pixel;
+    memory_region_set_client_dirty(d->vram, dest_addr, dest_size,
+                                   DIRTY_MEMORY_VGA);
+
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_BLIT_GPU);
+
+    return true;
+}
+
+/* Written through a host pointer, which the save state dirty logs miss */
+static void pgraph_mark_snapshot_dirty(NV2AState *d, hwaddr addr,
+                                       hwaddr size)
+{
+    memory_region_set_client_dirty(d->vram, addr, size, DIRTY_MEMORY_SNAPSHOT);
+    memory_region_set_client_dirty(d->vram, addr, size, DIRTY_MEMORY_REWIND);
+}
+
 static void pgraph_image_blit(NV2AState *d)
 {
     PGRAPHState *pg = &d->pgraph;
@@ -821,7 +1216,7 @@ static void pgraph_image_blit(NV2AState *d)
     ImageBlitState *image_blit = &pg->image_blit;
     BetaState *beta = &pg->beta;
 
-    pgraph_update_surface(d, false, true, true);
+    pg->renderer->update_surface(d, false, true, true);
 
     assert(context_surfaces->object_instance == image_blit->context_surfaces);
 
@@ -862,11 +1257,19 @@ static void pgraph_image_blit(NV2AState *d)
     hwaddr dest_addr = dest - d->vram_ptr;
 
     SurfaceBinding *surf_src = pgraph_surface_get(d, source_addr);
+    SurfaceBinding *surf_dest = pgraph_surface_get(d, dest_addr);
+
+    if (pgraph_image_blit_gpu(d, surf_src, surf_dest, bytes_per_pixel)) {
+        NV2A_DPRINTF("  - 0x%tx -> 0x%tx (gpu)\n", source_addr, dest_addr);
+        return;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_BLIT_CPU);
+
     if (surf_src) {
         pgraph_download_surface_data_if_dirty(d, surf_src);
     }
 
-    SurfaceBinding *surf_dest = pgraph_surface_get(d, dest_addr);
     if (surf_dest) {
         if (image_blit->height < surf_dest->height ||
             image_blit->width < surf_dest->width) {
@@ -891,6 +1294,9 @@ static void pgraph_image_blit(NV2AState *d)
            memory_region_size(d->vram));
     assert(dest_addr + dest_offset + dest_size <= memory_region_size(d->vram));
 
+    pgraph_capture_touch(d, source_addr + source_offset, source_size);
+    pgraph_capture_touch(d, dest_addr + dest_offset, dest_size);
+
     uint8_t *source_row = source + source_offset;
     uint8_t *dest_row = dest + dest_offset;
 
@@ -925,21 +1331,9 @@ static void pgraph_image_blit(NV2AState *d)
 
     NV2A_DPRINTF("  - 0x%tx -> 0x%tx\n", source_addr, dest_addr);
 
-    bool needs_alpha_patching;
     uint8_t alpha_override;
-    switch (context_surfaces->color_format) {
-    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8:
-        needs_alpha_patching = true;
-        alpha_override = 0xff;
-        break;
-    case NV062_SET_COLOR_FORMAT_LE_X8R8G8B8_Z8R8G8B8:
-        needs_alpha_patching = true;
-        alpha_override = 0;
-        break;
-    default:
-        needs_alpha_patching = false;
-        alpha_override = 0;
-    }
+    bool needs_alpha_patching =
+        pgraph_image_blit_alpha_override(context_surfaces, &alpha_override);
 
     if (needs_alpha_patching) {
         dest_row = dest + dest_offset;
@@ -956,6 +1350,7 @@ static void pgraph_image_blit(NV2AState *d)
                                    DIRTY_MEMORY_VGA);
     memory_region_set_client_dirty(d->vram, dest_addr, dest_size,
                                    DIRTY_MEMORY_NV2A_TEX);
+    pgraph_mark_snapshot_dirty(d, dest_addr, dest_size);
 }
 
 int pgraph_method(NV2AState *d, unsigned int subchannel,
@@ -963,20 +1358,17 @@ int pgraph_method(NV2AState *d, unsigned int subchannel,
                    uint32_t *parameters, size_t num_words_available,
                    size_t max_lookahead_words, bool inc)
 {
-    int num_processed = 1;
-
-    assert(glGetError() == GL_NO_ERROR);
-
     PGRAPHState *pg = &d->pgraph;
 
+    if (unlikely(pg->capture)) {
+        pgraph_capture_method(d, subchannel, method, parameter, parameters,
+                              num_words_available, max_lookahead_words, inc);
+    }
+
     bool channel_valid =
         d->pgraph.regs[NV_PGRAPH_CTX_CONTROL] & NV_PGRAPH_CTX_CONTROL_CHID;
     assert(channel_valid);
 
-    ContextSurfaces2DState *context_surfaces_2d = &pg->context_surfaces_2d;
-    ImageBlitState *image_blit = &pg->image_blit;
-    BetaState *beta = &pg->beta;
-
     assert(subchannel < 8);
 
     if (method == NV_SET_OBJECT) {
@@ -1014,130 +1406,133 @@ int pgraph_method(NV2AState *d, unsigned int subchannel,
         assert(graphics_class != 0x97);
     }
 
-    /* ugly switch for now */
-    switch (graphics_class) {
+    const MethodEntry *entry = pgraph_method_entry(graphics_class, method);
+    if (entry == NULL) {
+        NV2A_GL_DPRINTF(true, "    unhandled  (0x%02x 0x%08x)",
+                        graphics_class, method);
+        return 1;
+    }
 
-    case NV_BETA: { switch (method) {
-    case NV012_SET_OBJECT:
-        beta->object_instance = parameter;
-        break;
+    size_t num_words_consumed = 1;
+    entry->handler(d, pg, subchannel, method, parameter, parameters,
+                   num_words_available, &num_words_consumed, inc);
 
-    case NV012_SET_BETA:
-        if (parameter & 0x80000000) {
-            beta->beta = 0;
-        } else {
-            // The parameter is a signed fixed-point number with a sign bit and
-            // 31 fractional bits. Note that negative values are clamped to 0,
-            // and only 8 fractional bits are actually implemented in hardware.
-            beta->beta = parameter & 0x7f800000;
-        }
-        break;
-    } break; }
+    /* Squash repeated BEGIN,DRAW_ARRAYS,END */
+    #define LAM(i, mthd) ((parameters[i*2+1] & 0x31fff) == (mthd))
+    #define LAP(i, prm) (parameters[i*2+2] == (prm))
+    #define LAMP(i, mthd, prm) (LAM(i, mthd) && LAP(i, prm))
 
-    case NV_CONTEXT_PATTERN: { switch (method) {
-    case NV044_SET_MONOCHROME_COLOR0:
-        pg->regs[NV_PGRAPH_PATT_COLOR0] = parameter;
-        break;
-    } break; }
+    if (graphics_class == NV_KELVIN_PRIMITIVE &&
+        method == NV097_DRAW_ARRAYS && (max_lookahead_words >= 7) &&
+        pg->draw_arrays_length <
+            (ARRAY_SIZE(pg->gl_draw_arrays_start) - 1) &&
+        LAMP(0, NV097_SET_BEGIN_END, NV097_SET_BEGIN_END_OP_END) &&
+        LAMP(1, NV097_SET_BEGIN_END, pg->primitive_mode) &&
+        LAM(2, NV097_DRAW_ARRAYS)) {
+        num_words_consumed += 4;
+        pg->draw_arrays_prevent_connect = true;
+    }
 
-    case NV_CONTEXT_SURFACES_2D: { switch (method) {
-    case NV062_SET_OBJECT:
-        context_surfaces_2d->object_instance = parameter;
-        break;
+    #undef LAM
+    #undef LAP
+    #undef LAMP
 
-    case NV062_SET_CONTEXT_DMA_IMAGE_SOURCE:
-        context_surfaces_2d->dma_image_source = parameter;
-        break;
-    case NV062_SET_CONTEXT_DMA_IMAGE_DESTIN:
-        context_surfaces_2d->dma_image_dest = parameter;
-        break;
-    case NV062_SET_COLOR_FORMAT:
-        context_surfaces_2d->color_format = parameter;
-        break;
-    case NV062_SET_PITCH:
-        context_surfaces_2d->source_pitch = parameter & 0xFFFF;
-        context_surfaces_2d->dest_pitch = parameter >> 16;
-        break;
-    case NV062_SET_OFFSET_SOURCE:
-        context_surfaces_2d->source_offset = parameter & 0x07FFFFFF;
-        break;
-    case NV062_SET_OFFSET_DESTIN:
-        context_surfaces_2d->dest_offset = parameter & 0x07FFFFFF;
-        break;
-    } break; }
+    return num_words_consumed;
+}
 
-    case NV_IMAGE_BLIT: { switch (method) {
-    case NV09F_SET_OBJECT:
-        image_blit->object_instance = parameter;
-        break;
+DEF_METHOD(NV012, SET_OBJECT)
+{
+    pg->beta.object_instance = parameter;
+}
 
-    case NV09F_SET_CONTEXT_SURFACES:
-        image_blit->context_surfaces = parameter;
-        break;
-    case NV09F_SET_OPERATION:
-        image_blit->operation = parameter;
-        break;
-    case NV09F_CONTROL_POINT_IN:
-        image_blit->in_x = parameter & 0xFFFF;
-        image_blit->in_y = parameter >> 16;
-        break;
-    case NV09F_CONTROL_POINT_OUT:
-        image_blit->out_x = parameter & 0xFFFF;
-        image_blit->out_y = parameter >> 16;
-        break;
-    case NV09F_SIZE:
-        image_blit->width = parameter & 0xFFFF;
-        image_blit->height = parameter >> 16;
+DEF_METHOD(NV012, SET_BETA)
+{
+    if (parameter & 0x80000000) {
+        pg->beta.beta = 0;
+    } else {
+        // The parameter is a signed fixed-point number with a sign bit and
+        // 31 fractional bits. Note that negative values are clamped to 0,
+        // and only 8 fractional bits are actually implemented in hardware.
+        pg->beta.beta = parameter & 0x7f800000;
+    }
+}
 
-        if (image_blit->width && image_blit->height) {
-            pgraph_image_blit(d);
-        }
-        break;
-    } break; }
-
-    case NV_KELVIN_PRIMITIVE: {
-        MethodFunc handler =
-            pgraph_kelvin_methods[METHOD_ADDR_TO_INDEX(method)].handler;
-        if (handler == NULL) {
-            NV2A_GL_DPRINTF(true, "    unhandled  (0x%02x 0x%08x)",
-                            graphics_class, method);
-        } else {
-            size_t num_words_consumed = 1;
-            handler(d, pg, subchannel, method, parameter, parameters,
-                    num_words_available, &num_words_consumed, inc);
-
-            /* Squash repeated BEGIN,DRAW_ARRAYS,END */
-            #define LAM(i, mthd) ((parameters[i*2+1] & 0x31fff) == (mthd))
-            #define LAP(i, prm) (parameters[i*2+2] == (prm))
-            #define LAMP(i, mthd, prm) (LAM(i, mthd) && LAP(i, prm))
-
-            if (method == NV097_DRAW_ARRAYS && (max_lookahead_words >= 7) &&
-                pg->draw_arrays_length <
-                    (ARRAY_SIZE(pg->gl_draw_arrays_start) - 1) &&
-                LAMP(0, NV097_SET_BEGIN_END, NV097_SET_BEGIN_END_OP_END) &&
-                LAMP(1, NV097_SET_BEGIN_END, pg->primitive_mode) &&
-                LAM(2, NV097_DRAW_ARRAYS)) {
-                num_words_consumed += 4;
-                pg->draw_arrays_prevent_connect = true;
-            }
+DEF_METHOD(NV044, SET_MONOCHROME_COLOR0)
+{
+    pg->regs[NV_PGRAPH_PATT_COLOR0] = parameter;
+}
 
-            #undef LAM
-            #undef LAP
-            #undef LAMP
+DEF_METHOD(NV062, SET_OBJECT)
+{
+    pg->context_surfaces_2d.object_instance = parameter;
+}
 
-            num_processed = num_words_consumed;
-        }
-        break;
-    }
+DEF_METHOD(NV062, SET_CONTEXT_DMA_IMAGE_SOURCE)
+{
+    pg->context_surfaces_2d.dma_image_source = parameter;
+}
 
-    default:
-        NV2A_GL_DPRINTF(true, "    unhandled  (0x%02x 0x%08x)",
-                        graphics_class, method);
-        break;
+DEF_METHOD(NV062, SET_CONTEXT_DMA_IMAGE_DESTIN)
+{
+    pg->context_surfaces_2d.dma_image_dest = parameter;
+}
 
-    }
+DEF_METHOD(NV062, SET_COLOR_FORMAT)
+{
+    pg->context_surfaces_2d.color_format = parameter;
+}
+
+DEF_METHOD(NV062, SET_PITCH)
+{
+    pg->context_surfaces_2d.source_pitch = parameter & 0xFFFF;
+    pg->context_surfaces_2d.dest_pitch = parameter >> 16;
+}
+
+DEF_METHOD(NV062, SET_OFFSET_SOURCE)
+{
+    pg->context_surfaces_2d.source_offset = parameter & 0x07FFFFFF;
+}
+
+DEF_METHOD(NV062, SET_OFFSET_DESTIN)
+{
+    pg->context_surfaces_2d.dest_offset = parameter & 0x07FFFFFF;
+}
+
+DEF_METHOD(NV09F, SET_OBJECT)
+{
+    pg->image_blit.object_instance = parameter;
+}
+
+DEF_METHOD(NV09F, SET_CONTEXT_SURFACES)
+{
+    pg->image_blit.context_surfaces = parameter;
+}
+
+DEF_METHOD(NV09F, SET_OPERATION)
+{
+    pg->image_blit.operation = parameter;
+}
+
+DEF_METHOD(NV09F, CONTROL_POINT_IN)
+{
+    pg->image_blit.in_x = parameter & 0xFFFF;
+    pg->image_blit.in_y = parameter >> 16;
+}
+
+DEF_METHOD(NV09F, CONTROL_POINT_OUT)
+{
+    pg->image_blit.out_x = parameter & 0xFFFF;
+    pg->image_blit.out_y = parameter >> 16;
+}
+
+DEF_METHOD(NV09F, SIZE)
+{
+    pg->image_blit.width = parameter & 0xFFFF;
+    pg->image_blit.height = parameter >> 16;
 
-    return num_processed;
+    if (pg->image_blit.width && pg->image_blit.height) {
+        pgraph_image_blit(d);
+    }
 }
 
 DEF_METHOD(NV097, SET_OBJECT)
@@ -1183,7 +1578,7 @@ DEF_METHOD(NV097, NO_OPERATION)
 
 DEF_METHOD(NV097, WAIT_FOR_IDLE)
 {
-    pgraph_update_surface(d, false, true, true);
+    pg->renderer->update_surface(d, false, true, true);
 }
 
 DEF_METHOD(NV097, SET_FLIP_READ)
@@ -1221,12 +1616,16 @@ DEF_METHOD(NV097, FLIP_INCREMENT_WRITE)
 
     NV2A_GL_DFRAME_TERMINATOR();
     pg->frame_time++;
+
+    if (unlikely(pg->capture || pg->capture_request_path)) {
+        pgraph_capture_frame(d);
+    }
 }
 
 DEF_METHOD(NV097, FLIP_STALL)
 {
-    pgraph_update_surface(d, false, true, true);
-    nv2a_profile_flip_stall();
+    pg->renderer->update_surface(d, false, true, true);
+    nv2a_profile_flip_stall(d);
     pg->waiting_for_flip = true;
 }
 
@@ -1255,7 +1654,7 @@ DEF_METHOD(NV097, SET_CONTEXT_DMA_STATE)
 DEF_METHOD(NV097, SET_CONTEXT_DMA_COLOR)
 {
     /* try to get any straggling draws in before the surface's changed :/ */
-    pgraph_update_surface(d, false, true, true);
+    pg->renderer->update_surface(d, false, true, true);
 
     pg->dma_color = parameter;
     pg->surface_color.buffer_dirty = true;
@@ -1291,7 +1690,7 @@ DEF_METHOD(NV097, SET_CONTEXT_DMA_REPORT)
 
 DEF_METHOD(NV097, SET_SURFACE_CLIP_HORIZONTAL)
 {
-    pgraph_update_surface(d, false, true, true);
+    pg->renderer->update_surface(d, false, true, true);
 
     pg->surface_shape.clip_x =
         GET_MASK(parameter, NV097_SET_SURFACE_CLIP_HORIZONTAL_X);
@@ -1301,7 +1700,7 @@ DEF_METHOD(NV097, SET_SURFACE_CLIP_HORIZONTAL)
 
 DEF_METHOD(NV097, SET_SURFACE_CLIP_VERTICAL)
 {
-    pgraph_update_surface(d, false, true, true);
+    pg->renderer->update_surface(d, false, true, true);
 
     pg->surface_shape.clip_y =
         GET_MASK(parameter, NV097_SET_SURFACE_CLIP_VERTICAL_Y);
@@ -1311,7 +1710,7 @@ DEF_METHOD(NV097, SET_SURFACE_CLIP_VERTICAL)
 
 DEF_METHOD(NV097, SET_SURFACE_FORMAT)
 {
-    pgraph_update_surface(d, false, true, true);
+    pg->renderer->update_surface(d, false, true, true);
 
     pg->surface_shape.color_format =
         GET_MASK(parameter, NV097_SET_SURFACE_FORMAT_COLOR);
@@ -1334,7 +1733,7 @@ DEF_METHOD(NV097, SET_SURFACE_FORMAT)
 
 DEF_METHOD(NV097, SET_SURFACE_PITCH)
 {
-    pgraph_update_surface(d, false, true, true);
+    pg->renderer->update_surface(d, false, true, true);
     unsigned int color_pitch = GET_MASK(parameter, NV097_SET_SURFACE_PITCH_COLOR);
     unsigned int zeta_pitch  = GET_MASK(parameter, NV097_SET_SURFACE_PITCH_ZETA);
 
@@ -1347,14 +1746,14 @@ DEF_METHOD(NV097, SET_SURFACE_PITCH)
 
 DEF_METHOD(NV097, SET_SURFACE_COLOR_OFFSET)
 {
-    pgraph_update_surface(d, false, true, true);
+    pg->renderer->update_surface(d, false, true, true);
     pg->surface_color.buffer_dirty |= (pg->surface_color.offset != parameter);
     pg->surface_color.offset = parameter;
 }
 
 DEF_METHOD(NV097, SET_SURFACE_ZETA_OFFSET)
 {
-    pgraph_update_surface(d, false, true, true);
+    pg->renderer->update_surface(d, false, true, true);
     pg->surface_zeta.buffer_dirty |= (pg->surface_zeta.offset != parameter);
     pg->surface_zeta.offset = parameter;
 }
@@ -1383,7 +1782,7 @@ DEF_METHOD(NV097, SET_TEXTURE_ADDRESS)
 
 DEF_METHOD(NV097, SET_CONTROL0)
 {
-    pgraph_update_surface(d, false, true, true);
+    pg->renderer->update_surface(d, false, true, true);
 
     bool stencil_write_enable =
         parameter & NV097_SET_CONTROL0_STENCIL_WRITE_ENABLE;
@@ -2370,6 +2769,8 @@ static void pgraph_process_pending_report(NV2AState *d, QueryReport *r)
     stq_le_p((uint64_t *)&report_data[0], timestamp);
     stl_le_p((uint32_t *)&report_data[8], pg->zpass_pixel_count_result);
     stl_le_p((uint32_t *)&report_data[12], done);
+
+    pgraph_mark_snapshot_dirty(d, report_data - d->vram_ptr, 16);
 }
 
 void pgraph_process_pending_reports(NV2AState *d)
@@ -2428,324 +2829,354 @@ DEF_METHOD_INC(NV097, SET_EYE_DIRECTION)
     pg->ltctxa_dirty[NV_IGRAPH_XF_LTCTXA_EYED] = true;
 }
 
-DEF_METHOD(NV097, SET_BEGIN_END)
+static void pgraph_gl_draw_end(NV2AState *d)
 {
+    PGRAPHState *pg = &d->pgraph;
+
     bool depth_test =
         pg->regs[NV_PGRAPH_CONTROL_0] & NV_PGRAPH_CONTROL_0_ZENABLE;
     bool stencil_test =
         pg->regs[NV_PGRAPH_CONTROL_1] & NV_PGRAPH_CONTROL_1_STENCIL_TEST_ENABLE;
 
-    if (parameter == NV097_SET_BEGIN_END_OP_END) {
+    NV2A_GL_CHECK_ERROR();
+
+    assert(pg->shader_binding);
+
+    if (pg->draw_arrays_length) {
+        NV2A_GL_DPRINTF(false, "Draw Arrays");
+
+        assert(pg->inline_buffer_length == 0);
+        assert(pg->inline_array_length == 0);
+        assert(pg->inline_elements_length == 0);
+
+        pgraph_bind_vertex_attributes(d, pg->draw_arrays_min_start,
+                                      pg->draw_arrays_max_count, false, 0);
+        glMultiDrawArrays(pg->shader_binding->gl_primitive_mode,
+                          pg->gl_draw_arrays_start,
+                          pg->gl_draw_arrays_count,
+                          pg->draw_arrays_length);
+    } else if (pg->inline_buffer_length) {
+        NV2A_GL_DPRINTF(false, "Inline Buffer");
+
+        assert(pg->draw_arrays_length == 0);
+        assert(pg->inline_array_length == 0);
+        assert(pg->inline_elements_length == 0);
+
+        if (pg->compressed_attrs) {
+            pg->compressed_attrs = 0;
+            pgraph_bind_shaders(pg);
+        }
+
+        for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+            VertexAttribute *attr = &pg->vertex_attributes[i];
+            if (attr->inline_buffer_populated) {
+                nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_3);
+                glBindBuffer(GL_ARRAY_BUFFER, attr->gl_inline_buffer);
+                glBufferData(GL_ARRAY_BUFFER,
+                             pg->inline_buffer_length * sizeof(float) * 4,
+                             attr->inline_buffer, GL_STREAM_DRAW);
+                glVertexAttribPointer(i, 4, GL_FLOAT, GL_FALSE, 0, 0);
+                glEnableVertexAttribArray(i);
+                attr->inline_buffer_populated = false;
+            } else {
+                glDisableVertexAttribArray(i);
+                glVertexAttrib4fv(i, attr->inline_value);
+            }
+        }
 
-        nv2a_profile_inc_counter(NV2A_PROF_BEGIN_ENDS);
+        glDrawArrays(pg->shader_binding->gl_primitive_mode,
+                     0, pg->inline_buffer_length);
+    } else if (pg->inline_array_length) {
+        NV2A_GL_DPRINTF(false, "Inline Array");
 
-        assert(pg->shader_binding);
+        assert(pg->draw_arrays_length == 0);
+        assert(pg->inline_buffer_length == 0);
+        assert(pg->inline_elements_length == 0);
 
-        if (pg->draw_arrays_length) {
-            nv2a_profile_inc_counter(NV2A_PROF_DRAW_ARRAYS);
+        unsigned int index_count = pgraph_bind_inline_array(d);
+        glDrawArrays(pg->shader_binding->gl_primitive_mode,
+                     0, index_count);
+    } else if (pg->inline_elements_length) {
+        NV2A_GL_DPRINTF(false, "Inline Elements");
 
-            NV2A_GL_DPRINTF(false, "Draw Arrays");
+        assert(pg->draw_arrays_length == 0);
+        assert(pg->inline_buffer_length == 0);
+        assert(pg->inline_array_length == 0);
 
-            assert(pg->inline_buffer_length == 0);
-            assert(pg->inline_array_length == 0);
-            assert(pg->inline_elements_length == 0);
+        uint32_t min_element = (uint32_t)-1;
+        uint32_t max_element = 0;
+        for (int i=0; i < pg->inline_elements_length; i++) {
+            max_element = MAX(pg->inline_elements[i], max_element);
+            min_element = MIN(pg->inline_elements[i], min_element);
+        }
 
-            pgraph_bind_vertex_attributes(d, pg->draw_arrays_min_start,
-                                          pg->draw_arrays_max_count, false, 0);
-            glMultiDrawArrays(pg->shader_binding->gl_primitive_mode,
-                              pg->gl_draw_arrays_start,
-                              pg->gl_draw_arrays_count,
-                              pg->draw_arrays_length);
-        } else if (pg->inline_buffer_length) {
-            nv2a_profile_inc_counter(NV2A_PROF_INLINE_BUFFERS);
+        pgraph_bind_vertex_attributes(
+            d, min_element, max_element, false, 0);
 
-            NV2A_GL_DPRINTF(false, "Inline Buffer");
+        bool upload;
+        VertexLruNode *found = pgraph_lookup_inline_elements(d, &upload);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, found->gl_buffer);
+        if (upload) {
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                         pg->inline_elements_length * 4,
+                         pg->inline_elements, GL_STATIC_DRAW);
+        }
+        glDrawElements(pg->shader_binding->gl_primitive_mode,
+                       pg->inline_elements_length, GL_UNSIGNED_INT,
+                       (void *)0);
+    } else {
+        NV2A_GL_DPRINTF(true, "EMPTY NV097_SET_BEGIN_END");
+        NV2A_UNCONFIRMED("EMPTY NV097_SET_BEGIN_END");
+    }
 
-            assert(pg->draw_arrays_length == 0);
-            assert(pg->inline_array_length == 0);
-            assert(pg->inline_elements_length == 0);
+    /* End of visibility testing */
+    if (pg->zpass_pixel_count_enable) {
+        nv2a_profile_inc_counter(NV2A_PROF_QUERY);
+        glEndQuery(GL_SAMPLES_PASSED);
+    }
 
-            if (pg->compressed_attrs) {
-                pg->compressed_attrs = 0;
-                pgraph_bind_shaders(pg);
-            }
+    NV2A_GL_DGROUP_END();
 
-            for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
-                VertexAttribute *attr = &pg->vertex_attributes[i];
-                if (attr->inline_buffer_populated) {
-                    nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_3);
-                    glBindBuffer(GL_ARRAY_BUFFER, attr->gl_inline_buffer);
-                    glBufferData(GL_ARRAY_BUFFER,
-                                 pg->inline_buffer_length * sizeof(float) * 4,
-                                 attr->inline_buffer, GL_STREAM_DRAW);
-                    glVertexAttribPointer(i, 4, GL_FLOAT, GL_FALSE, 0, 0);
-                    glEnableVertexAttribArray(i);
-                    attr->inline_buffer_populated = false;
-                } else {
-                    glDisableVertexAttribArray(i);
-                    glVertexAttrib4fv(i, attr->inline_value);
-                }
-            }
+    pgraph_set_surface_dirty(pg, true, depth_test || stencil_test);
+}
 
-            glDrawArrays(pg->shader_binding->gl_primitive_mode,
-                         0, pg->inline_buffer_length);
-        } else if (pg->inline_array_length) {
-            nv2a_profile_inc_counter(NV2A_PROF_INLINE_ARRAYS);
+static void pgraph_gl_draw_begin(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
 
-            NV2A_GL_DPRINTF(false, "Inline Array");
+    bool depth_test =
+        pg->regs[NV_PGRAPH_CONTROL_0] & NV_PGRAPH_CONTROL_0_ZENABLE;
+    bool stencil_test =
+        pg->regs[NV_PGRAPH_CONTROL_1] & NV_PGRAPH_CONTROL_1_STENCIL_TEST_ENABLE;
 
-            assert(pg->draw_arrays_length == 0);
-            assert(pg->inline_buffer_length == 0);
-            assert(pg->inline_elements_length == 0);
+    NV2A_GL_CHECK_ERROR();
+
+    NV2A_GL_DGROUP_BEGIN("NV097_SET_BEGIN_END: 0x%x", pg->primitive_mode);
+
+    pgraph_update_surface(d, true, true, depth_test || stencil_test);
+    assert(pg->color_binding || pg->zeta_binding);
+
+    pgraph_bind_textures(d);
+    pgraph_bind_shaders(pg);
+
+    uint32_t control_0 = pg->regs[NV_PGRAPH_CONTROL_0];
+
+    bool alpha = control_0 & NV_PGRAPH_CONTROL_0_ALPHA_WRITE_ENABLE;
+    bool red = control_0 & NV_PGRAPH_CONTROL_0_RED_WRITE_ENABLE;
+    bool green = control_0 & NV_PGRAPH_CONTROL_0_GREEN_WRITE_ENABLE;
+    bool blue = control_0 & NV_PGRAPH_CONTROL_0_BLUE_WRITE_ENABLE;
+    glColorMask(red, green, blue, alpha);
+    glDepthMask(!!(control_0 & NV_PGRAPH_CONTROL_0_ZWRITEENABLE));
+    glStencilMask(GET_MASK(pg->regs[NV_PGRAPH_CONTROL_1],
+                           NV_PGRAPH_CONTROL_1_STENCIL_MASK_WRITE));
+
+    if (pg->regs[NV_PGRAPH_BLEND] & NV_PGRAPH_BLEND_EN) {
+        glEnable(GL_BLEND);
+        uint32_t sfactor = GET_MASK(pg->regs[NV_PGRAPH_BLEND],
+                                    NV_PGRAPH_BLEND_SFACTOR);
+        uint32_t dfactor = GET_MASK(pg->regs[NV_PGRAPH_BLEND],
+                                    NV_PGRAPH_BLEND_DFACTOR);
+        assert(sfactor < ARRAY_SIZE(pgraph_blend_factor_map));
+        assert(dfactor < ARRAY_SIZE(pgraph_blend_factor_map));
+        glBlendFunc(pgraph_blend_factor_map[sfactor],
+                    pgraph_blend_factor_map[dfactor]);
+
+        uint32_t equation = GET_MASK(pg->regs[NV_PGRAPH_BLEND],
+                                     NV_PGRAPH_BLEND_EQN);
+        assert(equation < ARRAY_SIZE(pgraph_blend_equation_map));
+        glBlendEquation(pgraph_blend_equation_map[equation]);
+
+        uint32_t blend_color = pg->regs[NV_PGRAPH_BLENDCOLOR];
+        glBlendColor( ((blend_color >> 16) & 0xFF) / 255.0f, /* red */
+                      ((blend_color >> 8) & 0xFF) / 255.0f,  /* green */
+                      (blend_color & 0xFF) / 255.0f,         /* blue */
+                      ((blend_color >> 24) & 0xFF) / 255.0f);/* alpha */
+    } else {
+        glDisable(GL_BLEND);
+    }
 
-            unsigned int index_count = pgraph_bind_inline_array(d);
-            glDrawArrays(pg->shader_binding->gl_primitive_mode,
-                         0, index_count);
-        } else if (pg->inline_elements_length) {
-            nv2a_profile_inc_counter(NV2A_PROF_INLINE_ELEMENTS);
+    /* Face culling */
+    if (pg->regs[NV_PGRAPH_SETUPRASTER]
+            & NV_PGRAPH_SETUPRASTER_CULLENABLE) {
+        uint32_t cull_face = GET_MASK(pg->regs[NV_PGRAPH_SETUPRASTER],
+                                      NV_PGRAPH_SETUPRASTER_CULLCTRL);
+        assert(cull_face < ARRAY_SIZE(pgraph_cull_face_map));
+        glCullFace(pgraph_cull_face_map[cull_face]);
+        glEnable(GL_CULL_FACE);
+    } else {
+        glDisable(GL_CULL_FACE);
+    }
 
-            NV2A_GL_DPRINTF(false, "Inline Elements");
+    /* Front-face select */
+    glFrontFace(pg->regs[NV_PGRAPH_SETUPRASTER]
+                    & NV_PGRAPH_SETUPRASTER_FRONTFACE
+                        ? GL_CCW : GL_CW);
 
-            assert(pg->draw_arrays_length == 0);
-            assert(pg->inline_buffer_length == 0);
-            assert(pg->inline_array_length == 0);
+    /* Polygon offset */
+    /* FIXME: GL implementation-specific, maybe do this in VS? */
+    if (pg->regs[NV_PGRAPH_SETUPRASTER] &
+            NV_PGRAPH_SETUPRASTER_POFFSETFILLENABLE) {
+        glEnable(GL_POLYGON_OFFSET_FILL);
+    } else {
+        glDisable(GL_POLYGON_OFFSET_FILL);
+    }
+    if (pg->regs[NV_PGRAPH_SETUPRASTER] &
+            NV_PGRAPH_SETUPRASTER_POFFSETLINEENABLE) {
+        glEnable(GL_POLYGON_OFFSET_LINE);
+    } else {
+        glDisable(GL_POLYGON_OFFSET_LINE);
+    }
+    if (pg->regs[NV_PGRAPH_SETUPRASTER] &
+            NV_PGRAPH_SETUPRASTER_POFFSETPOINTENABLE) {
+        glEnable(GL_POLYGON_OFFSET_POINT);
+    } else {
+        glDisable(GL_POLYGON_OFFSET_POINT);
+    }
+    if (pg->regs[NV_PGRAPH_SETUPRASTER] &
+            (NV_PGRAPH_SETUPRASTER_POFFSETFILLENABLE |
+             NV_PGRAPH_SETUPRASTER_POFFSETLINEENABLE |
+             NV_PGRAPH_SETUPRASTER_POFFSETPOINTENABLE)) {
+        GLfloat zfactor = *(float*)&pg->regs[NV_PGRAPH_ZOFFSETFACTOR];
+        GLfloat zbias = *(float*)&pg->regs[NV_PGRAPH_ZOFFSETBIAS];
+        glPolygonOffset(zfactor, zbias);
+    }
 
-            uint32_t min_element = (uint32_t)-1;
-            uint32_t max_element = 0;
-            for (int i=0; i < pg->inline_elements_length; i++) {
-                max_element = MAX(pg->inline_elements[i], max_element);
-                min_element = MIN(pg->inline_elements[i], min_element);
-            }
+    /* Depth testing */
+    if (depth_test) {
+        glEnable(GL_DEPTH_TEST);
 
-            pgraph_bind_vertex_attributes(
-                d, min_element, max_element, false, 0);
-
-            VertexKey k;
-            memset(&k, 0, sizeof(VertexKey));
-            k.count = pg->inline_elements_length;
-            k.gl_type = GL_UNSIGNED_INT;
-            k.gl_normalize = GL_FALSE;
-            k.stride = sizeof(uint32_t);
-            uint64_t h = fast_hash((uint8_t*)pg->inline_elements,
-                                   pg->inline_elements_length * 4);
-
-            LruNode *node = lru_lookup(&pg->element_cache, h, &k);
-            VertexLruNode *found = container_of(node, VertexLruNode, node);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, found->gl_buffer);
-            if (!found->initialized) {
-                nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_4);
-                glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                             pg->inline_elements_length * 4,
-                             pg->inline_elements, GL_STATIC_DRAW);
-                found->initialized = true;
-            } else {
-                nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_4_NOTDIRTY);
-            }
-            glDrawElements(pg->shader_binding->gl_primitive_mode,
-                           pg->inline_elements_length, GL_UNSIGNED_INT,
-                           (void *)0);
-        } else {
-            NV2A_GL_DPRINTF(true, "EMPTY NV097_SET_BEGIN_END");
-            NV2A_UNCONFIRMED("EMPTY NV097_SET_BEGIN_END");
-        }
+        uint32_t depth_func = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_0],
+                                       NV_PGRAPH_CONTROL_0_ZFUNC);
+        assert(depth_func < ARRAY_SIZE(pgraph_depth_func_map));
+        glDepthFunc(pgraph_depth_func_map[depth_func]);
+    } else {
+        glDisable(GL_DEPTH_TEST);
+    }
+
+    if (stencil_test) {
+        glEnable(GL_STENCIL_TEST);
+
+        uint32_t stencil_func = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_1],
+                                    NV_PGRAPH_CONTROL_1_STENCIL_FUNC);
+        uint32_t stencil_ref = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_1],
+                                    NV_PGRAPH_CONTROL_1_STENCIL_REF);
+        uint32_t func_mask = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_1],
+                                NV_PGRAPH_CONTROL_1_STENCIL_MASK_READ);
+        uint32_t op_fail = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_2],
+                                NV_PGRAPH_CONTROL_2_STENCIL_OP_FAIL);
+        uint32_t op_zfail = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_2],
+                                NV_PGRAPH_CONTROL_2_STENCIL_OP_ZFAIL);
+        uint32_t op_zpass = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_2],
+                                NV_PGRAPH_CONTROL_2_STENCIL_OP_ZPASS);
+
+        assert(stencil_func < ARRAY_SIZE(pgraph_stencil_func_map));
+        assert(op_fail < ARRAY_SIZE(pgraph_stencil_op_map));
+        assert(op_zfail < ARRAY_SIZE(pgraph_stencil_op_map));
+        assert(op_zpass < ARRAY_SIZE(pgraph_stencil_op_map));
+
+        glStencilFunc(
+            pgraph_stencil_func_map[stencil_func],
+            stencil_ref,
+            func_mask);
+
+        glStencilOp(
+            pgraph_stencil_op_map[op_fail],
+            pgraph_stencil_op_map[op_zfail],
+            pgraph_stencil_op_map[op_zpass]);
 
-        /* End of visibility testing */
-        if (pg->zpass_pixel_count_enable) {
-            nv2a_profile_inc_counter(NV2A_PROF_QUERY);
-            glEndQuery(GL_SAMPLES_PASSED);
-        }
+    } else {
+        glDisable(GL_STENCIL_TEST);
+    }
 
-        NV2A_GL_DGROUP_END();
+    /* Dither */
+    /* FIXME: GL implementation dependent */
+    if (pg->regs[NV_PGRAPH_CONTROL_0] &
+            NV_PGRAPH_CONTROL_0_DITHERENABLE) {
+        glEnable(GL_DITHER);
     } else {
-        NV2A_GL_DGROUP_BEGIN("NV097_SET_BEGIN_END: 0x%x", parameter);
-        assert(parameter <= NV097_SET_BEGIN_END_OP_POLYGON);
+        glDisable(GL_DITHER);
+    }
 
-        pgraph_update_surface(d, true, true, depth_test || stencil_test);
-        assert(pg->color_binding || pg->zeta_binding);
+    glEnable(GL_PROGRAM_POINT_SIZE);
 
-        pg->primitive_mode = parameter;
-        pgraph_bind_textures(d);
-        pgraph_bind_shaders(pg);
-
-        uint32_t control_0 = pg->regs[NV_PGRAPH_CONTROL_0];
-
-        bool alpha = control_0 & NV_PGRAPH_CONTROL_0_ALPHA_WRITE_ENABLE;
-        bool red = control_0 & NV_PGRAPH_CONTROL_0_RED_WRITE_ENABLE;
-        bool green = control_0 & NV_PGRAPH_CONTROL_0_GREEN_WRITE_ENABLE;
-        bool blue = control_0 & NV_PGRAPH_CONTROL_0_BLUE_WRITE_ENABLE;
-        glColorMask(red, green, blue, alpha);
-        glDepthMask(!!(control_0 & NV_PGRAPH_CONTROL_0_ZWRITEENABLE));
-        glStencilMask(GET_MASK(pg->regs[NV_PGRAPH_CONTROL_1],
-                               NV_PGRAPH_CONTROL_1_STENCIL_MASK_WRITE));
-
-        if (pg->regs[NV_PGRAPH_BLEND] & NV_PGRAPH_BLEND_EN) {
-            glEnable(GL_BLEND);
-            uint32_t sfactor = GET_MASK(pg->regs[NV_PGRAPH_BLEND],
-                                        NV_PGRAPH_BLEND_SFACTOR);
-            uint32_t dfactor = GET_MASK(pg->regs[NV_PGRAPH_BLEND],
-                                        NV_PGRAPH_BLEND_DFACTOR);
-            assert(sfactor < ARRAY_SIZE(pgraph_blend_factor_map));
-            assert(dfactor < ARRAY_SIZE(pgraph_blend_factor_map));
-            glBlendFunc(pgraph_blend_factor_map[sfactor],
-                        pgraph_blend_factor_map[dfactor]);
-
-            uint32_t equation = GET_MASK(pg->regs[NV_PGRAPH_BLEND],
-                                         NV_PGRAPH_BLEND_EQN);
-            assert(equation < ARRAY_SIZE(pgraph_blend_equation_map));
-            glBlendEquation(pgraph_blend_equation_map[equation]);
-
-            uint32_t blend_color = pg->regs[NV_PGRAPH_BLENDCOLOR];
-            glBlendColor( ((blend_color >> 16) & 0xFF) / 255.0f, /* red */
-                          ((blend_color >> 8) & 0xFF) / 255.0f,  /* green */
-                          (blend_color & 0xFF) / 255.0f,         /* blue */
-                          ((blend_color >> 24) & 0xFF) / 255.0f);/* alpha */
-        } else {
-            glDisable(GL_BLEND);
-        }
+    /* Edge Antialiasing */
+    if (pg->regs[NV_PGRAPH_SETUPRASTER] &
+            NV_PGRAPH_SETUPRASTER_LINESMOOTHENABLE) {
+        glEnable(GL_LINE_SMOOTH);
+    } else {
+        glDisable(GL_LINE_SMOOTH);
+    }
+    if (pg->regs[NV_PGRAPH_SETUPRASTER] &
+            NV_PGRAPH_SETUPRASTER_POLYSMOOTHENABLE) {
+        glEnable(GL_POLYGON_SMOOTH);
+    } else {
+        glDisable(GL_POLYGON_SMOOTH);
+    }
 
-        /* Face culling */
-        if (pg->regs[NV_PGRAPH_SETUPRASTER]
-                & NV_PGRAPH_SETUPRASTER_CULLENABLE) {
-            uint32_t cull_face = GET_MASK(pg->regs[NV_PGRAPH_SETUPRASTER],
-                                          NV_PGRAPH_SETUPRASTER_CULLCTRL);
-            assert(cull_face < ARRAY_SIZE(pgraph_cull_face_map));
-            glCullFace(pgraph_cull_face_map[cull_face]);
-            glEnable(GL_CULL_FACE);
-        } else {
-            glDisable(GL_CULL_FACE);
-        }
+    //glDisableVertexAttribArray(NV2A_VERTEX_ATTR_DIFFUSE);
+    //glVertexAttrib4f(NV2A_VERTEX_ATTR_DIFFUSE, 1.0, 1.0, 1.0, 1.0);
 
-        /* Front-face select */
-        glFrontFace(pg->regs[NV_PGRAPH_SETUPRASTER]
-                        & NV_PGRAPH_SETUPRASTER_FRONTFACE
-                            ? GL_CCW : GL_CW);
+    unsigned int vp_width = pg->surface_binding_dim.width,
+                 vp_height = pg->surface_binding_dim.height;
+    pgraph_apply_scaling_factor(pg, &vp_width, &vp_height);
+    glViewport(0, 0, vp_width, vp_height);
 
-        /* Polygon offset */
-        /* FIXME: GL implementation-specific, maybe do this in VS? */
-        if (pg->regs[NV_PGRAPH_SETUPRASTER] &
-                NV_PGRAPH_SETUPRASTER_POFFSETFILLENABLE) {
-            glEnable(GL_POLYGON_OFFSET_FILL);
-        } else {
-            glDisable(GL_POLYGON_OFFSET_FILL);
-        }
-        if (pg->regs[NV_PGRAPH_SETUPRASTER] &
-                NV_PGRAPH_SETUPRASTER_POFFSETLINEENABLE) {
-            glEnable(GL_POLYGON_OFFSET_LINE);
-        } else {
-            glDisable(GL_POLYGON_OFFSET_LINE);
-        }
-        if (pg->regs[NV_PGRAPH_SETUPRASTER] &
-                NV_PGRAPH_SETUPRASTER_POFFSETPOINTENABLE) {
-            glEnable(GL_POLYGON_OFFSET_POINT);
-        } else {
-            glDisable(GL_POLYGON_OFFSET_POINT);
-        }
-        if (pg->regs[NV_PGRAPH_SETUPRASTER] &
-                (NV_PGRAPH_SETUPRASTER_POFFSETFILLENABLE |
-                 NV_PGRAPH_SETUPRASTER_POFFSETLINEENABLE |
-                 NV_PGRAPH_SETUPRASTER_POFFSETPOINTENABLE)) {
-            GLfloat zfactor = *(float*)&pg->regs[NV_PGRAPH_ZOFFSETFACTOR];
-            GLfloat zbias = *(float*)&pg->regs[NV_PGRAPH_ZOFFSETBIAS];
-            glPolygonOffset(zfactor, zbias);
-        }
+    /* Surface clip */
+    /* FIXME: Consider moving to PSH w/ window clip */
+    unsigned int xmin = pg->surface_shape.clip_x - pg->surface_binding_dim.clip_x,
+                 ymin = pg->surface_shape.clip_y - pg->surface_binding_dim.clip_y;
+    unsigned int xmax = xmin + pg->surface_shape.clip_width - 1,
+                 ymax = ymin + pg->surface_shape.clip_height - 1;
 
-        /* Depth testing */
-        if (depth_test) {
-            glEnable(GL_DEPTH_TEST);
+    unsigned int scissor_width = xmax - xmin + 1,
+                 scissor_height = ymax - ymin + 1;
+    pgraph_apply_anti_aliasing_factor(pg, &xmin, &ymin);
+    pgraph_apply_anti_aliasing_factor(pg, &scissor_width, &scissor_height);
+    ymin = pg->surface_binding_dim.height - (ymin + scissor_height);
+    pgraph_apply_scaling_factor(pg, &xmin, &ymin);
+    pgraph_apply_scaling_factor(pg, &scissor_width, &scissor_height);
 
-            uint32_t depth_func = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_0],
-                                           NV_PGRAPH_CONTROL_0_ZFUNC);
-            assert(depth_func < ARRAY_SIZE(pgraph_depth_func_map));
-            glDepthFunc(pgraph_depth_func_map[depth_func]);
-        } else {
-            glDisable(GL_DEPTH_TEST);
-        }
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(xmin, ymin, scissor_width, scissor_height);
 
-        if (stencil_test) {
-            glEnable(GL_STENCIL_TEST);
-
-            uint32_t stencil_func = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_1],
-                                        NV_PGRAPH_CONTROL_1_STENCIL_FUNC);
-            uint32_t stencil_ref = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_1],
-                                        NV_PGRAPH_CONTROL_1_STENCIL_REF);
-            uint32_t func_mask = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_1],
-                                    NV_PGRAPH_CONTROL_1_STENCIL_MASK_READ);
-            uint32_t op_fail = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_2],
-                                    NV_PGRAPH_CONTROL_2_STENCIL_OP_FAIL);
-            uint32_t op_zfail = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_2],
-                                    NV_PGRAPH_CONTROL_2_STENCIL_OP_ZFAIL);
-            uint32_t op_zpass = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_2],
-                                    NV_PGRAPH_CONTROL_2_STENCIL_OP_ZPASS);
-
-            assert(stencil_func < ARRAY_SIZE(pgraph_stencil_func_map));
-            assert(op_fail < ARRAY_SIZE(pgraph_stencil_op_map));
-            assert(op_zfail < ARRAY_SIZE(pgraph_stencil_op_map));
-            assert(op_zpass < ARRAY_SIZE(pgraph_stencil_op_map));
-
-            glStencilFunc(
-                pgraph_stencil_func_map[stencil_func],
-                stencil_ref,
-                func_mask);
-
-            glStencilOp(
-                pgraph_stencil_op_map[op_fail],
-                pgraph_stencil_op_map[op_zfail],
-                pgraph_stencil_op_map[op_zpass]);
+    /* Visibility testing */
+    if (pg->zpass_pixel_count_enable) {
+        pg->gl_zpass_pixel_count_query_count++;
+        pg->gl_zpass_pixel_count_queries = (GLuint*)g_realloc(
+            pg->gl_zpass_pixel_count_queries,
+            sizeof(GLuint) * pg->gl_zpass_pixel_count_query_count);
 
-        } else {
-            glDisable(GL_STENCIL_TEST);
-        }
+        GLuint gl_query;
+        glGenQueries(1, &gl_query);
+        pg->gl_zpass_pixel_count_queries[
+            pg->gl_zpass_pixel_count_query_count - 1] = gl_query;
+        glBeginQuery(GL_SAMPLES_PASSED, gl_query);
+    }
 
-        /* Dither */
-        /* FIXME: GL implementation dependent */
-        if (pg->regs[NV_PGRAPH_CONTROL_0] &
-                NV_PGRAPH_CONTROL_0_DITHERENABLE) {
-            glEnable(GL_DITHER);
-        } else {
-            glDisable(GL_DITHER);
-        }
+    pgraph_set_surface_dirty(pg, true, depth_test || stencil_test);
+}
 
-        glEnable(GL_PROGRAM_POINT_SIZE);
+DEF_METHOD(NV097, SET_BEGIN_END)
+{
+    if (parameter == NV097_SET_BEGIN_END_OP_END) {
+        nv2a_profile_inc_counter(NV2A_PROF_BEGIN_ENDS);
 
-        /* Edge Antialiasing */
-        if (pg->regs[NV_PGRAPH_SETUPRASTER] &
-                NV_PGRAPH_SETUPRASTER_LINESMOOTHENABLE) {
-            glEnable(GL_LINE_SMOOTH);
-        } else {
-            glDisable(GL_LINE_SMOOTH);
-        }
-        if (pg->regs[NV_PGRAPH_SETUPRASTER] &
-                NV_PGRAPH_SETUPRASTER_POLYSMOOTHENABLE) {
-            glEnable(GL_POLYGON_SMOOTH);
-        } else {
-            glDisable(GL_POLYGON_SMOOTH);
+        if (pg->draw_arrays_length) {
+            nv2a_profile_inc_counter(NV2A_PROF_DRAW_ARRAYS);
+        } else if (pg->inline_buffer_length) {
+            nv2a_profile_inc_counter(NV2A_PROF_INLINE_BUFFERS);
+        } else if (pg->inline_array_length) {
+            nv2a_profile_inc_counter(NV2A_PROF_INLINE_ARRAYS);
+        } else if (pg->inline_elements_length) {
+            nv2a_profile_inc_counter(NV2A_PROF_INLINE_ELEMENTS);
         }
 
-        //glDisableVertexAttribArray(NV2A_VERTEX_ATTR_DIFFUSE);
-        //glVertexAttrib4f(NV2A_VERTEX_ATTR_DIFFUSE, 1.0, 1.0, 1.0, 1.0);
-
-        unsigned int vp_width = pg->surface_binding_dim.width,
-                     vp_height = pg->surface_binding_dim.height;
-        pgraph_apply_scaling_factor(pg, &vp_width, &vp_height);
-        glViewport(0, 0, vp_width, vp_height);
-
-        /* Surface clip */
-        /* FIXME: Consider moving to PSH w/ window clip */
-        unsigned int xmin = pg->surface_shape.clip_x - pg->surface_binding_dim.clip_x,
-                     ymin = pg->surface_shape.clip_y - pg->surface_binding_dim.clip_y;
-        unsigned int xmax = xmin + pg->surface_shape.clip_width - 1,
-                     ymax = ymin + pg->surface_shape.clip_height - 1;
-
-        unsigned int scissor_width = xmax - xmin + 1,
-                     scissor_height = ymax - ymin + 1;
-        pgraph_apply_anti_aliasing_factor(pg, &xmin, &ymin);
-        pgraph_apply_anti_aliasing_factor(pg, &scissor_width, &scissor_height);
-        ymin = pg->surface_binding_dim.height - (ymin + scissor_height);
-        pgraph_apply_scaling_factor(pg, &xmin, &ymin);
-        pgraph_apply_scaling_factor(pg, &scissor_width, &scissor_height);
+        pg->renderer->draw_end(d);
+    } else {
+        assert(parameter <= NV097_SET_BEGIN_END_OP_POLYGON);
+        pg->primitive_mode = parameter;
 
-        glEnable(GL_SCISSOR_TEST);
-        glScissor(xmin, ymin, scissor_width, scissor_height);
+        pg->renderer->draw_begin(d);
 
         pg->inline_elements_length = 0;
         pg->inline_array_length = 0;
@@ -2753,23 +3184,7 @@ DEF_METHOD(NV097, SET_BEGIN_END)
         pg->draw_arrays_length = 0;
         pg->draw_arrays_min_start = -1;
         pg->draw_arrays_max_count = 0;
-
-        /* Visibility testing */
-        if (pg->zpass_pixel_count_enable) {
-            pg->gl_zpass_pixel_count_query_count++;
-            pg->gl_zpass_pixel_count_queries = (GLuint*)g_realloc(
-                pg->gl_zpass_pixel_count_queries,
-                sizeof(GLuint) * pg->gl_zpass_pixel_count_query_count);
-
-            GLuint gl_query;
-            glGenQueries(1, &gl_query);
-            pg->gl_zpass_pixel_count_queries[
-                pg->gl_zpass_pixel_count_query_count - 1] = gl_query;
-            glBeginQuery(GL_SAMPLES_PASSED, gl_query);
-        }
     }
-
-    pgraph_set_surface_dirty(pg, true, depth_test || stencil_test);
 }
 
 DEF_METHOD(NV097, SET_TEXTURE_OFFSET)
@@ -3036,7 +3451,7 @@ DEF_METHOD(NV097, SET_SEMAPHORE_OFFSET)
 
 DEF_METHOD(NV097, BACK_END_WRITE_SEMAPHORE_RELEASE)
 {
-    pgraph_update_surface(d, false, true, true);
+    pg->renderer->update_surface(d, false, true, true);
 
     //qemu_mutex_unlock(&d->pgraph.lock);
     //qemu_mutex_lock_iothread();
@@ -3050,6 +3465,7 @@ DEF_METHOD(NV097, BACK_END_WRITE_SEMAPHORE_RELEASE)
     semaphore_data += semaphore_offset;
 
     stl_le_p((uint32_t*)semaphore_data, parameter);
+    pgraph_mark_snapshot_dirty(d, semaphore_data - d->vram_ptr, 4);
 
     //qemu_mutex_lock(&d->pgraph.lock);
     //qemu_mutex_unlock_iothread();
@@ -3065,8 +3481,12 @@ DEF_METHOD(NV097, SET_COLOR_CLEAR_VALUE)
     pg->regs[NV_PGRAPH_COLORCLEARVALUE] = parameter;
 }
 
-DEF_METHOD(NV097, CLEAR_SURFACE)
+static void pgraph_gl_clear_surface(NV2AState *d, uint32_t parameter)
 {
+    PGRAPHState *pg = &d->pgraph;
+
+    NV2A_GL_CHECK_ERROR();
+
     pg->clearing = true;
 
     NV2A_DPRINTF("---------PRE CLEAR ------\n");
@@ -3258,6 +3678,11 @@ DEF_METHOD(NV097, CLEAR_SURFACE)
     pg->clearing = false;
 }
 
+DEF_METHOD(NV097, CLEAR_SURFACE)
+{
+    pg->renderer->clear_surface(d, parameter);
+}
+
 DEF_METHOD(NV097, SET_CLEAR_RECT_HORIZONTAL)
 {
     pg->regs[NV_PGRAPH_CLEARRECTX] = parameter;
@@ -3378,6 +3803,13 @@ void pgraph_context_switch(NV2AState *d, unsigned int channel_id)
     }
 }
 
+const char *pgraph_kelvin_method_name(unsigned int method)
+{
+    const MethodEntry *entry =
+        pgraph_method_entry(NV_KELVIN_PRIMITIVE, method);
+    return entry ? entry->name : NULL;
+}
+
 static void pgraph_method_log(unsigned int subchannel,
                               unsigned int graphics_class,
                               unsigned int method, uint32_t parameter) {
@@ -3391,25 +3823,10 @@ static void pgraph_method_log(unsigned int subchannel,
     if (method != 0x1800) {
         const char* method_name = NULL;
         uint32_t base = method;
-        // unsigned int nmethod = 0;
-        switch (graphics_class) {
-            case NV_KELVIN_PRIMITIVE: {
-                // nmethod = method | (0x5c << 16);
-                int idx = METHOD_ADDR_TO_INDEX(method);
-                if (idx < ARRAY_SIZE(pgraph_kelvin_methods)) {
-                    method_name = pgraph_kelvin_methods[idx].name;
-                    base = pgraph_kelvin_methods[idx].base;
-                }
-                break;
-            }
-            case NV_CONTEXT_SURFACES_2D:
-                // nmethod = method | (0x6d << 16);
-                break;
-            case NV_CONTEXT_PATTERN:
-                // nmethod = method | (0x68 << 16);
-                break;
-            default:
-                break;
+        const MethodEntry *entry = pgraph_method_entry(graphics_class, method);
+        if (entry) {
+            method_name = entry->name;
+            base = entry->base;
         }
 
         char buf[256];
@@ -3539,6 +3956,11 @@ void pgraph_init(NV2AState *d)
     g_nv2a = d;
     PGRAPHState *pg = &d->pgraph;
 
+    int renderer;
+    xemu_settings_get_enum(XEMU_SETTINGS_DISPLAY_RENDERER, &renderer);
+    pg->renderer = (renderer == DISPLAY_RENDERER_NULL) ? &pgraph_null_renderer
+                                                       : &pgraph_gl_renderer;
+
     pgraph_reload_surface_scale_factor(d);
 
     pg->frame_time = 0;
@@ -3546,38 +3968,14 @@ void pgraph_init(NV2AState *d)
     pg->downloads_pending = false;
 
     qemu_mutex_init(&pg->lock);
-    qemu_event_init(&pg->gl_sync_complete, false);
     qemu_event_init(&pg->downloads_complete, false);
     qemu_event_init(&pg->dirty_surfaces_download_complete, false);
     qemu_event_init(&pg->flush_complete, false);
 
-    /* fire up opengl */
-    glo_set_current(g_nv2a_context_render);
-
-#ifdef DEBUG_NV2A_GL
-    gl_debug_initialize();
-#endif
-
-    /* DXT textures */
-    assert(glo_check_extension("GL_EXT_texture_compression_s3tc"));
-    /*  Internal RGB565 texture format */
-    assert(glo_check_extension("GL_ARB_ES2_compatibility"));
-
-    GLint max_vertex_attributes;
-    glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &max_vertex_attributes);
-    assert(max_vertex_attributes >= NV2A_VERTEXSHADER_ATTRIBUTES);
-
-
-    glGenFramebuffers(1, &pg->gl_framebuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, pg->gl_framebuffer);
-
-    pgraph_init_render_to_texture(d);
     QTAILQ_INIT(&pg->surfaces);
 
     QSIMPLEQ_INIT(&pg->report_queue);
 
-    //glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
-
     // Initialize texture cache
     const size_t texture_cache_size = 512;
     lru_init(&pg->texture_cache);
@@ -3592,14 +3990,9 @@ void pgraph_init(NV2AState *d)
     pg->texture_cache.post_node_evict = texture_cache_entry_post_evict;
 
     // Initialize element cache
-    const size_t element_cache_size = 50*1024;
     lru_init(&pg->element_cache);
-    pg->element_cache_entries = malloc(element_cache_size * sizeof(VertexLruNode));
-    assert(pg->element_cache_entries != NULL);
-    GLuint element_cache_buffers[element_cache_size];
-    glGenBuffers(element_cache_size, element_cache_buffers);
-    for (i = 0; i < element_cache_size; i++) {
-        pg->element_cache_entries[i].gl_buffer = element_cache_buffers[i];
+    pg->element_cache_entries = g_new0(VertexLruNode, NV2A_ELEMENT_CACHE_SIZE);
+    for (i = 0; i < NV2A_ELEMENT_CACHE_SIZE; i++) {
         lru_add_free(&pg->element_cache, &pg->element_cache_entries[i].node);
     }
 
@@ -3610,11 +4003,56 @@ void pgraph_init(NV2AState *d)
 
     for (i=0; i<NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
         VertexAttribute *attribute = &pg->vertex_attributes[i];
-        glGenBuffers(1, &attribute->gl_inline_buffer);
         attribute->inline_buffer = (float*)g_malloc(NV2A_MAX_BATCH_LENGTH
                                               * sizeof(float) * 4);
         attribute->inline_buffer_populated = false;
     }
+
+    pg->renderer->init(d);
+}
+
+static void pgraph_gl_init(NV2AState *d)
+{
+    int i;
+
+    PGRAPHState *pg = &d->pgraph;
+
+    /* fire up opengl */
+    glo_set_current(g_nv2a_context_render);
+
+#ifdef DEBUG_NV2A_GL
+    gl_debug_initialize();
+#endif
+
+    /* DXT textures */
+    assert(glo_check_extension("GL_EXT_texture_compression_s3tc"));
+    /*  Internal RGB565 texture format */
+    assert(glo_check_extension("GL_ARB_ES2_compatibility"));
+
+    GLint max_vertex_attributes;
+    glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &max_vertex_attributes);
+    assert(max_vertex_attributes >= NV2A_VERTEXSHADER_ATTRIBUTES);
+
+
+    glGenFramebuffers(1, &pg->gl_framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, pg->gl_framebuffer);
+
+    pgraph_init_render_to_texture(d);
+    pgraph_init_image_blit(d);
+    pgraph_init_swizzle_cs(d);
+
+    //glPolygonMode( GL_FRONT_AND_BACK, GL_LINE );
+
+    // Buffers for the element cache entries
+    GLuint element_cache_buffers[NV2A_ELEMENT_CACHE_SIZE];
+    glGenBuffers(NV2A_ELEMENT_CACHE_SIZE, element_cache_buffers);
+    for (i = 0; i < NV2A_ELEMENT_CACHE_SIZE; i++) {
+        pg->element_cache_entries[i].gl_buffer = element_cache_buffers[i];
+    }
+
+    for (i=0; i<NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        glGenBuffers(1, &pg->vertex_attributes[i].gl_inline_buffer);
+    }
     glGenBuffers(1, &pg->gl_inline_array_buffer);
 
     glGenBuffers(1, &pg->gl_memory_buffer);
@@ -3625,6 +4063,8 @@ void pgraph_init(NV2AState *d)
     glGenVertexArrays(1, &pg->gl_vertex_array);
     glBindVertexArray(pg->gl_vertex_array);
 
+    pgraph_init_uniform_ring(pg);
+
     assert(glGetError() == GL_NO_ERROR);
 
     glo_set_current(g_nv2a_context_display);
@@ -3633,10 +4073,27 @@ void pgraph_init(NV2AState *d)
     glo_set_current(NULL);
 }
 
+static void pgraph_gl_init_thread(NV2AState *d)
+{
+    glo_set_current(g_nv2a_context_render);
+}
+
 void pgraph_destroy(PGRAPHState *pg)
 {
+    NV2AState *d = container_of(pg, NV2AState, pgraph);
+
     qemu_mutex_destroy(&pg->lock);
 
+    pg->renderer->destroy(d);
+
+    free(pg->texture_cache_entries);
+    g_free(pg->element_cache_entries);
+}
+
+static void pgraph_gl_destroy(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
     glo_set_current(g_nv2a_context_render);
 
     // TODO: clear out surfaces
@@ -3647,13 +4104,79 @@ void pgraph_destroy(PGRAPHState *pg)
 
     // Clear out texture cache
     lru_flush(&pg->texture_cache);
-    free(pg->texture_cache_entries);
 
     glo_set_current(NULL);
     glo_context_destroy(g_nv2a_context_render);
     glo_context_destroy(g_nv2a_context_display);
 }
 
+static void pgraph_gl_finish(NV2AState *d)
+{
+    glFinish();
+}
+
+const PGRAPHRenderer pgraph_gl_renderer = {
+    .name = "opengl",
+    .init = pgraph_gl_init,
+    .destroy = pgraph_gl_destroy,
+    .init_thread = pgraph_gl_init_thread,
+    .flush = pgraph_gl_flush,
+    .update_surface = pgraph_update_surface,
+    .draw_begin = pgraph_gl_draw_begin,
+    .draw_end = pgraph_gl_draw_end,
+    .clear_surface = pgraph_gl_clear_surface,
+    .finish = pgraph_gl_finish,
+};
+
+/* Sized for a few frames of constant churn before the buffer is orphaned */
+#define NV2A_UNIFORM_RING_SIZE (4 * 1024 * 1024)
+
+static void pgraph_init_uniform_ring(PGRAPHState *pg)
+{
+    glGenBuffers(1, &pg->uniform_ring.buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, pg->uniform_ring.buffer);
+    glBufferData(GL_UNIFORM_BUFFER, NV2A_UNIFORM_RING_SIZE, NULL,
+                 GL_STREAM_DRAW);
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT,
+                  &pg->uniform_ring.align);
+    pg->uniform_ring.offset = 0;
+    pg->uniform_blocks_dirty = true;
+}
+
+/*
+ * Copy a constant block into unused space of the ring and bind it. Space is
+ * only handed out once per orphaning of the buffer, so the write never has
+ * to wait for draws that still read older constants.
+ */
+static void pgraph_upload_uniform_block(PGRAPHState *pg, GLuint binding,
+                                        const void *data, size_t size)
+{
+    size_t offset = QEMU_ALIGN_UP(pg->uniform_ring.offset,
+                                  pg->uniform_ring.align);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, pg->uniform_ring.buffer);
+    if (offset + size > NV2A_UNIFORM_RING_SIZE) {
+        glBufferData(GL_UNIFORM_BUFFER, NV2A_UNIFORM_RING_SIZE, NULL,
+                     GL_STREAM_DRAW);
+        offset = 0;
+    }
+
+    void *ptr = glMapBufferRange(GL_UNIFORM_BUFFER, offset, size,
+                                 GL_MAP_WRITE_BIT |
+                                 GL_MAP_INVALIDATE_RANGE_BIT |
+                                 GL_MAP_UNSYNCHRONIZED_BIT);
+    assert(ptr != NULL);
+    memcpy(ptr, data, size);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, pg->uniform_ring.buffer,
+                      offset, size);
+    pg->uniform_ring.offset = offset + size;
+
+    g_nv2a_stats.frame_working.counters[NV2A_PROF_UNIFORM_UPLOAD_BYTES] +=
+        size;
+}
+
 static void pgraph_shader_update_constants(PGRAPHState *pg,
                                            ShaderBinding *binding,
                                            bool binding_changed,
@@ -3661,8 +4184,12 @@ static void pgraph_shader_update_constants(PGRAPHState *pg,
                                            bool fixed_function)
 {
     int i, j;
+    bool uniform_blocks_dirty = pg->uniform_blocks_dirty;
+
+    pg->uniform_blocks_dirty = false;
 
     /* update combiner constants */
+    float psh_constants[9][2][4];
     for (i = 0; i < 9; i++) {
         uint32_t constant[2];
         if (i == 8) {
@@ -3675,18 +4202,21 @@ static void pgraph_shader_update_constants(PGRAPHState *pg,
         }
 
         for (j = 0; j < 2; j++) {
-            GLint loc = binding->psh_constant_loc[i][j];
-            if (loc != -1) {
-                float value[4];
-                value[0] = (float) ((constant[j] >> 16) & 0xFF) / 255.0f;
-                value[1] = (float) ((constant[j] >> 8) & 0xFF) / 255.0f;
-                value[2] = (float) (constant[j] & 0xFF) / 255.0f;
-                value[3] = (float) ((constant[j] >> 24) & 0xFF) / 255.0f;
-
-                glUniform4fv(loc, 1, value);
-            }
+            float *value = psh_constants[i][j];
+            value[0] = (float) ((constant[j] >> 16) & 0xFF) / 255.0f;
+            value[1] = (float) ((constant[j] >> 8) & 0xFF) / 255.0f;
+            value[2] = (float) (constant[j] & 0xFF) / 255.0f;
+            value[3] = (float) ((constant[j] >> 24) & 0xFF) / 255.0f;
         }
     }
+    if (uniform_blocks_dirty ||
+        memcmp(psh_constants, pg->psh_constants_uploaded,
+               sizeof(psh_constants))) {
+        memcpy(pg->psh_constants_uploaded, psh_constants,
+               sizeof(psh_constants));
+        pgraph_upload_uniform_block(pg, NV2A_UBO_PSH_CONSTANTS,
+                                    psh_constants, sizeof(psh_constants));
+    }
     if (binding->alpha_ref_loc != -1) {
         float alpha_ref = GET_MASK(pg->regs[NV_PGRAPH_CONTROL_0],
                                    NV_PGRAPH_CONTROL_0_ALPHAREF) / 255.0;
@@ -3824,21 +4354,30 @@ static void pgraph_shader_update_constants(PGRAPHState *pg,
         }
     }
 
-    /* update vertex program constants */
+    /*
+     * update vertex program constants, shared by all programs through the
+     * VshConstants block
+     */
+    bool vsh_constants_changed = uniform_blocks_dirty;
     for (i=0; i<NV2A_VERTEXSHADER_CONSTANTS; i++) {
-        if (!pg->vsh_constants_dirty[i] && !binding_changed) continue;
-
-        GLint loc = binding->vsh_constant_loc[i];
-        if ((loc != -1) &&
-            memcmp(binding->vsh_constants[i], pg->vsh_constants[i],
-                   sizeof(pg->vsh_constants[1]))) {
-            glUniform4fv(loc, 1, (const GLfloat *)pg->vsh_constants[i]);
-            memcpy(binding->vsh_constants[i], pg->vsh_constants[i],
+        if (!pg->vsh_constants_dirty[i]) continue;
+
+        if (memcmp(pg->vsh_constants_uploaded[i], pg->vsh_constants[i],
+                   sizeof(pg->vsh_constants[i]))) {
+            memcpy(pg->vsh_constants_uploaded[i], pg->vsh_constants[i],
                    sizeof(pg->vsh_constants[i]));
+            vsh_constants_changed = true;
         }
 
         pg->vsh_constants_dirty[i] = false;
     }
+    if (vsh_constants_changed) {
+        memcpy(pg->vsh_constants_uploaded, pg->vsh_constants,
+               sizeof(pg->vsh_constants));
+        pgraph_upload_uniform_block(pg, NV2A_UBO_VSH_CONSTANTS,
+                                    pg->vsh_constants,
+                                    sizeof(pg->vsh_constants));
+    }
 
     if (binding->surface_size_loc != -1) {
         unsigned int aa_width = 1, aa_height = 1;
@@ -4317,6 +4856,67 @@ static void pgraph_init_render_to_texture(NV2AState *d)
     glBindBuffer(GL_ARRAY_BUFFER, pg->s2t_rndr.vbo);
     glBufferData(GL_ARRAY_BUFFER, 0, NULL, GL_STATIC_DRAW);
     glGenFramebuffers(1, &pg->s2t_rndr.fbo);
+
+    glGenTextures(1, &pg->s2t_rndr.flip_tex);
+    pg->s2t_rndr.flip_internal_format = 0;
+    pg->s2t_rndr.flip_width = 0;
+    pg->s2t_rndr.flip_height = 0;
+    glGenBuffers(1, &pg->s2t_rndr.pbo);
+    pg->s2t_rndr.pbo_size = 0;
+}
+
+static void pgraph_init_image_blit(NV2AState *d)
+{
+    struct PGRAPHState *pg = &d->pgraph;
+    const char *vs =
+        "#version 330\n"
+        "void main()\n"
+        "{\n"
+        "    float x = -1.0 + float((gl_VertexID & 1) << 2);\n"
+        "    float y = -1.0 + float((gl_VertexID & 2) << 1);\n"
+        "    gl_Position = vec4(x, y, 0, 1);\n"
+        "}\n";
+    /* NV09F_SET_OPERATION_BLEND_AND, with the CPU path's integer math */
+    const char *fs =
+        "#version 330\n"
+        "uniform sampler2D src_tex;\n"
+        "uniform sampler2D dest_tex;\n"
+        "uniform ivec2 src_offset;\n"
+        "uniform ivec2 dest_offset;\n"
+        "uniform uint beta;\n"
+        "layout(location = 0) out vec4 out_Color;\n"
+        "void main()\n"
+        "{\n"
+        "    ivec2 coord = ivec2(gl_FragCoord.xy);\n"
+        "    vec4 s = texelFetch(src_tex, coord + src_offset, 0);\n"
+        "    vec4 d = texelFetch(dest_tex, coord + dest_offset, 0);\n"
+        "    uvec3 c = (uvec3(round(s.rgb * 255.0)) * beta +\n"
+        "               uvec3(round(d.rgb * 255.0)) * (0x7f80u - beta)) /\n"
+        "              0x7f80u;\n"
+        "    out_Color = vec4(vec3(c & 0xffu) / 255.0, d.a);\n"
+        "}\n";
+
+    pg->blit_rndr.prog = pgraph_compile_shader(vs, fs);
+    glProgramUniform1i(pg->blit_rndr.prog,
+                       glGetUniformLocation(pg->blit_rndr.prog, "src_tex"),
+                       0);
+    glProgramUniform1i(pg->blit_rndr.prog,
+                       glGetUniformLocation(pg->blit_rndr.prog, "dest_tex"),
+                       1);
+    pg->blit_rndr.src_offset_loc =
+        glGetUniformLocation(pg->blit_rndr.prog, "src_offset");
+    pg->blit_rndr.dest_offset_loc =
+        glGetUniformLocation(pg->blit_rndr.prog, "dest_offset");
+    pg->blit_rndr.beta_loc = glGetUniformLocation(pg->blit_rndr.prog, "beta");
+
+    glGenVertexArrays(1, &pg->blit_rndr.vao);
+    glGenFramebuffers(1, &pg->blit_rndr.read_fbo);
+    glGenFramebuffers(1, &pg->blit_rndr.draw_fbo);
+
+    glGenTextures(1, &pg->blit_rndr.dest_copy_tex);
+    pg->blit_rndr.dest_copy_internal_format = 0;
+    pg->blit_rndr.dest_copy_width = 0;
+    pg->blit_rndr.dest_copy_height = 0;
 }
 
 static bool pgraph_surface_to_texture_can_fastpath(SurfaceBinding *surface,
@@ -4380,7 +4980,7 @@ static void pgraph_render_surface_to(NV2AState *d, SurfaceBinding *surface,
                            gl_texture, 0);
     glDrawBuffers(1, draw_buffers);
     assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
-    assert(glGetError() == GL_NO_ERROR);
+    NV2A_GL_CHECK_ERROR();
 
     float color[] = { 0.0f, 0.0f, 0.0f, 0.0f };
     glBindTexture(GL_TEXTURE_2D, surface->gl_buffer);
@@ -4450,6 +5050,126 @@ static void pgraph_render_surface_to_texture_slow(
     glBindTexture(texture->gl_target, texture->gl_texture);
 }
 
+/* Reinterpret the surface bytes as the texture format, exactly like the slow
+ * path does, but without the data ever leaving the GPU: the surface is
+ * flipped into guest row order with a framebuffer blit, read back into a
+ * pixel buffer object and the texture is then specified from that buffer.
+ */
+static bool pgraph_render_surface_to_texture_reinterpret(
+    NV2AState *d, SurfaceBinding *surface, TextureBinding *texture,
+    TextureShape *texture_shape, int texture_unit)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    const ColorFormatInfo *f = &kelvin_color_format_map[texture_shape->color_format];
+    assert(texture_shape->color_format < ARRAY_SIZE(kelvin_color_format_map));
+
+    if (f->gl_format == 0 /* compressed */ ||
+        (texture->gl_target != GL_TEXTURE_2D &&
+         texture->gl_target != GL_TEXTURE_RECTANGLE) ||
+        (surface->pitch % surface->fmt.bytes_per_pixel) != 0) {
+        return false;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_TO_TEX_REINTERPRET);
+
+    unsigned int surface_width = surface->width,
+                 surface_height = surface->height;
+    pgraph_apply_scaling_factor(pg, &surface_width, &surface_height);
+
+    unsigned int width = texture_shape->width,
+                 height = texture_shape->height;
+    pgraph_apply_scaling_factor(pg, &width, &height);
+
+    /* Same row stride as pgraph_download_surface_data_to_buffer */
+    unsigned int row_length = pg->surface_scale_factor * surface->pitch /
+                              surface->fmt.bytes_per_pixel;
+    size_t read_size =
+        (size_t)row_length * surface_height * surface->fmt.bytes_per_pixel;
+    /* Upper bound for any uncompressed format/type pair */
+    size_t upload_size = (size_t)width * height * 4;
+    size_t size = MAX(read_size, upload_size);
+
+    glActiveTexture(GL_TEXTURE0 + texture_unit);
+
+    if (pg->s2t_rndr.flip_width != surface_width ||
+        pg->s2t_rndr.flip_height != surface_height ||
+        pg->s2t_rndr.flip_internal_format != surface->fmt.gl_internal_format) {
+        /* A rectangle texture leaves the unit's 2D binding alone below */
+        // FIXME: Don't query GL for texture binding
+        GLint last_texture_binding;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &last_texture_binding);
+        glBindTexture(GL_TEXTURE_2D, pg->s2t_rndr.flip_tex);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+        glTexImage2D(GL_TEXTURE_2D, 0, surface->fmt.gl_internal_format,
+                     surface_width, surface_height, 0, surface->fmt.gl_format,
+                     surface->fmt.gl_type, NULL);
+        pg->s2t_rndr.flip_width = surface_width;
+        pg->s2t_rndr.flip_height = surface_height;
+        pg->s2t_rndr.flip_internal_format = surface->fmt.gl_internal_format;
+        glBindTexture(GL_TEXTURE_2D, last_texture_binding);
+    }
+
+    GLbitfield mask;
+    if (surface->color) {
+        mask = GL_COLOR_BUFFER_BIT;
+    } else if (surface->fmt.gl_attachment == GL_DEPTH_STENCIL_ATTACHMENT) {
+        mask = GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT;
+    } else {
+        mask = GL_DEPTH_BUFFER_BIT;
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, pg->blit_rndr.read_fbo);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, surface->fmt.gl_attachment,
+                           GL_TEXTURE_2D, surface->gl_buffer, 0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, pg->blit_rndr.draw_fbo);
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, surface->fmt.gl_attachment,
+                           GL_TEXTURE_2D, pg->s2t_rndr.flip_tex, 0);
+    assert(glCheckFramebufferStatus(GL_READ_FRAMEBUFFER) ==
+           GL_FRAMEBUFFER_COMPLETE);
+    assert(glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER) ==
+           GL_FRAMEBUFFER_COMPLETE);
+
+    glDisable(GL_SCISSOR_TEST);
+    glBlitFramebuffer(0, 0, surface_width, surface_height,
+                      0, surface_height, surface_width, 0,
+                      mask, GL_NEAREST);
+
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, surface->fmt.gl_attachment,
+                           GL_TEXTURE_2D, 0, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, pg->blit_rndr.draw_fbo);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pg->s2t_rndr.pbo);
+    if (pg->s2t_rndr.pbo_size < size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_COPY);
+        pg->s2t_rndr.pbo_size = size;
+    }
+
+    GLint rl, pa;
+    glGetIntegerv(GL_PACK_ROW_LENGTH, &rl);
+    glGetIntegerv(GL_PACK_ALIGNMENT, &pa);
+    glPixelStorei(GL_PACK_ROW_LENGTH, row_length);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, surface_width, surface_height, surface->fmt.gl_format,
+                 surface->fmt.gl_type, NULL);
+    glPixelStorei(GL_PACK_ROW_LENGTH, rl);
+    glPixelStorei(GL_PACK_ALIGNMENT, pa);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, surface->fmt.gl_attachment,
+                           GL_TEXTURE_2D, 0, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, pg->gl_framebuffer);
+
+    glBindTexture(texture->gl_target, texture->gl_texture);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pg->s2t_rndr.pbo);
+    glTexImage2D(texture->gl_target, 0, f->gl_internal_format, width, height, 0,
+                 f->gl_format, f->gl_type, NULL);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    return true;
+}
+
 /* Note: This function is intended to be called before PGRAPH configures GL
  * state for rendering; it will configure GL state here but only restore a
  * couple of items.
@@ -4469,8 +5189,11 @@ static void pgraph_render_surface_to_texture(NV2AState *d,
     nv2a_profile_inc_counter(NV2A_PROF_SURF_TO_TEX);
 
     if (!pgraph_surface_to_texture_can_fastpath(surface, texture_shape)) {
-        pgraph_render_surface_to_texture_slow(d, surface, texture,
-                                              texture_shape, texture_unit);
+        if (!pgraph_render_surface_to_texture_reinterpret(
+                d, surface, texture, texture_shape, texture_unit)) {
+            pgraph_render_surface_to_texture_slow(d, surface, texture,
+                                                  texture_shape, texture_unit);
+        }
         return;
     }
 
@@ -4494,25 +5217,19 @@ static void pgraph_render_surface_to_texture(NV2AState *d,
         d->pgraph.shader_binding ? d->pgraph.shader_binding->gl_program : 0);
 }
 
-static void pgraph_gl_fence(void)
-{
-    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
-    int result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
-                                         (GLuint64)(5000000000));
-    assert(result == GL_CONDITION_SATISFIED || result == GL_ALREADY_SIGNALED);
-    glDeleteSync(fence);
-}
-
 static void pgraph_init_display_renderer(NV2AState *d)
 {
     struct PGRAPHState *pg = &d->pgraph;
 
-    glGenTextures(1, &pg->gl_display_buffer);
-    pg->gl_display_buffer_internal_format = 0;
-    pg->gl_display_buffer_width = 0;
-    pg->gl_display_buffer_height = 0;
-    pg->gl_display_buffer_format = 0;
-    pg->gl_display_buffer_type = 0;
+    for (int i = 0; i < NV2A_DISPLAY_BUFFERS; i++) {
+        DisplayBuffer *buf = &pg->display.buffers[i];
+        memset(buf, 0, sizeof(*buf));
+        glGenTextures(1, &buf->gl_texture);
+    }
+    pg->display.write = 0;
+    pg->display.read = 1;
+    pg->display.ready = 2;
+    pg->display.read_valid = false;
 
     const char *vs =
         "#version 330\n"
@@ -4673,7 +5390,8 @@ static void pgraph_render_display_pvideo_overlay(NV2AState *d)
                 out_x, out_y, out_width, out_height);
 }
 
-static void pgraph_render_display(NV2AState *d, SurfaceBinding *surface)
+static void pgraph_render_display(NV2AState *d, SurfaceBinding *surface,
+                                  DisplayBuffer *buf)
 {
     struct PGRAPHState *pg = &d->pgraph;
 
@@ -4687,13 +5405,13 @@ static void pgraph_render_display(NV2AState *d, SurfaceBinding *surface)
 
     glBindFramebuffer(GL_FRAMEBUFFER, d->pgraph.disp_rndr.fbo);
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, pg->gl_display_buffer);
+    glBindTexture(GL_TEXTURE_2D, buf->gl_texture);
     bool recreate = (
-        surface->fmt.gl_internal_format != pg->gl_display_buffer_internal_format
-        || width != pg->gl_display_buffer_width
-        || height != pg->gl_display_buffer_height
-        || surface->fmt.gl_format != pg->gl_display_buffer_format
-        || surface->fmt.gl_type != pg->gl_display_buffer_type
+        surface->fmt.gl_internal_format != buf->internal_format
+        || width != buf->width
+        || height != buf->height
+        || surface->fmt.gl_format != buf->format
+        || surface->fmt.gl_type != buf->type
         );
 
     if (recreate) {
@@ -4708,23 +5426,23 @@ static void pgraph_render_display(NV2AState *d, SurfaceBinding *surface)
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        pg->gl_display_buffer_internal_format = surface->fmt.gl_internal_format;
-        pg->gl_display_buffer_width = width;
-        pg->gl_display_buffer_height = height;
-        pg->gl_display_buffer_format = surface->fmt.gl_format;
-        pg->gl_display_buffer_type = surface->fmt.gl_type;
+        buf->internal_format = surface->fmt.gl_internal_format;
+        buf->width = width;
+        buf->height = height;
+        buf->format = surface->fmt.gl_format;
+        buf->type = surface->fmt.gl_type;
         glTexImage2D(GL_TEXTURE_2D, 0,
-            pg->gl_display_buffer_internal_format,
-            pg->gl_display_buffer_width,
-            pg->gl_display_buffer_height,
+            buf->internal_format,
+            buf->width,
+            buf->height,
             0,
-            pg->gl_display_buffer_format,
-            pg->gl_display_buffer_type,
+            buf->format,
+            buf->type,
             NULL);
     }
 
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-        GL_TEXTURE_2D, pg->gl_display_buffer, 0);
+        GL_TEXTURE_2D, buf->gl_texture, 0);
     GLenum DrawBuffers[1] = {GL_COLOR_ATTACHMENT0};
     glDrawBuffers(1, DrawBuffers);
     assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
@@ -4754,46 +5472,219 @@ static void pgraph_render_display(NV2AState *d, SurfaceBinding *surface)
         GL_TEXTURE_2D, 0, 0);
 }
 
+/* Insert a fence and flush so another context can wait on it */
+static GLsync pgraph_gl_fence_flush(void)
+{
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    return fence;
+}
+
+/* Make the GPU, not this thread, wait for a fence from another context */
+static void pgraph_gl_wait_sync(GLsync *fence)
+{
+    if (*fence) {
+        glWaitSync(*fence, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(*fence);
+        *fence = 0;
+    }
+}
+
+/*
+ * Render the scanned out surface into the display write buffer and publish
+ * it as the latest frame. Neither side blocks: ordering between the render,
+ * display and UI contexts is left to the GPU through fences.
+ */
 void pgraph_gl_sync(NV2AState *d)
 {
+    PGRAPHState *pg = &d->pgraph;
+
     uint32_t pline_offset, pstart_addr, pline_compare;
     d->vga.get_offsets(&d->vga, &pline_offset, &pstart_addr, &pline_compare);
     SurfaceBinding *surface = pgraph_surface_get_within(d, d->pcrtc.start + pline_offset);
     if (surface == NULL) {
-        qemu_event_set(&d->pgraph.gl_sync_complete);
+        qatomic_set(&pg->gl_sync_pending, false);
         return;
     }
 
     /* FIXME: Sanity check surface dimensions */
 
-    /* Wait for queued commands to complete */
+    /* Leave the last frame up if it would be rendered again unchanged. Not
+     * knowable when surfaces are always re-uploaded or the overlay is on. */
+    DisplayKey key;
+    memset(&key, 0, sizeof(key));
+    key.surface = surface;
+    key.gl_buffer = surface->gl_buffer;
+    key.draw_time = surface->draw_time;
+    key.pline_offset = pline_offset;
+    d->vga.get_resolution(&d->vga, &key.width, &key.height);
+    key.scale = pg->surface_scale_factor;
+    bool pvideo = d->pvideo.regs[NV_PVIDEO_BUFFER] & NV_PVIDEO_BUFFER_0_USE;
+    if (tcg_enabled() && !surface->upload_pending && !pvideo &&
+        !memcmp(&key, &pg->display.last_key, sizeof(key))) {
+        qatomic_set(&pg->gl_sync_pending, false);
+        return;
+    }
+    pg->display.last_key = key;
+
     pgraph_upload_surface_data(d, surface, !tcg_enabled());
-    pgraph_gl_fence();
-    assert(glGetError() == GL_NO_ERROR);
+    GLsync rendered = pgraph_gl_fence_flush();
+    NV2A_GL_CHECK_ERROR();
 
-    /* Render framebuffer in display context */
+    /* Render framebuffer in display context, once queued rendering and the
+     * UI's last use of the buffer have completed */
     glo_set_current(g_nv2a_context_display);
-    pgraph_render_display(d, surface);
-    pgraph_gl_fence();
-    assert(glGetError() == GL_NO_ERROR);
+    DisplayBuffer *buf = &pg->display.buffers[pg->display.write];
+    pgraph_gl_wait_sync(&rendered);
+    pgraph_gl_wait_sync(&buf->release_fence);
+    pgraph_render_display(d, surface, buf);
+    buf->fence = pgraph_gl_fence_flush();
+    buf->flip_time = g_nv2a_stats.last_flip_time;
+    NV2A_GL_CHECK_ERROR();
+
+    unsigned int prev = qatomic_xchg(&pg->display.ready,
+                                     pg->display.write |
+                                     NV2A_DISPLAY_BUFFER_FRESH);
+    pg->display.write = prev & NV2A_DISPLAY_BUFFER_INDEX_MASK;
+    if (prev & NV2A_DISPLAY_BUFFER_FRESH) {
+        /* Replaced before the UI picked it up */
+        buf = &pg->display.buffers[pg->display.write];
+        glDeleteSync(buf->fence);
+        buf->fence = 0;
+        qatomic_inc(&pg->display.dropped);
+    }
 
     /* Switch back to original context */
     glo_set_current(g_nv2a_context_render);
 
-    qatomic_set(&d->pgraph.gl_sync_pending, false);
-    qemu_event_set(&d->pgraph.gl_sync_complete);
+    qatomic_set(&pg->gl_sync_pending, false);
 }
 
-const uint8_t *nv2a_get_dac_palette(void)
-{
-    return g_nv2a->puserdac.palette;
+const uint8_t *nv2a_get_dac_palette(void)
+{
+    return g_nv2a->puserdac.palette;
+}
+
+/* The video encoder drives the pixel clock, so the NV2A side of the mode
+ * does not give the refresh rate directly. Go by the number of visible
+ * lines instead: 576 line modes are PAL 50 Hz, everything else (NTSC,
+ * PAL-60 and the HD modes) runs at NTSC field rate. */
+double nv2a_get_refresh_rate(void)
+{
+    NV2AState *d = g_nv2a;
+
+    if (!d) {
+        return 60000.0 / 1001.0;
+    }
+
+    VGACommonState *s = &d->vga;
+    unsigned int height = d->pramdac.fp_vdisplay_end;
+    if (height == 0) {
+        height = s->cr[VGA_CRTC_V_DISP_END] |
+                 ((s->cr[VGA_CRTC_OVERFLOW] & 0x02) << 7) |
+                 ((s->cr[VGA_CRTC_OVERFLOW] & 0x40) << 3);
+    }
+    height += 1;
+
+    if (height == 576 || height == 288) {
+        return 50.0;
+    }
+    return 60000.0 / 1001.0;
+}
+
+void nv2a_capture_frames(const char *path, unsigned int frames)
+{
+    NV2AState *d = g_nv2a;
+
+    qemu_mutex_lock(&d->pgraph.lock);
+    if (!d->pgraph.capture && !d->pgraph.capture_request_path) {
+        d->pgraph.capture_request_path = g_strdup(path);
+        d->pgraph.capture_request_frames = MAX(frames, 1);
+    }
+    qemu_mutex_unlock(&d->pgraph.lock);
+}
+
+/* Writes the translator inputs of every shader generated so far */
+void nv2a_save_shader_corpus(const char *path)
+{
+    PGRAPHState *pg = &g_nv2a->pgraph;
+    ShaderCorpusEntry *entries = NULL;
+    Error *local_err = NULL;
+    GHashTableIter iter;
+    gpointer key;
+    size_t n = 0;
+
+    qemu_mutex_lock(&pg->lock);
+    if (pg->shader_cache) {
+        entries = g_new(ShaderCorpusEntry,
+                        g_hash_table_size(pg->shader_cache));
+        g_hash_table_iter_init(&iter, pg->shader_cache);
+        while (g_hash_table_iter_next(&iter, &key, NULL)) {
+            const ShaderState *state = key;
+            ShaderCorpusEntry *entry = &entries[n++];
+
+            entry->vertex_program = state->vertex_program;
+            entry->z_perspective = state->z_perspective;
+            entry->program_length = state->program_length;
+            memcpy(entry->program_data, state->program_data,
+                   sizeof(entry->program_data));
+            entry->psh = state->psh;
+        }
+    }
+    qemu_mutex_unlock(&pg->lock);
+
+    if (!shader_corpus_save(path, entries, n, &local_err)) {
+        error_report_err(local_err);
+    }
+    g_free(entries);
+}
+
+/*
+ * Called on the UI thread with its context current. Takes the most recently
+ * published display buffer if there is one, otherwise shows the last one
+ * again. Returns NULL until PGRAPH has published its first frame.
+ */
+static DisplayBuffer *pgraph_display_acquire(PGRAPHState *pg, bool *updated)
+{
+    *updated = false;
+
+    if (!(qatomic_read(&pg->display.ready) & NV2A_DISPLAY_BUFFER_FRESH)) {
+        if (pg->display.read_valid) {
+            qatomic_inc(&pg->display.repeated);
+            return &pg->display.buffers[pg->display.read];
+        }
+        return NULL;
+    }
+
+    if (pg->display.read_valid) {
+        DisplayBuffer *old = &pg->display.buffers[pg->display.read];
+        old->release_fence = pgraph_gl_fence_flush();
+    }
+
+    unsigned int ready = qatomic_xchg(&pg->display.ready, pg->display.read);
+    pg->display.read = ready & NV2A_DISPLAY_BUFFER_INDEX_MASK;
+    pg->display.read_valid = true;
+
+    DisplayBuffer *buf = &pg->display.buffers[pg->display.read];
+    pgraph_gl_wait_sync(&buf->fence);
+
+    int64_t now = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+    if (buf->flip_time && now > buf->flip_time) {
+        qatomic_add(&pg->display.latency_us, now - buf->flip_time);
+        qatomic_inc(&pg->display.latency_samples);
+    }
+
+    *updated = true;
+    return buf;
 }
 
-int nv2a_get_framebuffer_surface(void)
+int nv2a_get_framebuffer_surface(int *width, int *height, bool *updated)
 {
     NV2AState *d = g_nv2a;
     PGRAPHState *pg = &d->pgraph;
 
+    *updated = false;
+
     qemu_mutex_lock(&d->pfifo.lock);
     // FIXME: Possible race condition with pgraph, consider lock
     uint32_t pline_offset, pstart_addr, pline_compare;
@@ -4813,13 +5704,20 @@ int nv2a_get_framebuffer_surface(void)
         );
 
     surface->frame_time = pg->frame_time;
-    qemu_event_reset(&d->pgraph.gl_sync_complete);
-    qatomic_set(&pg->gl_sync_pending, true);
-    pfifo_kick(d);
+    if (!qatomic_read(&pg->gl_sync_pending)) {
+        qatomic_set(&pg->gl_sync_pending, true);
+        pfifo_kick(d);
+    }
     qemu_mutex_unlock(&d->pfifo.lock);
-    qemu_event_wait(&d->pgraph.gl_sync_complete);
 
-    return pg->gl_display_buffer;
+    DisplayBuffer *buf = pgraph_display_acquire(pg, updated);
+    if (buf == NULL) {
+        return 0;
+    }
+
+    *width = buf->width;
+    *height = buf->height;
+    return buf->gl_texture;
 }
 
 static bool pgraph_check_surface_to_texture_compatibility(
@@ -5105,6 +6003,388 @@ static void surface_copy_shrink_row(uint8_t *out, uint8_t *in,
 }
 
 
+typedef struct SwizzleCsParams {
+    unsigned int bytes_per_pixel;
+    unsigned int src_width, src_height, src_pitch;
+    bool src_swizzled;
+    unsigned int dst_width, dst_height;
+    bool dst_swizzled;
+    unsigned int downscale, upscale;
+    bool flip;
+} SwizzleCsParams;
+
+static void pgraph_init_swizzle_cs(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    /* Each invocation produces one 32-bit word of the destination buffer,
+     * gathering 1, 2 or 4 texels from the source buffer. Both buffers are
+     * either linear or swizzled, source coordinates are derived from the
+     * destination by scaling and an optional vertical flip.
+     */
+    const char *cs_body =
+        "layout(local_size_x = 64) in;\n"
+        "layout(std430, binding = 0) readonly buffer Src { uint src[]; };\n"
+        "layout(std430, binding = 1) writeonly buffer Dst { uint dst[]; };\n"
+        "uniform uint bytes_per_pixel;\n"
+        "uniform uvec2 src_size;\n"
+        "uniform uint src_pitch;\n"
+        "uniform bool src_swizzled;\n"
+        "uniform uvec2 src_mask;\n"
+        "uniform uvec2 dst_size;\n"
+        "uniform bool dst_swizzled;\n"
+        "uniform uvec2 dst_mask;\n"
+        "uniform uint downscale;\n"
+        "uniform uint upscale;\n"
+        "uniform bool flip;\n"
+        "uint deposit(uint v, uint mask)\n"
+        "{\n"
+        "    uint r = 0u;\n"
+        "    for (uint bit = 1u; mask != 0u; bit <<= 1) {\n"
+        "        uint low = mask & (~mask + 1u);\n"
+        "        if ((v & bit) != 0u) r |= low;\n"
+        "        mask &= mask - 1u;\n"
+        "    }\n"
+        "    return r;\n"
+        "}\n"
+        "uint extract(uint v, uint mask)\n"
+        "{\n"
+        "    uint r = 0u;\n"
+        "    for (uint bit = 1u; mask != 0u; bit <<= 1) {\n"
+        "        uint low = mask & (~mask + 1u);\n"
+        "        if ((v & low) != 0u) r |= bit;\n"
+        "        mask &= mask - 1u;\n"
+        "    }\n"
+        "    return r;\n"
+        "}\n"
+        "void main()\n"
+        "{\n"
+        "    uint word = gl_GlobalInvocationID.x;\n"
+        "    uint texels_per_word = 4u / bytes_per_pixel;\n"
+        "    uint bits = bytes_per_pixel * 8u;\n"
+        "    uint count = dst_size.x * dst_size.y;\n"
+        "    if (word * texels_per_word >= count) return;\n"
+        "    uint result = 0u;\n"
+        "    for (uint t = 0u; t < texels_per_word; t++) {\n"
+        "        uint i = word * texels_per_word + t;\n"
+        "        if (i >= count) break;\n"
+        "        uvec2 p = dst_swizzled\n"
+        "            ? uvec2(extract(i, dst_mask.x), extract(i, dst_mask.y))\n"
+        "            : uvec2(i % dst_size.x, i / dst_size.x);\n"
+        "        p = p * downscale / upscale;\n"
+        "        if (flip) p.y = src_size.y - 1u - p.y;\n"
+        "        uint offset = src_swizzled\n"
+        "            ? (deposit(p.x, src_mask.x) | deposit(p.y, src_mask.y))\n"
+        "                  * bytes_per_pixel\n"
+        "            : p.y * src_pitch + p.x * bytes_per_pixel;\n"
+        "        uint v = bitfieldExtract(src[offset >> 2],\n"
+        "                                 int((offset & 3u) * 8u), int(bits));\n"
+        "        result |= v << (t * bits);\n"
+        "    }\n"
+        "    dst[word] = result;\n"
+        "}\n";
+
+    /* The header has to match the way compute support was found: core
+     * 4.3, or the extensions on top of the 4.0 context xemu requires. The
+     * explicit buffer bindings need GLSL 4.20 or its 420pack extension and
+     * the dispatches are fenced with glMemoryBarrier, which is core in 4.2
+     * or comes with ARB_shader_image_load_store.
+     */
+    const char *cs_header;
+    int gl_version = epoxy_gl_version();
+    if (gl_version >= 43) {
+        cs_header = "#version 430\n";
+    } else if (glo_check_extension("GL_ARB_compute_shader") &&
+               glo_check_extension("GL_ARB_shader_storage_buffer_object") &&
+               (gl_version >= 42 ||
+                (glo_check_extension("GL_ARB_shading_language_420pack") &&
+                 glo_check_extension("GL_ARB_shader_image_load_store")))) {
+        cs_header = gl_version >= 42 ?
+            "#version 420\n"
+            "#extension GL_ARB_compute_shader : require\n"
+            "#extension GL_ARB_shader_storage_buffer_object : require\n" :
+            "#version 400\n"
+            "#extension GL_ARB_compute_shader : require\n"
+            "#extension GL_ARB_shader_storage_buffer_object : require\n"
+            "#extension GL_ARB_shading_language_420pack : require\n";
+    } else {
+        cs_header = NULL;
+    }
+
+    pg->swizzle_cs.available = cs_header != NULL;
+    if (!pg->swizzle_cs.available) {
+        return;
+    }
+
+    const char *cs[] = { cs_header, cs_body };
+    GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+    glShaderSource(shader, ARRAY_SIZE(cs), cs, 0);
+    glCompileShader(shader);
+
+    GLint status;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status) {
+        char err_buf[512];
+        glGetShaderInfoLog(shader, sizeof(err_buf), NULL, err_buf);
+        fprintf(stderr, "nv2a: swizzle compute shader compilation failed: "
+                        "%s\n", err_buf);
+        glDeleteShader(shader);
+        pg->swizzle_cs.available = false;
+        return;
+    }
+
+    GLuint prog = glCreateProgram();
+    glAttachShader(prog, shader);
+    glLinkProgram(prog);
+    glDeleteShader(shader);
+
+    glGetProgramiv(prog, GL_LINK_STATUS, &status);
+    if (!status) {
+        fprintf(stderr, "nv2a: swizzle compute program link failed\n");
+        glDeleteProgram(prog);
+        pg->swizzle_cs.available = false;
+        return;
+    }
+
+    pg->swizzle_cs.prog = prog;
+    pg->swizzle_cs.bytes_per_pixel_loc =
+        glGetUniformLocation(prog, "bytes_per_pixel");
+    pg->swizzle_cs.src_size_loc = glGetUniformLocation(prog, "src_size");
+    pg->swizzle_cs.src_pitch_loc = glGetUniformLocation(prog, "src_pitch");
+    pg->swizzle_cs.src_swizzled_loc =
+        glGetUniformLocation(prog, "src_swizzled");
+    pg->swizzle_cs.src_mask_loc = glGetUniformLocation(prog, "src_mask");
+    pg->swizzle_cs.dst_size_loc = glGetUniformLocation(prog, "dst_size");
+    pg->swizzle_cs.dst_swizzled_loc =
+        glGetUniformLocation(prog, "dst_swizzled");
+    pg->swizzle_cs.dst_mask_loc = glGetUniformLocation(prog, "dst_mask");
+    pg->swizzle_cs.downscale_loc = glGetUniformLocation(prog, "downscale");
+    pg->swizzle_cs.upscale_loc = glGetUniformLocation(prog, "upscale");
+    pg->swizzle_cs.flip_loc = glGetUniformLocation(prog, "flip");
+
+    glGenBuffers(2, pg->swizzle_cs.buffers);
+    pg->swizzle_cs.buffer_size[0] = 0;
+    pg->swizzle_cs.buffer_size[1] = 0;
+}
+
+static bool pgraph_swizzle_cs_usable(PGRAPHState *pg,
+                                     SurfaceBinding *surface, bool swizzle)
+{
+    unsigned int bpp = surface->fmt.bytes_per_pixel;
+
+    if (!pg->swizzle_cs.available) {
+        return false;
+    }
+    if (bpp != 1 && bpp != 2 && bpp != 4) {
+        return false;
+    }
+    /* Swizzled layouts are only well defined for power-of-two sizes */
+    if (swizzle && (!is_power_of_2(surface->width) ||
+                    !is_power_of_2(surface->height))) {
+        return false;
+    }
+    return (surface->pitch % bpp) == 0;
+}
+
+static void pgraph_swizzle_cs_reserve(PGRAPHState *pg, int index, size_t size)
+{
+    size = ROUND_UP(size, 4);
+    if (pg->swizzle_cs.buffer_size[index] < size) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, pg->swizzle_cs.buffers[index]);
+        glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_COPY);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        pg->swizzle_cs.buffer_size[index] = size;
+    }
+}
+
+/* Remap buffers[0] into buffers[1] according to p */
+static void pgraph_swizzle_cs_dispatch(PGRAPHState *pg,
+                                       const SwizzleCsParams *p)
+{
+    GLuint prog = pg->swizzle_cs.prog;
+    uint32_t src_mask_x = 0, src_mask_y = 0, dst_mask_x = 0, dst_mask_y = 0;
+    uint32_t unused;
+
+    if (p->src_swizzled) {
+        generate_swizzle_masks(p->src_width, p->src_height, 1,
+                               &src_mask_x, &src_mask_y, &unused);
+    }
+    if (p->dst_swizzled) {
+        generate_swizzle_masks(p->dst_width, p->dst_height, 1,
+                               &dst_mask_x, &dst_mask_y, &unused);
+    }
+
+    glProgramUniform1ui(prog, pg->swizzle_cs.bytes_per_pixel_loc,
+                        p->bytes_per_pixel);
+    glProgramUniform2ui(prog, pg->swizzle_cs.src_size_loc,
+                        p->src_width, p->src_height);
+    glProgramUniform1ui(prog, pg->swizzle_cs.src_pitch_loc, p->src_pitch);
+    glProgramUniform1i(prog, pg->swizzle_cs.src_swizzled_loc,
+                       p->src_swizzled);
+    glProgramUniform2ui(prog, pg->swizzle_cs.src_mask_loc,
+                        src_mask_x, src_mask_y);
+    glProgramUniform2ui(prog, pg->swizzle_cs.dst_size_loc,
+                        p->dst_width, p->dst_height);
+    glProgramUniform1i(prog, pg->swizzle_cs.dst_swizzled_loc,
+                       p->dst_swizzled);
+    glProgramUniform2ui(prog, pg->swizzle_cs.dst_mask_loc,
+                        dst_mask_x, dst_mask_y);
+    glProgramUniform1ui(prog, pg->swizzle_cs.downscale_loc, p->downscale);
+    glProgramUniform1ui(prog, pg->swizzle_cs.upscale_loc, p->upscale);
+    glProgramUniform1i(prog, pg->swizzle_cs.flip_loc, p->flip);
+
+    size_t dst_words = DIV_ROUND_UP(
+        (size_t)p->dst_width * p->dst_height * p->bytes_per_pixel, 4);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, pg->swizzle_cs.buffers[0]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, pg->swizzle_cs.buffers[1]);
+    glUseProgram(prog);
+    glDispatchCompute(DIV_ROUND_UP(dst_words, 64), 1, 1);
+    glUseProgram(pg->shader_binding ? pg->shader_binding->gl_program : 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, 0);
+}
+
+/* Download path for pgraph_download_surface_data_to_buffer: read the
+ * surface into a pixel buffer object and let a compute shader flip, shrink
+ * and swizzle it, so only the final guest-sized image crosses the bus.
+ * Expects the surface to be attached to the current framebuffer.
+ */
+static bool pgraph_download_surface_data_cs(NV2AState *d,
+                                            SurfaceBinding *surface,
+                                            bool swizzle, bool flip,
+                                            bool downscale, uint8_t *pixels)
+{
+    PGRAPHState *pg = &d->pgraph;
+    unsigned int bpp = surface->fmt.bytes_per_pixel;
+
+    if (!pgraph_swizzle_cs_usable(pg, surface, swizzle) ||
+        (pg->surface_scale_factor != 1 && !downscale)) {
+        return false;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_SWIZZLE_CS);
+
+    unsigned int scale = pg->surface_scale_factor;
+    unsigned int src_width = surface->width * scale;
+    unsigned int src_height = surface->height * scale;
+
+    pgraph_swizzle_cs_reserve(pg, 0, (size_t)src_width * src_height * bpp);
+    pgraph_swizzle_cs_reserve(pg, 1, (size_t)surface->width * surface->height
+                                     * bpp);
+
+    GLint rl, pa;
+    glGetIntegerv(GL_PACK_ROW_LENGTH, &rl);
+    glGetIntegerv(GL_PACK_ALIGNMENT, &pa);
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pg->swizzle_cs.buffers[0]);
+    glReadPixels(0, 0, src_width, src_height, surface->fmt.gl_format,
+                 surface->fmt.gl_type, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glPixelStorei(GL_PACK_ROW_LENGTH, rl);
+    glPixelStorei(GL_PACK_ALIGNMENT, pa);
+
+    SwizzleCsParams params = {
+        .bytes_per_pixel = bpp,
+        .src_width = src_width,
+        .src_height = src_height,
+        .src_pitch = src_width * bpp,
+        .src_swizzled = false,
+        .dst_width = surface->width,
+        .dst_height = surface->height,
+        .dst_swizzled = swizzle,
+        .downscale = scale,
+        .upscale = 1,
+        .flip = flip,
+    };
+    pgraph_swizzle_cs_dispatch(pg, &params);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    size_t row_size = surface->width * bpp;
+    size_t size = row_size * surface->height;
+
+    glBindBuffer(GL_COPY_READ_BUFFER, pg->swizzle_cs.buffers[1]);
+    const uint8_t *out = glMapBufferRange(GL_COPY_READ_BUFFER, 0, size,
+                                          GL_MAP_READ_BIT);
+    assert(out != NULL);
+    if (swizzle || surface->pitch == row_size) {
+        memcpy(pixels, out, size);
+    } else {
+        for (unsigned int y = 0; y < surface->height; y++) {
+            memcpy(pixels + y * surface->pitch, out + y * row_size, row_size);
+        }
+    }
+    glUnmapBuffer(GL_COPY_READ_BUFFER);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    return true;
+}
+
+/* Upload path for pgraph_upload_surface_data: the raw (possibly swizzled)
+ * guest image is copied to the GPU as-is and a compute shader unswizzles,
+ * flips and expands it straight into the buffer the texture is specified
+ * from.
+ */
+static bool pgraph_upload_surface_data_cs(NV2AState *d,
+                                          SurfaceBinding *surface)
+{
+    PGRAPHState *pg = &d->pgraph;
+    unsigned int bpp = surface->fmt.bytes_per_pixel;
+
+    if (!pgraph_swizzle_cs_usable(pg, surface, surface->swizzle)) {
+        return false;
+    }
+
+    nv2a_profile_inc_counter(NV2A_PROF_SURF_SWIZZLE_CS);
+
+    unsigned int scale = pg->surface_scale_factor;
+    unsigned int width = surface->width * scale;
+    unsigned int height = surface->height * scale;
+
+    size_t src_size = surface->swizzle
+        ? (size_t)surface->width * surface->height * bpp
+        : (size_t)(surface->height - 1) * surface->pitch
+              + surface->width * bpp;
+
+    pgraph_swizzle_cs_reserve(pg, 0, src_size);
+    pgraph_swizzle_cs_reserve(pg, 1, (size_t)width * height * bpp);
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, pg->swizzle_cs.buffers[0]);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, 0, src_size,
+                    d->vram_ptr + surface->vram_addr);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    SwizzleCsParams params = {
+        .bytes_per_pixel = bpp,
+        .src_width = surface->width,
+        .src_height = surface->height,
+        .src_pitch = surface->pitch,
+        .src_swizzled = surface->swizzle,
+        .dst_width = width,
+        .dst_height = height,
+        .dst_swizzled = false,
+        .downscale = 1,
+        .upscale = scale,
+        .flip = true,
+    };
+    pgraph_swizzle_cs_dispatch(pg, &params);
+    glMemoryBarrier(GL_PIXEL_BUFFER_BARRIER_BIT);
+
+    GLint ua;
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &ua);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pg->swizzle_cs.buffers[1]);
+    glBindTexture(GL_TEXTURE_2D, surface->gl_buffer);
+    glTexImage2D(GL_TEXTURE_2D, 0, surface->fmt.gl_internal_format, width,
+                 height, 0, surface->fmt.gl_format, surface->fmt.gl_type,
+                 NULL);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, ua);
+
+    return true;
+}
+
 static void pgraph_download_surface_data_to_buffer(NV2AState *d,
                                                    SurfaceBinding *surface,
                                                    bool swizzle, bool flip,
@@ -5135,6 +6415,14 @@ static void pgraph_download_surface_data_to_buffer(NV2AState *d,
 
     assert(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
 
+    if (pgraph_download_surface_data_cs(d, surface, swizzle, flip, downscale,
+                                        pixels)) {
+        glFramebufferTexture2D(GL_FRAMEBUFFER, surface->fmt.gl_attachment,
+                               GL_TEXTURE_2D, 0, 0);
+        pgraph_bind_current_surface(d);
+        return;
+    }
+
     /* Read surface into memory */
     uint8_t *gl_read_buf = pixels;
 
@@ -5208,6 +6496,8 @@ static void pgraph_download_surface_data(NV2AState *d, SurfaceBinding *surface,
     memory_region_set_client_dirty(d->vram, surface->vram_addr,
                                    surface->pitch * surface->height,
                                    DIRTY_MEMORY_NV2A_TEX);
+    pgraph_mark_snapshot_dirty(d, surface->vram_addr,
+                               surface->pitch * surface->height);
 
     surface->download_pending = false;
     surface->draw_dirty = false;
@@ -5295,6 +6585,7 @@ static void pgraph_upload_surface_data(NV2AState *d, SurfaceBinding *surface,
     }
 
     nv2a_profile_inc_counter(NV2A_PROF_SURF_UPLOAD);
+    pgraph_capture_touch(d, surface->vram_addr, surface->size);
 
     NV2A_XPRINTF(DBG_SURFACE_SYNC,
                  "[RAM->GPU] %s (%s) surface @ %" HWADDR_PRIx
@@ -5320,6 +6611,12 @@ static void pgraph_upload_surface_data(NV2AState *d, SurfaceBinding *surface,
     glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
                            GL_TEXTURE_2D, 0, 0);
 
+    if (pgraph_upload_surface_data_cs(d, surface)) {
+        glBindTexture(GL_TEXTURE_2D, last_texture_binding);
+        pgraph_bind_current_surface(d);
+        return;
+    }
+
     uint8_t *data = d->vram_ptr;
     uint8_t *buf = data + surface->vram_addr;
 
@@ -5782,7 +7079,7 @@ static void pgraph_mark_textures_possibly_dirty_visitor(Lru *lru, LruNode *node,
         (struct pgraph_texture_possibly_dirty_struct *)opaque;
 
     struct TextureLruNode *tnode = container_of(node, TextureLruNode, node);
-    if (tnode->binding == NULL || tnode->possibly_dirty) {
+    if (!tnode->populated || tnode->possibly_dirty) {
         return;
     }
 
@@ -5826,349 +7123,427 @@ static bool pgraph_check_texture_dirty(NV2AState *d, hwaddr addr, hwaddr size)
                                               DIRTY_MEMORY_NV2A_TEX);
 }
 
-static void pgraph_bind_textures(NV2AState *d)
+/* Renderer independent half of binding texture unit i. Decodes the unit's
+ * registers, writes back the surfaces the texture overlaps and looks it up
+ * in the texture cache, counting the bind and any upload the renderer has to
+ * do. bound says whether the renderer has a texture bound to the unit; if it
+ * has and the registers haven't changed, nothing is looked up.
+ */
+PGRAPHTextureLookup pgraph_lookup_texture(NV2AState *d, int i, bool bound,
+                                          TextureLookup *t)
 {
-    int i;
     PGRAPHState *pg = &d->pgraph;
 
-    NV2A_GL_DGROUP_BEGIN("%s", __func__);
-
-    for (i=0; i<NV2A_MAX_TEXTURES; i++) {
-
-        uint32_t ctl_0 = pg->regs[NV_PGRAPH_TEXCTL0_0 + i*4];
-        uint32_t ctl_1 = pg->regs[NV_PGRAPH_TEXCTL1_0 + i*4];
-        uint32_t fmt = pg->regs[NV_PGRAPH_TEXFMT0 + i*4];
-        uint32_t filter = pg->regs[NV_PGRAPH_TEXFILTER0 + i*4];
-        uint32_t address =  pg->regs[NV_PGRAPH_TEXADDRESS0 + i*4];
-        uint32_t palette =  pg->regs[NV_PGRAPH_TEXPALETTE0 + i*4];
-
-        bool enabled = GET_MASK(ctl_0, NV_PGRAPH_TEXCTL0_0_ENABLE);
-        unsigned int min_mipmap_level =
-            GET_MASK(ctl_0, NV_PGRAPH_TEXCTL0_0_MIN_LOD_CLAMP);
-        unsigned int max_mipmap_level =
-            GET_MASK(ctl_0, NV_PGRAPH_TEXCTL0_0_MAX_LOD_CLAMP);
-
-        unsigned int pitch =
-            GET_MASK(ctl_1, NV_PGRAPH_TEXCTL1_0_IMAGE_PITCH);
-
-        unsigned int dma_select =
-            GET_MASK(fmt, NV_PGRAPH_TEXFMT0_CONTEXT_DMA);
-        bool cubemap =
-            GET_MASK(fmt, NV_PGRAPH_TEXFMT0_CUBEMAPENABLE);
-        unsigned int dimensionality =
-            GET_MASK(fmt, NV_PGRAPH_TEXFMT0_DIMENSIONALITY);
-        unsigned int color_format = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_COLOR);
-        unsigned int levels = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_MIPMAP_LEVELS);
-        unsigned int log_width = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_BASE_SIZE_U);
-        unsigned int log_height = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_BASE_SIZE_V);
-        unsigned int log_depth = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_BASE_SIZE_P);
-
-        unsigned int rect_width =
-            GET_MASK(pg->regs[NV_PGRAPH_TEXIMAGERECT0 + i*4],
-                     NV_PGRAPH_TEXIMAGERECT0_WIDTH);
-        unsigned int rect_height =
-            GET_MASK(pg->regs[NV_PGRAPH_TEXIMAGERECT0 + i*4],
-                     NV_PGRAPH_TEXIMAGERECT0_HEIGHT);
-#ifdef DEBUG_NV2A
-        unsigned int lod_bias =
-            GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MIPMAP_LOD_BIAS);
-#endif
-        unsigned int min_filter = GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MIN);
-        unsigned int mag_filter = GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MAG);
+    if (!GET_MASK(pg->regs[NV_PGRAPH_TEXCTL0_0 + i*4],
+                  NV_PGRAPH_TEXCTL0_0_ENABLE)) {
+        return PGRAPH_TEXTURE_DISABLED;
+    }
 
-        unsigned int addru = GET_MASK(address, NV_PGRAPH_TEXADDRESS0_ADDRU);
-        unsigned int addrv = GET_MASK(address, NV_PGRAPH_TEXADDRESS0_ADDRV);
-        unsigned int addrp = GET_MASK(address, NV_PGRAPH_TEXADDRESS0_ADDRP);
+    nv2a_profile_inc_counter(NV2A_PROF_TEX_BIND);
 
-        unsigned int border_source = GET_MASK(fmt,
-                                              NV_PGRAPH_TEXFMT0_BORDER_SOURCE);
-        uint32_t border_color = pg->regs[NV_PGRAPH_BORDERCOLOR0 + i*4];
+    if (!pg->texture_dirty[i] && bound) {
+        return PGRAPH_TEXTURE_UNCHANGED;
+    }
+    pg->texture_dirty[i] = false;
 
-        hwaddr offset = pg->regs[NV_PGRAPH_TEXOFFSET0 + i*4];
-
-        bool palette_dma_select =
-            GET_MASK(palette, NV_PGRAPH_TEXPALETTE0_CONTEXT_DMA);
-        unsigned int palette_length_index =
-            GET_MASK(palette, NV_PGRAPH_TEXPALETTE0_LENGTH);
-        unsigned int palette_offset =
-            palette & NV_PGRAPH_TEXPALETTE0_OFFSET;
-
-        unsigned int palette_length = 0;
-        switch (palette_length_index) {
-        case NV_PGRAPH_TEXPALETTE0_LENGTH_256: palette_length = 256; break;
-        case NV_PGRAPH_TEXPALETTE0_LENGTH_128: palette_length = 128; break;
-        case NV_PGRAPH_TEXPALETTE0_LENGTH_64: palette_length = 64; break;
-        case NV_PGRAPH_TEXPALETTE0_LENGTH_32: palette_length = 32; break;
-        default: assert(false); break;
-        }
+    uint32_t ctl_0 = pg->regs[NV_PGRAPH_TEXCTL0_0 + i*4];
+    uint32_t ctl_1 = pg->regs[NV_PGRAPH_TEXCTL1_0 + i*4];
+    uint32_t fmt = pg->regs[NV_PGRAPH_TEXFMT0 + i*4];
+    uint32_t filter = pg->regs[NV_PGRAPH_TEXFILTER0 + i*4];
+    uint32_t palette =  pg->regs[NV_PGRAPH_TEXPALETTE0 + i*4];
 
-        /* Check for unsupported features */
-        if (filter & NV_PGRAPH_TEXFILTER0_ASIGNED) NV2A_UNIMPLEMENTED("NV_PGRAPH_TEXFILTER0_ASIGNED");
-        if (filter & NV_PGRAPH_TEXFILTER0_RSIGNED) NV2A_UNIMPLEMENTED("NV_PGRAPH_TEXFILTER0_RSIGNED");
-        if (filter & NV_PGRAPH_TEXFILTER0_GSIGNED) NV2A_UNIMPLEMENTED("NV_PGRAPH_TEXFILTER0_GSIGNED");
-        if (filter & NV_PGRAPH_TEXFILTER0_BSIGNED) NV2A_UNIMPLEMENTED("NV_PGRAPH_TEXFILTER0_BSIGNED");
+    unsigned int min_mipmap_level =
+        GET_MASK(ctl_0, NV_PGRAPH_TEXCTL0_0_MIN_LOD_CLAMP);
+    unsigned int max_mipmap_level =
+        GET_MASK(ctl_0, NV_PGRAPH_TEXCTL0_0_MAX_LOD_CLAMP);
 
-        glActiveTexture(GL_TEXTURE0 + i);
-        if (!enabled) {
-            glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-            glBindTexture(GL_TEXTURE_RECTANGLE, 0);
-            glBindTexture(GL_TEXTURE_1D, 0);
-            glBindTexture(GL_TEXTURE_2D, 0);
-            glBindTexture(GL_TEXTURE_3D, 0);
-            continue;
-        }
+    unsigned int pitch =
+        GET_MASK(ctl_1, NV_PGRAPH_TEXCTL1_0_IMAGE_PITCH);
 
-        nv2a_profile_inc_counter(NV2A_PROF_TEX_BIND);
+    unsigned int dma_select =
+        GET_MASK(fmt, NV_PGRAPH_TEXFMT0_CONTEXT_DMA);
+    bool cubemap =
+        GET_MASK(fmt, NV_PGRAPH_TEXFMT0_CUBEMAPENABLE);
+    unsigned int dimensionality =
+        GET_MASK(fmt, NV_PGRAPH_TEXFMT0_DIMENSIONALITY);
+    unsigned int color_format = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_COLOR);
+    unsigned int levels = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_MIPMAP_LEVELS);
+    unsigned int log_width = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_BASE_SIZE_U);
+    unsigned int log_height = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_BASE_SIZE_V);
+    unsigned int log_depth = GET_MASK(fmt, NV_PGRAPH_TEXFMT0_BASE_SIZE_P);
+
+    unsigned int rect_width =
+        GET_MASK(pg->regs[NV_PGRAPH_TEXIMAGERECT0 + i*4],
+                 NV_PGRAPH_TEXIMAGERECT0_WIDTH);
+    unsigned int rect_height =
+        GET_MASK(pg->regs[NV_PGRAPH_TEXIMAGERECT0 + i*4],
+                 NV_PGRAPH_TEXIMAGERECT0_HEIGHT);
+#ifdef DEBUG_NV2A
+    unsigned int lod_bias =
+        GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MIPMAP_LOD_BIAS);
+    unsigned int min_filter = GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MIN);
+    unsigned int mag_filter = GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MAG);
+#endif
 
-        if (!pg->texture_dirty[i] && pg->texture_binding[i]) {
-            glBindTexture(pg->texture_binding[i]->gl_target,
-                          pg->texture_binding[i]->gl_texture);
-            continue;
+    hwaddr offset = pg->regs[NV_PGRAPH_TEXOFFSET0 + i*4];
+
+    bool palette_dma_select =
+        GET_MASK(palette, NV_PGRAPH_TEXPALETTE0_CONTEXT_DMA);
+    unsigned int palette_length_index =
+        GET_MASK(palette, NV_PGRAPH_TEXPALETTE0_LENGTH);
+    unsigned int palette_offset =
+        palette & NV_PGRAPH_TEXPALETTE0_OFFSET;
+
+    unsigned int palette_length = 0;
+    switch (palette_length_index) {
+    case NV_PGRAPH_TEXPALETTE0_LENGTH_256: palette_length = 256; break;
+    case NV_PGRAPH_TEXPALETTE0_LENGTH_128: palette_length = 128; break;
+    case NV_PGRAPH_TEXPALETTE0_LENGTH_64: palette_length = 64; break;
+    case NV_PGRAPH_TEXPALETTE0_LENGTH_32: palette_length = 32; break;
+    default: assert(false); break;
+    }
+
+    /* Check for unsupported features */
+    if (filter & NV_PGRAPH_TEXFILTER0_ASIGNED) NV2A_UNIMPLEMENTED("NV_PGRAPH_TEXFILTER0_ASIGNED");
+    if (filter & NV_PGRAPH_TEXFILTER0_RSIGNED) NV2A_UNIMPLEMENTED("NV_PGRAPH_TEXFILTER0_RSIGNED");
+    if (filter & NV_PGRAPH_TEXFILTER0_GSIGNED) NV2A_UNIMPLEMENTED("NV_PGRAPH_TEXFILTER0_GSIGNED");
+    if (filter & NV_PGRAPH_TEXFILTER0_BSIGNED) NV2A_UNIMPLEMENTED("NV_PGRAPH_TEXFILTER0_BSIGNED");
+
+    NV2A_DPRINTF(" texture %d is format 0x%x, "
+                    "off 0x%" HWADDR_PRIx " (r %d, %d or %d, %d, %d; %d%s),"
+                    " filter %x %x, levels %d-%d %d bias %d\n",
+                 i, color_format, offset,
+                 rect_width, rect_height,
+                 1 << log_width, 1 << log_height, 1 << log_depth,
+                 pitch,
+                 cubemap ? "; cubemap" : "",
+                 min_filter, mag_filter,
+                 min_mipmap_level, max_mipmap_level, levels,
+                 lod_bias);
+
+    assert(color_format < ARRAY_SIZE(kelvin_color_format_map));
+    ColorFormatInfo f = kelvin_color_format_map[color_format];
+    if (f.bytes_per_pixel == 0) {
+        fprintf(stderr, "nv2a: unimplemented texture color format 0x%x\n",
+                color_format);
+        abort();
+    }
+
+    unsigned int width, height, depth;
+    if (f.linear) {
+        assert(dimensionality == 2);
+        width = rect_width;
+        height = rect_height;
+        depth = 1;
+    } else {
+        width = 1 << log_width;
+        height = 1 << log_height;
+        depth = 1 << log_depth;
+        pitch = 0;
+
+        /* FIXME: What about 3D mipmaps? */
+        levels = MIN(levels, max_mipmap_level + 1);
+        if (f.gl_format != 0) {
+            /* Discard mipmap levels that would be smaller than 1x1.
+             * FIXME: Is this actually needed?
+             *
+             * >> Level 0: 32 x 4
+             *    Level 1: 16 x 2
+             *    Level 2: 8 x 1
+             *    Level 3: 4 x 1
+             *    Level 4: 2 x 1
+             *    Level 5: 1 x 1
+             */
+            levels = MIN(levels, MAX(log_width, log_height) + 1);
+        } else {
+            /* OpenGL requires DXT textures to always have a width and
+             * height a multiple of 4. The Xbox and DirectX handles DXT
+             * textures smaller than 4 by padding the reset of the block.
+             *
+             * See:
+             * https://msdn.microsoft.com/en-us/library/windows/desktop/bb204843(v=vs.85).aspx
+             * https://msdn.microsoft.com/en-us/library/windows/desktop/bb694531%28v=vs.85%29.aspx#Virtual_Size
+             *
+             * Work around this for now by discarding mipmap levels that
+             * would result in too-small textures. A correct solution
+             * will be to decompress these levels manually, or add texture
+             * sampling logic.
+             *
+             * >> Level 0: 64 x 8
+             *    Level 1: 32 x 4
+             *    Level 2: 16 x 2 << Ignored
+             * >> Level 0: 16 x 16
+             *    Level 1: 8 x 8
+             *    Level 2: 4 x 4 << OK!
+             */
+            if (log_width < 2 || log_height < 2) {
+                /* Base level is smaller than 4x4... */
+                levels = 1;
+            } else {
+                levels = MIN(levels, MIN(log_width, log_height) - 1);
+            }
         }
+        assert(levels > 0);
+    }
 
-        NV2A_DPRINTF(" texture %d is format 0x%x, "
-                        "off 0x%" HWADDR_PRIx " (r %d, %d or %d, %d, %d; %d%s),"
-                        " filter %x %x, levels %d-%d %d bias %d\n",
-                     i, color_format, offset,
-                     rect_width, rect_height,
-                     1 << log_width, 1 << log_height, 1 << log_depth,
-                     pitch,
-                     cubemap ? "; cubemap" : "",
-                     min_filter, mag_filter,
-                     min_mipmap_level, max_mipmap_level, levels,
-                     lod_bias);
-
-        assert(color_format < ARRAY_SIZE(kelvin_color_format_map));
-        ColorFormatInfo f = kelvin_color_format_map[color_format];
-        if (f.bytes_per_pixel == 0) {
-            fprintf(stderr, "nv2a: unimplemented texture color format 0x%x\n",
-                    color_format);
-            abort();
-        }
+    hwaddr dma_len;
+    uint8_t *texture_data;
+    if (dma_select) {
+        texture_data = (uint8_t*)nv_dma_map(d, pg->dma_b, &dma_len);
+    } else {
+        texture_data = (uint8_t*)nv_dma_map(d, pg->dma_a, &dma_len);
+    }
+    assert(offset < dma_len);
+    texture_data += offset;
+    hwaddr texture_vram_offset = texture_data - d->vram_ptr;
 
-        unsigned int width, height, depth;
-        if (f.linear) {
-            assert(dimensionality == 2);
-            width = rect_width;
-            height = rect_height;
-            depth = 1;
-        } else {
-            width = 1 << log_width;
-            height = 1 << log_height;
-            depth = 1 << log_depth;
-            pitch = 0;
+    hwaddr palette_dma_len;
+    uint8_t *palette_data;
+    if (palette_dma_select) {
+        palette_data = (uint8_t*)nv_dma_map(d, pg->dma_b, &palette_dma_len);
+    } else {
+        palette_data = (uint8_t*)nv_dma_map(d, pg->dma_a, &palette_dma_len);
+    }
+    assert(palette_offset < palette_dma_len);
+    palette_data += palette_offset;
+    hwaddr palette_vram_offset = palette_data - d->vram_ptr;
 
-            /* FIXME: What about 3D mipmaps? */
-            levels = MIN(levels, max_mipmap_level + 1);
+    size_t length = 0;
+    if (f.linear) {
+        assert(cubemap == false);
+        assert(dimensionality == 2);
+        length = height * pitch;
+    } else {
+        if (dimensionality >= 2) {
+            unsigned int w = width, h = height;
+            int level;
             if (f.gl_format != 0) {
-                /* Discard mipmap levels that would be smaller than 1x1.
-                 * FIXME: Is this actually needed?
-                 *
-                 * >> Level 0: 32 x 4
-                 *    Level 1: 16 x 2
-                 *    Level 2: 8 x 1
-                 *    Level 3: 4 x 1
-                 *    Level 4: 2 x 1
-                 *    Level 5: 1 x 1
-                 */
-                levels = MIN(levels, MAX(log_width, log_height) + 1);
+                for (level = 0; level < levels; level++) {
+                    w = MAX(w, 1); h = MAX(h, 1);
+                    length += w * h * f.bytes_per_pixel;
+                    w /= 2;
+                    h /= 2;
+                }
             } else {
-                /* OpenGL requires DXT textures to always have a width and
-                 * height a multiple of 4. The Xbox and DirectX handles DXT
-                 * textures smaller than 4 by padding the reset of the block.
-                 *
-                 * See:
-                 * https://msdn.microsoft.com/en-us/library/windows/desktop/bb204843(v=vs.85).aspx
-                 * https://msdn.microsoft.com/en-us/library/windows/desktop/bb694531%28v=vs.85%29.aspx#Virtual_Size
-                 *
-                 * Work around this for now by discarding mipmap levels that
-                 * would result in too-small textures. A correct solution
-                 * will be to decompress these levels manually, or add texture
-                 * sampling logic.
-                 *
-                 * >> Level 0: 64 x 8
-                 *    Level 1: 32 x 4
-                 *    Level 2: 16 x 2 << Ignored
-                 * >> Level 0: 16 x 16
-                 *    Level 1: 8 x 8
-                 *    Level 2: 4 x 4 << OK!
-                 */
-                if (log_width < 2 || log_height < 2) {
-                    /* Base level is smaller than 4x4... */
-                    levels = 1;
+                /* Compressed textures are a bit different */
+                unsigned int block_size;
+                if (f.gl_internal_format ==
+                        GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) {
+                    block_size = 8;
                 } else {
-                    levels = MIN(levels, MIN(log_width, log_height) - 1);
+                    block_size = 16;
+                }
+
+                for (level = 0; level < levels; level++) {
+                    w = MAX(w, 4); h = MAX(h, 4);
+                    length += w/4 * h/4 * block_size;
+                    w /= 2; h /= 2;
                 }
             }
-            assert(levels > 0);
+            if (cubemap) {
+                assert(dimensionality == 2);
+                length = (length + NV2A_CUBEMAP_FACE_ALIGNMENT - 1) & ~(NV2A_CUBEMAP_FACE_ALIGNMENT - 1);
+                length *= 6;
+            }
+            if (dimensionality >= 3) {
+                length *= depth;
+            }
         }
+    }
 
-        hwaddr dma_len;
-        uint8_t *texture_data;
-        if (dma_select) {
-            texture_data = (uint8_t*)nv_dma_map(d, pg->dma_b, &dma_len);
-        } else {
-            texture_data = (uint8_t*)nv_dma_map(d, pg->dma_a, &dma_len);
-        }
-        assert(offset < dma_len);
-        texture_data += offset;
-        hwaddr texture_vram_offset = texture_data - d->vram_ptr;
-
-        hwaddr palette_dma_len;
-        uint8_t *palette_data;
-        if (palette_dma_select) {
-            palette_data = (uint8_t*)nv_dma_map(d, pg->dma_b, &palette_dma_len);
-        } else {
-            palette_data = (uint8_t*)nv_dma_map(d, pg->dma_a, &palette_dma_len);
-        }
-        assert(palette_offset < palette_dma_len);
-        palette_data += palette_offset;
-        hwaddr palette_vram_offset = palette_data - d->vram_ptr;
+    assert((texture_vram_offset + length) < memory_region_size(d->vram));
+    assert((palette_vram_offset + palette_length)
+           < memory_region_size(d->vram));
 
-        size_t length = 0;
-        if (f.linear) {
-            assert(cubemap == false);
-            assert(dimensionality == 2);
-            length = height * pitch;
-        } else {
-            if (dimensionality >= 2) {
-                unsigned int w = width, h = height;
-                int level;
-                if (f.gl_format != 0) {
-                    for (level = 0; level < levels; level++) {
-                        w = MAX(w, 1); h = MAX(h, 1);
-                        length += w * h * f.bytes_per_pixel;
-                        w /= 2;
-                        h /= 2;
-                    }
-                } else {
-                    /* Compressed textures are a bit different */
-                    unsigned int block_size;
-                    if (f.gl_internal_format ==
-                            GL_COMPRESSED_RGBA_S3TC_DXT1_EXT) {
-                        block_size = 8;
-                    } else {
-                        block_size = 16;
-                    }
-
-                    for (level = 0; level < levels; level++) {
-                        w = MAX(w, 4); h = MAX(h, 4);
-                        length += w/4 * h/4 * block_size;
-                        w /= 2; h /= 2;
-                    }
-                }
-                if (cubemap) {
-                    assert(dimensionality == 2);
-                    length = (length + NV2A_CUBEMAP_FACE_ALIGNMENT - 1) & ~(NV2A_CUBEMAP_FACE_ALIGNMENT - 1);
-                    length *= 6;
-                }
-                if (dimensionality >= 3) {
-                    length *= depth;
-                }
+    TextureShape state;
+    memset(&state, 0, sizeof(TextureShape));
+    state.cubemap = cubemap;
+    state.dimensionality = dimensionality;
+    state.color_format = color_format;
+    state.levels = levels;
+    state.width = width;
+    state.height = height;
+    state.depth = depth;
+    state.min_mipmap_level = min_mipmap_level;
+    state.max_mipmap_level = max_mipmap_level;
+    state.pitch = pitch;
+
+    /*
+     * Check active surfaces to see if this texture was a render target
+     */
+    bool surf_to_tex = false;
+    SurfaceBinding *surface = pgraph_surface_get(d, texture_vram_offset);
+    if (surface != NULL) {
+        surf_to_tex = pgraph_check_surface_to_texture_compatibility(
+            surface, &state);
+    }
+
+    if (!surf_to_tex) {
+        // FIXME: Restructure to support rendering surfaces to cubemap faces
+
+        // Writeback any surfaces which this texture may index
+        hwaddr tex_vram_end = texture_vram_offset + length - 1;
+        QTAILQ_FOREACH(surface, &d->pgraph.surfaces, entry) {
+            hwaddr surf_vram_end = surface->vram_addr + surface->size - 1;
+            bool overlapping = !(surface->vram_addr >= tex_vram_end
+                                 || texture_vram_offset >= surf_vram_end);
+            if (overlapping) {
+                pgraph_download_surface_data_if_dirty(d, surface);
             }
         }
+    }
 
-        assert((texture_vram_offset + length) < memory_region_size(d->vram));
-        assert((palette_vram_offset + palette_length)
-               < memory_region_size(d->vram));
-
-        TextureShape state;
-        memset(&state, 0, sizeof(TextureShape));
-        state.cubemap = cubemap;
-        state.dimensionality = dimensionality;
-        state.color_format = color_format;
-        state.levels = levels;
-        state.width = width;
-        state.height = height;
-        state.depth = depth;
-        state.min_mipmap_level = min_mipmap_level;
-        state.max_mipmap_level = max_mipmap_level;
-        state.pitch = pitch;
-
-        /*
-         * Check active surfaces to see if this texture was a render target
-         */
-        bool surf_to_tex = false;
-        SurfaceBinding *surface = pgraph_surface_get(d, texture_vram_offset);
-        if (surface != NULL) {
-            surf_to_tex = pgraph_check_surface_to_texture_compatibility(
-                surface, &state);
-        }
+    bool is_indexed = (color_format ==
+        NV097_SET_TEXTURE_FORMAT_COLOR_SZ_I8_A8R8G8B8);
 
-        if (!surf_to_tex) {
-            // FIXME: Restructure to support rendering surfaces to cubemap faces
-
-            // Writeback any surfaces which this texture may index
-            hwaddr tex_vram_end = texture_vram_offset + length - 1;
-            QTAILQ_FOREACH(surface, &d->pgraph.surfaces, entry) {
-                hwaddr surf_vram_end = surface->vram_addr + surface->size - 1;
-                bool overlapping = !(surface->vram_addr >= tex_vram_end
-                                     || texture_vram_offset >= surf_vram_end);
-                if (overlapping) {
-                    pgraph_download_surface_data_if_dirty(d, surface);
-                }
-            }
+    pgraph_capture_touch(d, texture_vram_offset, length);
+    if (is_indexed) {
+        pgraph_capture_touch(d, palette_vram_offset, palette_length);
+    }
+
+    TextureKey key;
+    memset(&key, 0, sizeof(TextureKey));
+    key.state = state;
+    key.texture_vram_offset = texture_vram_offset;
+    key.texture_length = length;
+    if (is_indexed) {
+        key.palette_vram_offset = palette_vram_offset;
+        key.palette_length = palette_length;
+    }
+
+    // Search for existing texture binding in cache
+    uint64_t tex_binding_hash = fast_hash((uint8_t*)&key, sizeof(key));
+    LruNode *found = lru_lookup(&pg->texture_cache,
+                                 tex_binding_hash, &key);
+    TextureLruNode *key_out = container_of(found, TextureLruNode, node);
+    bool possibly_dirty = !key_out->populated || key_out->possibly_dirty;
+
+    // Check if any of the pages spanned by the texture are dirty
+    if (!surf_to_tex) {
+        if (pgraph_check_texture_dirty(d, texture_vram_offset, length)) {
+            possibly_dirty = true;
+            pgraph_mark_textures_possibly_dirty(d, texture_vram_offset,
+                                                   length);
         }
 
-        bool is_indexed = (color_format ==
-            NV097_SET_TEXTURE_FORMAT_COLOR_SZ_I8_A8R8G8B8);
+        if (is_indexed && pgraph_check_texture_dirty(d, palette_vram_offset,
+                                                        palette_length)) {
+            possibly_dirty = true;
+            pgraph_mark_textures_possibly_dirty(d, palette_vram_offset,
+                                                   palette_length);
+        }
+    }
 
-        TextureKey key;
-        memset(&key, 0, sizeof(TextureKey));
-        key.state = state;
-        key.texture_vram_offset = texture_vram_offset;
-        key.texture_length = length;
+    // Calculate hash of texture data, if necessary
+    uint64_t tex_data_hash = 0;
+    if (!surf_to_tex && possibly_dirty) {
+        tex_data_hash = fast_hash(texture_data, length);
         if (is_indexed) {
-            key.palette_vram_offset = palette_vram_offset;
-            key.palette_length = palette_length;
+            tex_data_hash ^= fast_hash(palette_data, palette_length);
         }
+    }
 
-        // Search for existing texture binding in cache
-        uint64_t tex_binding_hash = fast_hash((uint8_t*)&key, sizeof(key));
-        LruNode *found = lru_lookup(&pg->texture_cache,
-                                     tex_binding_hash, &key);
-        TextureLruNode *key_out = container_of(found, TextureLruNode, node);
-        bool possibly_dirty = (key_out->binding == NULL)
-                              || key_out->possibly_dirty;
-
-        // Check if any of the pages spanned by the texture are dirty
-        if (!surf_to_tex) {
-            if (pgraph_check_texture_dirty(d, texture_vram_offset, length)) {
-                possibly_dirty = true;
-                pgraph_mark_textures_possibly_dirty(d, texture_vram_offset,
-                                                       length);
-            }
+    bool regenerate = !key_out->populated ||
+                      (possibly_dirty && key_out->data_hash != tex_data_hash);
+    if (regenerate) {
+        nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD);
+    }
+    key_out->populated = true;
+    key_out->data_hash = tex_data_hash;
+    key_out->possibly_dirty = false;
 
-            if (is_indexed && pgraph_check_texture_dirty(d, palette_vram_offset,
-                                                            palette_length)) {
-                possibly_dirty = true;
-                pgraph_mark_textures_possibly_dirty(d, palette_vram_offset,
-                                                       palette_length);
-            }
-        }
+    t->state = state;
+    t->texture_data = texture_data;
+    t->palette_data = palette_data;
+    t->surface = surf_to_tex ? surface : NULL;
+    t->node = key_out;
+    t->regenerate = regenerate;
+    return PGRAPH_TEXTURE_FOUND;
+}
 
-        // Calculate hash of texture data, if necessary
-        uint64_t tex_data_hash = 0;
-        if (!surf_to_tex && possibly_dirty) {
-            tex_data_hash = fast_hash(texture_data, length);
-            if (is_indexed) {
-                tex_data_hash ^= fast_hash(palette_data, palette_length);
-            }
-        }
+/* Looks the inline element list up in the element cache. *upload says
+ * whether the renderer has to fill the entry's buffer; either way is counted.
+ */
+VertexLruNode *pgraph_lookup_inline_elements(NV2AState *d, bool *upload)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    VertexKey k;
+    memset(&k, 0, sizeof(VertexKey));
+    k.count = pg->inline_elements_length;
+    k.gl_type = GL_UNSIGNED_INT;
+    k.gl_normalize = GL_FALSE;
+    k.stride = sizeof(uint32_t);
+    uint64_t h = fast_hash((uint8_t*)pg->inline_elements,
+                           pg->inline_elements_length * 4);
+
+    LruNode *node = lru_lookup(&pg->element_cache, h, &k);
+    VertexLruNode *found = container_of(node, VertexLruNode, node);
+    *upload = !found->initialized;
+    if (*upload) {
+        nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_4);
+        found->initialized = true;
+    } else {
+        nv2a_profile_inc_counter(NV2A_PROF_GEOM_BUFFER_UPDATE_4_NOTDIRTY);
+    }
+    return found;
+}
+
+static void pgraph_bind_textures(NV2AState *d)
+{
+    int i;
+    PGRAPHState *pg = &d->pgraph;
+
+    NV2A_GL_DGROUP_BEGIN("%s", __func__);
 
-        // Free existing binding, if texture data has changed
-        bool must_destroy = (key_out->binding != NULL)
-                            && possibly_dirty
-                            && (key_out->binding->data_hash != tex_data_hash);
-        if (must_destroy) {
-            texture_binding_destroy(key_out->binding);
-            key_out->binding = NULL;
+    for (i=0; i<NV2A_MAX_TEXTURES; i++) {
+        TextureLookup t;
+
+        glActiveTexture(GL_TEXTURE0 + i);
+        switch (pgraph_lookup_texture(d, i, pg->texture_binding[i] != NULL,
+                                      &t)) {
+        case PGRAPH_TEXTURE_DISABLED:
+            glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+            glBindTexture(GL_TEXTURE_RECTANGLE, 0);
+            glBindTexture(GL_TEXTURE_1D, 0);
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glBindTexture(GL_TEXTURE_3D, 0);
+            continue;
+        case PGRAPH_TEXTURE_UNCHANGED:
+            glBindTexture(pg->texture_binding[i]->gl_target,
+                          pg->texture_binding[i]->gl_texture);
+            continue;
+        case PGRAPH_TEXTURE_FOUND:
+            break;
         }
 
-        if (key_out->binding == NULL) {
+        uint32_t fmt = pg->regs[NV_PGRAPH_TEXFMT0 + i*4];
+        uint32_t filter = pg->regs[NV_PGRAPH_TEXFILTER0 + i*4];
+        uint32_t address =  pg->regs[NV_PGRAPH_TEXADDRESS0 + i*4];
+
+        unsigned int dimensionality = t.state.dimensionality;
+        unsigned int min_filter = GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MIN);
+        unsigned int mag_filter = GET_MASK(filter, NV_PGRAPH_TEXFILTER0_MAG);
+
+        unsigned int addru = GET_MASK(address, NV_PGRAPH_TEXADDRESS0_ADDRU);
+        unsigned int addrv = GET_MASK(address, NV_PGRAPH_TEXADDRESS0_ADDRV);
+        unsigned int addrp = GET_MASK(address, NV_PGRAPH_TEXADDRESS0_ADDRP);
+
+        unsigned int border_source = GET_MASK(fmt,
+                                              NV_PGRAPH_TEXFMT0_BORDER_SOURCE);
+        uint32_t border_color = pg->regs[NV_PGRAPH_BORDERCOLOR0 + i*4];
+
+        ColorFormatInfo f = kelvin_color_format_map[t.state.color_format];
+        TextureLruNode *key_out = t.node;
+        SurfaceBinding *surface = t.surface;
+
+        if (t.regenerate) {
             // Must create the texture
-            key_out->binding = generate_texture(state, texture_data, palette_data);
-            key_out->binding->data_hash = tex_data_hash;
+            if (key_out->binding) {
+                texture_binding_destroy(key_out->binding);
+            }
+            key_out->binding = generate_texture(t.state, t.texture_data,
+                                                t.palette_data);
             key_out->binding->scale = 1;
         } else {
             // Saved an upload! Reuse existing texture in graphics memory.
@@ -6176,15 +7551,15 @@ static void pgraph_bind_textures(NV2AState *d)
                           key_out->binding->gl_texture);
         }
 
-        key_out->possibly_dirty = false;
         TextureBinding *binding = key_out->binding;
         binding->refcnt++;
 
-        if (surf_to_tex && (binding->draw_time < surface->draw_time)) {
+        if (surface && (binding->draw_time < surface->draw_time)) {
             NV2A_XPRINTF(DBG_SURFACES,
                 "Rendering surface @ %" HWADDR_PRIx " to texture (%dx%d)\n",
                 surface->vram_addr, surface->width, surface->height);
-            pgraph_render_surface_to_texture(d, surface, binding, &state, i);
+            pgraph_render_surface_to_texture(d, surface, binding, &t.state,
+                                             i);
             binding->draw_time = surface->draw_time;
             if (binding->gl_target == GL_TEXTURE_RECTANGLE) {
                 binding->scale = pg->surface_scale_factor;
@@ -6248,7 +7623,6 @@ static void pgraph_bind_textures(NV2AState *d)
             texture_binding_destroy(pg->texture_binding[i]);
         }
         pg->texture_binding[i] = binding;
-        pg->texture_dirty[i] = false;
     }
     NV2A_GL_DGROUP_END();
 }
@@ -6298,6 +7672,8 @@ static void pgraph_get_surface_dimensions(PGRAPHState *pg,
 static void pgraph_update_memory_buffer(NV2AState *d, hwaddr addr, hwaddr size,
                                         bool quick)
 {
+    pgraph_capture_touch(d, addr, size);
+
     glBindBuffer(GL_ARRAY_BUFFER, d->pgraph.gl_memory_buffer);
 
     hwaddr end = TARGET_PAGE_ALIGN(addr + size);
@@ -6551,7 +7927,6 @@ static void upload_gl_texture(GLenum gl_target,
                               const uint8_t *palette_data)
 {
     ColorFormatInfo f = kelvin_color_format_map[s.color_format];
-    nv2a_profile_inc_counter(NV2A_PROF_TEX_UPLOAD);
 
     switch(gl_target) {
     case GL_TEXTURE_1D:
@@ -6821,7 +8196,6 @@ static TextureBinding* generate_texture(const TextureShape s,
     ret->gl_texture = gl_texture;
     ret->refcnt = 1;
     ret->draw_time = 0;
-    ret->data_hash = 0;
     return ret;
 }
 
@@ -6843,6 +8217,7 @@ static void texture_cache_entry_init(Lru *lru, LruNode *node, void *key)
     memcpy(&tnode->key, key, sizeof(TextureKey));
 
     tnode->binding = NULL;
+    tnode->populated = false;
     tnode->possibly_dirty = false;
 }
 
@@ -6852,8 +8227,9 @@ static void texture_cache_entry_post_evict(Lru *lru, LruNode *node)
     if (tnode->binding) {
         texture_binding_destroy(tnode->binding);
         tnode->binding = NULL;
-        tnode->possibly_dirty = false;
     }
+    tnode->populated = false;
+    tnode->possibly_dirty = false;
 }
 
 static bool texture_cache_entry_compare(Lru *lru, LruNode *node, void *key)
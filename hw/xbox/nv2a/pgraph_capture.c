@@ -0,0 +1,572 @@
+/*
+ * QEMU Geforce NV2A pushbuffer capture and replay
+ *
+ * A capture holds the PGRAPH front end state at a frame boundary, RAMIN,
+ * every method handed to PGRAPH for the following frames and each VRAM
+ * page those methods read, recorded when first touched and again whenever
+ * its contents change. Replaying feeds the same methods back into
+ * pgraph_method() and reports where the time went; with the null
+ * renderer this measures method dispatch throughput alone.
+ *
+ * Captures store host-endian structure contents and are only meant to be
+ * replayed by the build that produced them.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nv2a_int.h"
+#include "qemu/bitmap.h"
+#include "qemu/fast-hash.h"
+#include "qemu/timer.h"
+
+#define CAPTURE_MAGIC "NV2ACAP1"
+#define CAPTURE_PAGE_BITS 12
+#define CAPTURE_PAGE_SIZE (1 << CAPTURE_PAGE_BITS)
+
+/* Words kept past the method's own so the BEGIN/DRAW_ARRAYS/END squashing
+ * in pgraph_method() sees the same lookahead on replay */
+#define CAPTURE_LOOKAHEAD_WORDS 8
+
+enum CaptureRecordType {
+    CAPTURE_RECORD_STATE = 1,
+    CAPTURE_RECORD_RAMIN,
+    CAPTURE_RECORD_PAGE,
+    CAPTURE_RECORD_METHOD,
+    CAPTURE_RECORD_FRAME,
+};
+
+typedef struct CaptureRecordHeader {
+    uint32_t type;
+    uint32_t length;
+} CaptureRecordHeader;
+
+typedef struct CaptureMethod {
+    uint32_t subchannel;
+    uint32_t method;
+    uint32_t parameter;
+    uint32_t inc;
+    uint32_t num_words_available;
+    uint32_t max_lookahead_words;
+    uint32_t num_words;
+    uint32_t words[];
+} CaptureMethod;
+
+typedef struct PGRAPHCapture {
+    FILE *file;
+    char *path;
+    unsigned int frames_left;
+    unsigned int frames;
+    size_t num_pages;
+    unsigned long *page_written;
+    uint64_t *page_hash;
+    int error;
+} PGRAPHCapture;
+
+/* Front end state restored before replay. Everything here is plain data;
+ * caches and host objects are rebuilt from it. */
+#define PGRAPH_CAPTURE_FIELD(f) \
+    { offsetof(PGRAPHState, f), sizeof_field(PGRAPHState, f) }
+
+static const struct {
+    size_t offset;
+    size_t size;
+} pgraph_capture_fields[] = {
+    PGRAPH_CAPTURE_FIELD(context_surfaces_2d),
+    PGRAPH_CAPTURE_FIELD(image_blit),
+    PGRAPH_CAPTURE_FIELD(kelvin),
+    PGRAPH_CAPTURE_FIELD(beta),
+    PGRAPH_CAPTURE_FIELD(dma_color),
+    PGRAPH_CAPTURE_FIELD(dma_zeta),
+    PGRAPH_CAPTURE_FIELD(surface_color),
+    PGRAPH_CAPTURE_FIELD(surface_zeta),
+    PGRAPH_CAPTURE_FIELD(surface_type),
+    PGRAPH_CAPTURE_FIELD(surface_shape),
+    PGRAPH_CAPTURE_FIELD(dma_a),
+    PGRAPH_CAPTURE_FIELD(dma_b),
+    PGRAPH_CAPTURE_FIELD(texture_matrix_enable),
+    PGRAPH_CAPTURE_FIELD(dma_state),
+    PGRAPH_CAPTURE_FIELD(dma_notifies),
+    PGRAPH_CAPTURE_FIELD(dma_semaphore),
+    PGRAPH_CAPTURE_FIELD(dma_report),
+    PGRAPH_CAPTURE_FIELD(report_offset),
+    PGRAPH_CAPTURE_FIELD(zpass_pixel_count_enable),
+    PGRAPH_CAPTURE_FIELD(zpass_pixel_count_result),
+    PGRAPH_CAPTURE_FIELD(dma_vertex_a),
+    PGRAPH_CAPTURE_FIELD(dma_vertex_b),
+    PGRAPH_CAPTURE_FIELD(primitive_mode),
+    PGRAPH_CAPTURE_FIELD(enable_vertex_program_write),
+    PGRAPH_CAPTURE_FIELD(program_data),
+    PGRAPH_CAPTURE_FIELD(vsh_constants),
+    PGRAPH_CAPTURE_FIELD(ltctxa),
+    PGRAPH_CAPTURE_FIELD(ltctxb),
+    PGRAPH_CAPTURE_FIELD(ltc1),
+    PGRAPH_CAPTURE_FIELD(light_infinite_half_vector),
+    PGRAPH_CAPTURE_FIELD(light_infinite_direction),
+    PGRAPH_CAPTURE_FIELD(light_local_position),
+    PGRAPH_CAPTURE_FIELD(light_local_attenuation),
+    PGRAPH_CAPTURE_FIELD(point_params),
+    PGRAPH_CAPTURE_FIELD(regs),
+};
+
+/* Vertex attribute format and pointer state, skipping the inline buffer */
+static const struct {
+    size_t offset;
+    size_t size;
+} vertex_attribute_fields[] = {
+    { 0, offsetof(VertexAttribute, inline_buffer) },
+    { offsetof(VertexAttribute, gl_count),
+      offsetof(VertexAttribute, gl_inline_buffer) -
+          offsetof(VertexAttribute, gl_count) },
+};
+
+#define VERTEX_ATTRIBUTE_STATE_SIZE \
+    (offsetof(VertexAttribute, inline_buffer) + \
+     offsetof(VertexAttribute, gl_inline_buffer) - \
+     offsetof(VertexAttribute, gl_count))
+
+static size_t pgraph_capture_state_size(void)
+{
+    size_t size = 0;
+    for (int i = 0; i < ARRAY_SIZE(pgraph_capture_fields); i++) {
+        size += pgraph_capture_fields[i].size;
+    }
+    return size + NV2A_VERTEXSHADER_ATTRIBUTES * VERTEX_ATTRIBUTE_STATE_SIZE;
+}
+
+static uint32_t pgraph_capture_layout(void)
+{
+    uint64_t h = fast_hash((const uint8_t *)pgraph_capture_fields,
+                           sizeof(pgraph_capture_fields));
+    return (uint32_t)(h ^ (h >> 32)) ^ VERTEX_ATTRIBUTE_STATE_SIZE;
+}
+
+/* A failed write is remembered and ends the capture at the next frame */
+static void pgraph_capture_write(PGRAPHCapture *c, uint32_t type,
+                                 const void *data, size_t len,
+                                 const void *data2, size_t len2)
+{
+    CaptureRecordHeader hdr = {
+        .type = type,
+        .length = len + len2,
+    };
+
+    if (c->error) {
+        return;
+    }
+    if (fwrite(&hdr, sizeof(hdr), 1, c->file) != 1 ||
+        (len && fwrite(data, len, 1, c->file) != 1) ||
+        (len2 && fwrite(data2, len2, 1, c->file) != 1)) {
+        c->error = errno ? errno : EIO;
+    }
+}
+
+static void pgraph_capture_write_state(NV2AState *d, PGRAPHCapture *c)
+{
+    PGRAPHState *pg = &d->pgraph;
+    uint8_t *buf = g_malloc(pgraph_capture_state_size());
+    uint8_t *p = buf;
+
+    for (int i = 0; i < ARRAY_SIZE(pgraph_capture_fields); i++) {
+        memcpy(p, (uint8_t *)pg + pgraph_capture_fields[i].offset,
+               pgraph_capture_fields[i].size);
+        p += pgraph_capture_fields[i].size;
+    }
+    for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        for (int j = 0; j < ARRAY_SIZE(vertex_attribute_fields); j++) {
+            memcpy(p, (uint8_t *)&pg->vertex_attributes[i] +
+                          vertex_attribute_fields[j].offset,
+                   vertex_attribute_fields[j].size);
+            p += vertex_attribute_fields[j].size;
+        }
+    }
+
+    pgraph_capture_write(c, CAPTURE_RECORD_STATE, buf, p - buf, NULL, 0);
+    g_free(buf);
+
+    pgraph_capture_write(c, CAPTURE_RECORD_RAMIN, d->ramin_ptr,
+                         memory_region_size(&d->ramin), NULL, 0);
+}
+
+static void pgraph_capture_restore_state(NV2AState *d, const uint8_t *p)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    for (int i = 0; i < ARRAY_SIZE(pgraph_capture_fields); i++) {
+        memcpy((uint8_t *)pg + pgraph_capture_fields[i].offset, p,
+               pgraph_capture_fields[i].size);
+        p += pgraph_capture_fields[i].size;
+    }
+    for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        for (int j = 0; j < ARRAY_SIZE(vertex_attribute_fields); j++) {
+            memcpy((uint8_t *)&pg->vertex_attributes[i] +
+                       vertex_attribute_fields[j].offset,
+                   p, vertex_attribute_fields[j].size);
+            p += vertex_attribute_fields[j].size;
+        }
+        pg->vertex_attributes[i].inline_buffer_populated = false;
+    }
+
+    /* Everything derived from the restored state has to be rebuilt */
+    pg->surface_color.buffer_dirty = true;
+    pg->surface_zeta.buffer_dirty = true;
+    memset(pg->texture_dirty, 1, sizeof(pg->texture_dirty));
+    pg->program_data_dirty = true;
+    memset(pg->vsh_constants_dirty, 1, sizeof(pg->vsh_constants_dirty));
+    memset(pg->ltctxa_dirty, 1, sizeof(pg->ltctxa_dirty));
+    memset(pg->ltctxb_dirty, 1, sizeof(pg->ltctxb_dirty));
+    memset(pg->ltc1_dirty, 1, sizeof(pg->ltc1_dirty));
+    pg->uniform_blocks_dirty = true;
+
+    pg->waiting_for_nop = false;
+    pg->waiting_for_flip = false;
+    pg->waiting_for_context_switch = false;
+}
+
+static void pgraph_capture_end(NV2AState *d)
+{
+    PGRAPHCapture *c = d->pgraph.capture;
+
+    d->pgraph.capture = NULL;
+
+    if (fclose(c->file) != 0 && !c->error) {
+        c->error = errno;
+    }
+    if (c->error) {
+        error_report("nv2a: failed to write capture file %s: %s", c->path,
+                     strerror(c->error));
+    } else {
+        info_report("nv2a: captured %u frame(s) to %s", c->frames, c->path);
+    }
+
+    g_free(c->path);
+    g_free(c->page_written);
+    g_free(c->page_hash);
+    g_free(c);
+}
+
+static void pgraph_capture_begin(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+    char *path = pg->capture_request_path;
+
+    pg->capture_request_path = NULL;
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        error_report("nv2a: failed to open capture file %s: %s", path,
+                     strerror(errno));
+        g_free(path);
+        return;
+    }
+
+    PGRAPHCapture *c = g_new0(PGRAPHCapture, 1);
+    c->file = file;
+    c->path = path;
+    c->frames = pg->capture_request_frames;
+    c->frames_left = c->frames;
+    c->num_pages = memory_region_size(d->vram) >> CAPTURE_PAGE_BITS;
+    c->page_written = bitmap_new(c->num_pages);
+    c->page_hash = g_new0(uint64_t, c->num_pages);
+
+    uint32_t hdr[3] = {
+        pgraph_capture_layout(),
+        pgraph_capture_state_size(),
+        memory_region_size(&d->ramin),
+    };
+    if (fwrite(CAPTURE_MAGIC, 8, 1, c->file) != 1 ||
+        fwrite(hdr, sizeof(hdr), 1, c->file) != 1) {
+        c->error = errno ? errno : EIO;
+    } else {
+        pgraph_capture_write_state(d, c);
+    }
+
+    pg->capture = c;
+    if (c->error) {
+        pgraph_capture_end(d);
+    }
+}
+
+/* Called at each FLIP_INCREMENT_WRITE, which is where captures start and
+ * end so that a capture always covers whole frames */
+void pgraph_capture_frame(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    if (pg->capture) {
+        pgraph_capture_write(pg->capture, CAPTURE_RECORD_FRAME, NULL, 0,
+                             NULL, 0);
+        if (pg->capture->error || --pg->capture->frames_left == 0) {
+            pgraph_capture_end(d);
+        }
+    } else if (pg->capture_request_path) {
+        pgraph_capture_begin(d);
+    }
+}
+
+void pgraph_capture_method(NV2AState *d, unsigned int subchannel,
+                           unsigned int method, uint32_t parameter,
+                           uint32_t *parameters, size_t num_words_available,
+                           size_t max_lookahead_words, bool inc)
+{
+    size_t num_words = MIN(MAX(num_words_available, CAPTURE_LOOKAHEAD_WORDS),
+                           MAX(max_lookahead_words, num_words_available));
+
+    CaptureMethod m = {
+        .subchannel = subchannel,
+        .method = method,
+        .parameter = parameter,
+        .inc = inc,
+        .num_words_available = num_words_available,
+        .max_lookahead_words = max_lookahead_words,
+        .num_words = num_words,
+    };
+    pgraph_capture_write(d->pgraph.capture, CAPTURE_RECORD_METHOD, &m,
+                         sizeof(m), parameters, num_words * sizeof(uint32_t));
+}
+
+void pgraph_capture_memory(NV2AState *d, hwaddr addr, hwaddr size)
+{
+    PGRAPHCapture *c = d->pgraph.capture;
+
+    if (size == 0) {
+        return;
+    }
+
+    size_t first = addr >> CAPTURE_PAGE_BITS;
+    size_t last = MIN((addr + size - 1) >> CAPTURE_PAGE_BITS,
+                      c->num_pages - 1);
+
+    for (size_t page = first; page <= last; page++) {
+        const uint8_t *data = d->vram_ptr + (page << CAPTURE_PAGE_BITS);
+        uint64_t h = fast_hash(data, CAPTURE_PAGE_SIZE);
+        if (test_bit(page, c->page_written) && c->page_hash[page] == h) {
+            continue;
+        }
+        set_bit(page, c->page_written);
+        c->page_hash[page] = h;
+
+        uint32_t page_addr = page << CAPTURE_PAGE_BITS;
+        pgraph_capture_write(c, CAPTURE_RECORD_PAGE, &page_addr,
+                             sizeof(page_addr), data, CAPTURE_PAGE_SIZE);
+    }
+}
+
+typedef struct ReplayMethodStats {
+    unsigned int method;
+    uint64_t count;
+    int64_t ns;
+} ReplayMethodStats;
+
+static int replay_compare_ns(gconstpointer a, gconstpointer b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static int replay_compare_method_ns(const void *a, const void *b)
+{
+    int64_t x = ((const ReplayMethodStats *)a)->ns;
+    int64_t y = ((const ReplayMethodStats *)b)->ns;
+    return (x < y) - (x > y);
+}
+
+static void pgraph_replay_report(ReplayMethodStats *stats, GArray *draws,
+                                 unsigned int frames, uint64_t total_words,
+                                 int64_t total_ns)
+{
+    uint64_t methods = 0;
+
+    for (unsigned int i = 0; i < 0x800; i++) {
+        stats[i].method = i << 2;
+        methods += stats[i].count;
+    }
+    qsort(stats, 0x800, sizeof(stats[0]), replay_compare_method_ns);
+
+    info_report("nv2a replay: %u frames, %" PRIu64 " methods in %.3f ms "
+                "(%.1f ns/method, %.3f ms/frame)",
+                frames, methods, total_ns / 1e6,
+                methods ? (double)total_ns / methods : 0.0,
+                frames ? total_ns / 1e6 / frames : 0.0);
+    info_report("nv2a replay: %" PRIu64 " words, %.2f Mwords/s",
+                total_words, total_ns ? total_words * 1e3 / total_ns : 0.0);
+
+    for (unsigned int i = 0; i < 32; i++) {
+        ReplayMethodStats *s = &stats[i];
+        if (!s->count) {
+            break;
+        }
+        const char *name = pgraph_kelvin_method_name(s->method);
+        info_report("  0x%04x %-40s %10" PRIu64 " calls %10.3f ms "
+                    "%8.1f ns/call", s->method, name ? name : "?",
+                    s->count, s->ns / 1e6, (double)s->ns / s->count);
+    }
+
+    if (draws->len) {
+        int64_t *ns = (int64_t *)draws->data;
+        int64_t sum = 0;
+        g_array_sort(draws, replay_compare_ns);
+        for (unsigned int i = 0; i < draws->len; i++) {
+            sum += ns[i];
+        }
+        info_report("  draws: %u, mean %.1f us, p50 %.1f us, p99 %.1f us, "
+                    "max %.1f us", draws->len, sum / 1e3 / draws->len,
+                    ns[draws->len / 2] / 1e3,
+                    ns[(draws->len - 1) * 99 / 100] / 1e3,
+                    ns[draws->len - 1] / 1e3);
+    }
+}
+
+/* Checks a record's payload fits what replaying it will touch, so a
+ * damaged capture is rejected rather than written past RAMIN or VRAM */
+static bool pgraph_replay_record_valid(NV2AState *d,
+                                       const CaptureRecordHeader *rec,
+                                       const uint8_t *data)
+{
+    switch (rec->type) {
+    case CAPTURE_RECORD_STATE:
+        return rec->length == pgraph_capture_state_size();
+    case CAPTURE_RECORD_RAMIN:
+        return rec->length == memory_region_size(&d->ramin);
+    case CAPTURE_RECORD_PAGE: {
+        if (rec->length != sizeof(uint32_t) + CAPTURE_PAGE_SIZE) {
+            return false;
+        }
+        uint64_t addr = ldl_he_p(data);
+        return addr + CAPTURE_PAGE_SIZE <= memory_region_size(d->vram);
+    }
+    case CAPTURE_RECORD_METHOD: {
+        const CaptureMethod *m = (const CaptureMethod *)data;
+        return rec->length >= sizeof(*m) &&
+               m->num_words <= (rec->length - sizeof(*m)) / sizeof(uint32_t) &&
+               m->num_words_available <= m->num_words;
+    }
+    default:
+        return true;
+    }
+}
+
+/* Must be called from the PFIFO thread with the PGRAPH lock held and the
+ * vCPUs paused, since it overwrites RAMIN and VRAM under the guest */
+void pgraph_replay(NV2AState *d, const char *path, unsigned int loops)
+{
+    PGRAPHState *pg = &d->pgraph;
+    GError *err = NULL;
+    gchar *buf;
+    gsize len;
+
+    if (!g_file_get_contents(path, &buf, &len, &err)) {
+        error_report("nv2a: failed to read capture %s: %s", path,
+                     err->message);
+        g_error_free(err);
+        return;
+    }
+
+    const size_t hdr_size = 8 + 3 * sizeof(uint32_t);
+    const uint32_t *hdr = (const uint32_t *)(buf + 8);
+    if (len < hdr_size || memcmp(buf, CAPTURE_MAGIC, 8) ||
+        hdr[0] != pgraph_capture_layout() ||
+        hdr[1] != pgraph_capture_state_size() ||
+        hdr[2] != memory_region_size(&d->ramin)) {
+        error_report("nv2a: %s is not a capture from this build", path);
+        g_free(buf);
+        return;
+    }
+
+    ReplayMethodStats *stats = g_new0(ReplayMethodStats, 0x800);
+    GArray *draws = g_array_new(false, false, sizeof(int64_t));
+    unsigned int frames = 0;
+    int64_t total_ns = 0;
+    uint64_t total_words = 0;
+    bool ok = true;
+
+    for (unsigned int loop = 0; ok && loop < loops; loop++) {
+        const uint8_t *p = (const uint8_t *)buf + hdr_size;
+        const uint8_t *end = (const uint8_t *)buf + len;
+        int64_t draw_start = 0;
+
+        while (p + sizeof(CaptureRecordHeader) <= end) {
+            const CaptureRecordHeader *rec = (const CaptureRecordHeader *)p;
+            const uint8_t *data = p + sizeof(*rec);
+            if (rec->length > end - data ||
+                !pgraph_replay_record_valid(d, rec, data)) {
+                error_report("nv2a: capture %s is truncated or corrupt "
+                             "at offset %td", path, p - (const uint8_t *)buf);
+                ok = false;
+                break;
+            }
+            p = data + rec->length;
+
+            switch (rec->type) {
+            case CAPTURE_RECORD_STATE:
+                pgraph_capture_restore_state(d, data);
+                break;
+            case CAPTURE_RECORD_RAMIN:
+                memcpy(d->ramin_ptr, data, rec->length);
+                memory_region_set_dirty(&d->ramin, 0, rec->length);
+                break;
+            case CAPTURE_RECORD_PAGE: {
+                uint32_t addr = ldl_he_p(data);
+                memcpy(d->vram_ptr + addr, data + sizeof(addr),
+                       CAPTURE_PAGE_SIZE);
+                memory_region_set_dirty(d->vram, addr, CAPTURE_PAGE_SIZE);
+                break;
+            }
+            case CAPTURE_RECORD_METHOD: {
+                const CaptureMethod *m = (const CaptureMethod *)data;
+                uint32_t *words = (uint32_t *)m->words;
+                bool begin_end = (m->method == NV097_SET_BEGIN_END);
+
+                int64_t t = get_clock();
+                if (begin_end && m->parameter != NV097_SET_BEGIN_END_OP_END) {
+                    draw_start = t;
+                }
+                total_words += pgraph_method(d, m->subchannel, m->method,
+                                             m->parameter, words,
+                                             m->num_words_available,
+                                             MIN(m->max_lookahead_words,
+                                                 m->num_words),
+                                             m->inc);
+                int64_t now = get_clock();
+
+                stats[(m->method >> 2) & 0x7ff].count++;
+                stats[(m->method >> 2) & 0x7ff].ns += now - t;
+                total_ns += now - t;
+                if (begin_end && m->parameter == NV097_SET_BEGIN_END_OP_END &&
+                    draw_start) {
+                    int64_t ns = now - draw_start;
+                    g_array_append_val(draws, ns);
+                    draw_start = 0;
+                }
+
+                /* Nothing will complete a flip or acknowledge a notify */
+                pg->waiting_for_flip = false;
+                pg->waiting_for_nop = false;
+                break;
+            }
+            case CAPTURE_RECORD_FRAME:
+                pgraph_process_pending_reports(d);
+                frames++;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+
+    pgraph_replay_report(stats, draws, frames, total_words, total_ns);
+
+    g_array_free(draws, true);
+    g_free(stats);
+    g_free(buf);
+}
@@ -160,3 +160,19 @@ DEF_METHOD(NV097, SET_TRANSFORM_PROGRAM_CXT_WRITE_EN)
 DEF_METHOD(NV097, SET_TRANSFORM_PROGRAM_LOAD)
 DEF_METHOD(NV097, SET_TRANSFORM_PROGRAM_START)
 DEF_METHOD(NV097, SET_TRANSFORM_CONSTANT_LOAD)
+DEF_METHOD(NV012, SET_OBJECT)
+DEF_METHOD(NV012, SET_BETA)
+DEF_METHOD(NV044, SET_MONOCHROME_COLOR0)
+DEF_METHOD(NV062, SET_OBJECT)
+DEF_METHOD(NV062, SET_CONTEXT_DMA_IMAGE_SOURCE)
+DEF_METHOD(NV062, SET_CONTEXT_DMA_IMAGE_DESTIN)
+DEF_METHOD(NV062, SET_COLOR_FORMAT)
+DEF_METHOD(NV062, SET_PITCH)
+DEF_METHOD(NV062, SET_OFFSET_SOURCE)
+DEF_METHOD(NV062, SET_OFFSET_DESTIN)
+DEF_METHOD(NV09F, SET_OBJECT)
+DEF_METHOD(NV09F, SET_CONTEXT_SURFACES)
+DEF_METHOD(NV09F, SET_OPERATION)
+DEF_METHOD(NV09F, CONTROL_POINT_IN)
+DEF_METHOD(NV09F, CONTROL_POINT_OUT)
+DEF_METHOD(NV09F, SIZE)
@@ -0,0 +1,90 @@
+/*
+ * QEMU Geforce NV2A null renderer
+ *
+ * Decodes and tracks PGRAPH state exactly like the OpenGL renderer, but
+ * never submits any work to the host. Useful for measuring pushbuffer and
+ * method throughput on machines without a GPU.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "nv2a_int.h"
+
+static void pgraph_null_init(NV2AState *d)
+{
+}
+
+static void pgraph_null_destroy(NV2AState *d)
+{
+}
+
+static void pgraph_null_init_thread(NV2AState *d)
+{
+}
+
+static void pgraph_null_flush(NV2AState *d)
+{
+}
+
+/* No surfaces are ever created, so image blits, reports and display reads
+ * all take their VRAM paths. Rendered and cleared pixels never reach VRAM. */
+static void pgraph_null_update_surface(NV2AState *d, bool upload,
+                                       bool color_write, bool zeta_write)
+{
+}
+
+/* The caches are still keyed and accounted, so the profile counters match
+ * what the OpenGL renderer reports for the same pushbuffers */
+static void pgraph_null_draw_begin(NV2AState *d)
+{
+    for (int i = 0; i < NV2A_MAX_TEXTURES; i++) {
+        TextureLookup t;
+        pgraph_lookup_texture(d, i, true, &t);
+    }
+}
+
+static void pgraph_null_draw_end(NV2AState *d)
+{
+    PGRAPHState *pg = &d->pgraph;
+
+    if (pg->inline_elements_length) {
+        bool upload;
+        pgraph_lookup_inline_elements(d, &upload);
+    }
+
+    for (int i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        pg->vertex_attributes[i].inline_buffer_populated = false;
+    }
+}
+
+static void pgraph_null_clear_surface(NV2AState *d, uint32_t parameter)
+{
+}
+
+static void pgraph_null_finish(NV2AState *d)
+{
+}
+
+const PGRAPHRenderer pgraph_null_renderer = {
+    .name = "null",
+    .init = pgraph_null_init,
+    .destroy = pgraph_null_destroy,
+    .init_thread = pgraph_null_init_thread,
+    .flush = pgraph_null_flush,
+    .update_surface = pgraph_null_update_surface,
+    .draw_begin = pgraph_null_draw_begin,
+    .draw_end = pgraph_null_draw_end,
+    .clear_surface = pgraph_null_clear_surface,
+    .finish = pgraph_null_finish,
+};
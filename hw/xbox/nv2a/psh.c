@@ -74,85 +74,6 @@ enum PS_TEXTUREMODES
     // 0x13-0x1f reserved
 };
 
-enum PS_INPUTMAPPING
-{
-    PS_INPUTMAPPING_UNSIGNED_IDENTITY= 0x00L, // max(0,x)         OK for final combiner
-    PS_INPUTMAPPING_UNSIGNED_INVERT=   0x20L, // 1 - max(0,x)     OK for final combiner
-    PS_INPUTMAPPING_EXPAND_NORMAL=     0x40L, // 2*max(0,x) - 1   invalid for final combiner
-    PS_INPUTMAPPING_EXPAND_NEGATE=     0x60L, // 1 - 2*max(0,x)   invalid for final combiner
-    PS_INPUTMAPPING_HALFBIAS_NORMAL=   0x80L, // max(0,x) - 1/2   invalid for final combiner
-    PS_INPUTMAPPING_HALFBIAS_NEGATE=   0xa0L, // 1/2 - max(0,x)   invalid for final combiner
-    PS_INPUTMAPPING_SIGNED_IDENTITY=   0xc0L, // x                invalid for final combiner
-    PS_INPUTMAPPING_SIGNED_NEGATE=     0xe0L, // -x               invalid for final combiner
-};
-
-enum PS_REGISTER
-{
-    PS_REGISTER_ZERO=              0x00L, // r
-    PS_REGISTER_DISCARD=           0x00L, // w
-    PS_REGISTER_C0=                0x01L, // r
-    PS_REGISTER_C1=                0x02L, // r
-    PS_REGISTER_FOG=               0x03L, // r
-    PS_REGISTER_V0=                0x04L, // r/w
-    PS_REGISTER_V1=                0x05L, // r/w
-    PS_REGISTER_T0=                0x08L, // r/w
-    PS_REGISTER_T1=                0x09L, // r/w
-    PS_REGISTER_T2=                0x0aL, // r/w
-    PS_REGISTER_T3=                0x0bL, // r/w
-    PS_REGISTER_R0=                0x0cL, // r/w
-    PS_REGISTER_R1=                0x0dL, // r/w
-    PS_REGISTER_V1R0_SUM=          0x0eL, // r
-    PS_REGISTER_EF_PROD=           0x0fL, // r
-
-    PS_REGISTER_ONE=               PS_REGISTER_ZERO | PS_INPUTMAPPING_UNSIGNED_INVERT, // OK for final combiner
-    PS_REGISTER_NEGATIVE_ONE=      PS_REGISTER_ZERO | PS_INPUTMAPPING_EXPAND_NORMAL,   // invalid for final combiner
-    PS_REGISTER_ONE_HALF=          PS_REGISTER_ZERO | PS_INPUTMAPPING_HALFBIAS_NEGATE, // invalid for final combiner
-    PS_REGISTER_NEGATIVE_ONE_HALF= PS_REGISTER_ZERO | PS_INPUTMAPPING_HALFBIAS_NORMAL, // invalid for final combiner
-};
-
-enum PS_COMBINERCOUNTFLAGS
-{
-    PS_COMBINERCOUNT_MUX_LSB=     0x0000L, // mux on r0.a lsb
-    PS_COMBINERCOUNT_MUX_MSB=     0x0001L, // mux on r0.a msb
-
-    PS_COMBINERCOUNT_SAME_C0=     0x0000L, // c0 same in each stage
-    PS_COMBINERCOUNT_UNIQUE_C0=   0x0010L, // c0 unique in each stage
-
-    PS_COMBINERCOUNT_SAME_C1=     0x0000L, // c1 same in each stage
-    PS_COMBINERCOUNT_UNIQUE_C1=   0x0100L  // c1 unique in each stage
-};
-
-enum PS_COMBINEROUTPUT
-{
-    PS_COMBINEROUTPUT_IDENTITY=            0x00L, // y = x
-    PS_COMBINEROUTPUT_BIAS=                0x08L, // y = x - 0.5
-    PS_COMBINEROUTPUT_SHIFTLEFT_1=         0x10L, // y = x*2
-    PS_COMBINEROUTPUT_SHIFTLEFT_1_BIAS=    0x18L, // y = (x - 0.5)*2
-    PS_COMBINEROUTPUT_SHIFTLEFT_2=         0x20L, // y = x*4
-    PS_COMBINEROUTPUT_SHIFTRIGHT_1=        0x30L, // y = x/2
-
-    PS_COMBINEROUTPUT_AB_BLUE_TO_ALPHA=    0x80L, // RGB only
-
-    PS_COMBINEROUTPUT_CD_BLUE_TO_ALPHA=    0x40L, // RGB only
-
-    PS_COMBINEROUTPUT_AB_MULTIPLY=         0x00L,
-    PS_COMBINEROUTPUT_AB_DOT_PRODUCT=      0x02L, // RGB only
-
-    PS_COMBINEROUTPUT_CD_MULTIPLY=         0x00L,
-    PS_COMBINEROUTPUT_CD_DOT_PRODUCT=      0x01L, // RGB only
-
-    PS_COMBINEROUTPUT_AB_CD_SUM=           0x00L, // 3rd output is AB+CD
-    PS_COMBINEROUTPUT_AB_CD_MUX=           0x04L, // 3rd output is MUX(AB,CD) based on R0.a
-};
-
-enum PS_CHANNEL
-{
-    PS_CHANNEL_RGB=   0x00, // used as RGB source
-    PS_CHANNEL_BLUE=  0x00, // used as ALPHA source
-    PS_CHANNEL_ALPHA= 0x10, // used as RGB or ALPHA source
-};
-
-
 enum PS_FINALCOMBINERSETTING
 {
     PS_FINALCOMBINERSETTING_CLAMP_SUM=     0x80, // V1+R0 sum clamped to [0,1]
@@ -177,36 +98,15 @@ enum PS_DOTMAPPING
 
 // Structures to describe the PS definition
 
-struct InputInfo {
-    int reg, mod, chan;
-};
-
-struct InputVarInfo {
-    struct InputInfo a, b, c, d;
-};
-
-struct FCInputInfo {
-    struct InputInfo a, b, c, d, e, f, g;
-    bool v1r0_sum, clamp_sum, inv_v1, inv_r0, enabled;
-};
-
 struct OutputInfo {
     int ab, cd, muxsum, flags, ab_op, cd_op, muxsum_op,
         mapping, ab_alphablue, cd_alphablue;
 };
 
-struct PSStageInfo {
-    struct InputVarInfo rgb_input, alpha_input;
-    struct OutputInfo rgb_output, alpha_output;
-    int c0, c1;
-};
-
 struct PixelShader {
     PshState state;
 
-    int num_stages, flags;
-    struct PSStageInfo stage[8];
-    struct FCInputInfo final_input;
+    PshProgram prog;
     int tex_modes[4], input_tex[4], dot_map[4];
 
     MString *varE, *varF;
@@ -219,6 +119,11 @@ struct PixelShader {
     char const_refs[32][32];
 };
 
+// Register channels, as a bit mask
+#define PSH_CHAN_RGB   0x7
+#define PSH_CHAN_BLUE  0x4
+#define PSH_CHAN_ALPHA 0x8
+
 static void add_var_ref(struct PixelShader *ps, const char *var)
 {
     int i;
@@ -237,6 +142,66 @@ static void add_const_ref(struct PixelShader *ps, const char *var)
     strcpy((char*)ps->const_refs[ps->num_const_refs++], var);
 }
 
+// Value of the zero register after an input mapping
+static float psh_map_zero(int mod)
+{
+    switch (mod) {
+    case PS_INPUTMAPPING_UNSIGNED_INVERT:
+    case PS_INPUTMAPPING_EXPAND_NEGATE:
+        return 1.0f;
+    case PS_INPUTMAPPING_EXPAND_NORMAL:
+        return -1.0f;
+    case PS_INPUTMAPPING_HALFBIAS_NORMAL:
+        return -0.5f;
+    case PS_INPUTMAPPING_HALFBIAS_NEGATE:
+        return 0.5f;
+    default:
+        return 0.0f;
+    }
+}
+
+// Output mapping of a stage, see get_output()
+static float psh_map_output(float x, int mapping)
+{
+    switch (mapping) {
+    case PS_COMBINEROUTPUT_BIAS:
+        return x - 0.5f;
+    case PS_COMBINEROUTPUT_SHIFTLEFT_1:
+        return x * 2.0f;
+    case PS_COMBINEROUTPUT_SHIFTLEFT_1_BIAS:
+        return (x - 0.5f) * 2.0f;
+    case PS_COMBINEROUTPUT_SHIFTLEFT_2:
+        return x * 4.0f;
+    case PS_COMBINEROUTPUT_SHIFTRIGHT_1:
+        return x / 2.0f;
+    default:
+        return x;
+    }
+}
+
+// Value of a * b (or dot(a, b)) if it doesn't depend on any register
+static bool psh_fold_product(const PshInstr *instr, const PshInput *a,
+                             const PshInput *b, bool dot, float *value)
+{
+    if ((a->is_const && a->value == 0.0f)
+        || (b->is_const && b->value == 0.0f)) {
+        *value = 0.0f;
+        return true;
+    }
+    if (a->is_const && b->is_const) {
+        *value = a->value * b->value * (dot && !instr->is_alpha ? 3.0f : 1.0f);
+        return true;
+    }
+    return false;
+}
+
+static bool psh_product_is_zero(const PshInstr *instr, int i, bool dot)
+{
+    float value;
+    return psh_fold_product(instr, &instr->src[i], &instr->src[i + 1], dot,
+                            &value) && value == 0.0f;
+}
+
 // Get the code for a variable used in the program
 static MString* get_var(struct PixelShader *ps, int reg, bool is_dest)
 {
@@ -249,7 +214,7 @@ static MString* get_var(struct PixelShader *ps, int reg, bool is_dest)
         }
         break;
     case PS_REGISTER_C0:
-        if (ps->flags & PS_COMBINERCOUNT_UNIQUE_C0 || ps->cur_stage == 8) {
+        if (ps->prog.flags & PS_COMBINERCOUNT_UNIQUE_C0 || ps->cur_stage == 8) {
             MString *reg = mstring_from_fmt("c0_%d", ps->cur_stage);
             add_const_ref(ps, mstring_get_str(reg));
             return reg;
@@ -259,7 +224,7 @@ static MString* get_var(struct PixelShader *ps, int reg, bool is_dest)
         }
         break;
     case PS_REGISTER_C1:
-        if (ps->flags & PS_COMBINERCOUNT_UNIQUE_C1 || ps->cur_stage == 8) {
+        if (ps->prog.flags & PS_COMBINERCOUNT_UNIQUE_C1 || ps->cur_stage == 8) {
             MString *reg = mstring_from_fmt("c1_%d", ps->cur_stage);
             add_const_ref(ps, mstring_get_str(reg));
             return reg;
@@ -301,9 +266,25 @@ static MString* get_var(struct PixelShader *ps, int reg, bool is_dest)
     }
 }
 
+// Get the code for a folded constant
+static MString* get_const(float value, bool is_alpha)
+{
+    char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+    g_ascii_formatd(buf, sizeof(buf), "%.9g", value);
+    if (!strpbrk(buf, ".e")) {
+        g_strlcat(buf, ".0", sizeof(buf));
+    }
+    return mstring_from_fmt(is_alpha ? "%s" : "vec3(%s)", buf);
+}
+
 // Get input variable code
-static MString* get_input_var(struct PixelShader *ps, struct InputInfo in, bool is_alpha)
+static MString* get_input_var(struct PixelShader *ps, PshInput in, bool is_alpha)
 {
+    if (in.is_const) {
+        return get_const(in.value, is_alpha);
+    }
+
     MString *reg = get_var(ps, in.reg, false);
 
     if (!is_alpha) {
@@ -399,112 +380,112 @@ static MString* get_output(MString *reg, int mapping)
     return res;
 }
 
-// Add the GLSL code for a stage
-static void add_stage_code(struct PixelShader *ps,
-                           struct InputVarInfo input, struct OutputInfo output,
-                           const char *write_mask, bool is_alpha)
+// Get code for a * b, or dot(a, b), starting at input i of a stage write
+static MString* get_product(struct PixelShader *ps, const PshInstr *instr,
+                            int i, bool dot)
 {
-    MString *a = get_input_var(ps, input.a, is_alpha);
-    MString *b = get_input_var(ps, input.b, is_alpha);
-    MString *c = get_input_var(ps, input.c, is_alpha);
-    MString *d = get_input_var(ps, input.d, is_alpha);
-
-    const char *caster = "";
-    if (strlen(write_mask) == 3) {
-        caster = "vec3";
-    }
+    const PshInput *a = &instr->src[i];
+    const PshInput *b = &instr->src[i + 1];
+    float value;
 
-    MString *ab;
-    if (output.ab_op == PS_COMBINEROUTPUT_AB_DOT_PRODUCT) {
-        ab = mstring_from_fmt("dot(%s, %s)",
-                              mstring_get_str(a), mstring_get_str(b));
-    } else {
-        ab = mstring_from_fmt("(%s * %s)",
-                              mstring_get_str(a), mstring_get_str(b));
+    if (psh_fold_product(instr, a, b, dot, &value)) {
+        return get_const(value, instr->is_alpha);
     }
-
-    MString *cd;
-    if (output.cd_op == PS_COMBINEROUTPUT_CD_DOT_PRODUCT) {
-        cd = mstring_from_fmt("dot(%s, %s)",
-                              mstring_get_str(c), mstring_get_str(d));
-    } else {
-        cd = mstring_from_fmt("(%s * %s)",
-                              mstring_get_str(c), mstring_get_str(d));
+    if (!dot && a->is_const && a->value == 1.0f) {
+        return get_input_var(ps, *b, instr->is_alpha);
     }
-
-    MString *ab_mapping = get_output(ab, output.mapping);
-    MString *cd_mapping = get_output(cd, output.mapping);
-    MString *ab_dest = get_var(ps, output.ab, true);
-    MString *cd_dest = get_var(ps, output.cd, true);
-    MString *sum_dest = get_var(ps, output.muxsum, true);
-
-    if (mstring_get_length(ab_dest)) {
-        mstring_append_fmt(ps->code, "%s.%s = clamp(%s(%s), -1.0, 1.0);\n",
-                           mstring_get_str(ab_dest), write_mask, caster, mstring_get_str(ab_mapping));
-    } else {
-        mstring_unref(ab_dest);
-        mstring_ref(ab_mapping);
-        ab_dest = ab_mapping;
+    if (!dot && b->is_const && b->value == 1.0f) {
+        return get_input_var(ps, *a, instr->is_alpha);
     }
 
-    if (mstring_get_length(cd_dest)) {
-        mstring_append_fmt(ps->code, "%s.%s = clamp(%s(%s), -1.0, 1.0);\n",
-                           mstring_get_str(cd_dest), write_mask, caster, mstring_get_str(cd_mapping));
-    } else {
-        mstring_unref(cd_dest);
-        mstring_ref(cd_mapping);
-        cd_dest = cd_mapping;
-    }
+    MString *ma = get_input_var(ps, *a, instr->is_alpha);
+    MString *mb = get_input_var(ps, *b, instr->is_alpha);
+    MString *res = mstring_from_fmt(dot ? "dot(%s, %s)" : "(%s * %s)",
+                                    mstring_get_str(ma), mstring_get_str(mb));
+    mstring_unref(ma);
+    mstring_unref(mb);
+    return res;
+}
 
-    if (!is_alpha && output.flags & PS_COMBINEROUTPUT_AB_BLUE_TO_ALPHA) {
-        mstring_append_fmt(ps->code, "%s.a = %s.b;\n",
-                           mstring_get_str(ab_dest), mstring_get_str(ab_dest));
-    }
-    if (!is_alpha && output.flags & PS_COMBINEROUTPUT_CD_BLUE_TO_ALPHA) {
-        mstring_append_fmt(ps->code, "%s.a = %s.b;\n",
-                           mstring_get_str(cd_dest), mstring_get_str(cd_dest));
-    }
+// Add the GLSL code for a write of a combiner stage
+static void add_stage_code(struct PixelShader *ps, const PshInstr *instr)
+{
+    const char *write_mask = instr->is_alpha ? "a" : "rgb";
+    const char *caster = instr->is_alpha ? "" : "vec3";
+    MString *dest, *value, *ab, *cd;
 
-    MString *sum;
-    if (output.muxsum_op == PS_COMBINEROUTPUT_AB_CD_SUM) {
-        sum = mstring_from_fmt("(%s + %s)", mstring_get_str(ab), mstring_get_str(cd));
-    } else {
-        sum = mstring_from_fmt("((r0.a >= 0.5) ? %s(%s) : %s(%s))",
-                               caster, mstring_get_str(cd), caster, mstring_get_str(ab));
+    switch (instr->op) {
+    case PSH_OP_AB:
+        value = get_product(ps, instr, 0, instr->ab_dot);
+        break;
+    case PSH_OP_CD:
+        value = get_product(ps, instr, 2, instr->cd_dot);
+        break;
+    case PSH_OP_SUM:
+        if (psh_product_is_zero(instr, 0, instr->ab_dot)) {
+            value = get_product(ps, instr, 2, instr->cd_dot);
+        } else if (psh_product_is_zero(instr, 2, instr->cd_dot)) {
+            value = get_product(ps, instr, 0, instr->ab_dot);
+        } else {
+            ab = get_product(ps, instr, 0, instr->ab_dot);
+            cd = get_product(ps, instr, 2, instr->cd_dot);
+            value = mstring_from_fmt("(%s + %s)",
+                                     mstring_get_str(ab), mstring_get_str(cd));
+            mstring_unref(ab);
+            mstring_unref(cd);
+        }
+        break;
+    case PSH_OP_MUX:
+        ab = get_product(ps, instr, 0, instr->ab_dot);
+        cd = get_product(ps, instr, 2, instr->cd_dot);
+        add_var_ref(ps, "r0");
+        value = mstring_from_fmt("((r0.a >= 0.5) ? %s(%s) : %s(%s))",
+                                 caster, mstring_get_str(cd),
+                                 caster, mstring_get_str(ab));
+        mstring_unref(ab);
+        mstring_unref(cd);
+        break;
+    case PSH_OP_BLUE_TO_ALPHA:
+        dest = get_var(ps, instr->dest, true);
+        mstring_append_fmt(ps->code, "%s.a = %s.b;\n",
+                           mstring_get_str(dest), mstring_get_str(dest));
+        mstring_unref(dest);
+        return;
+    case PSH_OP_CONST:
+        dest = get_var(ps, instr->dest, true);
+        value = get_const(instr->value, instr->is_alpha);
+        mstring_append_fmt(ps->code, "%s.%s = %s;\n", mstring_get_str(dest),
+                           write_mask, mstring_get_str(value));
+        mstring_unref(dest);
+        mstring_unref(value);
+        return;
+    default:
+        assert(false);
+        return;
     }
 
-    MString *sum_mapping = get_output(sum, output.mapping);
-    if (mstring_get_length(sum_dest)) {
-        mstring_append_fmt(ps->code, "%s.%s = clamp(%s(%s), -1.0, 1.0);\n",
-                           mstring_get_str(sum_dest), write_mask, caster, mstring_get_str(sum_mapping));
-    }
+    MString *mapping = get_output(value, instr->mapping);
+    dest = get_var(ps, instr->dest, true);
+    mstring_append_fmt(ps->code, "%s.%s = clamp(%s(%s), -1.0, 1.0);\n",
+                       mstring_get_str(dest), write_mask, caster,
+                       mstring_get_str(mapping));
 
-    mstring_unref(a);
-    mstring_unref(b);
-    mstring_unref(c);
-    mstring_unref(d);
-    mstring_unref(ab);
-    mstring_unref(cd);
-    mstring_unref(ab_mapping);
-    mstring_unref(cd_mapping);
-    mstring_unref(ab_dest);
-    mstring_unref(cd_dest);
-    mstring_unref(sum_dest);
-    mstring_unref(sum);
-    mstring_unref(sum_mapping);
+    mstring_unref(value);
+    mstring_unref(mapping);
+    mstring_unref(dest);
 }
 
 // Add code for the final combiner stage
-static void add_final_stage_code(struct PixelShader *ps, struct FCInputInfo final)
+static void add_final_stage_code(struct PixelShader *ps, const PshInstr *final)
 {
-    ps->varE = get_input_var(ps, final.e, false);
-    ps->varF = get_input_var(ps, final.f, false);
+    ps->varE = get_input_var(ps, final->src[4], false);
+    ps->varF = get_input_var(ps, final->src[5], false);
 
-    MString *a = get_input_var(ps, final.a, false);
-    MString *b = get_input_var(ps, final.b, false);
-    MString *c = get_input_var(ps, final.c, false);
-    MString *d = get_input_var(ps, final.d, false);
-    MString *g = get_input_var(ps, final.g, true);
+    MString *a = get_input_var(ps, final->src[0], false);
+    MString *b = get_input_var(ps, final->src[1], false);
+    MString *c = get_input_var(ps, final->src[2], false);
+    MString *d = get_input_var(ps, final->src[3], false);
+    MString *g = get_input_var(ps, final->src[6], true);
 
     mstring_append_fmt(ps->code, "fragColor.rgb = %s + mix(vec3(%s), vec3(%s), vec3(%s));\n",
                        mstring_get_str(d), mstring_get_str(c),
@@ -874,17 +855,21 @@ static MString* psh_convert(struct PixelShader *ps)
         }
     }
 
-    for (i = 0; i < ps->num_stages; i++) {
+    const PshInstr *instr = ps->prog.instrs;
+    const PshInstr *end = instr + ps->prog.num_instrs;
+    for (i = 0; i < ps->prog.num_stages; i++) {
         ps->cur_stage = i;
         mstring_append_fmt(ps->code, "// Stage %d\n", i);
-        add_stage_code(ps, ps->stage[i].rgb_input, ps->stage[i].rgb_output, "rgb", false);
-        add_stage_code(ps, ps->stage[i].alpha_input, ps->stage[i].alpha_output, "a", true);
+        for (; instr < end && instr->stage == i; instr++) {
+            add_stage_code(ps, instr);
+        }
     }
 
-    if (ps->final_input.enabled) {
+    if (instr < end) {
+        assert(instr->op == PSH_OP_FINAL);
         ps->cur_stage = 8;
         mstring_append(ps->code, "// Final Combiner\n");
-        add_final_stage_code(ps, ps->final_input);
+        add_final_stage_code(ps, instr);
     }
 
     if (ps->state.alpha_test && ps->state.alpha_func != ALPHA_FUNC_ALWAYS) {
@@ -909,8 +894,14 @@ static MString* psh_convert(struct PixelShader *ps)
         }
     }
 
-    for (i = 0; i < ps->num_const_refs; i++) {
-        mstring_append_fmt(preflight, "uniform vec4 %s;\n", ps->const_refs[i]);
+    /* Combiner factors, see NV2A_UBO_PSH_CONSTANTS */
+    if (ps->num_const_refs) {
+        mstring_append(preflight, "layout(std140) uniform PshConstants {\n");
+        for (i = 0; i < 9; i++) {
+            mstring_append_fmt(preflight, "    vec4 c0_%d;\n    vec4 c1_%d;\n",
+                               i, i);
+        }
+        mstring_append(preflight, "};\n");
     }
 
     for (i = 0; i < ps->num_var_refs; i++) {
@@ -940,16 +931,17 @@ static MString* psh_convert(struct PixelShader *ps)
     return final;
 }
 
-static void parse_input(struct InputInfo *var, int value)
+static void parse_input(PshInput *var, int value)
 {
     var->reg = value & 0xF;
     var->chan = value & 0x10;
     var->mod = value & 0xE0;
+    var->is_const = false;
 }
 
 static void parse_combiner_inputs(uint32_t value,
-                                struct InputInfo *a, struct InputInfo *b,
-                                struct InputInfo *c, struct InputInfo *d)
+                                PshInput *a, PshInput *b,
+                                PshInput *c, PshInput *d)
 {
     parse_input(d, value & 0xFF);
     parse_input(c, (value >> 8) & 0xFF);
@@ -972,6 +964,251 @@ static void parse_combiner_output(uint32_t value, struct OutputInfo *out)
     out->cd_alphablue = flags & 0x40;
 }
 
+static void add_instr(PshProgram *prog, const PshInstr *proto,
+                      PshOpcode op, int dest)
+{
+    PshInstr *instr;
+
+    assert(prog->num_instrs < PSH_MAX_INSTRS);
+    instr = &prog->instrs[prog->num_instrs++];
+    *instr = *proto;
+    instr->op = op;
+    instr->dest = dest;
+}
+
+// Decode the RGB or alpha half of a stage, one instruction per kept output
+static void decode_stage(PshProgram *prog, int stage, bool is_alpha,
+                         uint32_t inputs, uint32_t outputs)
+{
+    PshInstr proto = { .stage = stage, .is_alpha = is_alpha };
+    struct OutputInfo out;
+
+    parse_combiner_inputs(inputs, &proto.src[0], &proto.src[1],
+                          &proto.src[2], &proto.src[3]);
+    parse_combiner_output(outputs, &out);
+    proto.mapping = out.mapping;
+    proto.ab_dot = out.ab_op == PS_COMBINEROUTPUT_AB_DOT_PRODUCT;
+    proto.cd_dot = out.cd_op == PS_COMBINEROUTPUT_CD_DOT_PRODUCT;
+
+    if (out.ab != PS_REGISTER_DISCARD) {
+        add_instr(prog, &proto, PSH_OP_AB, out.ab);
+    }
+    if (out.cd != PS_REGISTER_DISCARD) {
+        add_instr(prog, &proto, PSH_OP_CD, out.cd);
+    }
+    if (!is_alpha && out.ab_alphablue && out.ab != PS_REGISTER_DISCARD) {
+        add_instr(prog, &proto, PSH_OP_BLUE_TO_ALPHA, out.ab);
+    }
+    if (!is_alpha && out.cd_alphablue && out.cd != PS_REGISTER_DISCARD) {
+        add_instr(prog, &proto, PSH_OP_BLUE_TO_ALPHA, out.cd);
+    }
+    if (out.muxsum != PS_REGISTER_DISCARD) {
+        add_instr(prog, &proto,
+                  out.muxsum_op == PS_COMBINEROUTPUT_AB_CD_MUX ? PSH_OP_MUX
+                                                               : PSH_OP_SUM,
+                  out.muxsum);
+    }
+}
+
+void psh_decode(const PshState *state, PshProgram *prog)
+{
+    int i;
+
+    memset(prog, 0, sizeof(*prog));
+    prog->num_stages = MIN(state->combiner_control & 0xFF, 8);
+    prog->flags = state->combiner_control >> 8;
+
+    for (i = 0; i < prog->num_stages; i++) {
+        decode_stage(prog, i, false,
+                     state->rgb_inputs[i], state->rgb_outputs[i]);
+        decode_stage(prog, i, true,
+                     state->alpha_inputs[i], state->alpha_outputs[i]);
+    }
+
+    if (state->final_inputs_0 || state->final_inputs_1) {
+        PshInstr proto = { .stage = PSH_FINAL_STAGE };
+        PshInput blank;
+
+        parse_combiner_inputs(state->final_inputs_0,
+                              &proto.src[0], &proto.src[1],
+                              &proto.src[2], &proto.src[3]);
+        parse_combiner_inputs(state->final_inputs_1,
+                              &proto.src[4], &proto.src[5],
+                              &proto.src[6], &blank);
+        add_instr(prog, &proto, PSH_OP_FINAL, PS_REGISTER_DISCARD);
+    }
+}
+
+/*
+ * The zero register only ever yields a constant through the input mappings,
+ * so such inputs are replaced by their value. Writes whose result then no
+ * longer depends on any register become PSH_OP_CONST.
+ */
+static void psh_fold_constants(PshProgram *prog)
+{
+    int i, j;
+
+    for (i = 0; i < prog->num_instrs; i++) {
+        PshInstr *instr = &prog->instrs[i];
+        float ab, cd, value;
+        bool ab_const, cd_const;
+
+        for (j = 0; j < ARRAY_SIZE(instr->src); j++) {
+            PshInput *in = &instr->src[j];
+            if (!in->is_const && in->reg == PS_REGISTER_ZERO) {
+                in->is_const = true;
+                in->value = psh_map_zero(in->mod);
+            }
+        }
+
+        ab_const = psh_fold_product(instr, &instr->src[0], &instr->src[1],
+                                    instr->ab_dot, &ab);
+        cd_const = psh_fold_product(instr, &instr->src[2], &instr->src[3],
+                                    instr->cd_dot, &cd);
+
+        switch (instr->op) {
+        case PSH_OP_AB:
+            if (!ab_const) {
+                continue;
+            }
+            value = ab;
+            break;
+        case PSH_OP_CD:
+            if (!cd_const) {
+                continue;
+            }
+            value = cd;
+            break;
+        case PSH_OP_SUM:
+            if (!ab_const || !cd_const) {
+                continue;
+            }
+            value = ab + cd;
+            break;
+        case PSH_OP_MUX:
+            if (!ab_const || !cd_const || ab != cd) {
+                continue;
+            }
+            value = ab;
+            break;
+        default:
+            continue;
+        }
+
+        instr->op = PSH_OP_CONST;
+        instr->value = MIN(MAX(psh_map_output(value, instr->mapping), -1.0f),
+                           1.0f);
+    }
+}
+
+static bool psh_reg_is_writable(int reg)
+{
+    switch (reg) {
+    case PS_REGISTER_V0:
+    case PS_REGISTER_V1:
+    case PS_REGISTER_T0:
+    case PS_REGISTER_T1:
+    case PS_REGISTER_T2:
+    case PS_REGISTER_T3:
+    case PS_REGISTER_R0:
+    case PS_REGISTER_R1:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void psh_mark_read(uint8_t *live, const PshInput *in, bool is_alpha)
+{
+    if (in->is_const) {
+        return;
+    }
+
+    if (in->reg == PS_REGISTER_V1R0_SUM) {
+        live[PS_REGISTER_V1] |= PSH_CHAN_RGB;
+        live[PS_REGISTER_R0] |= PSH_CHAN_RGB;
+    } else if (in->chan == PS_CHANNEL_ALPHA) {
+        live[in->reg] |= PSH_CHAN_ALPHA;
+    } else {
+        live[in->reg] |= is_alpha ? PSH_CHAN_BLUE : PSH_CHAN_RGB;
+    }
+}
+
+/*
+ * Backwards liveness over the writable registers, per channel. Writes that
+ * are overwritten or never read again are removed. The final combiner reads
+ * all of its inputs; without one, r0 is what the combiners output.
+ */
+static void psh_eliminate_dead_code(PshProgram *prog)
+{
+    uint8_t live[16] = { 0 };
+    bool dead[PSH_MAX_INSTRS] = { false };
+    int i, j, n;
+
+    if (!prog->num_instrs
+        || prog->instrs[prog->num_instrs - 1].op != PSH_OP_FINAL) {
+        live[PS_REGISTER_R0] = PSH_CHAN_RGB | PSH_CHAN_ALPHA;
+    }
+
+    for (i = prog->num_instrs - 1; i >= 0; i--) {
+        const PshInstr *instr = &prog->instrs[i];
+        uint8_t written = instr->is_alpha
+                          || instr->op == PSH_OP_BLUE_TO_ALPHA
+                          ? PSH_CHAN_ALPHA : PSH_CHAN_RGB;
+
+        if (instr->op != PSH_OP_FINAL && psh_reg_is_writable(instr->dest)) {
+            if (!(live[instr->dest] & written)) {
+                dead[i] = true;
+                continue;
+            }
+            live[instr->dest] &= ~written;
+        }
+
+        switch (instr->op) {
+        case PSH_OP_AB:
+            psh_mark_read(live, &instr->src[0], instr->is_alpha);
+            psh_mark_read(live, &instr->src[1], instr->is_alpha);
+            break;
+        case PSH_OP_CD:
+            psh_mark_read(live, &instr->src[2], instr->is_alpha);
+            psh_mark_read(live, &instr->src[3], instr->is_alpha);
+            break;
+        case PSH_OP_MUX:
+            live[PS_REGISTER_R0] |= PSH_CHAN_ALPHA;
+            /* fall through */
+        case PSH_OP_SUM:
+            for (j = 0; j < 4; j++) {
+                psh_mark_read(live, &instr->src[j], instr->is_alpha);
+            }
+            break;
+        case PSH_OP_BLUE_TO_ALPHA:
+            live[instr->dest] |= PSH_CHAN_BLUE;
+            break;
+        case PSH_OP_FINAL:
+            for (j = 0; j < 7; j++) {
+                psh_mark_read(live, &instr->src[j], j == 6);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    n = 0;
+    for (i = 0; i < prog->num_instrs; i++) {
+        if (!dead[i]) {
+            prog->instrs[n++] = prog->instrs[i];
+        }
+    }
+    prog->num_instrs = n;
+}
+
+void psh_optimize(PshProgram *prog)
+{
+    psh_fold_constants(prog);
+    psh_eliminate_dead_code(prog);
+}
+
 MString *psh_translate(const PshState state)
 {
     int i;
@@ -980,8 +1217,9 @@ MString *psh_translate(const PshState state)
 
     ps.state = state;
 
-    ps.num_stages = state.combiner_control & 0xFF;
-    ps.flags = state.combiner_control >> 8;
+    psh_decode(&state, &ps.prog);
+    psh_optimize(&ps.prog);
+
     for (i = 0; i < 4; i++) {
         ps.tex_modes[i] = (state.shader_stage_program >> (i * 5)) & 0x1F;
     }
@@ -995,34 +1233,6 @@ MString *psh_translate(const PshState state)
     ps.input_tex[1] = 0;
     ps.input_tex[2] = (state.other_stage_input >> 16) & 0xF;
     ps.input_tex[3] = (state.other_stage_input >> 20) & 0xF;
-    for (i = 0; i < ps.num_stages; i++) {
-        parse_combiner_inputs(state.rgb_inputs[i],
-            &ps.stage[i].rgb_input.a, &ps.stage[i].rgb_input.b,
-            &ps.stage[i].rgb_input.c, &ps.stage[i].rgb_input.d);
-        parse_combiner_inputs(state.alpha_inputs[i],
-            &ps.stage[i].alpha_input.a, &ps.stage[i].alpha_input.b,
-            &ps.stage[i].alpha_input.c, &ps.stage[i].alpha_input.d);
-
-        parse_combiner_output(state.rgb_outputs[i], &ps.stage[i].rgb_output);
-        parse_combiner_output(state.alpha_outputs[i], &ps.stage[i].alpha_output);
-    }
-
-    struct InputInfo blank;
-    ps.final_input.enabled = state.final_inputs_0 || state.final_inputs_1;
-    if (ps.final_input.enabled) {
-        parse_combiner_inputs(state.final_inputs_0,
-                              &ps.final_input.a, &ps.final_input.b,
-                              &ps.final_input.c, &ps.final_input.d);
-        parse_combiner_inputs(state.final_inputs_1,
-                              &ps.final_input.e, &ps.final_input.f,
-                              &ps.final_input.g, &blank);
-        int flags = state.final_inputs_1 & 0xFF;
-        ps.final_input.clamp_sum = flags & PS_FINALCOMBINERSETTING_CLAMP_SUM;
-        ps.final_input.inv_v1 = flags & PS_FINALCOMBINERSETTING_COMPLEMENT_V1;
-        ps.final_input.inv_r0 = flags & PS_FINALCOMBINERSETTING_COMPLEMENT_R0;
-    }
-
-
 
     return psh_convert(&ps);
 }
@@ -63,6 +63,131 @@ typedef struct PshState {
     bool window_clip_exclusive;
 } PshState;
 
+enum PS_INPUTMAPPING
+{
+    PS_INPUTMAPPING_UNSIGNED_IDENTITY= 0x00L, // max(0,x)         OK for final combiner
+    PS_INPUTMAPPING_UNSIGNED_INVERT=   0x20L, // 1 - max(0,x)     OK for final combiner
+    PS_INPUTMAPPING_EXPAND_NORMAL=     0x40L, // 2*max(0,x) - 1   invalid for final combiner
+    PS_INPUTMAPPING_EXPAND_NEGATE=     0x60L, // 1 - 2*max(0,x)   invalid for final combiner
+    PS_INPUTMAPPING_HALFBIAS_NORMAL=   0x80L, // max(0,x) - 1/2   invalid for final combiner
+    PS_INPUTMAPPING_HALFBIAS_NEGATE=   0xa0L, // 1/2 - max(0,x)   invalid for final combiner
+    PS_INPUTMAPPING_SIGNED_IDENTITY=   0xc0L, // x                invalid for final combiner
+    PS_INPUTMAPPING_SIGNED_NEGATE=     0xe0L, // -x               invalid for final combiner
+};
+
+enum PS_REGISTER
+{
+    PS_REGISTER_ZERO=              0x00L, // r
+    PS_REGISTER_DISCARD=           0x00L, // w
+    PS_REGISTER_C0=                0x01L, // r
+    PS_REGISTER_C1=                0x02L, // r
+    PS_REGISTER_FOG=               0x03L, // r
+    PS_REGISTER_V0=                0x04L, // r/w
+    PS_REGISTER_V1=                0x05L, // r/w
+    PS_REGISTER_T0=                0x08L, // r/w
+    PS_REGISTER_T1=                0x09L, // r/w
+    PS_REGISTER_T2=                0x0aL, // r/w
+    PS_REGISTER_T3=                0x0bL, // r/w
+    PS_REGISTER_R0=                0x0cL, // r/w
+    PS_REGISTER_R1=                0x0dL, // r/w
+    PS_REGISTER_V1R0_SUM=          0x0eL, // r
+    PS_REGISTER_EF_PROD=           0x0fL, // r
+
+    PS_REGISTER_ONE=               PS_REGISTER_ZERO | PS_INPUTMAPPING_UNSIGNED_INVERT, // OK for final combiner
+    PS_REGISTER_NEGATIVE_ONE=      PS_REGISTER_ZERO | PS_INPUTMAPPING_EXPAND_NORMAL,   // invalid for final combiner
+    PS_REGISTER_ONE_HALF=          PS_REGISTER_ZERO | PS_INPUTMAPPING_HALFBIAS_NEGATE, // invalid for final combiner
+    PS_REGISTER_NEGATIVE_ONE_HALF= PS_REGISTER_ZERO | PS_INPUTMAPPING_HALFBIAS_NORMAL, // invalid for final combiner
+};
+
+enum PS_COMBINERCOUNTFLAGS
+{
+    PS_COMBINERCOUNT_MUX_LSB=     0x0000L, // mux on r0.a lsb
+    PS_COMBINERCOUNT_MUX_MSB=     0x0001L, // mux on r0.a msb
+
+    PS_COMBINERCOUNT_SAME_C0=     0x0000L, // c0 same in each stage
+    PS_COMBINERCOUNT_UNIQUE_C0=   0x0010L, // c0 unique in each stage
+
+    PS_COMBINERCOUNT_SAME_C1=     0x0000L, // c1 same in each stage
+    PS_COMBINERCOUNT_UNIQUE_C1=   0x0100L  // c1 unique in each stage
+};
+
+enum PS_COMBINEROUTPUT
+{
+    PS_COMBINEROUTPUT_IDENTITY=            0x00L, // y = x
+    PS_COMBINEROUTPUT_BIAS=                0x08L, // y = x - 0.5
+    PS_COMBINEROUTPUT_SHIFTLEFT_1=         0x10L, // y = x*2
+    PS_COMBINEROUTPUT_SHIFTLEFT_1_BIAS=    0x18L, // y = (x - 0.5)*2
+    PS_COMBINEROUTPUT_SHIFTLEFT_2=         0x20L, // y = x*4
+    PS_COMBINEROUTPUT_SHIFTRIGHT_1=        0x30L, // y = x/2
+
+    PS_COMBINEROUTPUT_AB_BLUE_TO_ALPHA=    0x80L, // RGB only
+
+    PS_COMBINEROUTPUT_CD_BLUE_TO_ALPHA=    0x40L, // RGB only
+
+    PS_COMBINEROUTPUT_AB_MULTIPLY=         0x00L,
+    PS_COMBINEROUTPUT_AB_DOT_PRODUCT=      0x02L, // RGB only
+
+    PS_COMBINEROUTPUT_CD_MULTIPLY=         0x00L,
+    PS_COMBINEROUTPUT_CD_DOT_PRODUCT=      0x01L, // RGB only
+
+    PS_COMBINEROUTPUT_AB_CD_SUM=           0x00L, // 3rd output is AB+CD
+    PS_COMBINEROUTPUT_AB_CD_MUX=           0x04L, // 3rd output is MUX(AB,CD) based on R0.a
+};
+
+enum PS_CHANNEL
+{
+    PS_CHANNEL_RGB=   0x00, // used as RGB source
+    PS_CHANNEL_BLUE=  0x00, // used as ALPHA source
+    PS_CHANNEL_ALPHA= 0x10, // used as RGB or ALPHA source
+};
+
+/*
+ * Register combiner IR. psh_decode() turns every write a combiner stage makes
+ * into one PshInstr, in the order the GLSL statements are emitted, and
+ * psh_optimize() folds the inputs that don't depend on any register and
+ * drops the writes nothing reads.
+ */
+
+#define PSH_FINAL_STAGE 8
+#define PSH_MAX_INSTRS  (8 * 2 * 5 + 1)
+
+typedef enum PshOpcode {
+    PSH_OP_AB,            /* dest = a * b, or dot(a, b) */
+    PSH_OP_CD,            /* dest = c * d, or dot(c, d) */
+    PSH_OP_BLUE_TO_ALPHA, /* dest.a = dest.b */
+    PSH_OP_SUM,           /* dest = ab + cd */
+    PSH_OP_MUX,           /* dest = r0.a >= 0.5 ? cd : ab */
+    PSH_OP_CONST,         /* dest = value, the result didn't depend on inputs */
+    PSH_OP_FINAL,         /* fragColor from the final combiner */
+} PshOpcode;
+
+typedef struct PshInput {
+    int reg, mod, chan;
+    bool is_const;        /* Folded, read value instead of reg */
+    float value;
+} PshInput;
+
+typedef struct PshInstr {
+    PshOpcode op;
+    int stage;            /* PSH_FINAL_STAGE for the final combiner */
+    bool is_alpha;
+    int dest;
+    int mapping;          /* PS_COMBINEROUTPUT_* output mapping */
+    bool ab_dot, cd_dot;
+    float value;          /* PSH_OP_CONST result, mapped and clamped */
+    PshInput src[7];      /* a, b, c, d; e, f, g in the final combiner */
+} PshInstr;
+
+typedef struct PshProgram {
+    int num_stages;
+    int flags;            /* PS_COMBINERCOUNT_* */
+    int num_instrs;
+    PshInstr instrs[PSH_MAX_INSTRS];
+} PshProgram;
+
+void psh_decode(const PshState *state, PshProgram *prog);
+void psh_optimize(PshProgram *prog);
+
 MString *psh_translate(const PshState state);
 
 #endif
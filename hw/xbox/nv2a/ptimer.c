@@ -63,6 +63,22 @@ uint64_t ptimer_read(void *opaque, hwaddr addr, unsigned int size)
     return r;
 }
 
+bool ptimer_fast_read(void *opaque, hwaddr addr, uint32_t *val)
+{
+    NV2AState *d = opaque;
+
+    switch (addr) {
+    case NV_PTIMER_TIME_0:
+        *val = (ptimer_get_clock(d) & 0x7ffffff) << 5;
+        return true;
+    case NV_PTIMER_TIME_1:
+        *val = (ptimer_get_clock(d) >> 27) & 0x1fffffff;
+        return true;
+    default:
+        return false;
+    }
+}
+
 void ptimer_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
 {
     NV2AState *d = opaque;
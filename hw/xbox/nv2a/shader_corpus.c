@@ -0,0 +1,328 @@
+/*
+ * QEMU Geforce NV2A shader corpus
+ *
+ * Each group of the key file is one shader. Register values are written as
+ * hex words so a corpus can be compared against register dumps by eye:
+ *
+ *   [shader.0]
+ *   vertex_program=true
+ *   z_perspective=false
+ *   program=0x00000000;0x00ec001b;0x0836186c;0x08c00000;...
+ *   combiner_control=0x00000001;
+ *   rgb_inputs=0x08040000;0x00000000;...
+ *   ...
+ *
+ * Fixed function shaders leave out the vertex program keys.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qapi/error.h"
+#include "shader_corpus.h"
+
+typedef struct CorpusField {
+    const char *key;
+    size_t offset;
+    size_t count;
+} CorpusField;
+
+#define PSH_FIELD(f) \
+    { stringify(f), offsetof(PshState, f), \
+      sizeof_field(PshState, f) / sizeof(((PshState *)0)->f[0]) }
+#define PSH_SCALAR(f) \
+    { stringify(f), offsetof(PshState, f), 1 }
+
+static const CorpusField psh_words[] = {
+    PSH_SCALAR(combiner_control),
+    PSH_SCALAR(shader_stage_program),
+    PSH_SCALAR(other_stage_input),
+    PSH_SCALAR(final_inputs_0),
+    PSH_SCALAR(final_inputs_1),
+    PSH_FIELD(rgb_inputs),
+    PSH_FIELD(rgb_outputs),
+    PSH_FIELD(alpha_inputs),
+    PSH_FIELD(alpha_outputs),
+};
+
+static const CorpusField psh_bools[] = {
+    PSH_SCALAR(point_sprite),
+    PSH_FIELD(rect_tex),
+    PSH_FIELD(snorm_tex),
+    { "compare_mode", offsetof(PshState, compare_mode),
+      sizeof_field(PshState, compare_mode) / sizeof(bool) },
+    PSH_FIELD(alphakill),
+    PSH_SCALAR(alpha_test),
+    PSH_SCALAR(window_clip_exclusive),
+};
+
+static void set_words(GKeyFile *kf, const char *group, const char *key,
+                      const uint32_t *words, size_t count)
+{
+    gchar **list = g_new0(gchar *, count + 1);
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        list[i] = g_strdup_printf("0x%08" PRIx32, words[i]);
+    }
+    g_key_file_set_string_list(kf, group, key, (const gchar * const *)list,
+                               count);
+    g_strfreev(list);
+}
+
+static void set_bools(GKeyFile *kf, const char *group, const char *key,
+                      const bool *values, size_t count)
+{
+    gboolean *list = g_new(gboolean, count);
+    size_t i;
+
+    for (i = 0; i < count; i++) {
+        list[i] = values[i];
+    }
+    g_key_file_set_boolean_list(kf, group, key, list, count);
+    g_free(list);
+}
+
+static void save_entry(GKeyFile *kf, const char *group,
+                       const ShaderCorpusEntry *entry)
+{
+    const PshState *psh = &entry->psh;
+    int conv_tex[ARRAY_SIZE(psh->conv_tex)];
+    size_t i;
+
+    g_key_file_set_boolean(kf, group, "vertex_program", entry->vertex_program);
+    if (entry->vertex_program) {
+        g_key_file_set_boolean(kf, group, "z_perspective",
+                               entry->z_perspective);
+        set_words(kf, group, "program", &entry->program_data[0][0],
+                  entry->program_length * VSH_TOKEN_SIZE);
+    }
+
+    for (i = 0; i < ARRAY_SIZE(psh_words); i++) {
+        set_words(kf, group, psh_words[i].key,
+                  (const uint32_t *)((const char *)psh + psh_words[i].offset),
+                  psh_words[i].count);
+    }
+    for (i = 0; i < ARRAY_SIZE(psh_bools); i++) {
+        set_bools(kf, group, psh_bools[i].key,
+                  (const bool *)((const char *)psh + psh_bools[i].offset),
+                  psh_bools[i].count);
+    }
+    for (i = 0; i < ARRAY_SIZE(conv_tex); i++) {
+        conv_tex[i] = psh->conv_tex[i];
+    }
+    g_key_file_set_integer_list(kf, group, "conv_tex", conv_tex,
+                                ARRAY_SIZE(conv_tex));
+    g_key_file_set_integer(kf, group, "alpha_func", psh->alpha_func);
+}
+
+bool shader_corpus_save(const char *path, const ShaderCorpusEntry *entries,
+                        size_t num_entries, Error **errp)
+{
+    GKeyFile *kf = g_key_file_new();
+    GError *gerr = NULL;
+    bool ok;
+    size_t i;
+
+    for (i = 0; i < num_entries; i++) {
+        gchar *group = g_strdup_printf("shader.%zu", i);
+        save_entry(kf, group, &entries[i]);
+        g_free(group);
+    }
+
+    ok = g_key_file_save_to_file(kf, path, &gerr);
+    if (!ok) {
+        error_setg(errp, "failed to write shader corpus %s: %s", path,
+                   gerr->message);
+        g_error_free(gerr);
+    }
+    g_key_file_free(kf);
+    return ok;
+}
+
+static bool get_words(GKeyFile *kf, const char *group, const char *key,
+                      uint32_t *words, size_t min_count, size_t max_count,
+                      size_t *count, Error **errp)
+{
+    GError *gerr = NULL;
+    gsize len;
+    gchar **list = g_key_file_get_string_list(kf, group, key, &len, &gerr);
+    size_t i;
+
+    if (!list) {
+        error_setg(errp, "[%s] %s", group, gerr->message);
+        g_error_free(gerr);
+        return false;
+    }
+    if (len < min_count || len > max_count) {
+        error_setg(errp, "[%s] %s has %zu words", group, key, (size_t)len);
+        g_strfreev(list);
+        return false;
+    }
+    for (i = 0; i < len; i++) {
+        unsigned int value;
+        if (qemu_strtoui(list[i], NULL, 16, &value) < 0) {
+            error_setg(errp, "[%s] %s: invalid word '%s'", group, key,
+                       list[i]);
+            g_strfreev(list);
+            return false;
+        }
+        words[i] = value;
+    }
+    g_strfreev(list);
+    if (count) {
+        *count = len;
+    }
+    return true;
+}
+
+static bool get_bools(GKeyFile *kf, const char *group, const char *key,
+                      bool *values, size_t count, Error **errp)
+{
+    GError *gerr = NULL;
+    gsize len;
+    gboolean *list = g_key_file_get_boolean_list(kf, group, key, &len, &gerr);
+    size_t i;
+
+    if (!list) {
+        error_setg(errp, "[%s] %s", group, gerr->message);
+        g_error_free(gerr);
+        return false;
+    }
+    if (len != count) {
+        error_setg(errp, "[%s] %s has %zu values, expected %zu", group, key,
+                   (size_t)len, count);
+        g_free(list);
+        return false;
+    }
+    for (i = 0; i < count; i++) {
+        values[i] = list[i];
+    }
+    g_free(list);
+    return true;
+}
+
+static bool load_entry(GKeyFile *kf, const char *group,
+                       ShaderCorpusEntry *entry, Error **errp)
+{
+    PshState *psh = &entry->psh;
+    GError *gerr = NULL;
+    gint *conv_tex;
+    gsize len;
+    size_t i, num_words;
+
+    memset(entry, 0, sizeof(*entry));
+
+    entry->vertex_program = g_key_file_get_boolean(kf, group,
+                                                   "vertex_program", &gerr);
+    if (gerr) {
+        goto fail_gerr;
+    }
+    if (entry->vertex_program) {
+        entry->z_perspective = g_key_file_get_boolean(kf, group,
+                                                      "z_perspective", &gerr);
+        if (gerr) {
+            goto fail_gerr;
+        }
+        if (!get_words(kf, group, "program", &entry->program_data[0][0],
+                       VSH_TOKEN_SIZE,
+                       NV2A_MAX_TRANSFORM_PROGRAM_LENGTH * VSH_TOKEN_SIZE,
+                       &num_words, errp)) {
+            return false;
+        }
+        if (num_words % VSH_TOKEN_SIZE) {
+            error_setg(errp, "[%s] program has a partial token", group);
+            return false;
+        }
+        entry->program_length = num_words / VSH_TOKEN_SIZE;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(psh_words); i++) {
+        if (!get_words(kf, group, psh_words[i].key,
+                       (uint32_t *)((char *)psh + psh_words[i].offset),
+                       psh_words[i].count, psh_words[i].count, NULL, errp)) {
+            return false;
+        }
+    }
+    for (i = 0; i < ARRAY_SIZE(psh_bools); i++) {
+        if (!get_bools(kf, group, psh_bools[i].key,
+                       (bool *)((char *)psh + psh_bools[i].offset),
+                       psh_bools[i].count, errp)) {
+            return false;
+        }
+    }
+
+    conv_tex = g_key_file_get_integer_list(kf, group, "conv_tex", &len, &gerr);
+    if (!conv_tex) {
+        goto fail_gerr;
+    }
+    if (len != ARRAY_SIZE(psh->conv_tex)) {
+        error_setg(errp, "[%s] conv_tex has %zu values", group, (size_t)len);
+        g_free(conv_tex);
+        return false;
+    }
+    for (i = 0; i < len; i++) {
+        psh->conv_tex[i] = conv_tex[i];
+    }
+    g_free(conv_tex);
+
+    psh->alpha_func = g_key_file_get_integer(kf, group, "alpha_func", &gerr);
+    if (gerr) {
+        goto fail_gerr;
+    }
+    return true;
+
+fail_gerr:
+    error_setg(errp, "[%s] %s", group, gerr->message);
+    g_error_free(gerr);
+    return false;
+}
+
+ShaderCorpusEntry *shader_corpus_load(const char *path, size_t *num_entries,
+                                      Error **errp)
+{
+    GKeyFile *kf = g_key_file_new();
+    ShaderCorpusEntry *entries = NULL;
+    GError *gerr = NULL;
+    gchar **groups = NULL;
+    gsize len;
+    size_t i;
+
+    *num_entries = 0;
+
+    if (!g_key_file_load_from_file(kf, path, G_KEY_FILE_NONE, &gerr)) {
+        error_setg(errp, "failed to read shader corpus %s: %s", path,
+                   gerr->message);
+        g_error_free(gerr);
+        goto out;
+    }
+
+    groups = g_key_file_get_groups(kf, &len);
+    entries = g_new(ShaderCorpusEntry, MAX(len, 1));
+    for (i = 0; i < len; i++) {
+        if (!load_entry(kf, groups[i], &entries[i], errp)) {
+            error_prepend(errp, "%s: ", path);
+            g_free(entries);
+            entries = NULL;
+            goto out;
+        }
+    }
+    *num_entries = len;
+
+out:
+    g_strfreev(groups);
+    g_key_file_free(kf);
+    return entries;
+}
@@ -0,0 +1,44 @@
+/*
+ * QEMU Geforce NV2A shader corpus
+ *
+ * A corpus holds the inputs of the vertex program and register combiner
+ * translators for a set of shaders, so they can be translated outside of a
+ * running title. It is a GKeyFile with one group per shader.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_NV2A_SHADER_CORPUS_H
+#define HW_NV2A_SHADER_CORPUS_H
+
+#include "nv2a_regs.h"
+#include "vsh.h"
+#include "psh.h"
+
+typedef struct ShaderCorpusEntry {
+    /* Fixed function shaders only carry the combiner state */
+    bool vertex_program;
+    bool z_perspective;
+    int program_length;
+    uint32_t program_data[NV2A_MAX_TRANSFORM_PROGRAM_LENGTH][VSH_TOKEN_SIZE];
+
+    PshState psh;
+} ShaderCorpusEntry;
+
+bool shader_corpus_save(const char *path, const ShaderCorpusEntry *entries,
+                        size_t num_entries, Error **errp);
+ShaderCorpusEntry *shader_corpus_load(const char *path, size_t *num_entries,
+                                      Error **errp);
+
+#endif
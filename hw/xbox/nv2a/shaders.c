@@ -25,51 +25,6 @@
 #include "shaders_common.h"
 #include "shaders.h"
 
-void mstring_append_fmt(MString *qstring, const char *fmt, ...)
-{
-    va_list ap;
-    va_start(ap, fmt);
-    mstring_append_va(qstring, fmt, ap);
-    va_end(ap);
-}
-
-MString *mstring_from_fmt(const char *fmt, ...)
-{
-    MString *ret = mstring_new();
-    va_list ap;
-    va_start(ap, fmt);
-    mstring_append_va(ret, fmt, ap);
-    va_end(ap);
-
-    return ret;
-}
-
-void mstring_append_va(MString *qstring, const char *fmt, va_list va)
-{
-    char scratch[256];
-
-    va_list ap;
-    va_copy(ap, va);
-    const int len = vsnprintf(scratch, sizeof(scratch), fmt, ap);
-    va_end(ap);
-
-    if (len == 0) {
-        return;
-    } else if (len < sizeof(scratch)) {
-        mstring_append(qstring, scratch);
-        return;
-    }
-
-    /* overflowed out scratch buffer, alloc and try again */
-    char *buf = g_malloc(len + 1);
-    va_copy(ap, va);
-    vsnprintf(buf, len + 1, fmt, ap);
-    va_end(ap);
-
-    mstring_append(qstring, buf);
-    g_free(buf);
-}
-
 static MString* generate_geometry_shader(
                                       enum ShaderPolygonMode polygon_front_mode,
                                       enum ShaderPolygonMode polygon_back_mode,
@@ -685,8 +640,10 @@ static MString *generate_vertex_shader(const ShaderState state,
 "uniform vec2 clipRange;\n"
 "uniform vec2 surfaceSize;\n"
 "\n"
-/* All constants in 1 array declaration */
-"uniform vec4 c[" stringify(NV2A_VERTEXSHADER_CONSTANTS) "];\n"
+/* All constants in 1 array declaration, see NV2A_UBO_VSH_CONSTANTS */
+"layout(std140) uniform VshConstants {\n"
+"    vec4 c[" stringify(NV2A_VERTEXSHADER_CONSTANTS) "];\n"
+"};\n"
 "\n"
 "uniform vec4 fogColor;\n"
 "uniform float fogParam[2];\n"
@@ -916,7 +873,7 @@ static GLuint create_gl_shader(GLenum gl_shader_type,
 
 ShaderBinding* generate_shaders(const ShaderState state)
 {
-    int i, j;
+    int i;
     char tmp[64];
 
     char vtx_prefix;
@@ -972,6 +929,16 @@ ShaderBinding* generate_shaders(const ShaderState state)
 
     glUseProgram(program);
 
+    /* bind constant blocks */
+    GLuint block_index = glGetUniformBlockIndex(program, "VshConstants");
+    if (block_index != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, block_index, NV2A_UBO_VSH_CONSTANTS);
+    }
+    block_index = glGetUniformBlockIndex(program, "PshConstants");
+    if (block_index != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, block_index, NV2A_UBO_PSH_CONSTANTS);
+    }
+
     /* set texture samplers */
     for (i = 0; i < NV2A_MAX_TEXTURES; i++) {
         char samplerName[16];
@@ -998,12 +965,6 @@ ShaderBinding* generate_shaders(const ShaderState state)
     ret->gl_primitive_mode = gl_primitive_mode;
 
     /* lookup fragment shader uniforms */
-    for (i = 0; i < 9; i++) {
-        for (j = 0; j < 2; j++) {
-            snprintf(tmp, sizeof(tmp), "c%d_%d", j, i);
-            ret->psh_constant_loc[i][j] = glGetUniformLocation(program, tmp);
-        }
-    }
     ret->alpha_ref_loc = glGetUniformLocation(program, "alphaRef");
     for (i = 1; i < NV2A_MAX_TEXTURES; i++) {
         snprintf(tmp, sizeof(tmp), "bumpMat%d", i);
@@ -1020,10 +981,6 @@ ShaderBinding* generate_shaders(const ShaderState state)
     }
 
     /* lookup vertex shader uniforms */
-    for(i = 0; i < NV2A_VERTEXSHADER_CONSTANTS; i++) {
-        snprintf(tmp, sizeof(tmp), "c[%d]", i);
-        ret->vsh_constant_loc[i] = glGetUniformLocation(program, tmp);
-    }
     ret->surface_size_loc = glGetUniformLocation(program, "surfaceSize");
     ret->clip_range_loc = glGetUniformLocation(program, "clipRange");
     ret->fog_color_loc = glGetUniformLocation(program, "fogColor");
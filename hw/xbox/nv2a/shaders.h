@@ -97,11 +97,19 @@ typedef struct ShaderState {
     float point_params[8];
 } ShaderState;
 
+/*
+ * Uniform buffer binding points of the std140 constant blocks shared by all
+ * generated programs:
+ *   VshConstants: vec4 c[NV2A_VERTEXSHADER_CONSTANTS]
+ *   PshConstants: vec4 c0_0, c1_0, ... c0_8, c1_8 (combiner factors)
+ */
+#define NV2A_UBO_VSH_CONSTANTS 0
+#define NV2A_UBO_PSH_CONSTANTS 1
+
 typedef struct ShaderBinding {
     GLuint gl_program;
     GLenum gl_primitive_mode;
 
-    GLint psh_constant_loc[9][2];
     GLint alpha_ref_loc;
 
     GLint bump_mat_loc[NV2A_MAX_TEXTURES];
@@ -112,9 +120,6 @@ typedef struct ShaderBinding {
     GLint surface_size_loc;
     GLint clip_range_loc;
 
-    GLint vsh_constant_loc[NV2A_VERTEXSHADER_CONSTANTS];
-    uint32_t vsh_constants[NV2A_VERTEXSHADER_CONSTANTS][4];
-
     GLint inv_viewport_loc;
     GLint ltctxa_loc[NV2A_LTCTXA_COUNT];
     GLint ltctxb_loc[NV2A_LTCTXB_COUNT];
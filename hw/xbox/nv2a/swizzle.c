@@ -31,12 +31,12 @@
  * If there are no bits left from any component it will pack the other masks
  * more tighly (Example: zzxzxzyx = Fewer x than z and even fewer y)
  */
-static void generate_swizzle_masks(unsigned int width,
-                                   unsigned int height,
-                                   unsigned int depth,
-                                   uint32_t* mask_x,
-                                   uint32_t* mask_y,
-                                   uint32_t* mask_z)
+void generate_swizzle_masks(unsigned int width,
+                            unsigned int height,
+                            unsigned int depth,
+                            uint32_t* mask_x,
+                            uint32_t* mask_y,
+                            uint32_t* mask_z)
 {
     uint32_t x = 0, y = 0, z = 0;
     uint32_t bit = 1;
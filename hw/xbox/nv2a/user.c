@@ -70,6 +70,33 @@ uint64_t user_read(void *opaque, hwaddr addr, unsigned int size)
     return r;
 }
 
+bool user_fast_read(void *opaque, hwaddr addr, uint32_t *val)
+{
+    NV2AState *d = (NV2AState *)opaque;
+
+    unsigned int channel_id = addr >> 16;
+    uint32_t channel_modes = qatomic_read(&d->pfifo.regs[NV_PFIFO_MODE]);
+    unsigned int cur_channel_id =
+        GET_MASK(qatomic_read(&d->pfifo.regs[NV_PFIFO_CACHE1_PUSH1]),
+                 NV_PFIFO_CACHE1_PUSH1_CHID);
+
+    /* Only the active DMA channel is backed by CACHE1 */
+    if (!(channel_modes & (1 << channel_id)) || channel_id != cur_channel_id) {
+        return false;
+    }
+
+    switch (addr & 0xFFFF) {
+    case NV_USER_DMA_PUT:
+        *val = qatomic_read(&d->pfifo.regs[NV_PFIFO_CACHE1_DMA_PUT]);
+        return true;
+    case NV_USER_DMA_GET:
+        *val = qatomic_read(&d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET]);
+        return true;
+    default:
+        return false;
+    }
+}
+
 void user_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
 {
     NV2AState *d = (NV2AState *)opaque;
@@ -95,6 +122,7 @@ void user_write(void *opaque, hwaddr addr, uint64_t val, unsigned int size)
                 break;
             case NV_USER_DMA_GET:
                 d->pfifo.regs[NV_PFIFO_CACHE1_DMA_GET] = val;
+                pfifo_reset_dma_state(d);
                 break;
             case NV_USER_REF:
                 d->pfifo.regs[NV_PFIFO_CACHE1_REF] = val;
@@ -38,13 +38,6 @@
 #define VSH_D3DSCM_CORRECTION 96
 
 
-typedef enum {
-    PARAM_UNKNOWN = 0,
-    PARAM_R,
-    PARAM_V,
-    PARAM_C
-} VshParameterType;
-
 typedef enum {
     OUTPUT_C = 0,
     OUTPUT_O
@@ -55,41 +48,6 @@ typedef enum {
     OMUX_ILU
 } VshOutputMux;
 
-typedef enum {
-    ILU_NOP = 0,
-    ILU_MOV,
-    ILU_RCP,
-    ILU_RCC,
-    ILU_RSQ,
-    ILU_EXP,
-    ILU_LOG,
-    ILU_LIT
-} VshILU;
-
-typedef enum {
-    MAC_NOP,
-    MAC_MOV,
-    MAC_MUL,
-    MAC_ADD,
-    MAC_MAD,
-    MAC_DP3,
-    MAC_DPH,
-    MAC_DP4,
-    MAC_DST,
-    MAC_MIN,
-    MAC_MAX,
-    MAC_SLT,
-    MAC_SGE,
-    MAC_ARL
-} VshMAC;
-
-typedef enum {
-    SWIZZLE_X = 0,
-    SWIZZLE_Y,
-    SWIZZLE_Z,
-    SWIZZLE_W
-} VshSwizzle;
-
 
 typedef struct VshFieldMapping {
     VshFieldName field_name;
@@ -291,108 +249,67 @@ static int16_t convert_c_register(const int16_t c_reg)
 }
 
 
-
-static MString* decode_swizzle(const uint32_t *shader_token,
-                               VshFieldName swizzle_field)
+static void decode_src(const uint32_t *shader_token,
+                       VshSrc *src,
+                       VshParameterType param,
+                       VshFieldName neg_field,
+                       int reg_num)
 {
-    const char* swizzle_str = "xyzw";
-    VshSwizzle x, y, z, w;
-
-    /* some microcode instructions force a scalar value */
-    if (swizzle_field == FLD_C_SWZ_X
-        && ilu_force_scalar[vsh_get_field(shader_token, FLD_ILU)]) {
-        x = y = z = w = vsh_get_field(shader_token, swizzle_field);
-    } else {
-        x = vsh_get_field(shader_token, swizzle_field++);
-        y = vsh_get_field(shader_token, swizzle_field++);
-        z = vsh_get_field(shader_token, swizzle_field++);
-        w = vsh_get_field(shader_token, swizzle_field);
-    }
-
-    if (x == SWIZZLE_X && y == SWIZZLE_Y
-        && z == SWIZZLE_Z && w == SWIZZLE_W) {
-        /* Don't print the swizzle if it's .xyzw */
-        return mstring_from_str(""); // Will turn ".xyzw" into "."
-    /* Don't print duplicates */
-    } else if (x == y && y == z && z == w) {
-        return mstring_from_str((char[]){'.', swizzle_str[x], '\0'});
-    } else if (y == z && z == w) {
-        return mstring_from_str((char[]){'.',
-            swizzle_str[x], swizzle_str[y], '\0'});
-    } else if (z == w) {
-        return mstring_from_str((char[]){'.',
-            swizzle_str[x], swizzle_str[y], swizzle_str[z], '\0'});
-    } else {
-        return mstring_from_str((char[]){'.',
-                                       swizzle_str[x], swizzle_str[y],
-                                       swizzle_str[z], swizzle_str[w],
-                                       '\0'}); // Normal swizzle mask
-    }
-}
-
-static MString* decode_opcode_input(const uint32_t *shader_token,
-                                    VshParameterType param,
-                                    VshFieldName neg_field,
-                                    int reg_num)
-{
-    /* This function decodes a vertex shader opcode parameter into a string.
-     * Input A, B or C is controlled via the Param and NEG fieldnames,
+    /* Input A, B or C is controlled via the param and neg fieldnames,
      * the R-register address for each input is already given by caller. */
+    VshFieldName swizzle_field = neg_field + 1;
+    int i;
 
-    MString *ret_str = mstring_new();
+    src->type = param;
+    src->neg = vsh_get_field(shader_token, neg_field) > 0;
+    src->relative = false;
 
-
-    if (vsh_get_field(shader_token, neg_field) > 0) {
-        mstring_append_chr(ret_str, '-');
-    }
-
-    /* PARAM_R uses the supplied reg_num, but the other two need to be
-     * determined */
-    char tmp[40];
     switch (param) {
     case PARAM_R:
-        snprintf(tmp, sizeof(tmp), "R%d", reg_num);
+        src->index = reg_num;
         break;
     case PARAM_V:
-        reg_num = vsh_get_field(shader_token, FLD_V);
-        snprintf(tmp, sizeof(tmp), "v%d", reg_num);
+        src->index = vsh_get_field(shader_token, FLD_V);
         break;
     case PARAM_C:
-        reg_num = convert_c_register(vsh_get_field(shader_token, FLD_CONST));
-        if (vsh_get_field(shader_token, FLD_A0X) > 0) {
-            //FIXME: does this really require the "correction" doe in convert_c_register?!
-            snprintf(tmp, sizeof(tmp), "c[A0+%d]", reg_num);
-        } else {
-            snprintf(tmp, sizeof(tmp), "c[%d]", reg_num);
-        }
+        src->index = convert_c_register(vsh_get_field(shader_token, FLD_CONST));
+        //FIXME: does this really require the "correction" doe in convert_c_register?!
+        src->relative = vsh_get_field(shader_token, FLD_A0X) > 0;
         break;
     default:
         fprintf(stderr, "Unknown vs param: 0x%x\n", param);
         assert(false);
         break;
     }
-    mstring_append(ret_str, tmp);
 
-    {
-        /* swizzle bits are next to the neg bit */
-        MString *swizzle_str = decode_swizzle(shader_token, neg_field+1);
-        mstring_append(ret_str, mstring_get_str(swizzle_str));
-        mstring_unref(swizzle_str);
+    /* some microcode instructions force a scalar value */
+    if (swizzle_field == FLD_C_SWZ_X
+        && ilu_force_scalar[vsh_get_field(shader_token, FLD_ILU)]) {
+        for (i = 0; i < 4; i++) {
+            src->swizzle[i] = vsh_get_field(shader_token, swizzle_field);
+        }
+    } else {
+        for (i = 0; i < 4; i++) {
+            src->swizzle[i] = vsh_get_field(shader_token, swizzle_field + i);
+        }
     }
-
-    return ret_str;
 }
 
-
-static MString* decode_opcode(const uint32_t *shader_token,
-                              VshOutputMux out_mux,
-                              uint32_t mask,
-                              const char *opcode,
-                              const char *inputs)
+static void decode_dests(const uint32_t *shader_token,
+                         VshOutputMux out_mux,
+                         uint8_t mask,
+                         VshInstr *instr)
 {
-    MString *ret = mstring_new();
     int reg_num = vsh_get_field(shader_token, FLD_OUT_R);
 
+    instr->num_dests = 0;
+
+    if (!instr->is_ilu && instr->opcode == MAC_ARL) {
+        /* ARL only ever targets the address register */
+        instr->dest[instr->num_dests++] = (VshDest){ DEST_A0, 0, VSH_MASK_X };
+        return;
+    }
+
     /* Test for paired opcodes (in other words : Are both <> NOP?) */
     if (out_mux == OMUX_MAC
           &&  vsh_get_field(shader_token, FLD_ILU) != ILU_NOP
@@ -409,119 +326,363 @@ static MString* decode_opcode(const uint32_t *shader_token,
     if (vsh_get_field(shader_token, FLD_OUT_MUX) == out_mux
         /* Only if it's not masked away: */
         && vsh_get_field(shader_token, FLD_OUT_O_MASK) != 0) {
-
-        mstring_append(ret, "  ");
-        mstring_append(ret, opcode);
-        mstring_append(ret, "(");
+        VshDest *dest = &instr->dest[instr->num_dests++];
+        int address = vsh_get_field(shader_token, FLD_OUT_ADDRESS);
 
         if (vsh_get_field(shader_token, FLD_OUT_ORB) == OUTPUT_C) {
             /* TODO : Emulate writeable const registers */
-            mstring_append(ret, "c");
-            mstring_append_int(ret,
-                convert_c_register(
-                    vsh_get_field(shader_token, FLD_OUT_ADDRESS)));
+            dest->type = DEST_C;
+            dest->index = convert_c_register(address);
         } else {
-            mstring_append(ret,
-                out_reg_name[
-                    vsh_get_field(shader_token, FLD_OUT_ADDRESS) & 0xF]);
+            dest->type = DEST_O;
+            dest->index = address & 0xF;
         }
-        mstring_append(ret,
-            mask_str[
-                vsh_get_field(shader_token, FLD_OUT_O_MASK)]);
-        mstring_append(ret, inputs);
-        mstring_append(ret, ");\n");
+        dest->mask = vsh_get_field(shader_token, FLD_OUT_O_MASK);
     }
 
-    if (strcmp(opcode, mac_opcode[MAC_ARL]) == 0) {
-        mstring_append_fmt(ret, "  ARL(A0%s);\n", inputs);
-    } else if (mask > 0) {
-        mstring_append_fmt(ret, "  %s(R%d%s%s);\n",
-                           opcode, reg_num, mask_str[mask], inputs);
+    if (mask > 0) {
+        instr->dest[instr->num_dests++] = (VshDest){ DEST_R, reg_num, mask };
     }
-
-    return ret;
 }
 
-
-static MString* decode_token(const uint32_t *shader_token)
+static void decode_token(const uint32_t *shader_token, int slot,
+                         VshProgram *prog)
 {
-    MString *ret;
-
     /* See what MAC opcode is written to (if not masked away): */
     VshMAC mac = vsh_get_field(shader_token, FLD_MAC);
     /* See if a ILU opcode is present too: */
     VshILU ilu = vsh_get_field(shader_token, FLD_ILU);
     if (mac == MAC_NOP && ilu == ILU_NOP) {
-        return mstring_new();
+        return;
     }
 
     /* Since it's potentially used twice, decode input C once: */
-    MString *input_c =
-        decode_opcode_input(shader_token,
-                            vsh_get_field(shader_token, FLD_C_MUX),
-                            FLD_C_NEG,
-                            (vsh_get_field(shader_token, FLD_C_R_HIGH) << 2)
-                                | vsh_get_field(shader_token, FLD_C_R_LOW));
+    VshSrc input_c;
+    decode_src(shader_token, &input_c,
+               vsh_get_field(shader_token, FLD_C_MUX),
+               FLD_C_NEG,
+               (vsh_get_field(shader_token, FLD_C_R_HIGH) << 2)
+                   | vsh_get_field(shader_token, FLD_C_R_LOW));
 
     if (mac != MAC_NOP) {
-        MString *inputs_mac = mstring_new();
+        VshInstr *instr = &prog->instrs[prog->num_instrs++];
+        instr->slot = slot;
+        instr->is_ilu = false;
+        instr->opcode = mac;
+        instr->num_srcs = 0;
         if (mac_opcode_params[mac].A) {
-            MString *input_a =
-                decode_opcode_input(shader_token,
-                                    vsh_get_field(shader_token, FLD_A_MUX),
-                                    FLD_A_NEG,
-                                    vsh_get_field(shader_token, FLD_A_R));
-            mstring_append(inputs_mac, ", ");
-            mstring_append(inputs_mac, mstring_get_str(input_a));
-            mstring_unref(input_a);
+            decode_src(shader_token, &instr->src[instr->num_srcs++],
+                       vsh_get_field(shader_token, FLD_A_MUX),
+                       FLD_A_NEG,
+                       vsh_get_field(shader_token, FLD_A_R));
         }
         if (mac_opcode_params[mac].B) {
-            MString *input_b =
-                decode_opcode_input(shader_token,
-                                    vsh_get_field(shader_token, FLD_B_MUX),
-                                    FLD_B_NEG,
-                                    vsh_get_field(shader_token, FLD_B_R));
-            mstring_append(inputs_mac, ", ");
-            mstring_append(inputs_mac, mstring_get_str(input_b));
-            mstring_unref(input_b);
+            decode_src(shader_token, &instr->src[instr->num_srcs++],
+                       vsh_get_field(shader_token, FLD_B_MUX),
+                       FLD_B_NEG,
+                       vsh_get_field(shader_token, FLD_B_R));
         }
         if (mac_opcode_params[mac].C) {
-            mstring_append(inputs_mac, ", ");
-            mstring_append(inputs_mac, mstring_get_str(input_c));
+            instr->src[instr->num_srcs++] = input_c;
         }
-
-        /* Then prepend these inputs with the actual opcode, mask, and input : */
-        ret = decode_opcode(shader_token,
-                            OMUX_MAC,
-                            vsh_get_field(shader_token, FLD_OUT_MAC_MASK),
-                            mac_opcode[mac],
-                            mstring_get_str(inputs_mac));
-        mstring_unref(inputs_mac);
-    } else {
-        ret = mstring_new();
+        decode_dests(shader_token, OMUX_MAC,
+                     vsh_get_field(shader_token, FLD_OUT_MAC_MASK), instr);
     }
 
     if (ilu != ILU_NOP) {
-        MString *inputs_c = mstring_from_str(", ");
-        mstring_append(inputs_c, mstring_get_str(input_c));
+        VshInstr *instr = &prog->instrs[prog->num_instrs++];
+        instr->slot = slot;
+        instr->is_ilu = true;
+        instr->opcode = ilu;
+        instr->num_srcs = 1;
+        instr->src[0] = input_c;
+        decode_dests(shader_token, OMUX_ILU,
+                     vsh_get_field(shader_token, FLD_OUT_ILU_MASK), instr);
+    }
+}
+
+static uint8_t vsh_write_mask(const VshInstr *instr)
+{
+    uint8_t mask = 0;
+    int i;
+    for (i = 0; i < instr->num_dests; i++) {
+        mask |= instr->dest[i].mask;
+    }
+    return mask;
+}
+
+/* Components of a source (before swizzling) that affect the written ones */
+static uint8_t vsh_src_components(const VshInstr *instr, int src_index,
+                                  uint8_t mask)
+{
+    if (mask == 0) {
+        return 0;
+    }
+
+    if (instr->is_ilu) {
+        switch (instr->opcode) {
+        case ILU_MOV:
+            return mask;
+        case ILU_LIT: {
+            uint8_t comps = 0;
+            if (mask & VSH_MASK_Y) {
+                comps |= VSH_MASK_X;
+            }
+            if (mask & VSH_MASK_Z) {
+                comps |= VSH_MASK_X | VSH_MASK_Y | VSH_MASK_W;
+            }
+            return comps;
+        }
+        default:
+            /* Scalar opcodes only look at the first component */
+            return VSH_MASK_X;
+        }
+    }
+
+    switch (instr->opcode) {
+    case MAC_DP3:
+        return VSH_MASK_X | VSH_MASK_Y | VSH_MASK_Z;
+    case MAC_DPH:
+        return src_index == 0 ? VSH_MASK_X | VSH_MASK_Y | VSH_MASK_Z
+                              : VSH_MASK_ALL;
+    case MAC_DP4:
+        return VSH_MASK_ALL;
+    case MAC_DST:
+        return src_index == 0 ? mask & (VSH_MASK_Y | VSH_MASK_Z)
+                              : mask & (VSH_MASK_Y | VSH_MASK_W);
+    case MAC_ARL:
+        return VSH_MASK_X;
+    default:
+        /* Component-wise opcodes */
+        return mask;
+    }
+}
+
+/* Register components read through the source swizzle */
+static uint8_t vsh_src_read_mask(const VshSrc *src, uint8_t comps)
+{
+    uint8_t mask = 0;
+    int i;
+    for (i = 0; i < 4; i++) {
+        if (comps & VSH_MASK_COMPONENT(i)) {
+            mask |= VSH_MASK_COMPONENT(src->swizzle[i]);
+        }
+    }
+    return mask;
+}
+
+/*
+ * Backwards liveness over the temporary registers. Temporary components that
+ * are overwritten or never read again are dropped from the write masks, and
+ * instructions left without any destination are removed. Outputs, constants,
+ * A0 and R12 (which aliases oPos) are always live.
+ */
+static void vsh_eliminate_dead_code(VshProgram *prog)
+{
+    uint8_t live[16] = { 0 };
+    int i, j, n;
+
+    for (i = prog->num_instrs - 1; i >= 0; i--) {
+        VshInstr *instr = &prog->instrs[i];
+
+        n = 0;
+        for (j = 0; j < instr->num_dests; j++) {
+            VshDest dest = instr->dest[j];
+            if (dest.type == DEST_R && dest.index != VSH_R_OPOS) {
+                uint8_t written = dest.mask;
+                dest.mask &= live[dest.index];
+                live[dest.index] &= ~written;
+                if (dest.mask == 0) {
+                    continue;
+                }
+            }
+            instr->dest[n++] = dest;
+        }
+        instr->num_dests = n;
+
+        uint8_t mask = vsh_write_mask(instr);
+        for (j = 0; j < instr->num_srcs; j++) {
+            const VshSrc *src = &instr->src[j];
+            if (src->type == PARAM_R) {
+                live[src->index] |= vsh_src_read_mask(
+                    src, vsh_src_components(instr, j, mask));
+            }
+        }
+    }
+
+    n = 0;
+    for (i = 0; i < prog->num_instrs; i++) {
+        if (prog->instrs[i].num_dests > 0) {
+            prog->instrs[n++] = prog->instrs[i];
+        }
+    }
+    prog->num_instrs = n;
+}
+
+/*
+ * Rewrite swizzle components the instruction never reads so the swizzle is
+ * either dropped (identity on everything read) or printed in its shortest
+ * form; _in() pads short swizzles with their last component.
+ */
+static void vsh_simplify_swizzles(VshProgram *prog)
+{
+    int i, j, k;
+
+    for (i = 0; i < prog->num_instrs; i++) {
+        VshInstr *instr = &prog->instrs[i];
+        uint8_t mask = vsh_write_mask(instr);
+
+        for (j = 0; j < instr->num_srcs; j++) {
+            VshSwizzle *swizzle = instr->src[j].swizzle;
+            uint8_t comps = vsh_src_components(instr, j, mask);
+            bool identity = true;
+            int last = -1;
+
+            for (k = 0; k < 4; k++) {
+                if (comps & VSH_MASK_COMPONENT(k)) {
+                    identity &= swizzle[k] == k;
+                    last = k;
+                }
+            }
+            if (identity || last < 0) {
+                for (k = 0; k < 4; k++) {
+                    swizzle[k] = k;
+                }
+                continue;
+            }
+
+            for (k = last + 1; k < 4; k++) {
+                swizzle[k] = swizzle[last];
+            }
+            for (k = last - 1; k >= 0; k--) {
+                if (!(comps & VSH_MASK_COMPONENT(k))) {
+                    swizzle[k] = swizzle[k + 1];
+                }
+            }
+        }
+    }
+}
+
+void vsh_decode(const uint32_t *tokens, unsigned int length,
+                VshProgram *prog)
+{
+    bool has_final = false;
+    int slot;
+
+    prog->num_slots = 0;
+    prog->num_instrs = 0;
+    prog->instrs = g_new(VshInstr, length * 2);
+
+    for (slot = 0; slot < length; slot++) {
+        const uint32_t* cur_token = &tokens[slot * VSH_TOKEN_SIZE];
+        decode_token(cur_token, slot, prog);
+        prog->num_slots = slot + 1;
+
+        if (vsh_get_field(cur_token, FLD_FINAL)) {
+            has_final = true;
+            break;
+        }
+    }
+    assert(has_final);
+}
+
+void vsh_optimize(VshProgram *prog)
+{
+    vsh_eliminate_dead_code(prog);
+    vsh_simplify_swizzles(prog);
+}
+
+static void emit_swizzle(MString *out, const VshSwizzle *s)
+{
+    const char* swizzle_str = "xyzw";
+
+    if (s[0] == SWIZZLE_X && s[1] == SWIZZLE_Y
+        && s[2] == SWIZZLE_Z && s[3] == SWIZZLE_W) {
+        /* Don't print the swizzle if it's .xyzw */
+        return;
+    }
+
+    mstring_append_chr(out, '.');
+    mstring_append_chr(out, swizzle_str[s[0]]);
+    /* Don't print duplicates */
+    if (s[0] == s[1] && s[1] == s[2] && s[2] == s[3]) {
+        return;
+    }
+    mstring_append_chr(out, swizzle_str[s[1]]);
+    if (s[1] == s[2] && s[2] == s[3]) {
+        return;
+    }
+    mstring_append_chr(out, swizzle_str[s[2]]);
+    if (s[2] == s[3]) {
+        return;
+    }
+    mstring_append_chr(out, swizzle_str[s[3]]);
+}
 
-        /* Append the ILU opcode, mask and (the already determined) input C: */
-        MString *ilu_op =
-            decode_opcode(shader_token,
-                          OMUX_ILU,
-                          vsh_get_field(shader_token, FLD_OUT_ILU_MASK),
-                          ilu_opcode[ilu],
-                          mstring_get_str(inputs_c));
+static void emit_src(MString *out, const VshSrc *src)
+{
+    if (src->neg) {
+        mstring_append_chr(out, '-');
+    }
 
-        mstring_append(ret, mstring_get_str(ilu_op));
+    switch (src->type) {
+    case PARAM_R:
+        mstring_append_fmt(out, "R%d", src->index);
+        break;
+    case PARAM_V:
+        mstring_append_fmt(out, "v%d", src->index);
+        break;
+    case PARAM_C:
+        mstring_append_fmt(out, src->relative ? "c[A0+%d]" : "c[%d]",
+                           src->index);
+        break;
+    default:
+        assert(false);
+        break;
+    }
+
+    emit_swizzle(out, src->swizzle);
+}
 
-        mstring_unref(inputs_c);
-        mstring_unref(ilu_op);
+static void emit_instr(MString *body, const VshInstr *instr)
+{
+    const char *opcode = instr->is_ilu ? ilu_opcode[instr->opcode]
+                                       : mac_opcode[instr->opcode];
+    MString *inputs = mstring_new();
+    int i;
+
+    for (i = 0; i < instr->num_srcs; i++) {
+        mstring_append(inputs, ", ");
+        emit_src(inputs, &instr->src[i]);
     }
 
-    mstring_unref(input_c);
+    for (i = 0; i < instr->num_dests; i++) {
+        const VshDest *dest = &instr->dest[i];
+        switch (dest->type) {
+        case DEST_A0:
+            mstring_append_fmt(body, "  ARL(A0%s);\n",
+                               mstring_get_str(inputs));
+            break;
+        case DEST_O:
+            mstring_append_fmt(body, "  %s(%s%s%s);\n", opcode,
+                               out_reg_name[dest->index],
+                               mask_str[dest->mask],
+                               mstring_get_str(inputs));
+            break;
+        case DEST_C:
+            mstring_append_fmt(body, "  %s(c%d%s%s);\n", opcode,
+                               dest->index, mask_str[dest->mask],
+                               mstring_get_str(inputs));
+            break;
+        case DEST_R:
+            mstring_append_fmt(body, "  %s(R%d%s%s);\n", opcode,
+                               dest->index, mask_str[dest->mask],
+                               mstring_get_str(inputs));
+            break;
+        }
+    }
 
-    return ret;
+    mstring_unref(inputs);
 }
 
 static const char* vsh_header =
@@ -728,26 +889,25 @@ void vsh_translate(uint16_t version,
 
     mstring_append(header, vsh_header);
 
-    bool has_final = false;
-    int slot;
-    for (slot=0; slot < length; slot++) {
+    VshProgram prog;
+    vsh_decode(tokens, length, &prog);
+    vsh_optimize(&prog);
+
+    int i = 0, slot;
+    for (slot = 0; slot < prog.num_slots; slot++) {
         const uint32_t* cur_token = &tokens[slot * VSH_TOKEN_SIZE];
-        MString *token_str = decode_token(cur_token);
         mstring_append_fmt(body,
                            "  /* Slot %d: 0x%08X 0x%08X 0x%08X 0x%08X */",
                            slot,
                            cur_token[0],cur_token[1],cur_token[2],cur_token[3]);
         mstring_append(body, "\n");
-        mstring_append(body, mstring_get_str(token_str));
-        mstring_append(body, "\n");
-        mstring_unref(token_str);
-
-        if (vsh_get_field(cur_token, FLD_FINAL)) {
-            has_final = true;
-            break;
+        for (; i < prog.num_instrs && prog.instrs[i].slot == slot; i++) {
+            emit_instr(body, &prog.instrs[i]);
         }
+        mstring_append(body, "\n");
     }
-    assert(has_final);
+
+    g_free(prog.instrs);
 
     /* pre-divide and output the generated W so we can do persepctive correct
      * interpolation manually. OpenGL can't, since we give it a W of 1 to work
@@ -128,8 +128,111 @@ typedef enum {
     FLD_FINAL
 } VshFieldName;
 
+typedef enum {
+    PARAM_UNKNOWN = 0,
+    PARAM_R,
+    PARAM_V,
+    PARAM_C
+} VshParameterType;
+
+typedef enum {
+    ILU_NOP = 0,
+    ILU_MOV,
+    ILU_RCP,
+    ILU_RCC,
+    ILU_RSQ,
+    ILU_EXP,
+    ILU_LOG,
+    ILU_LIT
+} VshILU;
+
+typedef enum {
+    MAC_NOP,
+    MAC_MOV,
+    MAC_MUL,
+    MAC_ADD,
+    MAC_MAD,
+    MAC_DP3,
+    MAC_DPH,
+    MAC_DP4,
+    MAC_DST,
+    MAC_MIN,
+    MAC_MAX,
+    MAC_SLT,
+    MAC_SGE,
+    MAC_ARL
+} VshMAC;
+
+typedef enum {
+    SWIZZLE_X = 0,
+    SWIZZLE_Y,
+    SWIZZLE_Z,
+    SWIZZLE_W
+} VshSwizzle;
+
+/*
+ * Vertex programs are decoded into a small in-memory IR before any GLSL is
+ * generated, so that the program can be inspected and trimmed as a whole.
+ * Each MAC or ILU half of a microcode slot becomes one VshInstr. Both of its
+ * possible destinations (the temporary register and the muxed output or
+ * constant register) hang off the same instruction, since they are fed by a
+ * single evaluation of the opcode.
+ */
+
+typedef enum {
+    DEST_R,
+    DEST_O,
+    DEST_C,
+    DEST_A0
+} VshDestType;
+
+typedef struct VshSrc {
+    VshParameterType type;
+    int index;
+    bool relative;
+    bool neg;
+    VshSwizzle swizzle[4];
+} VshSrc;
+
+typedef struct VshDest {
+    VshDestType type;
+    int index;
+    uint8_t mask; /* Component mask, same layout as mask_str */
+} VshDest;
+
+typedef struct VshInstr {
+    int slot;
+    bool is_ilu;
+    int opcode; /* VshMAC or VshILU, depending on is_ilu */
+    int num_srcs;
+    VshSrc src[3];
+    int num_dests;
+    VshDest dest[2];
+} VshInstr;
+
+typedef struct VshProgram {
+    int num_slots;
+    int num_instrs;
+    VshInstr *instrs;
+} VshProgram;
+
+#define VSH_MASK_COMPONENT(c) (0x8 >> (c))
+#define VSH_MASK_X   0x8
+#define VSH_MASK_Y   0x4
+#define VSH_MASK_Z   0x2
+#define VSH_MASK_W   0x1
+#define VSH_MASK_ALL 0xF
+
+/* R12 is a mirror of oPos, so it is never a plain temporary */
+#define VSH_R_OPOS 12
+
 uint8_t vsh_get_field(const uint32_t *shader_token, VshFieldName field_name);
 
+/* prog->instrs is allocated here, the caller g_free()s it */
+void vsh_decode(const uint32_t *tokens, unsigned int length,
+                VshProgram *prog);
+void vsh_optimize(VshProgram *prog);
+
 void vsh_translate(uint16_t version,
                    const uint32_t *tokens,
                    unsigned int length,
@@ -25,6 +25,7 @@
 #include "hw/qdev-properties.h"
 #include "net/net.h"
 #include "qemu/iov.h"
+#include "qemu/timer.h"
 #include "migration/vmstate.h"
 
 #define IOPORT_SIZE 0x8
@@ -242,6 +243,10 @@ enum {
 #define RX_ALLOC_BUFSIZE      (DEFAULT_MTU + 128)
 #define TX_ALLOC_BUFSIZE      (DEFAULT_MTU + 128)
 
+/* How long to wait before looking for a free rx descriptor again when the
+ * guest has refilled the ring without touching any register */
+#define RX_RETRY_DELAY_US     1000
+
 #define OOM_REFILL            (1 + HZ / 20)
 #define POLL_WAIT             (1 + HZ / 100)
 
@@ -272,6 +277,14 @@ enum {
  * Primary State Structure
  ******************************************************************************/
 
+#pragma pack(1)
+struct RingDesc {
+    uint32_t packet_buffer;
+    uint16_t length;
+    uint16_t flags;
+};
+#pragma pack()
+
 typedef struct NvNetState {
     /*< private >*/
     PCIDevice parent_obj;
@@ -291,18 +304,23 @@ typedef struct NvNetState {
     uint32_t     tx_dma_buf_offset;
     uint8_t      rx_dma_buf[RX_ALLOC_BUFSIZE];
 
+    /* Next rx descriptor, read ahead by nvnet_can_receive() */
+    struct RingDesc rx_desc;
+    bool         rx_desc_valid;
+    QEMUTimer    *rx_retry_timer;
+
+    /* Interrupt moderation */
+    QEMUTimer    *irq_timer;
+    uint32_t     irq_pending;
+    uint32_t     irq_pending_frames;
+    bool         irq_batching;
+    uint32_t     coalesce_usecs;
+    uint32_t     coalesce_frames;
+
     FILE         *packet_dump_file;
     char         *packet_dump_path;
 } NvNetState;
 
-#pragma pack(1)
-struct RingDesc {
-    uint32_t packet_buffer;
-    uint16_t length;
-    uint16_t flags;
-};
-#pragma pack()
-
 /*******************************************************************************
  * Helper Macros
  ******************************************************************************/
@@ -346,6 +364,10 @@ static void nvnet_set_link_status(NetClientState *nc);
 
 /* Interrupts */
 static void nvnet_update_irq(NvNetState *s);
+static void nvnet_post_irq(NvNetState *s, uint32_t bits);
+static void nvnet_flush_irq(NvNetState *s);
+static void nvnet_moderate_irq(NvNetState *s);
+static void nvnet_irq_timer_cb(void *opaque);
 
 /* Packet Tx / Rx */
 static void nvnet_send_packet(NvNetState *s,
@@ -353,6 +375,9 @@ static void nvnet_send_packet(NvNetState *s,
 static ssize_t nvnet_dma_packet_to_guest(NvNetState *s,
     const uint8_t *buf, size_t size);
 static ssize_t nvnet_dma_packet_from_guest(NvNetState *s);
+static bool nvnet_read_rx_desc(NvNetState *s);
+static void nvnet_flush_rx(NvNetState *s);
+static void nvnet_rx_retry_cb(void *opaque);
 static bool nvnet_can_receive(NetClientState *nc);
 static ssize_t nvnet_receive(NetClientState *nc,
     const uint8_t *buf, size_t size);
@@ -390,6 +415,61 @@ static void nvnet_update_irq(NvNetState *s)
     }
 }
 
+/*
+ * Post interrupt status bits for a completed frame. The bits reach
+ * NvRegIrqStatus once enough frames have completed or the coalescing delay
+ * has passed, and at the latest when the current receive batch ends.
+ */
+static void nvnet_post_irq(NvNetState *s, uint32_t bits)
+{
+    s->irq_pending |= bits;
+    s->irq_pending_frames++;
+
+    if (!s->irq_batching) {
+        nvnet_moderate_irq(s);
+    }
+}
+
+/*
+ * Deliver any posted interrupt status bits now.
+ */
+static void nvnet_flush_irq(NvNetState *s)
+{
+    timer_del(s->irq_timer);
+
+    if (!s->irq_pending) {
+        return;
+    }
+
+    NVNET_DPRINTF("Triggering interrupt (%d frames)\n", s->irq_pending_frames);
+    uint32_t irq_status = nvnet_get_reg(s, NvRegIrqStatus, 4);
+    nvnet_set_reg(s, NvRegIrqStatus, irq_status | s->irq_pending, 4);
+    s->irq_pending = 0;
+    s->irq_pending_frames = 0;
+    nvnet_update_irq(s);
+}
+
+static void nvnet_moderate_irq(NvNetState *s)
+{
+    if (!s->irq_pending) {
+        return;
+    }
+
+    if (s->coalesce_usecs == 0 ||
+        (s->coalesce_frames && s->irq_pending_frames >= s->coalesce_frames)) {
+        nvnet_flush_irq(s);
+    } else if (!timer_pending(s->irq_timer)) {
+        timer_mod(s->irq_timer, qemu_clock_get_us(QEMU_CLOCK_VIRTUAL) +
+                                s->coalesce_usecs);
+    }
+}
+
+static void nvnet_irq_timer_cb(void *opaque)
+{
+    NvNetState *s = opaque;
+    nvnet_flush_irq(s);
+}
+
 /*******************************************************************************
  * Register Control
  ******************************************************************************/
@@ -557,6 +637,14 @@ static void nvnet_mmio_write(void *opaque, hwaddr addr,
         nvnet_set_reg(s, addr, val, size);
         s->rx_ring_size = ((val >> NVREG_RINGSZ_RXSHIFT) & 0xffff) + 1;
         s->tx_ring_size = ((val >> NVREG_RINGSZ_TXSHIFT) & 0xffff) + 1;
+        s->rx_desc_valid = false;
+        nvnet_flush_rx(s);
+        break;
+
+    case NvRegRxRingPhysAddr:
+        nvnet_set_reg(s, addr, val, size);
+        s->rx_desc_valid = false;
+        nvnet_flush_rx(s);
         break;
 
     case NvRegMIIData:
@@ -570,6 +658,7 @@ static void nvnet_mmio_write(void *opaque, hwaddr addr,
             nvnet_dump_ring_descriptors(s);
 #endif
             nvnet_dma_packet_from_guest(s);
+            nvnet_flush_rx(s);
         }
 
         if (val & NVREG_TXRXCTL_BIT2) {
@@ -580,6 +669,7 @@ static void nvnet_mmio_write(void *opaque, hwaddr addr,
         if (val & NVREG_TXRXCTL_RESET) {
             s->tx_ring_index = 0;
             s->rx_ring_index = 0;
+            s->rx_desc_valid = false;
             s->tx_dma_buf_offset = 0;
         }
 
@@ -608,6 +698,8 @@ static void nvnet_mmio_write(void *opaque, hwaddr addr,
     case NvRegIrqStatus:
         nvnet_set_reg(s, addr, nvnet_get_reg(s, addr, size) & ~val, size);
         nvnet_update_irq(s);
+        /* The guest has likely processed and refilled the rx ring */
+        nvnet_flush_rx(s);
         break;
 
     default:
@@ -634,10 +726,85 @@ static void nvnet_send_packet(NvNetState *s, const uint8_t *buf, int size)
     qemu_send_packet(nc, buf, size);
 }
 
+/*
+ * Make sure the descriptor at the current rx ring index is cached, returning
+ * whether it is available to receive a packet.
+ */
+static bool nvnet_read_rx_desc(NvNetState *s)
+{
+    PCIDevice *d = PCI_DEVICE(s);
+
+    if (s->rx_desc_valid) {
+        return true;
+    }
+
+    dma_addr_t rx_ring_addr = nvnet_get_reg(s, NvRegRxRingPhysAddr, 4);
+    if (s->rx_ring_size == 0 || rx_ring_addr == 0) {
+        return false;
+    }
+
+    s->rx_ring_index %= s->rx_ring_size;
+    rx_ring_addr += s->rx_ring_index * sizeof(s->rx_desc);
+    pci_dma_read(d, rx_ring_addr, &s->rx_desc, sizeof(s->rx_desc));
+    NVNET_DPRINTF("RX: Looking at ring descriptor %d (0x%llx): ",
+                  s->rx_ring_index, rx_ring_addr);
+    NVNET_DPRINTF("Buffer: 0x%x, ", s->rx_desc.packet_buffer);
+    NVNET_DPRINTF("Length: 0x%x, ", s->rx_desc.length);
+    NVNET_DPRINTF("Flags: 0x%x\n", s->rx_desc.flags);
+
+    /* Descriptors the guest has handed over stay ours until we complete
+     * them, so only those are safe to keep */
+    s->rx_desc_valid = s->rx_desc.flags & NV_RX_AVAIL;
+    return s->rx_desc_valid;
+}
+
+/*
+ * Deliver packets queued while the rx ring was full, raising one interrupt
+ * for the whole batch.
+ */
+static void nvnet_flush_rx(NvNetState *s)
+{
+    if (s->irq_batching) {
+        return;
+    }
+
+    s->irq_batching = true;
+    qemu_flush_queued_packets(qemu_get_queue(s->nic));
+    s->irq_batching = false;
+
+    nvnet_moderate_irq(s);
+}
+
+static void nvnet_rx_retry_cb(void *opaque)
+{
+    NvNetState *s = opaque;
+    nvnet_flush_rx(s);
+}
+
 static bool nvnet_can_receive(NetClientState *nc)
 {
+    NvNetState *s = qemu_get_nic_opaque(nc);
+
     NVNET_DPRINTF("nvnet_can_receive called\n");
-    return 1;
+
+    /* Packets arriving before the driver has set up a ring are dropped */
+    if (s->rx_ring_size == 0 ||
+        nvnet_get_reg(s, NvRegRxRingPhysAddr, 4) == 0) {
+        return true;
+    }
+
+    if (nvnet_read_rx_desc(s)) {
+        return true;
+    }
+
+    /* Ring is full. The net layer holds on to packets until we flush, which
+     * happens once the guest touches the controller or after a short delay
+     * in case it refills the ring silently. */
+    if (!timer_pending(s->rx_retry_timer)) {
+        timer_mod(s->rx_retry_timer, qemu_clock_get_us(QEMU_CLOCK_VIRTUAL) +
+                                     RX_RETRY_DELAY_US);
+    }
+    return false;
 }
 
 static ssize_t nvnet_receive(NetClientState *nc,
@@ -683,86 +850,76 @@ static ssize_t nvnet_dma_packet_to_guest(NvNetState *s,
                                          const uint8_t *buf, size_t size)
 {
     PCIDevice *d = PCI_DEVICE(s);
-    struct RingDesc desc;
-    int i;
-    bool did_receive = false;
+    struct RingDesc *desc = &s->rx_desc;
+
+    if (!nvnet_read_rx_desc(s)) {
+        if (s->rx_ring_size == 0 ||
+            nvnet_get_reg(s, NvRegRxRingPhysAddr, 4) == 0) {
+            NVNET_DPRINTF("No rx ring, dropping packet\n");
+            return size;
+        }
+
+        /* Could not find free buffer, queue it until the guest has one */
+        NVNET_DPRINTF("Could not find free buffer!\n");
+        return 0;
+    }
 
     nvnet_set_reg(s, NvRegTxRxControl,
         nvnet_get_reg(s, NvRegTxRxControl, 4) & ~NVREG_TXRXCTL_IDLE,
         4);
 
-    for (i = 0; i < s->rx_ring_size; i++) {
-        /* Read current ring descriptor */
-        s->rx_ring_index %= s->rx_ring_size;
-        dma_addr_t rx_ring_addr = nvnet_get_reg(s, NvRegRxRingPhysAddr, 4);
-        rx_ring_addr += s->rx_ring_index * sizeof(desc);
-        pci_dma_read(d, rx_ring_addr, &desc, sizeof(desc));
-        NVNET_DPRINTF("RX: Looking at ring descriptor %d (0x%llx): ",
-                      s->rx_ring_index, rx_ring_addr);
-        NVNET_DPRINTF("Buffer: 0x%x, ", desc.packet_buffer);
-        NVNET_DPRINTF("Length: 0x%x, ", desc.length);
-        NVNET_DPRINTF("Flags: 0x%x\n", desc.flags);
-
-        if (!(desc.flags & NV_RX_AVAIL)) {
-            break;
-        }
+    assert((desc->length+1) >= size); // FIXME
 
-        assert((desc.length+1) >= size); // FIXME
+    dma_addr_t rx_ring_addr = nvnet_get_reg(s, NvRegRxRingPhysAddr, 4);
+    rx_ring_addr += s->rx_ring_index * sizeof(*desc);
+    s->rx_ring_index = (s->rx_ring_index + 1) % s->rx_ring_size;
+    s->rx_desc_valid = false;
 
-        s->rx_ring_index += 1;
+    /* Transfer packet from device to memory */
+    NVNET_DPRINTF("Transferring packet, size 0x%zx, to memory at 0x%x\n",
+                  size, desc->packet_buffer);
+    pci_dma_write(d, desc->packet_buffer, buf, size);
 
-        /* Transfer packet from device to memory */
-        NVNET_DPRINTF("Transferring packet, size 0x%zx, to memory at 0x%x\n",
-                      size, desc.packet_buffer);
-        pci_dma_write(d, desc.packet_buffer, buf, size);
+    /* Update descriptor indicating the packet is waiting */
+    desc->length = size;
+    desc->flags  = NV_RX_BIT4 | NV_RX_DESCRIPTORVALID;
+    pci_dma_write(d, rx_ring_addr, desc, sizeof(*desc));
+    NVNET_DPRINTF("Updated ring descriptor: ");
+    NVNET_DPRINTF("Length: 0x%x, ", desc->length);
+    NVNET_DPRINTF("Flags: 0x%x\n", desc->flags);
 
-        /* Update descriptor indicating the packet is waiting */
-        desc.length = size;
-        desc.flags  = NV_RX_BIT4 | NV_RX_DESCRIPTORVALID;
-        pci_dma_write(d, rx_ring_addr, &desc, sizeof(desc));
-        NVNET_DPRINTF("Updated ring descriptor: ");
-        NVNET_DPRINTF("Length: 0x%x, ", desc.length);
-        NVNET_DPRINTF("Flags: 0x%x\n", desc.flags);
-
-        /* Trigger interrupt */
-        NVNET_DPRINTF("Triggering interrupt\n");
-        uint32_t irq_status = nvnet_get_reg(s, NvRegIrqStatus, 4);
-        nvnet_set_reg(s, NvRegIrqStatus, irq_status | NVREG_IRQSTAT_BIT1, 4);
-        nvnet_update_irq(s);
-        did_receive = true;
-        break;
-    }
+    nvnet_post_irq(s, NVREG_IRQSTAT_BIT1);
 
     nvnet_set_reg(s, NvRegTxRxControl,
         nvnet_get_reg(s, NvRegTxRxControl, 4) | NVREG_TXRXCTL_IDLE,
         4);
 
-    if (did_receive) {
-        return size;
-    } else {
-        /* Could not find free buffer, or packet too large. */
-        NVNET_DPRINTF("Could not find free buffer!\n");
-        return -1;
-    }
+    return size;
 }
 
+/*
+ * Send every packet the guest has queued on the tx ring, completing the
+ * batch with a single interrupt.
+ */
 static ssize_t nvnet_dma_packet_from_guest(NvNetState *s)
 {
     PCIDevice *d = PCI_DEVICE(s);
     struct RingDesc desc;
     bool is_last_packet;
-    bool packet_sent = false;
+    int packets_sent = 0;
     int i;
 
     nvnet_set_reg(s, NvRegTxRxControl,
         nvnet_get_reg(s, NvRegTxRxControl, 4) & ~NVREG_TXRXCTL_IDLE,
         4);
 
+    dma_addr_t tx_ring_base = nvnet_get_reg(s, NvRegTxRingPhysAddr, 4);
+
     for (i = 0; i < s->tx_ring_size; i++) {
         /* Read ring descriptor */
         s->tx_ring_index %= s->tx_ring_size;
-        dma_addr_t tx_ring_addr = nvnet_get_reg(s, NvRegTxRingPhysAddr, 4);
-        tx_ring_addr += s->tx_ring_index * sizeof(desc);
+        dma_addr_t tx_ring_addr = tx_ring_base +
+                                  s->tx_ring_index * sizeof(desc);
         pci_dma_read(d, tx_ring_addr, &desc, sizeof(desc));
         NVNET_DPRINTF("TX: Looking at ring desc %d (%llx): ",
                       s->tx_ring_index, tx_ring_addr);
@@ -789,7 +946,7 @@ static ssize_t nvnet_dma_packet_from_guest(NvNetState *s)
             NVNET_DPRINTF("Sending packet...\n");
             nvnet_send_packet(s, s->tx_dma_buf, s->tx_dma_buf_offset);
             s->tx_dma_buf_offset = 0;
-            packet_sent = true;
+            packets_sent++;
         }
 
         desc.flags &= ~(NV_TX_VALID | NV_TX_RETRYERROR | NV_TX_DEFERRED |
@@ -797,19 +954,12 @@ static ssize_t nvnet_dma_packet_from_guest(NvNetState *s)
             NV_TX_ERROR);
         desc.length = desc.length + 5;
         pci_dma_write(d, tx_ring_addr, &desc, sizeof(desc));
-
-        if (is_last_packet) {
-            // FIXME
-            break;
-        }
     }
 
     /* Trigger interrupt */
-    if (packet_sent) {
-        NVNET_DPRINTF("Triggering interrupt\n");
-        uint32_t irq_status = nvnet_get_reg(s, NvRegIrqStatus, 4);
-        nvnet_set_reg(s, NvRegIrqStatus, irq_status | NVREG_IRQSTAT_BIT4, 4);
-        nvnet_update_irq(s);
+    if (packets_sent) {
+        NVNET_DPRINTF("Sent %d packets\n", packets_sent);
+        nvnet_post_irq(s, NVREG_IRQSTAT_BIT4);
     }
 
     nvnet_set_reg(s, NvRegTxRxControl,
@@ -893,6 +1043,9 @@ static void nvnet_realize(PCIDevice *pci_dev, Error **errp)
     s->tx_ring_index = 0;
     s->tx_ring_size  = 0;
 
+    s->rx_retry_timer = timer_new_us(QEMU_CLOCK_VIRTUAL, nvnet_rx_retry_cb, s);
+    s->irq_timer = timer_new_us(QEMU_CLOCK_VIRTUAL, nvnet_irq_timer_cb, s);
+
     memory_region_init_io(&s->mmio, OBJECT(dev), &nvnet_mmio_ops, s,
         "nvnet-mmio", MMIO_SIZE);
     pci_register_bar(d, 0, PCI_BASE_ADDRESS_SPACE_MEMORY, &s->mmio);
@@ -915,6 +1068,9 @@ static void nvnet_uninit(PCIDevice *dev)
         fclose(s->packet_dump_file);
     }
 
+    timer_free(s->rx_retry_timer);
+    timer_free(s->irq_timer);
+
     // memory_region_destroy(&s->mmio);
     // memory_region_destroy(&s->io);
     qemu_del_nic(s->nic);
@@ -941,6 +1097,11 @@ static void nvnet_reset(void *opaque)
     memset(&s->tx_dma_buf, 0, sizeof(s->tx_dma_buf));
     s->tx_dma_buf_offset = 0;
     memset(&s->rx_dma_buf, 0, sizeof(s->rx_dma_buf));
+    s->rx_desc_valid = false;
+    timer_del(s->rx_retry_timer);
+    timer_del(s->irq_timer);
+    s->irq_pending = 0;
+    s->irq_pending_frames = 0;
 }
 
 static void qdev_nvnet_reset(DeviceState *dev)
@@ -1098,10 +1259,54 @@ static void nvnet_dump_ring_descriptors(NvNetState *s)
  * Properties
  ******************************************************************************/
 
+static int nvnet_pre_load(void *opaque)
+{
+    NvNetState *s = opaque;
+
+    /* Nothing held back unless the coalesce subsection says otherwise */
+    timer_del(s->irq_timer);
+    s->irq_pending = 0;
+    s->irq_pending_frames = 0;
+
+    return 0;
+}
+
+static int nvnet_post_load(void *opaque, int version_id)
+{
+    NvNetState *s = opaque;
+
+    s->rx_desc_valid = false;
+
+    return 0;
+}
+
+static bool nvnet_irq_coalesce_needed(void *opaque)
+{
+    NvNetState *s = opaque;
+
+    return s->irq_pending != 0;
+}
+
+/* Interrupts held back by moderation, so saving leaves their timing alone */
+static const VMStateDescription vmstate_nvnet_irq_coalesce = {
+    .name = "nvnet/irq_coalesce",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = nvnet_irq_coalesce_needed,
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(irq_pending, NvNetState),
+        VMSTATE_UINT32(irq_pending_frames, NvNetState),
+        VMSTATE_TIMER_PTR(irq_timer, NvNetState),
+        VMSTATE_END_OF_LIST()
+    },
+};
+
 static const VMStateDescription vmstate_nvnet = {
     .name = "nvnet",
     .version_id = 1,
     .minimum_version_id = 1,
+    .pre_load = nvnet_pre_load,
+    .post_load = nvnet_post_load,
     .fields = (VMStateField[]) {
         VMSTATE_PCI_DEVICE(parent_obj, NvNetState),
         VMSTATE_UINT8_ARRAY(regs, NvNetState, MMIO_SIZE),
@@ -1112,6 +1317,10 @@ static const VMStateDescription vmstate_nvnet = {
         VMSTATE_UINT8(rx_ring_size, NvNetState),
         VMSTATE_END_OF_LIST()
     },
+    .subsections = (const VMStateDescription * []) {
+        &vmstate_nvnet_irq_coalesce,
+        NULL
+    },
 };
 
 static void nvnet_class_init(ObjectClass *klass, void *data)
@@ -1136,6 +1345,10 @@ static void nvnet_class_init(ObjectClass *klass, void *data)
 static Property nvnet_properties[] = {
     DEFINE_NIC_PROPERTIES(NvNetState, conf),
     DEFINE_PROP_STRING("dump", NvNetState, packet_dump_path),
+    /* Hold completion interrupts for up to this long, 0 = immediately */
+    DEFINE_PROP_UINT32("coalesce-usecs", NvNetState, coalesce_usecs, 0),
+    /* ...or until this many frames have completed, 0 = no limit */
+    DEFINE_PROP_UINT32("coalesce-frames", NvNetState, coalesce_frames, 0),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -20,6 +20,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/timer.h"
 #include "hw/qdev-properties.h"
 #include "migration/vmstate.h"
 #include "sysemu/sysemu.h"
@@ -107,6 +108,8 @@ typedef struct USBXIDState {
     XIDGamepadOutputReport out_state;
     XIDGamepadOutputReport out_state_capabilities;
     uint8_t                device_index;
+    uint32_t               input_changes;
+    bool                   input_seen;
 } USBXIDState;
 
 static const USBDescIface desc_iface_xbox_gamepad = {
@@ -198,11 +201,11 @@ static void update_output(USBXIDState *s)
         return;
     }
 
+    /* Applied by the UI thread the next time it updates controllers */
     ControllerState *state = xemu_input_get_bound(s->device_index);
     assert(state);
     state->rumble_l = s->out_state.left_actuator_strength;
     state->rumble_r = s->out_state.right_actuator_strength;
-    xemu_input_update_rumble(state);
 }
 
 static void update_input(USBXIDState *s)
@@ -212,9 +215,17 @@ static void update_input(USBXIDState *s)
         return;
     }
 
-    ControllerState *state = xemu_input_get_bound(s->device_index);
-    assert(state);
-    xemu_input_update_controller(state);
+    /* Latest state published by the UI thread, no host polling here */
+    ControllerSnapshot snap;
+    xemu_input_get_snapshot(s->device_index, &snap);
+    if (snap.changes != s->input_changes) {
+        if (s->input_seen) {
+            xemu_input_record_latency(qemu_clock_get_us(QEMU_CLOCK_REALTIME) -
+                                      snap.changed_ts);
+        }
+        s->input_changes = snap.changes;
+    }
+    s->input_seen = true;
 
     const int button_map_analog[6][2] = {
         { GAMEPAD_A,     CONTROLLER_BUTTON_A     },
@@ -237,23 +248,23 @@ static void update_input(USBXIDState *s)
     };
 
     for (int i = 0; i < 6; i++) {
-        int pressed = state->buttons & button_map_analog[i][1];
+        int pressed = snap.buttons & button_map_analog[i][1];
         s->in_state.bAnalogButtons[button_map_analog[i][0]] = pressed ? 0xff : 0;
     }
 
     s->in_state.wButtons = 0;
     for (int i = 0; i < 8; i++) {
-        if (state->buttons & button_map_binary[i][1]) {
+        if (snap.buttons & button_map_binary[i][1]) {
             s->in_state.wButtons |= BUTTON_MASK(button_map_binary[i][0]);
         }
     }
 
-    s->in_state.bAnalogButtons[GAMEPAD_LEFT_TRIGGER] = state->axis[CONTROLLER_AXIS_LTRIG] >> 7;
-    s->in_state.bAnalogButtons[GAMEPAD_RIGHT_TRIGGER] = state->axis[CONTROLLER_AXIS_RTRIG] >> 7;
-    s->in_state.sThumbLX = state->axis[CONTROLLER_AXIS_LSTICK_X];
-    s->in_state.sThumbLY = state->axis[CONTROLLER_AXIS_LSTICK_Y];
-    s->in_state.sThumbRX = state->axis[CONTROLLER_AXIS_RSTICK_X];
-    s->in_state.sThumbRY = state->axis[CONTROLLER_AXIS_RSTICK_Y];
+    s->in_state.bAnalogButtons[GAMEPAD_LEFT_TRIGGER] = snap.axis[CONTROLLER_AXIS_LTRIG] >> 7;
+    s->in_state.bAnalogButtons[GAMEPAD_RIGHT_TRIGGER] = snap.axis[CONTROLLER_AXIS_RTRIG] >> 7;
+    s->in_state.sThumbLX = snap.axis[CONTROLLER_AXIS_LSTICK_X];
+    s->in_state.sThumbLY = snap.axis[CONTROLLER_AXIS_LSTICK_Y];
+    s->in_state.sThumbRX = snap.axis[CONTROLLER_AXIS_RSTICK_X];
+    s->in_state.sThumbRY = snap.axis[CONTROLLER_AXIS_RSTICK_Y];
 }
 
 static void usb_xid_handle_reset(USBDevice *dev)
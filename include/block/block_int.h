@@ -120,6 +120,11 @@ struct BlockDriver {
      * on those children.
      */
     bool is_format;
+    /*
+     * Set to true if the BlockDriver serves reads out of a memory mapping
+     * of the image, so they cost a copy rather than a trip to the disk.
+     */
+    bool is_memory_mapped;
     /*
      * Return true if @to_replace can be replaced by a BDS with the
      * same data as @bs without it affecting @bs's behavior (that is,
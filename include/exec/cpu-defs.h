@@ -76,8 +76,17 @@ typedef uint64_t target_ulong;
 
 #if !defined(CONFIG_USER_ONLY) && defined(CONFIG_TCG)
 
+#ifdef XBOX
+/*
+ * The Xbox kernel and titles keep a working set of code, stacks, push
+ * buffers and textures that regularly conflicts in the direct-mapped tlb;
+ * a larger victim tlb absorbs most of those conflict misses.
+ */
+#define CPU_VTLB_SIZE 16
+#else
 /* use a fully associative victim tlb of 8 entries */
 #define CPU_VTLB_SIZE 8
+#endif
 
 #if HOST_LONG_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
@@ -175,6 +184,15 @@ typedef struct CPUTLBDesc {
     CPUIOTLBEntry viotlb[CPU_VTLB_SIZE];
     /* The iotlb.  */
     CPUIOTLBEntry *iotlb;
+    /*
+     * Statistics.  Written by the owning vCPU and read atomically, see
+     * tlb_mmu_idx_stats().
+     */
+    size_t fill_count;
+    size_t victim_hit_count;
+    size_t prefill_count;
+    size_t flush_count;
+    size_t large_page_flush_count;
 } CPUTLBDesc;
 
 /*
@@ -27,5 +27,21 @@
 void tlb_protect_code(ram_addr_t ram_addr);
 void tlb_unprotect_code(ram_addr_t ram_addr);
 void tlb_flush_counts(size_t *full, size_t *part, size_t *elide);
+
+typedef struct TLBMmuIdxStats {
+    size_t n_entries;        /* current size of the tlb */
+    size_t n_used_entries;
+    size_t fills;            /* misses that walked the guest page tables */
+    size_t victim_hits;      /* misses served from the victim tlb */
+    size_t prefills;         /* entries filled ahead of use */
+    size_t flushes;          /* flushes of the whole mmu_idx */
+    size_t large_page_flushes;
+} TLBMmuIdxStats;
+
+/*
+ * Fill at most @max elements of @stats with per mmu_idx tlb statistics,
+ * summed over all cpus. Returns the number of mmu_idx of the target.
+ */
+int tlb_mmu_idx_stats(TLBMmuIdxStats *stats, int max);
 #endif
 #endif
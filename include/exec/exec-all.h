@@ -503,6 +503,7 @@ struct TranslationBlock {
 #define CF_USE_ICOUNT    0x00020000
 #define CF_INVALID       0x00040000 /* TB is stale. Set with @jmp_lock held */
 #define CF_PARALLEL      0x00080000 /* Generate code for a parallel context */
+#define CF_SUPERBLOCK    0x00100000 /* Tier-2 TB that follows direct jumps */
 #define CF_CLUSTER_MASK  0xff000000 /* Top 8 bits are cluster ID */
 #define CF_CLUSTER_SHIFT 24
 
@@ -518,6 +519,9 @@ struct TranslationBlock {
     uint16_t icount;
     uint64_t ihash;
 
+    /* dispatches through the exec loop, used to detect hot blocks */
+    uint32_t exec_count;
+
     struct tb_tc tc;
 
     /* first and second physical page containing code. The lower bit
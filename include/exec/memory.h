@@ -696,6 +696,7 @@ struct MemoryRegion {
     bool nonvolatile;
     bool rom_device;
     bool flush_coalesced_mmio;
+    bool lockless_io;
     uint8_t dirty_log_mask;
     bool is_iommu;
     RAMBlock *ram_block;
@@ -2105,6 +2106,18 @@ void memory_region_set_flush_coalesced(MemoryRegion *mr);
  */
 void memory_region_clear_flush_coalesced(MemoryRegion *mr);
 
+/**
+ * memory_region_enable_lockless_io: Dispatch accesses without the BQL.
+ *
+ * By default, accesses to MMIO regions are dispatched with the iothread
+ * lock held.  Devices whose callbacks for @mr do their own locking (or
+ * need none, e.g. free running counters) can opt out so that hot polling
+ * loops in the guest do not contend on the global lock.
+ *
+ * @mr: the memory region to be updated.
+ */
+void memory_region_enable_lockless_io(MemoryRegion *mr);
+
 /**
  * memory_region_add_eventfd: Request an eventfd to be triggered when a word
  *                            is written to a location.
@@ -236,11 +236,14 @@ static inline bool cpu_physical_memory_is_clean(ram_addr_t addr)
 {
     bool nv2a = cpu_physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_NV2A);
     bool nv2a_tex = cpu_physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_NV2A_TEX);
+    bool snapshot = cpu_physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_SNAPSHOT);
+    bool rewind = cpu_physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_REWIND);
     bool vga = cpu_physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_VGA);
     bool code = cpu_physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_CODE);
     bool migration =
         cpu_physical_memory_get_dirty_flag(addr, DIRTY_MEMORY_MIGRATION);
-    return !(nv2a && nv2a_tex && vga && code && migration);
+    return !(nv2a && nv2a_tex && snapshot && rewind && vga && code &&
+             migration);
 }
 
 static inline uint8_t cpu_physical_memory_range_includes_clean(ram_addr_t start,
@@ -257,6 +260,14 @@ static inline uint8_t cpu_physical_memory_range_includes_clean(ram_addr_t start,
         !cpu_physical_memory_all_dirty(start, length, DIRTY_MEMORY_NV2A_TEX)) {
         ret |= (1 << DIRTY_MEMORY_NV2A_TEX);
     }
+    if (mask & (1 << DIRTY_MEMORY_SNAPSHOT) &&
+        !cpu_physical_memory_all_dirty(start, length, DIRTY_MEMORY_SNAPSHOT)) {
+        ret |= (1 << DIRTY_MEMORY_SNAPSHOT);
+    }
+    if (mask & (1 << DIRTY_MEMORY_REWIND) &&
+        !cpu_physical_memory_all_dirty(start, length, DIRTY_MEMORY_REWIND)) {
+        ret |= (1 << DIRTY_MEMORY_REWIND);
+    }
     if (mask & (1 << DIRTY_MEMORY_VGA) &&
         !cpu_physical_memory_all_dirty(start, length, DIRTY_MEMORY_VGA)) {
         ret |= (1 << DIRTY_MEMORY_VGA);
@@ -338,6 +349,14 @@ static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
                 bitmap_set_atomic(blocks[DIRTY_MEMORY_NV2A_TEX]->blocks[idx],
                                   offset, next - page);
             }
+            if (unlikely(mask & (1 << DIRTY_MEMORY_SNAPSHOT))) {
+                bitmap_set_atomic(blocks[DIRTY_MEMORY_SNAPSHOT]->blocks[idx],
+                                  offset, next - page);
+            }
+            if (unlikely(mask & (1 << DIRTY_MEMORY_REWIND))) {
+                bitmap_set_atomic(blocks[DIRTY_MEMORY_REWIND]->blocks[idx],
+                                  offset, next - page);
+            }
 
             page = next;
             idx++;
@@ -388,6 +407,8 @@ static inline void cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
                     qatomic_or(&blocks[DIRTY_MEMORY_VGA][idx][offset], temp);
                     qatomic_or(&blocks[DIRTY_MEMORY_NV2A][idx][offset], temp);
                     qatomic_or(&blocks[DIRTY_MEMORY_NV2A_TEX][idx][offset], temp);
+                    qatomic_or(&blocks[DIRTY_MEMORY_SNAPSHOT][idx][offset], temp);
+                    qatomic_or(&blocks[DIRTY_MEMORY_REWIND][idx][offset], temp);
 
                     if (global_dirty_log) {
                         qatomic_or(
@@ -456,6 +477,8 @@ static inline void cpu_physical_memory_clear_dirty_range(ram_addr_t start,
     cpu_physical_memory_test_and_clear_dirty(start, length, DIRTY_MEMORY_VGA);
     cpu_physical_memory_test_and_clear_dirty(start, length, DIRTY_MEMORY_NV2A);
     cpu_physical_memory_test_and_clear_dirty(start, length, DIRTY_MEMORY_NV2A_TEX);
+    cpu_physical_memory_test_and_clear_dirty(start, length, DIRTY_MEMORY_SNAPSHOT);
+    cpu_physical_memory_test_and_clear_dirty(start, length, DIRTY_MEMORY_REWIND);
     cpu_physical_memory_test_and_clear_dirty(start, length, DIRTY_MEMORY_CODE);
 }
 
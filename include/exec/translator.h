@@ -144,6 +144,41 @@ void translator_loop_temp_check(DisasContextBase *db);
  */
 bool translator_use_goto_tb(DisasContextBase *db, target_ulong dest);
 
+/**
+ * translator_use_superblock
+ * @db: Disassembly context
+ * @pc_next: pc of the instruction following the jump
+ * @dest: target pc of the jump
+ *
+ * Return true if translation of a superblock (CF_SUPERBLOCK) may
+ * continue at @dest instead of ending the TB with a direct jump.
+ */
+bool translator_use_superblock(DisasContextBase *db, target_ulong pc_next,
+                               target_ulong dest);
+
+/**
+ * translator_use_inline_lookup
+ * @db: Disassembly context
+ *
+ * Return true if an indirect jump out of the current TB may look up
+ * its target with translator_gen_lookup_and_goto_ptr().
+ */
+bool translator_use_inline_lookup(DisasContextBase *db);
+
+/**
+ * translator_gen_lookup_and_goto_ptr
+ * @db: Disassembly context
+ * @pc: pc of the next TB, as returned by cpu_get_tb_cpu_state()
+ * @cs_base: cs_base of the next TB, likewise
+ * @flags: flags of the next TB, likewise
+ *
+ * Like tcg_gen_lookup_and_goto_ptr(), but first look the next TB up in
+ * the vCPU's tb_jmp_cache from the generated code, and jump straight to
+ * it if it is a superblock.  Anything else falls back to the helper.
+ */
+void translator_gen_lookup_and_goto_ptr(DisasContextBase *db, TCGv pc,
+                                        TCGv cs_base, TCGv_i32 flags);
+
 /*
  * Translator Load Functions
  *
@@ -332,6 +332,11 @@ struct CPUState {
     int thread_id;
     bool running, has_waiter;
     struct QemuCond *halt_cond;
+#ifdef XBOX
+    /* Set while a device parks the vCPU, broadcast by qemu_cpu_kick() */
+    struct QemuMutex *park_lock;
+    struct QemuCond *park_cond;
+#endif
     bool thread_kicked;
     bool created;
     bool stop;
@@ -0,0 +1,87 @@
+/*
+ * ATAPI read-ahead cache
+ *
+ * Serves CD/DVD reads out of a bounded cache of 16 sector (one DVD ECC
+ * block) chunks. Sequential streams are detected and read ahead of the
+ * guest through the block layer's coroutine I/O, and seek times of a real
+ * drive can optionally be charged to reads that move the head.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef HW_IDE_ATAPI_READAHEAD_H
+#define HW_IDE_ATAPI_READAHEAD_H
+
+#include "block/aio.h"
+#include "qemu/iov.h"
+
+#define ATAPI_RA_SECTOR_SIZE    2048
+#define ATAPI_RA_CHUNK_SECTORS  16
+#define ATAPI_RA_CHUNK_SIZE     (ATAPI_RA_CHUNK_SECTORS * ATAPI_RA_SECTOR_SIZE)
+
+typedef struct ATAPIReadahead ATAPIReadahead;
+
+typedef struct ATAPIReadaheadStats {
+    uint64_t requests;
+    uint64_t sectors;
+    uint64_t hit_sectors;      /* Already in the cache when requested */
+    uint64_t wait_sectors;     /* Covered by a read-ahead still in flight */
+    uint64_t miss_sectors;     /* Had to be fetched on demand */
+    uint64_t prefetch_chunks;  /* Chunks fetched ahead of the guest */
+    uint64_t wasted_chunks;    /* Prefetched chunks dropped without a read */
+    uint64_t fetch_bytes;      /* Read from the image */
+    uint64_t seeks;
+    uint64_t seek_ns;          /* Delay charged for emulated seeks */
+    uint64_t throughput;       /* Bytes per second delivered to the guest */
+    uint64_t avg_latency_ns;
+    uint32_t cache_chunks;
+    uint32_t valid_chunks;
+    uint32_t streams;          /* Sequential streams being read ahead */
+} ATAPIReadaheadStats;
+
+/*
+ * @size is the cache size in bytes. @seek_scale charges seek times as a
+ * percentage of a stock drive's, with 0 disabling seek emulation.
+ */
+ATAPIReadahead *atapi_readahead_new(BlockBackend *blk, uint64_t size,
+                                    uint32_t seek_scale);
+void atapi_readahead_free(ATAPIReadahead *ra);
+
+/* Drop everything cached, for a medium change */
+void atapi_readahead_invalidate(ATAPIReadahead *ra);
+
+/*
+ * Read @nb_sectors 2048 byte sectors starting at @lba into @qiov. @cb is
+ * always called asynchronously. Only one read may be outstanding; the
+ * drive never has more than one command in flight.
+ */
+BlockAIOCB *atapi_readahead_readv(ATAPIReadahead *ra, int64_t lba,
+                                  int nb_sectors, QEMUIOVector *qiov,
+                                  BlockCompletionFunc *cb, void *opaque);
+
+/* Copy one sector into @buf if it is cached, without waiting */
+bool atapi_readahead_read_cached(ATAPIReadahead *ra, int64_t lba, void *buf);
+
+/*
+ * Complete the outstanding read with -ECANCELED right away, matching what
+ * ide_cancel_dma_sync() does to buffered requests.
+ */
+void atapi_readahead_cancel(ATAPIReadahead *ra);
+
+void atapi_readahead_get_stats(ATAPIReadahead *ra, ATAPIReadaheadStats *stats);
+
+/* Statistics of the read-ahead cache of the IDE CD drive on @blk */
+bool ide_cd_get_readahead_stats(BlockBackend *blk, ATAPIReadaheadStats *stats);
+
+#endif
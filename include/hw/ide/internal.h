@@ -13,6 +13,7 @@
 #include "hw/isa/isa.h"
 #include "sysemu/dma.h"
 #include "hw/block/block.h"
+#include "hw/ide/atapi-readahead.h"
 #include "scsi/constants.h"
 
 /* debug IDE devices */
@@ -422,6 +423,7 @@ struct IDEState {
     BlockAIOCB *pio_aiocb;
     QEMUIOVector qiov;
     QLIST_HEAD(, IDEBufferedRequest) buffered_requests;
+    ATAPIReadahead *readahead;
     /* ATA DMA state */
     uint64_t io_buffer_offset;
     int32_t io_buffer_size;
@@ -524,6 +526,9 @@ struct IDEDevice {
      * 0xffff        - reserved
      */
     uint16_t rotation_rate;
+    /* ATAPI read-ahead cache size, and seek time in % of a real drive's */
+    uint64_t readahead_size;
+    uint32_t seek_timing;
 };
 
 /* These are used for the error_status field of IDEBus */
@@ -0,0 +1,77 @@
+/*
+ * System Link UDP tunnel
+ *
+ * Wire format shared by the syslink netdev and the syslink-relay tool, and
+ * the statistics the netdev keeps about the other instances it hears from.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef NET_SYSLINK_H
+#define NET_SYSLINK_H
+
+#define SYSLINK_MAGIC          0x58534c31 /* "XSL1" */
+#define SYSLINK_DEFAULT_PORT   9369
+#define SYSLINK_MAX_DATAGRAM   2048
+#define SYSLINK_MAX_PEERS      16
+
+/* Datagram types */
+#define SYSLINK_TYPE_FRAME     0
+#define SYSLINK_TYPE_PING      1
+#define SYSLINK_TYPE_PONG      2
+
+/* Datagram flags */
+#define SYSLINK_FLAG_DEFLATE   0x01
+
+/*
+ * Every datagram starts with this header, all fields in network byte order.
+ * The relay forwards datagrams untouched to every other instance it has
+ * heard from, so instances tell each other apart by node id.
+ */
+typedef struct QEMU_PACKED SyslinkHeader {
+    uint32_t magic;
+    uint8_t  type;
+    uint8_t  flags;
+    uint16_t length; /* Frame length before compression */
+    uint32_t src;    /* Node id of the sender */
+    uint32_t dst;    /* Node id a pong answers, 0 otherwise */
+    uint64_t time;   /* Ping send time in ns, echoed back in the pong */
+} SyslinkHeader;
+
+#define SYSLINK_MAX_PAYLOAD (SYSLINK_MAX_DATAGRAM - sizeof(SyslinkHeader))
+
+typedef struct SyslinkPeerStats {
+    uint32_t id;
+    float    rtt_ms;    /* Smoothed round trip time through the relay */
+    float    jitter_ms; /* Mean deviation between successive round trips */
+    uint64_t rx_frames;
+    uint64_t rx_bytes;
+    float    idle_s;    /* Time since anything was heard from this peer */
+} SyslinkPeerStats;
+
+typedef struct SyslinkStats {
+    uint32_t id;
+    uint64_t tx_frames;
+    uint64_t tx_bytes;  /* Bytes on the wire, after compression */
+    uint64_t tx_dropped;
+    uint64_t tx_batches;
+    uint64_t rx_dropped;
+    int      num_peers;
+    SyslinkPeerStats peers[SYSLINK_MAX_PEERS];
+} SyslinkStats;
+
+/* Fills @stats for a syslink netdev, returns false for other netdevs */
+bool net_syslink_get_stats(NetClientState *nc, SyslinkStats *stats);
+
+#endif
@@ -198,6 +198,7 @@ void blk_error_action(BlockBackend *blk, BlockErrorAction action,
 bool blk_supports_write_perm(BlockBackend *blk);
 bool blk_is_writable(BlockBackend *blk);
 bool blk_is_sg(BlockBackend *blk);
+bool blk_is_memory_mapped(BlockBackend *blk);
 bool blk_enable_write_cache(BlockBackend *blk);
 void blk_set_enable_write_cache(BlockBackend *blk, bool wce);
 void blk_invalidate_cache(BlockBackend *blk, Error **errp);
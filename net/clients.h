@@ -67,4 +67,7 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
 int net_init_pcap(const Netdev *netdev, const char *name,
                   NetClientState *peer, Error **errp);
 
+int net_init_syslink(const Netdev *netdev, const char *name,
+                     NetClientState *peer, Error **errp);
+
 #endif /* QEMU_NET_CLIENTS_H */
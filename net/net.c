@@ -1002,6 +1002,7 @@ static int (* const net_client_init_fun[NET_CLIENT_DRIVER__MAX])(
         [NET_CLIENT_DRIVER_L2TPV3]    = net_init_l2tpv3,
 #endif
         [NET_CLIENT_DRIVER_PCAP]      = net_init_pcap,
+        [NET_CLIENT_DRIVER_SYSLINK]   = net_init_syslink,
 };
 
 
@@ -1067,6 +1068,7 @@ void show_netdevs(void)
         "socket",
         "hubport",
         "tap",
+        "syslink",
 #ifdef CONFIG_SLIRP
         "user",
 #endif
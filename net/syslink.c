@@ -0,0 +1,532 @@
+/*
+ * QEMU System Link UDP tunnel network client
+ *
+ * Carries link-layer frames between emulator instances through a small UDP
+ * relay (contrib/syslink-relay), batching datagrams per main loop iteration
+ * and optionally deflating frames. Instances ping each other through the
+ * relay so the UI can show per-peer round trip time and jitter.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include <zlib.h>
+#include "net/net.h"
+#include "net/eth.h"
+#include "net/syslink.h"
+#include "clients.h"
+#include "qapi/error.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "qemu/sockets.h"
+#include "qemu/timer.h"
+#include "trace.h"
+
+#define SYSLINK_BATCH           32
+#define SYSLINK_PING_INTERVAL_MS 1000
+#define SYSLINK_PEER_TIMEOUT    (10 * NANOSECONDS_PER_SECOND)
+
+/* Frames smaller than this rarely shrink enough to pay for deflating them */
+#define SYSLINK_DEFLATE_MIN     128
+
+typedef struct SyslinkPeer {
+    uint32_t id;
+    int64_t  last_seen;
+    int64_t  rtt;
+    int64_t  last_rtt;
+    int64_t  jitter;
+    bool     rtt_valid;
+    uint64_t rx_frames;
+    uint64_t rx_bytes;
+} SyslinkPeer;
+
+typedef struct NetSyslinkState {
+    NetClientState nc;
+    int fd;
+    bool read_poll;
+    bool compress;
+    uint32_t node_id;
+
+    QEMUBH *tx_bh;
+    QEMUTimer *ping_timer;
+
+    /* Datagrams waiting to go out at the end of this main loop iteration */
+    uint8_t tx_buf[SYSLINK_BATCH][SYSLINK_MAX_DATAGRAM];
+    size_t tx_len[SYSLINK_BATCH];
+    int tx_count;
+
+    uint8_t rx_buf[SYSLINK_BATCH][SYSLINK_MAX_DATAGRAM];
+    uint8_t frame_buf[SYSLINK_MAX_PAYLOAD];
+
+    SyslinkPeer peers[SYSLINK_MAX_PEERS];
+
+    uint64_t tx_frames;
+    uint64_t tx_bytes;
+    uint64_t tx_dropped;
+    uint64_t tx_batches;
+    uint64_t rx_dropped;
+} NetSyslinkState;
+
+static void net_syslink_read_poll(NetSyslinkState *s, bool enable);
+
+static void net_syslink_flush_tx(NetSyslinkState *s)
+{
+    int sent = 0;
+
+    if (s->tx_count == 0) {
+        return;
+    }
+
+#ifdef CONFIG_LINUX
+    struct mmsghdr msgs[SYSLINK_BATCH];
+    struct iovec iov[SYSLINK_BATCH];
+
+    for (int i = 0; i < s->tx_count; i++) {
+        iov[i].iov_base = s->tx_buf[i];
+        iov[i].iov_len = s->tx_len[i];
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    while (sent < s->tx_count) {
+        int ret = sendmmsg(s->fd, &msgs[sent], s->tx_count - sent, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        sent += ret;
+    }
+#else
+    for (; sent < s->tx_count; sent++) {
+        ssize_t ret;
+        do {
+            ret = send(s->fd, (const void *)s->tx_buf[sent], s->tx_len[sent],
+                       0);
+        } while (ret == -1 && errno == EINTR);
+        if (ret < 0) {
+            break;
+        }
+    }
+#endif
+
+    /* A full socket buffer means the link is saturated; dropping is what a
+     * real wire would do and keeps latency down for what follows */
+    s->tx_dropped += s->tx_count - sent;
+    s->tx_batches++;
+    s->tx_count = 0;
+}
+
+static void net_syslink_tx_bh(void *opaque)
+{
+    NetSyslinkState *s = opaque;
+    net_syslink_flush_tx(s);
+}
+
+/*
+ * Reserve the next outgoing datagram slot and fill in its header.
+ */
+static uint8_t *net_syslink_tx_slot(NetSyslinkState *s, uint8_t type,
+                                    uint32_t dst, uint64_t time)
+{
+    if (s->tx_count == SYSLINK_BATCH) {
+        net_syslink_flush_tx(s);
+    }
+
+    uint8_t *buf = s->tx_buf[s->tx_count];
+    SyslinkHeader *hdr = (SyslinkHeader *)buf;
+    hdr->magic = cpu_to_be32(SYSLINK_MAGIC);
+    hdr->type = type;
+    hdr->flags = 0;
+    hdr->length = 0;
+    hdr->src = cpu_to_be32(s->node_id);
+    hdr->dst = cpu_to_be32(dst);
+    hdr->time = cpu_to_be64(time);
+
+    return buf;
+}
+
+static void net_syslink_tx_commit(NetSyslinkState *s, size_t len)
+{
+    s->tx_len[s->tx_count++] = len;
+    qemu_bh_schedule(s->tx_bh);
+}
+
+static ssize_t net_syslink_receive(NetClientState *nc, const uint8_t *buf,
+                                   size_t size)
+{
+    NetSyslinkState *s = DO_UPCAST(NetSyslinkState, nc, nc);
+
+    if (size > SYSLINK_MAX_PAYLOAD) {
+        trace_syslink_drop_oversized(size);
+        s->tx_dropped++;
+        return size;
+    }
+
+    uint8_t *dgram = net_syslink_tx_slot(s, SYSLINK_TYPE_FRAME, 0, 0);
+    SyslinkHeader *hdr = (SyslinkHeader *)dgram;
+    uint8_t *payload = dgram + sizeof(SyslinkHeader);
+    size_t payload_len = size;
+
+    hdr->length = cpu_to_be16(size);
+
+    if (s->compress && size >= SYSLINK_DEFLATE_MIN) {
+        uLongf dlen = SYSLINK_MAX_PAYLOAD;
+        if (compress2(payload, &dlen, buf, size, Z_BEST_SPEED) == Z_OK &&
+            dlen < size) {
+            hdr->flags |= SYSLINK_FLAG_DEFLATE;
+            payload_len = dlen;
+        }
+    }
+
+    if (!(hdr->flags & SYSLINK_FLAG_DEFLATE)) {
+        memcpy(payload, buf, size);
+    }
+
+    net_syslink_tx_commit(s, sizeof(SyslinkHeader) + payload_len);
+    s->tx_frames++;
+    s->tx_bytes += sizeof(SyslinkHeader) + payload_len;
+
+    return size;
+}
+
+static SyslinkPeer *net_syslink_find_peer(NetSyslinkState *s, uint32_t id,
+                                          int64_t now)
+{
+    SyslinkPeer *free_slot = NULL;
+
+    for (int i = 0; i < SYSLINK_MAX_PEERS; i++) {
+        SyslinkPeer *p = &s->peers[i];
+        if (p->id == id) {
+            p->last_seen = now;
+            return p;
+        }
+        if (!p->id && !free_slot) {
+            free_slot = p;
+        }
+    }
+
+    if (free_slot) {
+        memset(free_slot, 0, sizeof(*free_slot));
+        free_slot->id = id;
+        free_slot->last_seen = now;
+        trace_syslink_peer_new(id);
+    }
+
+    return free_slot;
+}
+
+static void net_syslink_send_completed(NetClientState *nc, ssize_t len)
+{
+    NetSyslinkState *s = DO_UPCAST(NetSyslinkState, nc, nc);
+
+    if (!s->read_poll) {
+        net_syslink_read_poll(s, true);
+    }
+}
+
+/*
+ * Handle one datagram from the relay, returning false when the peer of this
+ * client cannot take any more frames for now.
+ */
+static bool net_syslink_handle_datagram(NetSyslinkState *s,
+                                        const uint8_t *dgram, size_t len)
+{
+    const SyslinkHeader *hdr = (const SyslinkHeader *)dgram;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    if (len < sizeof(SyslinkHeader) ||
+        be32_to_cpu(hdr->magic) != SYSLINK_MAGIC) {
+        s->rx_dropped++;
+        return true;
+    }
+
+    uint32_t src = be32_to_cpu(hdr->src);
+    if (src == 0 || src == s->node_id) {
+        return true;
+    }
+
+    SyslinkPeer *peer = net_syslink_find_peer(s, src, now);
+    const uint8_t *payload = dgram + sizeof(SyslinkHeader);
+    size_t payload_len = len - sizeof(SyslinkHeader);
+
+    switch (hdr->type) {
+    case SYSLINK_TYPE_PING:
+        net_syslink_tx_slot(s, SYSLINK_TYPE_PONG, src, be64_to_cpu(hdr->time));
+        net_syslink_tx_commit(s, sizeof(SyslinkHeader));
+        return true;
+
+    case SYSLINK_TYPE_PONG: {
+        if (be32_to_cpu(hdr->dst) != s->node_id || !peer) {
+            return true;
+        }
+        int64_t rtt = now - (int64_t)be64_to_cpu(hdr->time);
+        if (rtt < 0) {
+            return true;
+        }
+        if (!peer->rtt_valid) {
+            peer->rtt = rtt;
+            peer->rtt_valid = true;
+        } else {
+            /* RFC 3550 style interarrival jitter and a TCP style SRTT */
+            int64_t d = rtt - peer->last_rtt;
+            peer->jitter += ((d < 0 ? -d : d) - peer->jitter) / 16;
+            peer->rtt += (rtt - peer->rtt) / 8;
+        }
+        peer->last_rtt = rtt;
+        return true;
+    }
+
+    case SYSLINK_TYPE_FRAME:
+        break;
+
+    default:
+        s->rx_dropped++;
+        return true;
+    }
+
+    size_t size = be16_to_cpu(hdr->length);
+    const uint8_t *frame = payload;
+
+    if (hdr->flags & SYSLINK_FLAG_DEFLATE) {
+        uLongf flen = sizeof(s->frame_buf);
+        if (size > sizeof(s->frame_buf) ||
+            uncompress(s->frame_buf, &flen, payload, payload_len) != Z_OK ||
+            flen != size) {
+            s->rx_dropped++;
+            return true;
+        }
+        frame = s->frame_buf;
+    } else if (size != payload_len) {
+        s->rx_dropped++;
+        return true;
+    }
+
+    if (peer) {
+        peer->rx_frames++;
+        peer->rx_bytes += len;
+    }
+
+    uint8_t min_pkt[ETH_ZLEN];
+    size_t min_pktsz = sizeof(min_pkt);
+    if (net_peer_needs_padding(&s->nc)) {
+        if (eth_pad_short_frame(min_pkt, &min_pktsz, frame, size)) {
+            frame = min_pkt;
+            size = min_pktsz;
+        }
+    }
+
+    trace_syslink_receive(size);
+    return qemu_send_packet_async(&s->nc, frame, size,
+                                  net_syslink_send_completed) != 0;
+}
+
+static void net_syslink_send(void *opaque)
+{
+    NetSyslinkState *s = opaque;
+    int count = 0;
+
+#ifdef CONFIG_LINUX
+    struct mmsghdr msgs[SYSLINK_BATCH];
+    struct iovec iov[SYSLINK_BATCH];
+
+    for (int i = 0; i < SYSLINK_BATCH; i++) {
+        iov[i].iov_base = s->rx_buf[i];
+        iov[i].iov_len = SYSLINK_MAX_DATAGRAM;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    do {
+        count = recvmmsg(s->fd, msgs, SYSLINK_BATCH, MSG_DONTWAIT, NULL);
+    } while (count < 0 && errno == EINTR);
+
+    for (int i = 0; i < count; i++) {
+        if (!net_syslink_handle_datagram(s, s->rx_buf[i], msgs[i].msg_len)) {
+            /* Frames already read stay queued by the net layer, but stop
+             * reading until they have been delivered */
+            net_syslink_read_poll(s, false);
+        }
+    }
+#else
+    for (; count < SYSLINK_BATCH && s->read_poll; count++) {
+        ssize_t ret = qemu_recv(s->fd, s->rx_buf[count],
+                                SYSLINK_MAX_DATAGRAM, 0);
+        if (ret < 0) {
+            break;
+        }
+        if (!net_syslink_handle_datagram(s, s->rx_buf[count], ret)) {
+            net_syslink_read_poll(s, false);
+        }
+    }
+#endif
+
+    /* Send any pongs right away rather than after the next main loop pass */
+    net_syslink_flush_tx(s);
+}
+
+static void net_syslink_update_fd_handler(NetSyslinkState *s)
+{
+    qemu_set_fd_handler(s->fd, s->read_poll ? net_syslink_send : NULL, NULL,
+                        s);
+}
+
+static void net_syslink_read_poll(NetSyslinkState *s, bool enable)
+{
+    s->read_poll = enable;
+    net_syslink_update_fd_handler(s);
+}
+
+static void net_syslink_ping(void *opaque)
+{
+    NetSyslinkState *s = opaque;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    /* Forget instances that have gone quiet */
+    for (int i = 0; i < SYSLINK_MAX_PEERS; i++) {
+        SyslinkPeer *p = &s->peers[i];
+        if (p->id && now - p->last_seen > SYSLINK_PEER_TIMEOUT) {
+            trace_syslink_peer_timeout(p->id);
+            p->id = 0;
+        }
+    }
+
+    /* Also keeps our registration with the relay alive */
+    net_syslink_tx_slot(s, SYSLINK_TYPE_PING, 0, now);
+    net_syslink_tx_commit(s, sizeof(SyslinkHeader));
+    net_syslink_flush_tx(s);
+
+    timer_mod(s->ping_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                             SYSLINK_PING_INTERVAL_MS);
+}
+
+static void net_syslink_cleanup(NetClientState *nc)
+{
+    NetSyslinkState *s = DO_UPCAST(NetSyslinkState, nc, nc);
+
+    net_syslink_flush_tx(s);
+    timer_free(s->ping_timer);
+    qemu_bh_delete(s->tx_bh);
+    net_syslink_read_poll(s, false);
+    closesocket(s->fd);
+}
+
+static NetClientInfo net_syslink_info = {
+    .type = NET_CLIENT_DRIVER_SYSLINK,
+    .size = sizeof(NetSyslinkState),
+    .receive = net_syslink_receive,
+    .cleanup = net_syslink_cleanup,
+};
+
+bool net_syslink_get_stats(NetClientState *nc, SyslinkStats *stats)
+{
+    if (!nc || nc->info->type != NET_CLIENT_DRIVER_SYSLINK) {
+        return false;
+    }
+
+    NetSyslinkState *s = DO_UPCAST(NetSyslinkState, nc, nc);
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    memset(stats, 0, sizeof(*stats));
+    stats->id = s->node_id;
+    stats->tx_frames = s->tx_frames;
+    stats->tx_bytes = s->tx_bytes;
+    stats->tx_dropped = s->tx_dropped;
+    stats->tx_batches = s->tx_batches;
+    stats->rx_dropped = s->rx_dropped;
+
+    for (int i = 0; i < SYSLINK_MAX_PEERS; i++) {
+        SyslinkPeer *p = &s->peers[i];
+        if (!p->id) {
+            continue;
+        }
+        SyslinkPeerStats *ps = &stats->peers[stats->num_peers++];
+        ps->id = p->id;
+        ps->rtt_ms = p->rtt_valid ? p->rtt / (float)SCALE_MS : 0;
+        ps->jitter_ms = p->jitter / (float)SCALE_MS;
+        ps->rx_frames = p->rx_frames;
+        ps->rx_bytes = p->rx_bytes;
+        ps->idle_s = (now - p->last_seen) / (float)NANOSECONDS_PER_SECOND;
+    }
+
+    return true;
+}
+
+int net_init_syslink(const Netdev *netdev, const char *name,
+                     NetClientState *peer, Error **errp)
+{
+    const NetdevSyslinkOptions *opts = &netdev->u.syslink;
+    struct sockaddr_in laddr, raddr;
+    NetClientState *nc;
+    NetSyslinkState *s;
+    int fd;
+
+    assert(netdev->type == NET_CLIENT_DRIVER_SYSLINK);
+
+    if (parse_host_port(&raddr, opts->relay, errp) < 0) {
+        return -1;
+    }
+
+    if (parse_host_port(&laddr, opts->has_localaddr ? opts->localaddr
+                                                    : "0.0.0.0:0",
+                        errp) < 0) {
+        return -1;
+    }
+
+    fd = qemu_socket(PF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) {
+        error_setg_errno(errp, errno, "can't create datagram socket");
+        return -1;
+    }
+
+    if (bind(fd, (struct sockaddr *)&laddr, sizeof(laddr)) < 0) {
+        error_setg_errno(errp, errno, "can't bind ip=%s to socket",
+                         inet_ntoa(laddr.sin_addr));
+        closesocket(fd);
+        return -1;
+    }
+
+    /* Only ever talk to the relay, which also lets the kernel discard
+     * datagrams from anyone else */
+    if (connect(fd, (struct sockaddr *)&raddr, sizeof(raddr)) < 0) {
+        error_setg_errno(errp, errno, "can't connect to relay %s",
+                         opts->relay);
+        closesocket(fd);
+        return -1;
+    }
+
+    qemu_set_nonblock(fd);
+
+    nc = qemu_new_net_client(&net_syslink_info, peer, "syslink", name);
+    s = DO_UPCAST(NetSyslinkState, nc, nc);
+    s->fd = fd;
+    s->compress = opts->has_compress && opts->compress;
+    do {
+        s->node_id = g_random_int();
+    } while (s->node_id == 0);
+
+    s->tx_bh = qemu_bh_new(net_syslink_tx_bh, s);
+    s->ping_timer = timer_new_ms(QEMU_CLOCK_REALTIME, net_syslink_ping, s);
+    net_syslink_ping(s);
+
+    snprintf(nc->info_str, sizeof(nc->info_str), "syslink: relay=%s:%d",
+             inet_ntoa(raddr.sin_addr), ntohs(raddr.sin_port));
+
+    net_syslink_read_poll(s, true);
+
+    return 0;
+}
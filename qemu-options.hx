@@ -144,7 +144,9 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                kernel-irqchip=on|off|split controls accelerated irqchip support (default=on)\n"
     "                kvm-shadow-mem=size of KVM shadow MMU in bytes\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
+    "                superblock-threshold=n (TCG superblock promotion, default 0)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tlb-prefill=n (TCG large page TLB prefill, default 0)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n", QEMU_ARCH_ALL)
 SRST
@@ -176,9 +178,23 @@ SRST
         such a case this will default on. On other operating systems, this
         will default off, but one may enable this for testing or debugging.
 
+    ``superblock-threshold=n``
+        Number of times a TCG translation block may be dispatched from the
+        execution loop or an indirect jump before it is retranslated as a
+        superblock that follows direct jumps and calls further down the
+        same page. Indirect jumps out of a superblock look up the next
+        superblock inline instead of calling into the execution loop.
+        The default of 0 disables superblock promotion.
+
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``tlb-prefill=n``
+        Number of TCG TLB entries filled ahead of use after a miss within a
+        guest large page. The following pages of the same large page are
+        filled if their TLB slots are empty. The default of 0 disables
+        prefilling.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
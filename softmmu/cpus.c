@@ -451,6 +451,16 @@ void cpus_kick_thread(CPUState *cpu)
 void qemu_cpu_kick(CPUState *cpu)
 {
     qemu_cond_broadcast(cpu->halt_cond);
+#ifdef XBOX
+    /* Pairs with smp_mb() in fast_mmio_park() */
+    smp_mb();
+    QemuMutex *park_lock = qatomic_read(&cpu->park_lock);
+    if (park_lock) {
+        qemu_mutex_lock(park_lock);
+        qemu_cond_broadcast(qatomic_read(&cpu->park_cond));
+        qemu_mutex_unlock(park_lock);
+    }
+#endif
     if (cpus_accel->kick_vcpu_thread) {
         cpus_accel->kick_vcpu_thread(cpu);
     } else { /* default */
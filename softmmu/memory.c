@@ -2112,7 +2112,9 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 #ifdef XBOX
     assert((client == DIRTY_MEMORY_VGA) \
         || (client == DIRTY_MEMORY_NV2A) \
-        || (client == DIRTY_MEMORY_NV2A_TEX));
+        || (client == DIRTY_MEMORY_NV2A_TEX) \
+        || (client == DIRTY_MEMORY_SNAPSHOT) \
+        || (client == DIRTY_MEMORY_REWIND));
     if (mr->alias) {
         memory_region_set_log(mr->alias, log, client);
         return;
@@ -2483,6 +2485,11 @@ void memory_region_clear_flush_coalesced(MemoryRegion *mr)
     }
 }
 
+void memory_region_enable_lockless_io(MemoryRegion *mr)
+{
+    mr->lockless_io = true;
+}
+
 static bool userspace_eventfd_warning;
 
 void memory_region_add_eventfd(MemoryRegion *mr,
@@ -2827,7 +2827,7 @@ static bool prepare_mmio_access(MemoryRegion *mr)
 {
     bool release_lock = false;
 
-    if (!qemu_mutex_iothread_locked()) {
+    if (!mr->lockless_io && !qemu_mutex_iothread_locked()) {
         qemu_mutex_lock_iothread();
         release_lock = true;
     }
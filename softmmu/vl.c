@@ -133,6 +133,7 @@
 #include "ui/xemu-notifications.h"
 #include "ui/xemu-net.h"
 #include "ui/xemu-input.h"
+#include "ui/xemu-rewind.h"
 #include "hw/xbox/eeprom_generation.h"
 
 #define MAX_VIRTIO_CONSOLES 1
@@ -2721,6 +2722,7 @@ static void qemu_machine_creation_done(void)
 
 #ifdef XBOX
     xemu_input_init();
+    xemu_rewind_init();
 #endif
 
     if (machine->cgs) {
@@ -2966,13 +2968,34 @@ void qemu_init(int argc, char **argv, char **envp)
     }
 
     // Always populate DVD drive. If disc path is the empty string, drive is
-    // connected but no media present.
+    // connected but no media present. Disc images never change under the
+    // guest, so they can optionally be served from a read-only mapping,
+    // which the mmap driver reads into the page cache in the background.
+    // A read error on a mapped image raises SIGBUS rather than failing the
+    // request, hence off by default.
+    int dvd_mmap;
+    xemu_settings_get_bool(XEMU_SETTINGS_SYSTEM_DVD_MMAP, &dvd_mmap);
     fake_argv[fake_argc++] = strdup("-drive");
     char *escaped_dvd_path = strdup_double_commas(dvd_path);
-    fake_argv[fake_argc++] = g_strdup_printf("index=1,media=cdrom,file=%s",
+    fake_argv[fake_argc++] = g_strdup_printf("index=1,media=cdrom,file=%s%s",
+        dvd_mmap && strlen(dvd_path) > 0 ? "mmap:" : "",
         escaped_dvd_path);
     free(escaped_dvd_path);
 
+    int dvd_readahead, dvd_seek_timing;
+    xemu_settings_get_int(XEMU_SETTINGS_SYSTEM_DVD_READAHEAD, &dvd_readahead);
+    xemu_settings_get_int(XEMU_SETTINGS_SYSTEM_DVD_SEEK_TIMING, &dvd_seek_timing);
+    if (dvd_readahead > 0) {
+        fake_argv[fake_argc++] = strdup("-global");
+        fake_argv[fake_argc++] = g_strdup_printf("ide-cd.readahead-size=%dK",
+                                                 dvd_readahead);
+    }
+    if (dvd_seek_timing > 0) {
+        fake_argv[fake_argc++] = strdup("-global");
+        fake_argv[fake_argc++] = g_strdup_printf("ide-cd.seek-timing=%d",
+                                                 dvd_seek_timing);
+    }
+
     fake_argv[fake_argc++] = strdup("-display");
     fake_argv[fake_argc++] = strdup("xemu");
 
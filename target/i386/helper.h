@@ -72,6 +72,8 @@ DEF_HELPER_1(rsm, void, env)
 #endif /* !CONFIG_USER_ONLY */
 
 DEF_HELPER_2(into, void, env, int)
+DEF_HELPER_3(rep_movs, void, env, i32, i32)
+DEF_HELPER_2(rep_stos, void, env, i32)
 DEF_HELPER_2(cmpxchg8b_unlocked, void, env, tl)
 DEF_HELPER_2(cmpxchg8b, void, env, tl)
 #ifdef TARGET_X86_64
@@ -181,3 +181,171 @@ void helper_boundl(CPUX86State *env, target_ulong a0, int v)
         raise_exception_ra(env, EXCP05_BOUND, GETPC());
     }
 }
+
+/*
+ * Bulk "rep movs" and "rep stos" for a 32-bit address size.  Each call
+ * handles at most REP_BULK_MAX_BYTES, a guest page at a time, with host
+ * memmove/memset wherever both sides resolve to RAM.  ECX, ESI and EDI are
+ * written back after every chunk, so a fault leaves the instruction ready
+ * to restart, and the translated loop around the helper still gives
+ * interrupts a chance between calls.  probe_access() takes care of
+ * watchpoints, code invalidation and dirty tracking for the whole chunk;
+ * MMIO, page-crossing elements and DF=1 fall back to single elements.
+ */
+#define REP_BULK_MAX_BYTES (16 * TARGET_PAGE_SIZE)
+
+static target_ulong rep_linear_addr(CPUX86State *env, int seg,
+                                    target_ulong reg)
+{
+    target_ulong addr = env->segs[seg].base + (uint32_t)reg;
+
+#ifdef TARGET_X86_64
+    if (!(env->hflags & HF_CS64_MASK)) {
+        addr = (uint32_t)addr;
+    }
+#endif
+    return addr;
+}
+
+/* Whole elements of 1 << ot bytes left before the end of the page */
+static uint32_t rep_page_elems(target_ulong addr, int ot)
+{
+    return -(addr | TARGET_PAGE_MASK) >> ot;
+}
+
+static void rep_advance(CPUX86State *env, int reg, uint32_t bytes)
+{
+    env->regs[reg] = (uint32_t)(env->regs[reg] + env->df * (int32_t)bytes);
+}
+
+static uint64_t rep_ld(CPUX86State *env, target_ulong addr, int ot,
+                       uintptr_t ra)
+{
+    switch (ot) {
+    case MO_8:
+        return cpu_ldub_data_ra(env, addr, ra);
+    case MO_16:
+        return cpu_lduw_data_ra(env, addr, ra);
+    case MO_32:
+        return cpu_ldl_data_ra(env, addr, ra);
+    default:
+        return cpu_ldq_data_ra(env, addr, ra);
+    }
+}
+
+static void rep_st(CPUX86State *env, target_ulong addr, uint64_t val, int ot,
+                   uintptr_t ra)
+{
+    switch (ot) {
+    case MO_8:
+        cpu_stb_data_ra(env, addr, val, ra);
+        break;
+    case MO_16:
+        cpu_stw_data_ra(env, addr, val, ra);
+        break;
+    case MO_32:
+        cpu_stl_data_ra(env, addr, val, ra);
+        break;
+    default:
+        cpu_stq_data_ra(env, addr, val, ra);
+        break;
+    }
+}
+
+void helper_rep_movs(CPUX86State *env, uint32_t ot, uint32_t seg)
+{
+    uintptr_t ra = GETPC();
+    int mmu_idx = cpu_mmu_index(env, false);
+    uint32_t count = env->regs[R_ECX];
+    uint32_t budget = REP_BULK_MAX_BYTES >> ot;
+
+    while (count && budget) {
+        target_ulong src = rep_linear_addr(env, seg, env->regs[R_ESI]);
+        target_ulong dst = rep_linear_addr(env, R_ES, env->regs[R_EDI]);
+        uint32_t n = MIN(count, budget);
+        void *hsrc = NULL, *hdst = NULL;
+
+        if (env->df > 0) {
+            n = MIN(n, rep_page_elems(src, ot));
+            n = MIN(n, rep_page_elems(dst, ot));
+        }
+        if (env->df > 0 && n) {
+            hsrc = probe_access(env, src, n << ot, MMU_DATA_LOAD, mmu_idx, ra);
+            hdst = probe_access(env, dst, n << ot, MMU_DATA_STORE, mmu_idx,
+                                ra);
+        }
+
+        if (hsrc && hdst) {
+            /*
+             * An element-wise forward copy into an overlapping destination
+             * replicates the pattern between the two; copying no further
+             * than the distance at a time gives the same result.
+             */
+            if (hdst > hsrc && hdst < hsrc + (n << ot)) {
+                n = MAX(((uintptr_t)hdst - (uintptr_t)hsrc) >> ot, 1);
+            }
+            memmove(hdst, hsrc, n << ot);
+        } else {
+            n = 1;
+            rep_st(env, dst, rep_ld(env, src, ot, ra), ot, ra);
+        }
+
+        count -= n;
+        budget -= n;
+        env->regs[R_ECX] = count;
+        rep_advance(env, R_ESI, n << ot);
+        rep_advance(env, R_EDI, n << ot);
+    }
+}
+
+void helper_rep_stos(CPUX86State *env, uint32_t ot)
+{
+    uintptr_t ra = GETPC();
+    int mmu_idx = cpu_mmu_index(env, false);
+    uint32_t count = env->regs[R_ECX];
+    uint32_t budget = REP_BULK_MAX_BYTES >> ot;
+    uint64_t val = env->regs[R_EAX] & MAKE_64BIT_MASK(0, 8 << ot);
+    bool splat = val == (uint8_t)val * (MAKE_64BIT_MASK(0, 8 << ot) / 0xff);
+
+    while (count && budget) {
+        target_ulong dst = rep_linear_addr(env, R_ES, env->regs[R_EDI]);
+        uint32_t n = MIN(count, budget);
+        void *hdst = NULL;
+
+        if (env->df > 0) {
+            n = MIN(n, rep_page_elems(dst, ot));
+        }
+        if (env->df > 0 && n) {
+            hdst = probe_access(env, dst, n << ot, MMU_DATA_STORE, mmu_idx,
+                                ra);
+        }
+
+        if (hdst && splat) {
+            memset(hdst, val, n << ot);
+        } else if (hdst) {
+            for (uint32_t i = 0; i < n; i++) {
+                void *p = hdst + (i << ot);
+
+                switch (ot) {
+                case MO_16:
+                    stw_le_p(p, val);
+                    break;
+                case MO_32:
+                    stl_le_p(p, val);
+                    break;
+                default:
+                    stq_le_p(p, val);
+                    break;
+                }
+            }
+        } else {
+            n = 1;
+            rep_st(env, dst, val, ot, ra);
+        }
+
+        count -= n;
+        budget -= n;
+        env->regs[R_ECX] = count;
+        rep_advance(env, R_EDI, n << ot);
+    }
+}
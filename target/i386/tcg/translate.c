@@ -1374,6 +1374,36 @@ GEN_REPZ(outs)
 GEN_REPZ2(scas)
 GEN_REPZ2(cmps)
 
+/*
+ * rep movs/stos with a 32-bit address size go through a helper that moves
+ * many elements per call with host memcpy/memset.  Keep the per-iteration
+ * loop when single-stepping or counting instructions.
+ */
+static inline bool use_rep_bulk(DisasContext *s)
+{
+    return s->aflag == MO_32 && s->jmp_opt &&
+           !(tb_cflags(s->base.tb) & CF_USE_ICOUNT);
+}
+
+static void gen_repz_bulk(DisasContext *s, MemOp ot, bool stos,
+                          target_ulong cur_eip, target_ulong next_eip)
+{
+    TCGLabel *l2;
+
+    gen_update_cc_op(s);
+    l2 = gen_jz_ecx_string(s, next_eip);
+    if (stos) {
+        gen_helper_rep_stos(cpu_env, tcg_constant_i32(ot));
+    } else {
+        gen_helper_rep_movs(cpu_env, tcg_constant_i32(ot),
+                            tcg_constant_i32(s->override < 0 ? R_DS
+                                                             : s->override));
+    }
+    /* The helper stops early to let interrupts in; loop until ECX is 0 */
+    gen_op_jz_ecx(s, s->aflag, l2);
+    gen_jmp(s, cur_eip);
+}
+
 static TCGv_ptr gen_stn_ptr(int opreg)
 {
     TCGv_i32 offset = tcg_temp_new_i32();
@@ -3127,6 +3157,43 @@ static void gen_bnd_jmp(DisasContext *s)
     }
 }
 
+/* Look up the next TB from the state cpu_get_tb_cpu_state() will see,
+   so that superblocks can jump to each other without the helper.  */
+static void gen_lookup_and_goto_ptr(DisasContext *s)
+{
+    TCGv pc, cs_base, eflags;
+    TCGv_i32 flags, t32;
+
+    if (!translator_use_inline_lookup(&s->base)) {
+        tcg_gen_lookup_and_goto_ptr();
+        return;
+    }
+
+    pc = tcg_temp_new();
+    cs_base = tcg_temp_new();
+    eflags = tcg_temp_new();
+    flags = tcg_temp_new_i32();
+    t32 = tcg_temp_new_i32();
+
+    tcg_gen_ld_tl(cs_base, cpu_env, offsetof(CPUX86State, segs[R_CS].base));
+    tcg_gen_ld_tl(pc, cpu_env, offsetof(CPUX86State, eip));
+    tcg_gen_add_tl(pc, pc, cs_base);
+    tcg_gen_ld_i32(flags, cpu_env, offsetof(CPUX86State, hflags));
+    tcg_gen_ld_tl(eflags, cpu_env, offsetof(CPUX86State, eflags));
+    tcg_gen_trunc_tl_i32(t32, eflags);
+    tcg_gen_andi_i32(t32, t32,
+                     IOPL_MASK | TF_MASK | RF_MASK | VM_MASK | AC_MASK);
+    tcg_gen_or_i32(flags, flags, t32);
+
+    translator_gen_lookup_and_goto_ptr(&s->base, pc, cs_base, flags);
+
+    tcg_temp_free_i32(t32);
+    tcg_temp_free_i32(flags);
+    tcg_temp_free(eflags);
+    tcg_temp_free(cs_base);
+    tcg_temp_free(pc);
+}
+
 /* Generate an end of block. Trace exception is also generated if needed.
    If INHIBIT, set HF_INHIBIT_IRQ_MASK if it isn't already set.
    If RECHECK_TF, emit a rechecking helper for #DB, ignoring the state of
@@ -3154,7 +3221,7 @@ do_gen_eob_worker(DisasContext *s, bool inhibit, bool recheck_tf, bool jr)
     } else if (s->flags & HF_TF_MASK) {
         gen_helper_single_step(cpu_env);
     } else if (jr) {
-        tcg_gen_lookup_and_goto_ptr();
+        gen_lookup_and_goto_ptr(s);
     } else {
         tcg_gen_exit_tb(NULL, 0);
     }
@@ -3205,6 +3272,19 @@ static void gen_jmp(DisasContext *s, target_ulong eip)
     gen_jmp_tb(s, eip, 0);
 }
 
+/* Direct jump to an immediate target.  Superblocks keep translating at
+   the target instead of ending the block when it is further down the
+   same page. */
+static void gen_jmp_direct(DisasContext *s, target_ulong eip)
+{
+    if (s->jmp_opt &&
+        translator_use_superblock(&s->base, s->pc, s->cs_base + eip)) {
+        s->pc = s->cs_base + eip;
+        return;
+    }
+    gen_jmp(s, eip);
+}
+
 static inline void gen_ldq_env_A0(DisasContext *s, int offset)
 {
     tcg_gen_qemu_ld_i64(s->tmp1_i64, s->A0, s->mem_index, MO_LEQ);
@@ -6959,7 +7039,10 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
     case 0xa4: /* movsS */
     case 0xa5:
         ot = mo_b_d(b, dflag);
-        if (prefixes & (PREFIX_REPZ | PREFIX_REPNZ)) {
+        if ((prefixes & (PREFIX_REPZ | PREFIX_REPNZ)) && use_rep_bulk(s)) {
+            gen_repz_bulk(s, ot, false, pc_start - s->cs_base,
+                          s->pc - s->cs_base);
+        } else if (prefixes & (PREFIX_REPZ | PREFIX_REPNZ)) {
             gen_repz_movs(s, ot, pc_start - s->cs_base, s->pc - s->cs_base);
         } else {
             gen_movs(s, ot);
@@ -6969,7 +7052,10 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
     case 0xaa: /* stosS */
     case 0xab:
         ot = mo_b_d(b, dflag);
-        if (prefixes & (PREFIX_REPZ | PREFIX_REPNZ)) {
+        if ((prefixes & (PREFIX_REPZ | PREFIX_REPNZ)) && use_rep_bulk(s)) {
+            gen_repz_bulk(s, ot, true, pc_start - s->cs_base,
+                          s->pc - s->cs_base);
+        } else if (prefixes & (PREFIX_REPZ | PREFIX_REPNZ)) {
             gen_repz_stos(s, ot, pc_start - s->cs_base, s->pc - s->cs_base);
         } else {
             gen_stos(s, ot);
@@ -7207,7 +7293,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             tcg_gen_movi_tl(s->T0, next_eip);
             gen_push_v(s, s->T0);
             gen_bnd_jmp(s);
-            gen_jmp(s, tval);
+            gen_jmp_direct(s, tval);
         }
         break;
     case 0x9a: /* lcall im */
@@ -7237,7 +7323,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
             tval &= 0xffffffff;
         }
         gen_bnd_jmp(s);
-        gen_jmp(s, tval);
+        gen_jmp_direct(s, tval);
         break;
     case 0xea: /* ljmp im */
         {
@@ -7259,7 +7345,7 @@ static target_ulong disas_insn(DisasContext *s, CPUState *cpu)
         if (dflag == MO_16) {
             tval &= 0xffff;
         }
-        gen_jmp(s, tval);
+        gen_jmp_direct(s, tval);
         break;
     case 0x70 ... 0x7f: /* jcc Jb */
         tval = (int8_t)insn_get(env, s, MO_8);
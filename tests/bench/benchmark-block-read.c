@@ -0,0 +1,273 @@
+/*
+ * Disc image read benchmark, mmap driver against the file driver
+ *
+ * Reads a scratch image through each driver from a warm page cache, so
+ * what is measured is the per-request cost of the read path rather than
+ * the disk, and reports throughput and request latency percentiles.
+ *
+ * The mmap driver is measured twice: before the image is populated, when
+ * reads go through the thread pool like the file driver's, and once its
+ * background populate has finished and reads are copied in place.
+ *
+ * The atapi cases issue the reads the way an ATAPI DMA read of 2048 byte
+ * sectors does: over the file driver through the read-ahead cache into a
+ * bounce buffer copied out to guest pages, over the mmap driver straight
+ * into the scattered guest pages.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/timer.h"
+#include "qemu/main-loop.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "block/block.h"
+#include "sysemu/block-backend.h"
+#include "hw/ide/atapi-readahead.h"
+
+#define IMAGE_SIZE      (64 * MiB)
+#define READ_TOTAL      (256 * MiB)
+#define GUEST_PAGE_SIZE (4 * KiB)
+#define READAHEAD_SIZE  (4 * MiB)  /* xemu's default dvd_readahead */
+
+typedef struct BlockReadDriver {
+    const char *name;
+    const char *driver;
+    bool populate;
+} BlockReadDriver;
+
+typedef struct BlockReadOpts {
+    const BlockReadDriver *driver;
+    size_t chunk_size;
+    bool random;
+    bool atapi;
+} BlockReadOpts;
+
+typedef struct BlockReadReq {
+    int ret;
+    bool done;
+} BlockReadReq;
+
+static char *image_path;
+
+static void create_image(void)
+{
+    uint8_t *buf = g_malloc(MiB);
+    int fd, i;
+
+    fd = g_file_open_tmp("qemu-bench-block-read.XXXXXX", &image_path, NULL);
+    g_assert(fd >= 0);
+    for (i = 0; i < IMAGE_SIZE / MiB; i++) {
+        memset(buf, i, MiB);
+        g_assert(write(fd, buf, MiB) == MiB);
+    }
+    close(fd);
+    g_free(buf);
+}
+
+static bool mmap_populated(BlockBackend *blk)
+{
+    ImageInfoSpecific *info = bdrv_get_specific_info(blk_bs(blk),
+                                                     &error_abort);
+    bool populated;
+
+    g_assert(info && info->type == IMAGE_INFO_SPECIFIC_KIND_MMAP);
+    populated = info->u.mmap.data->populated;
+    qapi_free_ImageInfoSpecific(info);
+    return populated;
+}
+
+static BlockBackend *open_image(const BlockReadDriver *driver)
+{
+    QDict *options = qdict_new();
+    BlockBackend *blk;
+
+    qdict_put_str(options, "driver", driver->driver);
+    qdict_put_str(options, "filename", image_path);
+    if (!strcmp(driver->driver, "mmap")) {
+        qdict_put_bool(options, "populate", driver->populate);
+    }
+    blk = blk_new_open(NULL, NULL, options, 0, &error_abort);
+
+    /* Measure the in-place copy, not the pool path before it */
+    while (driver->populate && !mmap_populated(blk)) {
+        g_usleep(1000);
+    }
+    return blk;
+}
+
+static int cmp_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static void block_read_cb(void *opaque, int ret)
+{
+    BlockReadReq *r = opaque;
+
+    r->ret = ret;
+    r->done = true;
+}
+
+static void block_read_wait(BlockReadReq *r)
+{
+    while (!r->done) {
+        aio_poll(qemu_get_aio_context(), true);
+    }
+    g_assert(r->ret == 0);
+}
+
+/* One DMA read of a sector run, as hw/ide/atapi.c issues it */
+static void atapi_read(BlockBackend *blk, ATAPIReadahead *ra, int64_t offset,
+                       size_t size, uint8_t *bounce, uint8_t **pages)
+{
+    BlockReadReq r = { 0 };
+    QEMUIOVector qiov;
+    size_t i;
+
+    if (!ra) {
+        qemu_iovec_init(&qiov, size / GUEST_PAGE_SIZE + 1);
+        for (i = 0; i < size; i += GUEST_PAGE_SIZE) {
+            qemu_iovec_add(&qiov, pages[i / GUEST_PAGE_SIZE],
+                           MIN(GUEST_PAGE_SIZE, size - i));
+        }
+        blk_aio_preadv(blk, offset, &qiov, 0, block_read_cb, &r);
+        block_read_wait(&r);
+        qemu_iovec_destroy(&qiov);
+        return;
+    }
+
+    qemu_iovec_init_buf(&qiov, bounce, size);
+    atapi_readahead_readv(ra, offset / ATAPI_RA_SECTOR_SIZE,
+                          size / ATAPI_RA_SECTOR_SIZE, &qiov,
+                          block_read_cb, &r);
+    block_read_wait(&r);
+    for (i = 0; i < size; i += GUEST_PAGE_SIZE) {
+        memcpy(pages[i / GUEST_PAGE_SIZE], bounce + i,
+               MIN(GUEST_PAGE_SIZE, size - i));
+    }
+}
+
+static void test_block_read_speed(const void *opaque)
+{
+    const BlockReadOpts *opts = opaque;
+    size_t nb_requests = READ_TOTAL / opts->chunk_size;
+    size_t nb_chunks = IMAGE_SIZE / opts->chunk_size;
+    size_t nb_pages = DIV_ROUND_UP(opts->chunk_size, GUEST_PAGE_SIZE);
+    int64_t *latency = g_new(int64_t, nb_requests);
+    uint8_t *buf = qemu_memalign(4096, opts->chunk_size);
+    /* Every other page, guest memory is rarely contiguous */
+    uint8_t *guest = qemu_memalign(4096, nb_pages * 2 * GUEST_PAGE_SIZE);
+    uint8_t **pages = g_new(uint8_t *, nb_pages);
+    BlockBackend *blk = open_image(opts->driver);
+    ATAPIReadahead *ra = NULL;
+    int64_t offset, start, total_ns = 0;
+    size_t i;
+
+    for (i = 0; i < nb_pages; i++) {
+        pages[i] = guest + i * 2 * GUEST_PAGE_SIZE;
+    }
+    if (opts->atapi && !blk_is_memory_mapped(blk)) {
+        ra = atapi_readahead_new(blk, READAHEAD_SIZE, 0);
+    }
+
+    /* Warm the page cache and the mapping */
+    for (offset = 0; offset < IMAGE_SIZE; offset += opts->chunk_size) {
+        g_assert(blk_pread(blk, offset, buf, opts->chunk_size) >= 0);
+    }
+
+    for (i = 0; i < nb_requests; i++) {
+        if (opts->random) {
+            offset = g_test_rand_int_range(0, nb_chunks) * opts->chunk_size;
+        } else {
+            offset = (i % nb_chunks) * opts->chunk_size;
+        }
+        start = get_clock();
+        if (opts->atapi) {
+            atapi_read(blk, ra, offset, opts->chunk_size, buf, pages);
+        } else {
+            g_assert(blk_pread(blk, offset, buf, opts->chunk_size) >= 0);
+        }
+        latency[i] = get_clock() - start;
+        total_ns += latency[i];
+        g_assert((opts->atapi ? pages[0][0] : buf[0]) == offset / MiB);
+    }
+
+    qsort(latency, nb_requests, sizeof(*latency), cmp_int64);
+    g_test_message("%s(%s): %s chunk %zu bytes %.2f MB/sec, "
+                   "latency avg %.2f us p50 %.2f us p99 %.2f us",
+                   opts->atapi ? "atapi" : "read", opts->driver->name,
+                   opts->random ? "random" : "sequential",
+                   opts->chunk_size,
+                   (double)READ_TOTAL / MiB / (total_ns / 1e9),
+                   total_ns / 1e3 / nb_requests,
+                   latency[nb_requests / 2] / 1e3,
+                   latency[nb_requests * 99 / 100] / 1e3);
+
+    atapi_readahead_free(ra);
+    blk_unref(blk);
+    g_free(pages);
+    qemu_vfree(guest);
+    qemu_vfree(buf);
+    g_free(latency);
+}
+
+int main(int argc, char **argv)
+{
+    static const BlockReadDriver drivers[] = {
+        { "file", "file", false },
+        { "mmap", "mmap", false },
+        { "mmap-populated", "mmap", true },
+    };
+    static const size_t chunk_sizes[] = { 2 * KiB, 32 * KiB, 128 * KiB };
+    BlockReadOpts *opts;
+    char *name;
+    int a, d, c, r, ret;
+
+    g_test_init(&argc, &argv, NULL);
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+    create_image();
+
+    for (a = 0; a < 2; a++) {
+        for (r = 0; r < 2; r++) {
+            for (c = 0; c < ARRAY_SIZE(chunk_sizes); c++) {
+                for (d = 0; d < ARRAY_SIZE(drivers); d++) {
+                    opts = g_new(BlockReadOpts, 1);
+                    opts->driver = &drivers[d];
+                    opts->chunk_size = chunk_sizes[c];
+                    opts->random = r;
+                    opts->atapi = a;
+                    name = g_strdup_printf("/block/benchmark/%s/%s/%s/"
+                                           "bufsize-%zu",
+                                           a ? "atapi" : "read",
+                                           r ? "random" : "sequential",
+                                           drivers[d].name, chunk_sizes[c]);
+                    g_test_add_data_func_full(name, opts,
+                                              test_block_read_speed, g_free);
+                    g_free(name);
+                }
+            }
+        }
+    }
+
+    ret = g_test_run();
+    unlink(image_path);
+    g_free(image_path);
+    return ret;
+}
@@ -0,0 +1,159 @@
+/*
+ * Quick save memory path benchmark
+ *
+ * Drives the shadow chunk helpers behind xemu's quick save over synthetic
+ * guest RAM: copying dirty pages into the shadow at several dirty rates,
+ * then compressing and unpacking every chunk. The RAM mixes zero, repeated
+ * and random pages so compression sees something like a running game.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/bitmap.h"
+#include "qemu/timer.h"
+#include "ui/xemu-quicksave-chunks.h"
+
+#define RAM_SIZE      (64 * MiB)
+#define RAM_PAGE_SIZE (4 * KiB)
+#define NUM_PAGES     (RAM_SIZE / RAM_PAGE_SIZE)
+#define NUM_CHUNKS    (RAM_SIZE / QUICKSAVE_CHUNK_SIZE)
+#define COPY_ROUNDS   16
+
+static uint8_t *ram;
+static uint8_t *shadow;
+static QuickSaveChunk chunks[NUM_CHUNKS];
+
+static void fill_ram(void)
+{
+    for (size_t page = 0; page < NUM_PAGES; page++) {
+        uint32_t *p = (uint32_t *)(ram + page * RAM_PAGE_SIZE);
+        uint32_t kind = g_test_rand_int_range(0, 4);
+
+        for (size_t i = 0; i < RAM_PAGE_SIZE / sizeof(uint32_t); i++) {
+            switch (kind) {
+            case 0:
+            case 1:
+                p[i] = 0;
+                break;
+            case 2:
+                p[i] = page * 0x9e3779b1 + (i & 15);
+                break;
+            default:
+                p[i] = g_test_rand_int();
+                break;
+            }
+        }
+    }
+}
+
+static void test_copy_dirty(const void *opaque)
+{
+    unsigned int percent = GPOINTER_TO_UINT(opaque);
+    unsigned long *dirty = bitmap_new(NUM_PAGES);
+    int64_t total_ns = 0;
+    uint64_t pages = 0;
+
+    for (int round = 0; round < COPY_ROUNDS; round++) {
+        bitmap_zero(dirty, NUM_PAGES);
+        for (size_t page = 0; page < NUM_PAGES; page++) {
+            if (g_test_rand_int_range(0, 100) < percent) {
+                set_bit(page, dirty);
+            }
+        }
+
+        int64_t start = get_clock();
+        pages += quicksave_copy_dirty_pages(shadow, chunks, 0, ram, RAM_SIZE,
+                                            dirty, RAM_PAGE_SIZE);
+        total_ns += get_clock() - start;
+    }
+
+    g_test_message("copy dirty %u%%: %" PRIu64 " pages, %.3f ms/save, "
+                   "%.2f GB/s copied", percent, pages / COPY_ROUNDS,
+                   total_ns / 1e6 / COPY_ROUNDS,
+                   total_ns ? pages * RAM_PAGE_SIZE / (double)total_ns : 0.0);
+    g_free(dirty);
+}
+
+static void test_compress(void)
+{
+    uint64_t stored = 0;
+
+    memcpy(shadow, ram, RAM_SIZE);
+
+    int64_t start = get_clock();
+    for (uint32_t i = 0; i < NUM_CHUNKS; i++) {
+        quicksave_compress_chunk_data(&chunks[i],
+                                      shadow + i * QUICKSAVE_CHUNK_SIZE,
+                                      quicksave_chunk_size(RAM_SIZE, i));
+    }
+    int64_t ns = get_clock() - start;
+
+    for (uint32_t i = 0; i < NUM_CHUNKS; i++) {
+        stored += chunks[i].len;
+    }
+    g_test_message("compress: %.2f MB/s, %u chunks to %.1f%% of %u MiB",
+                   RAM_SIZE / (double)MiB / (ns / 1e9), (unsigned)NUM_CHUNKS,
+                   stored * 100.0 / RAM_SIZE, (unsigned)(RAM_SIZE / MiB));
+}
+
+static void test_decompress(void)
+{
+    memset(shadow, 0xaa, RAM_SIZE);
+
+    int64_t start = get_clock();
+    for (uint32_t i = 0; i < NUM_CHUNKS; i++) {
+        g_assert(quicksave_decompress_chunk_data(
+            &chunks[i], shadow + i * QUICKSAVE_CHUNK_SIZE,
+            quicksave_chunk_size(RAM_SIZE, i)));
+    }
+    int64_t ns = get_clock() - start;
+
+    g_assert(memcmp(shadow, ram, RAM_SIZE) == 0);
+    g_test_message("decompress: %.2f MB/s",
+                   RAM_SIZE / (double)MiB / (ns / 1e9));
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned int percents[] = { 1, 10, 50, 100 };
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+
+    ram = qemu_memalign(RAM_PAGE_SIZE, RAM_SIZE);
+    shadow = qemu_memalign(RAM_PAGE_SIZE, RAM_SIZE);
+    fill_ram();
+
+    for (int i = 0; i < ARRAY_SIZE(percents); i++) {
+        char *name = g_strdup_printf("/quicksave/benchmark/copy-dirty/%u",
+                                     percents[i]);
+        g_test_add_data_func(name, GUINT_TO_POINTER(percents[i]),
+                             test_copy_dirty);
+        g_free(name);
+    }
+    /* Decompress unpacks what compress left behind, so order matters */
+    g_test_add_func("/quicksave/benchmark/compress", test_compress);
+    g_test_add_func("/quicksave/benchmark/decompress", test_decompress);
+
+    ret = g_test_run();
+
+    for (uint32_t i = 0; i < NUM_CHUNKS; i++) {
+        g_free(chunks[i].data);
+    }
+    qemu_vfree(ram);
+    qemu_vfree(shadow);
+    return ret;
+}
@@ -0,0 +1,92 @@
+/*
+ * Indirect branch benchmark
+ *
+ * CPU bound loops dominated by call/ret and calls through a function
+ * pointer table, which all end their TB with an indirect jump.  Each
+ * kernel reports the TSC cycles it took, so runs with and without
+ * -accel tcg,superblock-threshold=N can be compared.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include <inttypes.h>
+#include <minilib.h>
+
+#define ARRAY_SIZE(x) ((sizeof(x) / sizeof((x)[0])))
+
+#define FIB_N       24
+#define FIB_RESULT  46368
+#define FIB_ROUNDS  20
+
+#define DISPATCH_ROUNDS 200000
+
+static inline uint64_t rdtsc(void)
+{
+    uint32_t lo, hi;
+
+    asm volatile("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static uint32_t fib(uint32_t n)
+{
+    return n < 2 ? n : fib(n - 1) + fib(n - 2);
+}
+
+static uint32_t op_add(uint32_t acc, uint32_t i) { return acc + i; }
+static uint32_t op_xor(uint32_t acc, uint32_t i) { return acc ^ (i << 3); }
+static uint32_t op_rol(uint32_t acc, uint32_t i) { return acc << 5 | acc >> 27; }
+static uint32_t op_mul(uint32_t acc, uint32_t i) { return acc * 33 + 1; }
+static uint32_t op_sub(uint32_t acc, uint32_t i) { return acc - (i >> 1); }
+static uint32_t op_not(uint32_t acc, uint32_t i) { return ~acc; }
+static uint32_t op_neg(uint32_t acc, uint32_t i) { return -acc + i; }
+static uint32_t op_shr(uint32_t acc, uint32_t i) { return acc >> 1 | i << 31; }
+
+static uint32_t (*const ops[])(uint32_t, uint32_t) = {
+    op_add, op_xor, op_rol, op_mul, op_sub, op_not, op_neg, op_shr,
+};
+
+static uint32_t dispatch(uint32_t rounds)
+{
+    uint32_t acc = 1, i;
+
+    for (i = 0; i < rounds; i++) {
+        /* Scramble the index so the call target is not predictable */
+        acc = ops[(acc ^ i) % ARRAY_SIZE(ops)](acc, i);
+    }
+    return acc;
+}
+
+int main(void)
+{
+    uint64_t start, fib_cycles, dispatch_cycles;
+    uint32_t result = 0, i;
+    uint32_t first, second;
+
+    start = rdtsc();
+    for (i = 0; i < FIB_ROUNDS; i++) {
+        result = fib(FIB_N);
+        if (result != FIB_RESULT) {
+            ml_printf("FAIL: fib(%d) = %d, expected %d\n",
+                      FIB_N, result, FIB_RESULT);
+            return 1;
+        }
+    }
+    fib_cycles = rdtsc() - start;
+
+    start = rdtsc();
+    first = dispatch(DISPATCH_ROUNDS);
+    second = dispatch(DISPATCH_ROUNDS);
+    dispatch_cycles = rdtsc() - start;
+    if (first != second) {
+        ml_printf("FAIL: dispatch gave %x then %x\n", first, second);
+        return 1;
+    }
+
+    ml_printf("fib: %llu cycles\n", fib_cycles);
+    ml_printf("dispatch: %llu cycles\n", dispatch_cycles);
+    return 0;
+}
@@ -0,0 +1,389 @@
+/*
+ * ATAPI read-ahead cache tests
+ *
+ * Set ATAPI_READAHEAD_TRACE to a log recorded with
+ *   -trace cd_read_sector -trace cd_read_sector_sync
+ *   -trace ide_atapi_cmd_read_dma_cb_aio
+ * to replay a real title's disc accesses instead of the built-in trace.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "block/block.h"
+#include "sysemu/block-backend.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/bswap.h"
+#include "qemu/main-loop.h"
+#include "hw/ide/atapi-readahead.h"
+
+#define SECTOR        ATAPI_RA_SECTOR_SIZE
+#define DISC_SECTORS  4096
+
+typedef struct TraceRead {
+    int64_t lba;
+    int nb_sectors;
+} TraceRead;
+
+typedef struct TestRead {
+    bool done;
+    int ret;
+} TestRead;
+
+static char *image_path;
+
+static void fill_sector(uint8_t *buf, int64_t lba)
+{
+    int i;
+
+    for (i = 0; i < SECTOR; i++) {
+        buf[i] = lba * 7 + i;
+    }
+    stq_le_p(buf, lba);
+}
+
+/*
+ * Sparse image with the pattern written to the first DISC_SECTORS sectors,
+ * and to every sector @trace reads
+ */
+static void write_image(GArray *trace)
+{
+    int64_t nb_sectors = DISC_SECTORS;
+    uint8_t buf[SECTOR];
+    GError *err = NULL;
+    int64_t lba;
+    guint i;
+    int fd;
+
+    for (i = 0; i < trace->len; i++) {
+        TraceRead *r = &g_array_index(trace, TraceRead, i);
+        nb_sectors = MAX(nb_sectors, r->lba + r->nb_sectors);
+    }
+
+    fd = g_file_open_tmp("atapi-readahead-XXXXXX", &image_path, &err);
+    g_assert_no_error(err);
+    g_assert_cmpint(ftruncate(fd, nb_sectors * SECTOR), ==, 0);
+    for (lba = 0; lba < nb_sectors; lba++) {
+        bool used = lba < DISC_SECTORS;
+
+        for (i = 0; !used && i < trace->len; i++) {
+            TraceRead *r = &g_array_index(trace, TraceRead, i);
+            used = lba >= r->lba && lba < r->lba + r->nb_sectors;
+        }
+        if (used) {
+            fill_sector(buf, lba);
+            g_assert_cmpint(pwrite(fd, buf, SECTOR, lba * SECTOR), ==, SECTOR);
+        }
+    }
+    close(fd);
+}
+
+static BlockBackend *open_image(void)
+{
+    QDict *options = qdict_new();
+
+    qdict_put_str(options, "driver", "file");
+    return blk_new_open(image_path, NULL, options, 0, &error_abort);
+}
+
+static void test_read_cb(void *opaque, int ret)
+{
+    TestRead *r = opaque;
+
+    r->ret = ret;
+    r->done = true;
+}
+
+static int do_read(ATAPIReadahead *ra, int64_t lba, int nb_sectors)
+{
+    uint8_t *buf = g_malloc(nb_sectors * SECTOR);
+    uint8_t expected[SECTOR];
+    QEMUIOVector qiov;
+    TestRead r = { 0 };
+    int i;
+
+    qemu_iovec_init_buf(&qiov, buf, nb_sectors * SECTOR);
+    atapi_readahead_readv(ra, lba, nb_sectors, &qiov, test_read_cb, &r);
+    g_assert_false(r.done);
+    while (!r.done) {
+        aio_poll(qemu_get_aio_context(), true);
+    }
+
+    if (!r.ret) {
+        for (i = 0; i < nb_sectors; i++) {
+            fill_sector(expected, lba + i);
+            g_assert(!memcmp(buf + i * SECTOR, expected, SECTOR));
+        }
+    }
+    g_free(buf);
+    return r.ret;
+}
+
+static uint64_t served_ahead(const ATAPIReadaheadStats *stats)
+{
+    return stats->hit_sectors + stats->wait_sectors;
+}
+
+static void test_sequential(void)
+{
+    BlockBackend *blk = open_image();
+    ATAPIReadahead *ra = atapi_readahead_new(blk, 4 * MiB, 0);
+    ATAPIReadaheadStats stats;
+    int64_t lba;
+
+    for (lba = 0; lba < 2048; lba += 64) {
+        g_assert_cmpint(do_read(ra, lba, 64), ==, 0);
+    }
+
+    atapi_readahead_get_stats(ra, &stats);
+    g_assert_cmpuint(stats.sectors, ==, 2048);
+    g_assert_cmpuint(stats.prefetch_chunks, >, 0);
+    g_assert_cmpuint(served_ahead(&stats) * 4, >=, stats.sectors * 3);
+    g_assert_cmpuint(stats.streams, ==, 1);
+
+    atapi_readahead_free(ra);
+    blk_unref(blk);
+}
+
+static void test_interleaved(void)
+{
+    BlockBackend *blk = open_image();
+    ATAPIReadahead *ra = atapi_readahead_new(blk, 4 * MiB, 0);
+    ATAPIReadaheadStats stats;
+    int i;
+
+    for (i = 0; i < 64; i++) {
+        g_assert_cmpint(do_read(ra, i * 16, 16), ==, 0);
+        g_assert_cmpint(do_read(ra, 2048 + i * 16, 16), ==, 0);
+    }
+
+    atapi_readahead_get_stats(ra, &stats);
+    g_assert_cmpuint(stats.streams, ==, 2);
+    g_assert_cmpuint(served_ahead(&stats) * 4, >=, stats.sectors * 3);
+
+    atapi_readahead_free(ra);
+    blk_unref(blk);
+}
+
+static void test_random(void)
+{
+    BlockBackend *blk = open_image();
+    ATAPIReadahead *ra = atapi_readahead_new(blk, 1 * MiB, 0);
+    ATAPIReadaheadStats stats;
+    int i;
+
+    /* Far apart, nothing here continues an earlier read */
+    for (i = 0; i < 32; i++) {
+        g_assert_cmpint(do_read(ra, (i * 977) % (DISC_SECTORS - 64), 16),
+                        ==, 0);
+    }
+
+    atapi_readahead_get_stats(ra, &stats);
+    g_assert_cmpuint(stats.prefetch_chunks, ==, 0);
+    g_assert_cmpuint(stats.streams, ==, 0);
+
+    atapi_readahead_free(ra);
+    blk_unref(blk);
+}
+
+static void test_cached(void)
+{
+    BlockBackend *blk = open_image();
+    ATAPIReadahead *ra = atapi_readahead_new(blk, 1 * MiB, 0);
+    uint8_t buf[SECTOR], expected[SECTOR];
+
+    g_assert_false(atapi_readahead_read_cached(ra, 100, buf));
+    g_assert_cmpint(do_read(ra, 96, 4), ==, 0);
+
+    /* The whole chunk was fetched */
+    g_assert_true(atapi_readahead_read_cached(ra, 100, buf));
+    fill_sector(expected, 100);
+    g_assert(!memcmp(buf, expected, SECTOR));
+
+    atapi_readahead_invalidate(ra);
+    g_assert_false(atapi_readahead_read_cached(ra, 100, buf));
+
+    atapi_readahead_free(ra);
+    blk_unref(blk);
+}
+
+static void test_cancel(void)
+{
+    BlockBackend *blk = open_image();
+    ATAPIReadahead *ra = atapi_readahead_new(blk, 1 * MiB, 0);
+    uint8_t buf[16 * SECTOR];
+    QEMUIOVector qiov;
+    TestRead r = { 0 };
+
+    qemu_iovec_init_buf(&qiov, buf, sizeof(buf));
+    atapi_readahead_readv(ra, 512, 16, &qiov, test_read_cb, &r);
+    atapi_readahead_cancel(ra);
+    g_assert_true(r.done);
+    g_assert_cmpint(r.ret, ==, -ECANCELED);
+
+    /* The fetch still lands, and nothing completes twice */
+    r.done = false;
+    blk_drain(blk);
+    g_assert_false(r.done);
+    g_assert_cmpint(do_read(ra, 512, 16), ==, 0);
+
+    atapi_readahead_free(ra);
+    blk_unref(blk);
+}
+
+static void test_seek(void)
+{
+    BlockBackend *blk = open_image();
+    ATAPIReadahead *ra = atapi_readahead_new(blk, 1 * MiB, 1);
+    ATAPIReadaheadStats stats;
+
+    g_assert_cmpint(do_read(ra, 3000, 16), ==, 0);
+    atapi_readahead_get_stats(ra, &stats);
+    g_assert_cmpuint(stats.seeks, ==, 1);
+    g_assert_cmpuint(stats.seek_ns, >, 0);
+
+    /* Continuing where the pickup stopped costs no seek */
+    g_assert_cmpint(do_read(ra, 3016, 16), ==, 0);
+    atapi_readahead_get_stats(ra, &stats);
+    g_assert_cmpuint(stats.seeks, ==, 1);
+
+    atapi_readahead_free(ra);
+    blk_unref(blk);
+}
+
+/*
+ * Synthetic trace shaped like a title booting: the volume descriptor and
+ * directory read a sector at a time, the XBE streamed by DMA, then level
+ * data streamed with music interleaved, and a few repeated lookups.
+ */
+static GArray *builtin_trace(void)
+{
+    GArray *trace = g_array_new(false, false, sizeof(TraceRead));
+    TraceRead r;
+    int i;
+
+#define TRACE(l, n) \
+    do { r.lba = (l); r.nb_sectors = (n); g_array_append_val(trace, r); } \
+    while (0)
+
+    TRACE(32, 1);
+    TRACE(33, 1);
+    TRACE(264, 1);
+    TRACE(265, 1);
+    TRACE(1024, 8);
+    for (i = 0; i < 12; i++) {
+        TRACE(1032 + i * 64, 64);
+    }
+    for (i = 0; i < 48; i++) {
+        TRACE(2600 + i * 24, 24);
+        if (i % 3 == 2) {
+            TRACE(3900 + (i / 3) * 8, 8);
+        }
+    }
+    TRACE(264, 1);
+    TRACE(266, 1);
+    TRACE(1024, 8);
+
+#undef TRACE
+    return trace;
+}
+
+static GArray *load_trace(const char *path)
+{
+    GArray *trace = g_array_new(false, false, sizeof(TraceRead));
+    char *contents, **lines, **line;
+    GError *err = NULL;
+
+    g_file_get_contents(path, &contents, NULL, &err);
+    g_assert_no_error(err);
+    lines = g_strsplit(contents, "\n", -1);
+    for (line = lines; *line; line++) {
+        TraceRead r = { .nb_sectors = 1 };
+        int lba, n;
+        char *p;
+
+        if ((p = strstr(*line, "aio read: lba=")) &&
+            sscanf(p, "aio read: lba=%d n=%d", &lba, &n) == 2) {
+            r.nb_sectors = n;
+        } else if (!(((p = strstr(*line, "cd_read_sector lba=")) ||
+                      (p = strstr(*line, "cd_read_sector_sync lba="))) &&
+                     sscanf(strchr(p, '='), "=%d", &lba) == 1)) {
+            continue;
+        }
+        r.lba = lba;
+        g_array_append_val(trace, r);
+    }
+    g_strfreev(lines);
+    g_free(contents);
+    return trace;
+}
+
+static void test_trace(gconstpointer opaque)
+{
+    GArray *trace = (GArray *)opaque;
+    BlockBackend *blk = open_image();
+    ATAPIReadahead *ra = atapi_readahead_new(blk, 1 * MiB, 0);
+    ATAPIReadaheadStats stats;
+    guint i;
+
+    for (i = 0; i < trace->len; i++) {
+        TraceRead *r = &g_array_index(trace, TraceRead, i);
+        g_assert_cmpint(do_read(ra, r->lba, r->nb_sectors), ==, 0);
+    }
+
+    atapi_readahead_get_stats(ra, &stats);
+    g_test_message("%u reads, %" PRIu64 " sectors: %" PRIu64 " hit, %" PRIu64
+                   " in flight, %" PRIu64 " missed, %" PRIu64 " prefetched "
+                   "chunks, %" PRIu64 " unused",
+                   trace->len, stats.sectors, stats.hit_sectors,
+                   stats.wait_sectors, stats.miss_sectors,
+                   stats.prefetch_chunks, stats.wasted_chunks);
+    g_assert_cmpuint(stats.sectors, >, 0);
+    if (!getenv("ATAPI_READAHEAD_TRACE")) {
+        g_assert_cmpuint(served_ahead(&stats) * 2, >=, stats.sectors);
+    }
+
+    atapi_readahead_free(ra);
+    blk_unref(blk);
+}
+
+int main(int argc, char **argv)
+{
+    const char *trace_path = getenv("ATAPI_READAHEAD_TRACE");
+    GArray *trace;
+    int ret;
+
+    bdrv_init();
+    qemu_init_main_loop(&error_abort);
+    g_test_init(&argc, &argv, NULL);
+
+    trace = trace_path ? load_trace(trace_path) : builtin_trace();
+    write_image(trace);
+
+    g_test_add_func("/atapi-readahead/sequential", test_sequential);
+    g_test_add_func("/atapi-readahead/interleaved", test_interleaved);
+    g_test_add_func("/atapi-readahead/random", test_random);
+    g_test_add_func("/atapi-readahead/cached", test_cached);
+    g_test_add_func("/atapi-readahead/cancel", test_cancel);
+    g_test_add_func("/atapi-readahead/seek", test_seek);
+    g_test_add_data_func("/atapi-readahead/trace", trace, test_trace);
+
+    ret = g_test_run();
+
+    unlink(image_path);
+    g_free(image_path);
+    g_array_free(trace, true);
+    return ret;
+}
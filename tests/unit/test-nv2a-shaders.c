@@ -0,0 +1,954 @@
+/*
+ * NV2A shader translator tests
+ *
+ * Generates random vertex programs and register combiner setups and checks
+ * that the IR left by the optimization passes computes the same outputs as
+ * the IR straight out of the decoder. The decoded IR maps one to one onto
+ * the statements the translators emitted before the passes existed, so this
+ * compares the old and the new translation. Run with --seed to reproduce a
+ * failure.
+ *
+ * The translators are also run over the shader corpora in
+ * tests/data/nv2a-shaders, timing each translation. When GLSLANG_VALIDATOR
+ * points at glslangValidator (meson sets it if one is installed) the GLSL
+ * they emit is compiled as well.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "hw/xbox/nv2a/vsh.h"
+#include "hw/xbox/nv2a/psh.h"
+#include "hw/xbox/nv2a/shader_corpus.h"
+
+#define NUM_PROGRAMS 3000
+#define NUM_RUNS     4    /* Input sets evaluated per program */
+#define MAX_SLOTS    32
+#define NUM_COMPILED 64   /* Random programs handed to the GLSL compiler */
+#define NUM_TIMED    100  /* Translations of each corpus entry timed */
+
+static const char *glsl_validator;
+
+static float rand_float(void)
+{
+    return g_test_rand_double_range(-2.0, 2.0);
+}
+
+static bool same_float(float a, float b)
+{
+    return a == b || (isnan(a) && isnan(b));
+}
+
+/* Compiles code with glslangValidator, which picks the stage by extension */
+static void check_glsl(const char *stage, const char *code)
+{
+    char *tmpl = g_strdup_printf("nv2a-shader-XXXXXX.%s", stage);
+    char *path, *out = NULL, *err = NULL;
+    const char *argv[] = { glsl_validator, NULL, NULL };
+    GError *gerr = NULL;
+    int fd, status;
+
+    fd = g_file_open_tmp(tmpl, &path, &gerr);
+    g_assert_no_error(gerr);
+    close(fd);
+    g_file_set_contents(path, code, -1, &gerr);
+    g_assert_no_error(gerr);
+
+    argv[1] = path;
+    g_spawn_sync(NULL, (char **)argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL,
+                 &out, &err, &status, &gerr);
+    g_assert_no_error(gerr);
+    if (!g_spawn_check_exit_status(status, NULL)) {
+        g_test_message("%s%s\n%s", out, err, code);
+        g_test_fail();
+    }
+
+    unlink(path);
+    g_free(path);
+    g_free(tmpl);
+    g_free(out);
+    g_free(err);
+}
+
+/* The declarations generate_vertex_shader() puts around a vertex program */
+static MString *vsh_wrap(MString *header, MString *body)
+{
+    MString *code = mstring_from_str(
+        "#version 400\n"
+        "uniform vec2 clipRange;\n"
+        "uniform vec2 surfaceSize;\n"
+        "layout(std140) uniform VshConstants {\n"
+        "    vec4 c[" stringify(NV2A_VERTEXSHADER_CONSTANTS) "];\n"
+        "};\n"
+        "vec4 oPos = vec4(0.0,0.0,0.0,1.0);\n"
+        "vec4 oD0 = vec4(0.0,0.0,0.0,1.0);\n"
+        "vec4 oD1 = vec4(0.0,0.0,0.0,1.0);\n"
+        "vec4 oB0 = vec4(0.0,0.0,0.0,1.0);\n"
+        "vec4 oB1 = vec4(0.0,0.0,0.0,1.0);\n"
+        "vec4 oPts = vec4(0.0,0.0,0.0,1.0);\n"
+        "vec4 oFog = vec4(1.0,0.0,0.0,1.0);\n"
+        "vec4 oT0 = vec4(0.0,0.0,0.0,1.0);\n"
+        "vec4 oT1 = vec4(0.0,0.0,0.0,1.0);\n"
+        "vec4 oT2 = vec4(0.0,0.0,0.0,1.0);\n"
+        "vec4 oT3 = vec4(0.0,0.0,0.0,1.0);\n"
+        STRUCT_VERTEX_DATA
+        "noperspective out VertexData g_vtx;\n"
+        "#define vtx g_vtx\n");
+    int i;
+
+    for (i = 0; i < NV2A_VERTEXSHADER_ATTRIBUTES; i++) {
+        mstring_append_fmt(code, "layout(location = %d) in vec4 v%d;\n", i, i);
+    }
+    mstring_append(code, mstring_get_str(header));
+    mstring_append(code, "void main() {\n");
+    mstring_append(code, mstring_get_str(body));
+    mstring_append(code, "  gl_Position = oPos;\n}\n");
+    return code;
+}
+
+/* Vertex programs */
+
+typedef struct VshMachine {
+    float r[16][4];
+    float v[16][4];
+    float c[256][4];
+    float c_written[256][4];
+    float o[16][4];
+    int a0;
+} VshMachine;
+
+/* Sets a field of a microcode token, positions as in vsh.c field_mapping */
+static void set_field(uint32_t *token, int subtoken, int start, int length,
+                      uint32_t value)
+{
+    uint32_t mask = ((1u << length) - 1) << start;
+    token[subtoken] = (token[subtoken] & ~mask) | ((value << start) & mask);
+}
+
+/*
+ * Programs that get compiled only write output registers, as writes to
+ * constant registers aren't emulated (see decode_dests()), and only read
+ * constants the GLSL array declares.
+ */
+static void gen_vsh_program(uint32_t *tokens, int num_slots, bool compilable)
+{
+    static const int outputs[] = { 0, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+    int slot, i;
+
+    for (slot = 0; slot < num_slots; slot++) {
+        uint32_t *token = &tokens[slot * VSH_TOKEN_SIZE];
+
+        for (i = 0; i < VSH_TOKEN_SIZE; i++) {
+            token[i] = g_test_rand_int();
+        }
+        set_field(token, 1, 21, 4, g_test_rand_int_range(0, MAC_ARL + 1));
+        set_field(token, 2, 26, 2, g_test_rand_int_range(PARAM_R, PARAM_C + 1));
+        set_field(token, 2, 11, 2, g_test_rand_int_range(PARAM_R, PARAM_C + 1));
+        set_field(token, 3, 28, 2, g_test_rand_int_range(PARAM_R, PARAM_C + 1));
+        /* Temporaries R0-R12 */
+        set_field(token, 2, 28, 4, g_test_rand_int_range(0, 13));
+        set_field(token, 2, 13, 4, g_test_rand_int_range(0, 13));
+        i = g_test_rand_int_range(0, 13);
+        set_field(token, 2, 0, 2, i >> 2);
+        set_field(token, 3, 30, 2, i & 3);
+        set_field(token, 3, 20, 4, g_test_rand_int_range(0, 13));
+        if (compilable) {
+            set_field(token, 1, 13, 8,
+                      g_test_rand_int_range(0, NV2A_VERTEXSHADER_CONSTANTS));
+            set_field(token, 3, 11, 1, 1);
+        }
+        if (vsh_get_field(token, FLD_OUT_ORB)) {
+            set_field(token, 3, 3, 8,
+                      outputs[g_test_rand_int_range(0, ARRAY_SIZE(outputs))]);
+        }
+        set_field(token, 3, 0, 1, slot == num_slots - 1);
+    }
+}
+
+static void vsh_read_src(const VshMachine *m, const VshSrc *src, float *out)
+{
+    const float *reg;
+    int i;
+
+    switch (src->type) {
+    case PARAM_R:
+        reg = src->index == VSH_R_OPOS ? m->o[0] : m->r[src->index];
+        break;
+    case PARAM_V:
+        reg = m->v[src->index];
+        break;
+    case PARAM_C:
+        reg = m->c[(src->index + (src->relative ? m->a0 : 0)) & 255];
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    for (i = 0; i < 4; i++) {
+        out[i] = src->neg ? -reg[src->swizzle[i]] : reg[src->swizzle[i]];
+    }
+}
+
+/* Same operations as the macros in vsh_header */
+static void vsh_exec_mac(int opcode, float s[3][4], float *res)
+{
+    int i;
+
+    switch (opcode) {
+    case MAC_MOV:
+    case MAC_ARL:
+        memcpy(res, s[0], sizeof(s[0]));
+        break;
+    case MAC_MUL:
+        for (i = 0; i < 4; i++) {
+            res[i] = s[0][i] * s[1][i];
+        }
+        break;
+    case MAC_ADD:
+        for (i = 0; i < 4; i++) {
+            res[i] = s[0][i] + s[1][i];
+        }
+        break;
+    case MAC_MAD:
+        for (i = 0; i < 4; i++) {
+            res[i] = s[0][i] * s[1][i] + s[2][i];
+        }
+        break;
+    case MAC_DP3:
+        res[0] = s[0][0] * s[1][0] + s[0][1] * s[1][1] + s[0][2] * s[1][2];
+        res[1] = res[2] = res[3] = res[0];
+        break;
+    case MAC_DPH:
+        res[0] = s[0][0] * s[1][0] + s[0][1] * s[1][1] + s[0][2] * s[1][2]
+                 + s[1][3];
+        res[1] = res[2] = res[3] = res[0];
+        break;
+    case MAC_DP4:
+        res[0] = s[0][0] * s[1][0] + s[0][1] * s[1][1] + s[0][2] * s[1][2]
+                 + s[0][3] * s[1][3];
+        res[1] = res[2] = res[3] = res[0];
+        break;
+    case MAC_DST:
+        res[0] = 1.0f;
+        res[1] = s[0][1] * s[1][1];
+        res[2] = s[0][2];
+        res[3] = s[1][3];
+        break;
+    case MAC_MIN:
+        for (i = 0; i < 4; i++) {
+            res[i] = fminf(s[0][i], s[1][i]);
+        }
+        break;
+    case MAC_MAX:
+        for (i = 0; i < 4; i++) {
+            res[i] = fmaxf(s[0][i], s[1][i]);
+        }
+        break;
+    case MAC_SLT:
+        for (i = 0; i < 4; i++) {
+            res[i] = s[0][i] < s[1][i];
+        }
+        break;
+    case MAC_SGE:
+        for (i = 0; i < 4; i++) {
+            res[i] = s[0][i] >= s[1][i];
+        }
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+static void vsh_exec_ilu(int opcode, float *s, float *res)
+{
+    float x = s[0], t;
+
+    switch (opcode) {
+    case ILU_MOV:
+        memcpy(res, s, 4 * sizeof(float));
+        return;
+    case ILU_RCP:
+        t = 1.0f / x;
+        break;
+    case ILU_RCC:
+        t = 1.0f / x;
+        if (t > 0.0f) {
+            t = MIN(MAX(t, 5.42101e-020f), 1.884467e+019f);
+        } else {
+            t = MIN(MAX(t, -1.884467e+019f), -5.42101e-020f);
+        }
+        break;
+    case ILU_RSQ:
+        t = x == 0.0f ? INFINITY : isinf(x) ? 0.0f : 1.0f / sqrtf(fabsf(x));
+        break;
+    case ILU_EXP:
+        res[0] = exp2f(floorf(x));
+        res[1] = x - floorf(x);
+        res[2] = exp2f(x);
+        res[3] = 1.0f;
+        return;
+    case ILU_LOG:
+        t = fabsf(x);
+        if (t == 0.0f) {
+            res[0] = res[2] = -INFINITY;
+            res[1] = res[3] = 1.0f;
+        } else {
+            res[0] = floorf(log2f(t));
+            res[1] = t / exp2f(floorf(log2f(t)));
+            res[2] = log2f(t);
+            res[3] = 1.0f;
+        }
+        return;
+    case ILU_LIT: {
+        float sx = MAX(s[0], 0.0f), sy = MAX(s[1], 0.0f);
+        float sw = MIN(MAX(s[3], -(128.0f - 1.0f / 256)), 128.0f - 1.0f / 256);
+        res[0] = 1.0f;
+        res[1] = sx;
+        res[2] = sx > 0.0f ? exp2f(sw * log2f(sy)) : 0.0f;
+        res[3] = 1.0f;
+        return;
+    }
+    default:
+        g_assert_not_reached();
+    }
+
+    res[0] = res[1] = res[2] = res[3] = t;
+}
+
+/* Each destination re-evaluates the instruction, as the emitted GLSL does */
+static void vsh_run(const VshProgram *prog, VshMachine *m)
+{
+    int i, j, k;
+
+    for (i = 0; i < prog->num_instrs; i++) {
+        const VshInstr *instr = &prog->instrs[i];
+
+        for (j = 0; j < instr->num_dests; j++) {
+            const VshDest *dest = &instr->dest[j];
+            float s[3][4], res[4], *reg;
+
+            for (k = 0; k < instr->num_srcs; k++) {
+                vsh_read_src(m, &instr->src[k], s[k]);
+            }
+            if (instr->is_ilu) {
+                vsh_exec_ilu(instr->opcode, s[0], res);
+            } else {
+                vsh_exec_mac(instr->opcode, s, res);
+            }
+
+            switch (dest->type) {
+            case DEST_A0:
+                res[0] = floorf(res[0] + 0.001f);
+                m->a0 = isfinite(res[0]) ? MIN(MAX(res[0], -256), 256) : 0;
+                continue;
+            case DEST_R:
+                reg = dest->index == VSH_R_OPOS ? m->o[0] : m->r[dest->index];
+                break;
+            case DEST_O:
+                reg = m->o[dest->index];
+                break;
+            case DEST_C:
+                reg = m->c_written[dest->index & 255];
+                break;
+            default:
+                g_assert_not_reached();
+            }
+            for (k = 0; k < 4; k++) {
+                if (dest->mask & VSH_MASK_COMPONENT(k)) {
+                    reg[k] = res[k];
+                }
+            }
+        }
+    }
+}
+
+static int vsh_num_statements(const VshProgram *prog)
+{
+    int i, n = 0;
+
+    for (i = 0; i < prog->num_instrs; i++) {
+        n += prog->instrs[i].num_dests;
+    }
+    return n;
+}
+
+static void test_vsh_optimize(void)
+{
+    uint32_t tokens[MAX_SLOTS * VSH_TOKEN_SIZE];
+    VshMachine *init = g_new(VshMachine, 1);
+    VshMachine *m_ref = g_new(VshMachine, 1);
+    VshMachine *m_opt = g_new(VshMachine, 1);
+    int before = 0, after = 0;
+    int p, run, i, j;
+
+    for (p = 0; p < NUM_PROGRAMS; p++) {
+        int num_slots = g_test_rand_int_range(1, MAX_SLOTS + 1);
+        VshProgram ref, opt;
+
+        gen_vsh_program(tokens, num_slots, false);
+        vsh_decode(tokens, num_slots, &ref);
+        vsh_decode(tokens, num_slots, &opt);
+        vsh_optimize(&opt);
+        before += vsh_num_statements(&ref);
+        after += vsh_num_statements(&opt);
+
+        for (run = 0; run < NUM_RUNS; run++) {
+            float *f = (float *)init;
+
+            for (i = 0; i < offsetof(VshMachine, a0) / sizeof(float); i++) {
+                f[i] = rand_float();
+            }
+            init->a0 = 0;
+            *m_ref = *init;
+            *m_opt = *init;
+            vsh_run(&ref, m_ref);
+            vsh_run(&opt, m_opt);
+
+            for (i = 0; i < 16; i++) {
+                for (j = 0; j < 4; j++) {
+                    g_assert_true(same_float(m_ref->o[i][j], m_opt->o[i][j]));
+                }
+            }
+            for (i = 0; i < 256; i++) {
+                for (j = 0; j < 4; j++) {
+                    g_assert_true(same_float(m_ref->c_written[i][j],
+                                             m_opt->c_written[i][j]));
+                }
+            }
+        }
+
+        g_free(ref.instrs);
+        g_free(opt.instrs);
+    }
+
+    g_test_message("vsh: %d statements before the passes, %d after",
+                   before, after);
+    g_assert_cmpint(after, <=, before);
+
+    g_free(init);
+    g_free(m_ref);
+    g_free(m_opt);
+}
+
+static void test_vsh_translate(void)
+{
+    uint32_t tokens[MAX_SLOTS * VSH_TOKEN_SIZE];
+    int p;
+
+    if (!glsl_validator) {
+        g_test_skip("GLSLANG_VALIDATOR not set");
+        return;
+    }
+
+    for (p = 0; p < NUM_COMPILED; p++) {
+        int num_slots = g_test_rand_int_range(1, MAX_SLOTS + 1);
+        MString *header = mstring_new();
+        MString *body = mstring_new();
+        MString *code;
+
+        gen_vsh_program(tokens, num_slots, true);
+        vsh_translate(VSH_VERSION_XVS, tokens, num_slots, false, header, body);
+        code = vsh_wrap(header, body);
+        check_glsl("vert", mstring_get_str(code));
+
+        mstring_unref(code);
+        mstring_unref(header);
+        mstring_unref(body);
+    }
+}
+
+/* Register combiners */
+
+typedef struct PshMachine {
+    float reg[16][4];     /* Indexed by PS_REGISTER_* */
+    float c0[9][4];
+    float c1[9][4];
+    float frag[4];
+} PshMachine;
+
+static uint32_t gen_psh_input(bool allow_ef_prod)
+{
+    static const int regs[] = {
+        PS_REGISTER_ZERO, PS_REGISTER_ZERO, PS_REGISTER_ZERO,
+        PS_REGISTER_C0, PS_REGISTER_C1, PS_REGISTER_FOG,
+        PS_REGISTER_V0, PS_REGISTER_V1,
+        PS_REGISTER_T0, PS_REGISTER_T1, PS_REGISTER_T2, PS_REGISTER_T3,
+        PS_REGISTER_R0, PS_REGISTER_R1, PS_REGISTER_V1R0_SUM,
+    };
+    int reg = regs[g_test_rand_int_range(0, ARRAY_SIZE(regs))];
+
+    if (allow_ef_prod && g_test_rand_int_range(0, 8) == 0) {
+        reg = PS_REGISTER_EF_PROD;
+    }
+    return reg | (g_test_rand_int() & 0x10) | (g_test_rand_int() & 0xe0);
+}
+
+static uint32_t gen_psh_inputs(bool allow_ef_prod)
+{
+    uint32_t value = 0;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        value |= gen_psh_input(allow_ef_prod) << (i * 8);
+    }
+    return value;
+}
+
+static uint32_t gen_psh_output(bool is_alpha)
+{
+    static const int dests[] = {
+        PS_REGISTER_DISCARD, PS_REGISTER_DISCARD, PS_REGISTER_DISCARD,
+        PS_REGISTER_V0, PS_REGISTER_V1,
+        PS_REGISTER_T0, PS_REGISTER_T1, PS_REGISTER_T2, PS_REGISTER_T3,
+        PS_REGISTER_R0, PS_REGISTER_R0, PS_REGISTER_R1, PS_REGISTER_R1,
+    };
+    static const int mappings[] = {
+        PS_COMBINEROUTPUT_IDENTITY, PS_COMBINEROUTPUT_BIAS,
+        PS_COMBINEROUTPUT_SHIFTLEFT_1, PS_COMBINEROUTPUT_SHIFTLEFT_1_BIAS,
+        PS_COMBINEROUTPUT_SHIFTLEFT_2, PS_COMBINEROUTPUT_SHIFTRIGHT_1,
+    };
+    uint32_t cd = dests[g_test_rand_int_range(0, ARRAY_SIZE(dests))];
+    uint32_t ab = dests[g_test_rand_int_range(0, ARRAY_SIZE(dests))];
+    uint32_t sum = dests[g_test_rand_int_range(0, ARRAY_SIZE(dests))];
+    uint32_t flags = (g_test_rand_int() & 7)
+                     | mappings[g_test_rand_int_range(0, ARRAY_SIZE(mappings))];
+
+    if (!is_alpha) {
+        flags |= g_test_rand_int() & (PS_COMBINEROUTPUT_AB_BLUE_TO_ALPHA
+                                      | PS_COMBINEROUTPUT_CD_BLUE_TO_ALPHA);
+    }
+    return cd | ab << 4 | sum << 8 | flags << 12;
+}
+
+static void gen_psh_state(PshState *state)
+{
+    int i;
+
+    memset(state, 0, sizeof(*state));
+    state->combiner_control = g_test_rand_int_range(1, 9)
+        | (g_test_rand_int() & (PS_COMBINERCOUNT_UNIQUE_C0
+                                | PS_COMBINERCOUNT_UNIQUE_C1)) << 8;
+    for (i = 0; i < 8; i++) {
+        state->rgb_inputs[i] = gen_psh_inputs(false);
+        state->alpha_inputs[i] = gen_psh_inputs(false);
+        state->rgb_outputs[i] = gen_psh_output(false);
+        state->alpha_outputs[i] = gen_psh_output(true);
+    }
+    if (g_test_rand_int_range(0, 4)) {
+        /* E and F can't read their own product */
+        state->final_inputs_0 = gen_psh_inputs(true);
+        state->final_inputs_1 = (gen_psh_inputs(false) & 0xffffff00)
+                                | (g_test_rand_int() & 0xe0);
+    }
+}
+
+static const float *psh_reg(const PshMachine *m, const PshProgram *prog,
+                            int stage, int reg)
+{
+    bool unique_c0 = prog->flags & PS_COMBINERCOUNT_UNIQUE_C0;
+    bool unique_c1 = prog->flags & PS_COMBINERCOUNT_UNIQUE_C1;
+
+    switch (reg) {
+    case PS_REGISTER_C0:
+        return m->c0[unique_c0 || stage == PSH_FINAL_STAGE ? stage : 0];
+    case PS_REGISTER_C1:
+        return m->c1[unique_c1 || stage == PSH_FINAL_STAGE ? stage : 0];
+    default:
+        return m->reg[reg];
+    }
+}
+
+static void psh_read_input(const PshMachine *m, const PshProgram *prog,
+                           const PshInstr *instr, const PshInput *in,
+                           bool is_alpha, float *out);
+
+/* Three components in RGB context, one in alpha context */
+static void psh_read_reg(const PshMachine *m, const PshProgram *prog,
+                         const PshInstr *instr, const PshInput *in,
+                         bool is_alpha, float *out)
+{
+    float v[4] = { 0 }, e[3], f[3];
+    const float *reg;
+    int i;
+
+    switch (in->reg) {
+    case PS_REGISTER_ZERO:
+        break;
+    case PS_REGISTER_V1R0_SUM:
+        for (i = 0; i < 3; i++) {
+            v[i] = m->reg[PS_REGISTER_V1][i] + m->reg[PS_REGISTER_R0][i];
+        }
+        break;
+    case PS_REGISTER_EF_PROD:
+        g_assert_cmpint(instr->op, ==, PSH_OP_FINAL);
+        psh_read_input(m, prog, instr, &instr->src[4], false, e);
+        psh_read_input(m, prog, instr, &instr->src[5], false, f);
+        for (i = 0; i < 3; i++) {
+            v[i] = e[i] * f[i];
+        }
+        break;
+    default:
+        reg = psh_reg(m, prog, instr->stage, in->reg);
+        memcpy(v, reg, sizeof(v));
+        break;
+    }
+
+    if (is_alpha) {
+        out[0] = in->chan == PS_CHANNEL_ALPHA ? v[3] : v[2];
+    } else {
+        for (i = 0; i < 3; i++) {
+            out[i] = in->chan == PS_CHANNEL_ALPHA ? v[3] : v[i];
+        }
+    }
+}
+
+static void psh_read_input(const PshMachine *m, const PshProgram *prog,
+                           const PshInstr *instr, const PshInput *in,
+                           bool is_alpha, float *out)
+{
+    int n = is_alpha ? 1 : 3, i;
+
+    if (in->is_const) {
+        for (i = 0; i < n; i++) {
+            out[i] = in->value;
+        }
+        return;
+    }
+
+    psh_read_reg(m, prog, instr, in, is_alpha, out);
+    for (i = 0; i < n; i++) {
+        float x = out[i];
+        switch (in->mod) {
+        case PS_INPUTMAPPING_UNSIGNED_IDENTITY:
+            out[i] = MAX(x, 0.0f);
+            break;
+        case PS_INPUTMAPPING_UNSIGNED_INVERT:
+            out[i] = 1.0f - MIN(MAX(x, 0.0f), 1.0f);
+            break;
+        case PS_INPUTMAPPING_EXPAND_NORMAL:
+            out[i] = 2.0f * MAX(x, 0.0f) - 1.0f;
+            break;
+        case PS_INPUTMAPPING_EXPAND_NEGATE:
+            out[i] = -2.0f * MAX(x, 0.0f) + 1.0f;
+            break;
+        case PS_INPUTMAPPING_HALFBIAS_NORMAL:
+            out[i] = MAX(x, 0.0f) - 0.5f;
+            break;
+        case PS_INPUTMAPPING_HALFBIAS_NEGATE:
+            out[i] = -MAX(x, 0.0f) + 0.5f;
+            break;
+        case PS_INPUTMAPPING_SIGNED_IDENTITY:
+            break;
+        case PS_INPUTMAPPING_SIGNED_NEGATE:
+            out[i] = -x;
+            break;
+        }
+    }
+}
+
+static void psh_product(const PshMachine *m, const PshProgram *prog,
+                        const PshInstr *instr, int i, bool dot, float *out)
+{
+    int n = instr->is_alpha ? 1 : 3, k;
+    float a[3], b[3];
+
+    psh_read_input(m, prog, instr, &instr->src[i], instr->is_alpha, a);
+    psh_read_input(m, prog, instr, &instr->src[i + 1], instr->is_alpha, b);
+    if (dot && !instr->is_alpha) {
+        out[0] = out[1] = out[2] = a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+        return;
+    }
+    for (k = 0; k < n; k++) {
+        out[k] = a[k] * b[k];
+    }
+}
+
+static float psh_output_mapping(float x, int mapping)
+{
+    switch (mapping) {
+    case PS_COMBINEROUTPUT_BIAS:
+        x = x - 0.5f;
+        break;
+    case PS_COMBINEROUTPUT_SHIFTLEFT_1:
+        x = x * 2.0f;
+        break;
+    case PS_COMBINEROUTPUT_SHIFTLEFT_1_BIAS:
+        x = (x - 0.5f) * 2.0f;
+        break;
+    case PS_COMBINEROUTPUT_SHIFTLEFT_2:
+        x = x * 4.0f;
+        break;
+    case PS_COMBINEROUTPUT_SHIFTRIGHT_1:
+        x = x / 2.0f;
+        break;
+    }
+    return MIN(MAX(x, -1.0f), 1.0f);
+}
+
+static void psh_run(const PshProgram *prog, PshMachine *m)
+{
+    float ab[3], cd[3], res[3], a[3], b[3], c[3], d[3], g;
+    int i, k;
+
+    for (i = 0; i < prog->num_instrs; i++) {
+        const PshInstr *instr = &prog->instrs[i];
+        float *dest = m->reg[instr->dest];
+        int n = instr->is_alpha ? 1 : 3;
+
+        switch (instr->op) {
+        case PSH_OP_AB:
+            psh_product(m, prog, instr, 0, instr->ab_dot, res);
+            break;
+        case PSH_OP_CD:
+            psh_product(m, prog, instr, 2, instr->cd_dot, res);
+            break;
+        case PSH_OP_SUM:
+            psh_product(m, prog, instr, 0, instr->ab_dot, ab);
+            psh_product(m, prog, instr, 2, instr->cd_dot, cd);
+            for (k = 0; k < n; k++) {
+                res[k] = ab[k] + cd[k];
+            }
+            break;
+        case PSH_OP_MUX:
+            psh_product(m, prog, instr, 0, instr->ab_dot, ab);
+            psh_product(m, prog, instr, 2, instr->cd_dot, cd);
+            memcpy(res, m->reg[PS_REGISTER_R0][3] >= 0.5f ? cd : ab,
+                   sizeof(res));
+            break;
+        case PSH_OP_BLUE_TO_ALPHA:
+            dest[3] = dest[2];
+            continue;
+        case PSH_OP_CONST:
+            for (k = 0; k < n; k++) {
+                dest[instr->is_alpha ? 3 : k] = instr->value;
+            }
+            continue;
+        case PSH_OP_FINAL:
+            psh_read_input(m, prog, instr, &instr->src[0], false, a);
+            psh_read_input(m, prog, instr, &instr->src[1], false, b);
+            psh_read_input(m, prog, instr, &instr->src[2], false, c);
+            psh_read_input(m, prog, instr, &instr->src[3], false, d);
+            psh_read_input(m, prog, instr, &instr->src[6], true, &g);
+            for (k = 0; k < 3; k++) {
+                m->frag[k] = d[k] + (c[k] * (1.0f - a[k]) + b[k] * a[k]);
+            }
+            m->frag[3] = g;
+            continue;
+        default:
+            g_assert_not_reached();
+        }
+
+        for (k = 0; k < n; k++) {
+            dest[instr->is_alpha ? 3 : k] =
+                psh_output_mapping(res[k], instr->mapping);
+        }
+    }
+
+    if (!prog->num_instrs
+        || prog->instrs[prog->num_instrs - 1].op != PSH_OP_FINAL) {
+        memcpy(m->frag, m->reg[PS_REGISTER_R0], sizeof(m->frag));
+    }
+}
+
+static void test_psh_optimize(void)
+{
+    PshProgram *ref = g_new(PshProgram, 1);
+    PshProgram *opt = g_new(PshProgram, 1);
+    PshMachine init, m_ref, m_opt;
+    int before = 0, after = 0;
+    int p, run, i;
+
+    for (p = 0; p < NUM_PROGRAMS; p++) {
+        PshState state;
+
+        gen_psh_state(&state);
+        psh_decode(&state, ref);
+        psh_decode(&state, opt);
+        psh_optimize(opt);
+        before += ref->num_instrs;
+        after += opt->num_instrs;
+
+        for (run = 0; run < NUM_RUNS; run++) {
+            float *f = (float *)&init;
+
+            for (i = 0; i < sizeof(init) / sizeof(float); i++) {
+                f[i] = rand_float() / 2;
+            }
+            memset(init.reg[PS_REGISTER_ZERO], 0, sizeof(init.reg[0]));
+            m_ref = init;
+            m_opt = init;
+            psh_run(ref, &m_ref);
+            psh_run(opt, &m_opt);
+
+            for (i = 0; i < 4; i++) {
+                g_assert_true(same_float(m_ref.frag[i], m_opt.frag[i]));
+            }
+        }
+    }
+
+    g_test_message("psh: %d statements before the passes, %d after",
+                   before, after);
+    g_assert_cmpint(after, <=, before);
+
+    g_free(ref);
+    g_free(opt);
+}
+
+static void test_psh_translate(void)
+{
+    int p;
+
+    if (!glsl_validator) {
+        g_test_skip("GLSLANG_VALIDATOR not set");
+        return;
+    }
+
+    for (p = 0; p < NUM_COMPILED; p++) {
+        PshState state;
+        MString *code;
+
+        gen_psh_state(&state);
+        code = psh_translate(state);
+        check_glsl("frag", mstring_get_str(code));
+        mstring_unref(code);
+    }
+}
+
+/* Shader corpora */
+
+static ShaderCorpusEntry *load_corpora(size_t *num_entries)
+{
+    const char *dir_path = g_test_get_filename(G_TEST_DIST, "..", "data",
+                                               "nv2a-shaders", NULL);
+    GArray *entries = g_array_new(false, false, sizeof(ShaderCorpusEntry));
+    GError *gerr = NULL;
+    const char *name;
+    GDir *dir;
+
+    dir = g_dir_open(dir_path, 0, &gerr);
+    g_assert_no_error(gerr);
+    while ((name = g_dir_read_name(dir))) {
+        char *path;
+        ShaderCorpusEntry *corpus;
+        size_t n;
+
+        if (!g_str_has_suffix(name, ".ini")) {
+            continue;
+        }
+        path = g_build_filename(dir_path, name, NULL);
+        corpus = shader_corpus_load(path, &n, &error_abort);
+        g_array_append_vals(entries, corpus, n);
+        g_free(corpus);
+        g_free(path);
+    }
+    g_dir_close(dir);
+
+    *num_entries = entries->len;
+    g_assert_cmpint(*num_entries, >, 0);
+    return (ShaderCorpusEntry *)g_array_free(entries, false);
+}
+
+static void test_corpus_translate(void)
+{
+    size_t num_entries, num_programs = 0, i;
+    ShaderCorpusEntry *corpus = load_corpora(&num_entries);
+    double vsh_time = 0, psh_time = 0;
+    int run;
+
+    for (i = 0; i < num_entries; i++) {
+        const ShaderCorpusEntry *entry = &corpus[i];
+
+        if (entry->vertex_program) {
+            g_test_timer_start();
+            for (run = 0; run < NUM_TIMED; run++) {
+                MString *header = mstring_new();
+                MString *body = mstring_new();
+
+                vsh_translate(VSH_VERSION_XVS, &entry->program_data[0][0],
+                              entry->program_length, entry->z_perspective,
+                              header, body);
+                mstring_unref(header);
+                mstring_unref(body);
+            }
+            vsh_time += g_test_timer_elapsed();
+            num_programs++;
+        }
+
+        g_test_timer_start();
+        for (run = 0; run < NUM_TIMED; run++) {
+            mstring_unref(psh_translate(entry->psh));
+        }
+        psh_time += g_test_timer_elapsed();
+    }
+
+    if (num_programs) {
+        g_test_message("vsh: %zu programs, %.1f us per translation",
+                       num_programs, vsh_time * 1e6 / num_programs / NUM_TIMED);
+    }
+    g_test_message("psh: %zu combiner setups, %.1f us per translation",
+                   num_entries, psh_time * 1e6 / num_entries / NUM_TIMED);
+
+    g_free(corpus);
+}
+
+static void test_corpus_compile(void)
+{
+    size_t num_entries, i;
+    ShaderCorpusEntry *corpus;
+
+    if (!glsl_validator) {
+        g_test_skip("GLSLANG_VALIDATOR not set");
+        return;
+    }
+
+    corpus = load_corpora(&num_entries);
+    for (i = 0; i < num_entries; i++) {
+        const ShaderCorpusEntry *entry = &corpus[i];
+        MString *code;
+
+        if (entry->vertex_program) {
+            MString *header = mstring_new();
+            MString *body = mstring_new();
+
+            vsh_translate(VSH_VERSION_XVS, &entry->program_data[0][0],
+                          entry->program_length, entry->z_perspective,
+                          header, body);
+            code = vsh_wrap(header, body);
+            check_glsl("vert", mstring_get_str(code));
+            mstring_unref(code);
+            mstring_unref(header);
+            mstring_unref(body);
+        }
+
+        code = psh_translate(entry->psh);
+        check_glsl("frag", mstring_get_str(code));
+        mstring_unref(code);
+    }
+
+    g_free(corpus);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    glsl_validator = g_getenv("GLSLANG_VALIDATOR");
+    g_test_add_func("/nv2a/vsh/optimize", test_vsh_optimize);
+    g_test_add_func("/nv2a/vsh/translate", test_vsh_translate);
+    g_test_add_func("/nv2a/psh/optimize", test_psh_optimize);
+    g_test_add_func("/nv2a/psh/translate", test_psh_translate);
+    g_test_add_func("/nv2a/corpus/translate", test_corpus_translate);
+    g_test_add_func("/nv2a/corpus/compile", test_corpus_compile);
+    return g_test_run();
+}
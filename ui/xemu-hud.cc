@@ -35,6 +35,9 @@
 #include "xemu-version.h"
 #include "xemu-net.h"
 #include "xemu-os-utils.h"
+#include "xemu-pacing.h"
+#include "xemu-quicksave.h"
+#include "xemu-rewind.h"
 #include "xemu-xbe.h"
 #include "xemu-reporting.h"
 
@@ -60,7 +63,11 @@ extern "C" {
 #include "hw/xbox/mcpx/apu_debug.h"
 #include "hw/xbox/nv2a/debug.h"
 #include "hw/xbox/nv2a/nv2a.h"
+#include "hw/ide/atapi-readahead.h"
+#include "qemu/fast-hash.h"
+#include "exec/cputlb.h"
 #include "net/pcap.h"
+#include "net/syslink.h"
 
 #undef typename
 #undef atomic_fetch_add
@@ -595,6 +602,19 @@ public:
             ImGui::SameLine();
         }
 
+        ImGui::SetCursorPosY(cur.y + controller_height*g_ui_scale);
+        ImGui::Dummy(ImVec2(0.0f, ImGui::GetStyle().WindowPadding.y));
+        ImGui::SetCursorPosX(ImGui::GetCursorPosX()+(int)((ImGui::GetColumnWidth()-controller_width*g_ui_scale)/2.0));
+        ImGui::SetNextItemWidth(controller_width*0.5*g_ui_scale);
+        int poll_rate = xemu_input_get_poll_rate();
+        if (ImGui::SliderInt("Polling Rate (Hz)", &poll_rate, 60, 8000)) {
+            xemu_input_set_poll_rate(poll_rate);
+        }
+        float latency_avg, latency_max;
+        xemu_input_get_latency(&latency_avg, &latency_max);
+        ImGui::SetCursorPosX(ImGui::GetCursorPosX()+(int)((ImGui::GetColumnWidth()-controller_width*g_ui_scale)/2.0));
+        ImGui::Text("Input latency: %.2f ms avg, %.2f ms max", latency_avg, latency_max);
+
         ImGui::End();
         ImGui::PopStyleVar(); // Window padding
 
@@ -1018,6 +1038,8 @@ public:
     int  backend;
     char remote_addr[64];
     char local_addr[64];
+    char relay_addr[64];
+    bool compress;
     std::unique_ptr<NetworkInterfaceManager> iface_mgr;
 
     NetworkWindow()
@@ -1029,6 +1051,36 @@ public:
     {
     }
 
+    void DrawSyslinkStats(const SyslinkStats &stats)
+    {
+        ImGui::Dummy(ImVec2(0.0f, ImGui::GetStyle().WindowPadding.y));
+        ImGui::Text("Node %08x: %llu frames sent in %llu batches, %llu dropped",
+                    stats.id, (unsigned long long)stats.tx_frames,
+                    (unsigned long long)stats.tx_batches,
+                    (unsigned long long)(stats.tx_dropped + stats.rx_dropped));
+
+        if (stats.num_peers == 0) {
+            ImGui::TextDisabled("No other instances on this relay yet");
+            return;
+        }
+
+        ImGui::Columns(5, "syslink_peers", false);
+        ImGui::Text("Peer");       ImGui::NextColumn();
+        ImGui::Text("RTT");        ImGui::NextColumn();
+        ImGui::Text("Jitter");     ImGui::NextColumn();
+        ImGui::Text("Frames");     ImGui::NextColumn();
+        ImGui::Text("Last Heard"); ImGui::NextColumn();
+        for (int i = 0; i < stats.num_peers; i++) {
+            const SyslinkPeerStats &p = stats.peers[i];
+            ImGui::Text("%08x", p.id);                           ImGui::NextColumn();
+            ImGui::Text("%.2f ms", p.rtt_ms);                   ImGui::NextColumn();
+            ImGui::Text("%.2f ms", p.jitter_ms);                ImGui::NextColumn();
+            ImGui::Text("%llu", (unsigned long long)p.rx_frames); ImGui::NextColumn();
+            ImGui::Text("%.1f s ago", p.idle_s);                ImGui::NextColumn();
+        }
+        ImGui::Columns(1);
+    }
+
     void Draw()
     {
         if (!is_open) return;
@@ -1045,6 +1097,11 @@ public:
             strncpy(remote_addr, tmp, sizeof(remote_addr)-1);
             xemu_settings_get_string(XEMU_SETTINGS_NETWORK_LOCAL_ADDR, &tmp);
             strncpy(local_addr, tmp, sizeof(local_addr)-1);
+            xemu_settings_get_string(XEMU_SETTINGS_NETWORK_RELAY_ADDR, &tmp);
+            strncpy(relay_addr, tmp, sizeof(relay_addr)-1);
+            int compress_int;
+            xemu_settings_get_bool(XEMU_SETTINGS_NETWORK_COMPRESS, &compress_int);
+            compress = compress_int;
             xemu_settings_get_enum(XEMU_SETTINGS_NETWORK_BACKEND, &backend);
         }
 
@@ -1062,7 +1119,7 @@ public:
         ImGui::NextColumn();
         if (is_enabled) ImGui::PushStyleVar(ImGuiStyleVar_Alpha, 0.6f);
         int temp_backend = backend; // Temporary to make backend combo read-only (FIXME: surely there's a nicer way)
-        if (ImGui::Combo("##backend", is_enabled ? &temp_backend : &backend, "NAT\0UDP Tunnel\0Bridged Adapter\0") && !is_enabled) {
+        if (ImGui::Combo("##backend", is_enabled ? &temp_backend : &backend, "NAT\0UDP Tunnel\0Bridged Adapter\0System Link Relay\0") && !is_enabled) {
             xemu_settings_set_enum(XEMU_SETTINGS_NETWORK_BACKEND, backend);
             xemu_settings_save();
         }
@@ -1074,6 +1131,8 @@ public:
             HelpMarker("Tunnels link-layer traffic to a remote host via UDP");
         } else if (backend == XEMU_NET_BACKEND_PCAP) {
             HelpMarker("Bridges with a host network interface");
+        } else if (backend == XEMU_NET_BACKEND_SYSLINK) {
+            HelpMarker("Joins other instances attached to the same relay (see contrib/syslink-relay)");
         }
         ImGui::NextColumn();
 
@@ -1096,6 +1155,25 @@ public:
             ImGui::InputText("###local_host", local_addr, sizeof(local_addr), flg);
             if (is_enabled) ImGui::PopStyleVar();
             ImGui::NextColumn();
+        } else if (backend == XEMU_NET_BACKEND_SYSLINK) {
+            ImGui::Text("Relay");
+            ImGui::SameLine(); HelpMarker("The <IP address>:<Port> of the System Link relay (e.g. 192.168.1.2:9369)");
+            ImGui::NextColumn();
+            float w = ImGui::GetColumnWidth()-10*g_ui_scale;
+            ImGui::SetNextItemWidth(w);
+            if (is_enabled) ImGui::PushStyleVar(ImGuiStyleVar_Alpha, 0.6f);
+            ImGui::InputText("###relay_addr", relay_addr, sizeof(relay_addr), flg);
+            if (is_enabled) ImGui::PopStyleVar();
+            ImGui::NextColumn();
+
+            ImGui::Text("Compression");
+            ImGui::SameLine(); HelpMarker("Deflate frames before sending them, trading some CPU time for bandwidth");
+            ImGui::NextColumn();
+            if (is_enabled) ImGui::PushStyleVar(ImGuiStyleVar_Alpha, 0.6f);
+            bool temp_compress = compress;
+            ImGui::Checkbox("###compress", is_enabled ? &temp_compress : &compress);
+            if (is_enabled) ImGui::PopStyleVar();
+            ImGui::NextColumn();
         } else if (backend == XEMU_NET_BACKEND_PCAP) {
             static bool should_refresh = true;
             if (iface_mgr.get() == nullptr) {
@@ -1158,6 +1236,11 @@ public:
 
         ImGui::Columns(1);
 
+        SyslinkStats stats;
+        if (is_enabled && xemu_net_get_syslink_stats(&stats)) {
+            DrawSyslinkStats(stats);
+        }
+
         ImGui::Dummy(ImVec2(0.0f, ImGui::GetStyle().WindowPadding.y));
         ImGui::Separator();
         ImGui::Dummy(ImVec2(0.0f, ImGui::GetStyle().WindowPadding.y));
@@ -1171,6 +1254,8 @@ public:
             if (!is_enabled) {
                 xemu_settings_set_string(XEMU_SETTINGS_NETWORK_REMOTE_ADDR, remote_addr);
                 xemu_settings_set_string(XEMU_SETTINGS_NETWORK_LOCAL_ADDR, local_addr);
+                xemu_settings_set_string(XEMU_SETTINGS_NETWORK_RELAY_ADDR, relay_addr);
+                xemu_settings_set_bool(XEMU_SETTINGS_NETWORK_COMPRESS, compress);
                 xemu_net_enable();
             } else {
                 xemu_net_disable();
@@ -1422,6 +1507,85 @@ public:
     }
 };
 
+class RewindWindow
+{
+public:
+    bool is_open;
+    float seconds_back;
+    int seconds, interval_ms, budget_ms;
+
+    RewindWindow()
+    {
+        is_open = false;
+        seconds_back = 1.0f;
+    }
+
+    ~RewindWindow()
+    {
+    }
+
+    void Draw()
+    {
+        if (!is_open) return;
+
+        ImGui::SetNextWindowContentSize(ImVec2(500.0f*g_ui_scale, 0.0f));
+        if (!ImGui::Begin("Rewind", &is_open, ImGuiWindowFlags_NoCollapse | ImGuiWindowFlags_AlwaysAutoResize)) {
+            ImGui::End();
+            return;
+        }
+
+        bool enabled = xemu_rewind_is_enabled();
+        if (ImGui::Checkbox("Keep a rewind buffer", &enabled)) {
+            xemu_rewind_set_enabled(enabled);
+        }
+
+        // Only pick up the current values while nothing is being dragged
+        if (!ImGui::IsAnyItemActive()) {
+            xemu_rewind_get_config(&seconds, &interval_ms, &budget_ms);
+        }
+        bool changed = false;
+        ImGui::SliderInt("Length (s)", &seconds, 5, 600);
+        changed |= ImGui::IsItemDeactivatedAfterEdit();
+        ImGui::SliderInt("Capture interval (ms)", &interval_ms, 100, 5000);
+        changed |= ImGui::IsItemDeactivatedAfterEdit();
+        ImGui::SliderInt("Capture budget (ms)", &budget_ms, 1, 50);
+        changed |= ImGui::IsItemDeactivatedAfterEdit();
+        ImGui::SameLine(); HelpMarker("Captures that stop the machine for longer than this are spaced out until they fit again");
+        if (changed) {
+            xemu_rewind_set_config(seconds, interval_ms, budget_ms);
+        }
+
+        if (!enabled) {
+            ImGui::End();
+            return;
+        }
+
+        XemuRewindStats stats;
+        xemu_rewind_get_stats(&stats);
+
+        ImGui::Separator();
+        ImGui::Text("%d captures covering %.1f s, %.1f MiB (%.1f MiB of deltas)",
+                    stats.frames, stats.seconds,
+                    stats.memory_bytes / (1024.0 * 1024.0),
+                    stats.delta_bytes / (1024.0 * 1024.0));
+        ImGui::Text("Capture: %.2f ms paused (%.2f ms average), "
+                    "%.2f ms packing, %" PRIu64 " dirty pages",
+                    stats.capture_ms, stats.capture_avg_ms, stats.pack_ms,
+                    stats.dirty_pages);
+        ImGui::Text("Capturing every %d ms", stats.interval_ms);
+
+        ImGui::Separator();
+        seconds_back = MIN(seconds_back, MAX(stats.seconds, 1.0f));
+        ImGui::SliderFloat("Seconds back", &seconds_back, 0.0f,
+                           MAX(stats.seconds, 1.0f), "%.1f");
+        if (ImGui::Button("Rewind", ImVec2(120*g_ui_scale, 0))) {
+            xemu_rewind_restore(seconds_back);
+        }
+
+        ImGui::End();
+    }
+};
+
 #include <math.h>
 
 float mix(float a, float b, float t)
@@ -1717,6 +1881,96 @@ public:
             }
             ImPlot::PopStyleColor();
 
+            XemuFrameTimes frame_times;
+            xemu_pacing_get_frame_times(&frame_times);
+            ImGui::Text("Frame time: p50 %.2f ms, p95 %.2f ms, p99 %.2f ms, "
+                        "max %.2f ms (last %u frames)",
+                        frame_times.p50, frame_times.p95, frame_times.p99,
+                        frame_times.max, frame_times.count);
+
+            XemuQuickSaveStats qs_stats;
+            xemu_quicksave_get_stats(&qs_stats);
+            if (qs_stats.have_save && ImGui::TreeNode("Quick Save")) {
+                if (qs_stats.chunks_total) {
+                    ImGui::Text("Save: %.1f ms total, %.1f ms paused, "
+                                "%.1f ms compressing",
+                                qs_stats.save_ms, qs_stats.pause_ms,
+                                qs_stats.compress_ms);
+                    ImGui::Text("Copied %" PRIu64 " dirty pages, "
+                                "recompressed %u of %u chunks, "
+                                "%.1f MiB written",
+                                qs_stats.dirty_pages,
+                                qs_stats.chunks_compressed,
+                                qs_stats.chunks_total,
+                                qs_stats.file_bytes / (1024.0 * 1024.0));
+                }
+                if (qs_stats.load_ms > 0) {
+                    ImGui::Text("Load: %.1f ms", qs_stats.load_ms);
+                }
+                ImGui::TreePop();
+            }
+
+            ATAPIReadaheadStats ra_stats;
+            if (xemu_get_disc_readahead_stats(&ra_stats) &&
+                ImGui::TreeNode("DVD Drive")) {
+                uint64_t sectors = MAX(ra_stats.sectors, (uint64_t)1);
+                ImGui::Text("Cache: %u of %u chunks, %u streams ahead",
+                            ra_stats.valid_chunks, ra_stats.cache_chunks,
+                            ra_stats.streams);
+                ImGui::Text("Sectors: %.1f%% hit, %.1f%% in flight, "
+                            "%.1f%% missed of %" PRIu64,
+                            100.0 * ra_stats.hit_sectors / sectors,
+                            100.0 * ra_stats.wait_sectors / sectors,
+                            100.0 * ra_stats.miss_sectors / sectors,
+                            ra_stats.sectors);
+                ImGui::Text("Read-ahead: %" PRIu64 " chunks, %" PRIu64
+                            " unused",
+                            ra_stats.prefetch_chunks, ra_stats.wasted_chunks);
+                ImGui::Text("Throughput: %.2f MiB/s, latency %.2f ms avg, "
+                            "%.1f MiB read from image",
+                            ra_stats.throughput / (1024.0 * 1024.0),
+                            ra_stats.avg_latency_ns / 1e6,
+                            ra_stats.fetch_bytes / (1024.0 * 1024.0));
+                if (ra_stats.seeks) {
+                    ImGui::Text("Seeks: %" PRIu64 ", %.1f ms avg",
+                                ra_stats.seeks,
+                                ra_stats.seek_ns / 1e6 / ra_stats.seeks);
+                }
+                ImGui::TreePop();
+            }
+
+            if (ImGui::TreeNode("MMIO Registers")) {
+                bool enabled = nv2a_reg_stats_get_enabled();
+                if (ImGui::Checkbox("Count NV2A reads taking the slow path",
+                                    &enabled)) {
+                    nv2a_reg_stats_set_enabled(enabled);
+                }
+                if (enabled) {
+                    NV2ARegStat regs[16];
+                    uint64_t overflow;
+                    int n = nv2a_reg_stats_get(regs, ARRAY_SIZE(regs),
+                                               &overflow);
+                    ImGui::Columns(3, "mmio", false);
+                    ImGui::TextUnformatted("Block"); ImGui::NextColumn();
+                    ImGui::TextUnformatted("Offset"); ImGui::NextColumn();
+                    ImGui::TextUnformatted("Reads"); ImGui::NextColumn();
+                    for (int i = 0; i < n; i++) {
+                        ImGui::TextUnformatted(regs[i].block);
+                        ImGui::NextColumn();
+                        ImGui::Text("0x%06x", regs[i].addr);
+                        ImGui::NextColumn();
+                        ImGui::Text("%" PRIu64, regs[i].reads);
+                        ImGui::NextColumn();
+                    }
+                    ImGui::Columns(1);
+                    if (overflow) {
+                        ImGui::Text("%" PRIu64 " reads of other registers",
+                                    overflow);
+                    }
+                }
+                ImGui::TreePop();
+            }
+
             if (ImGui::TreeNode("Advanced")) {
                 ImPlot::SetNextPlotLimitsX(x_start, x_end, ImGuiCond_Always);
                 ImPlot::SetNextPlotLimitsY(0, 1500, ImGuiCond_Always);
@@ -1739,6 +1993,40 @@ public:
                 ImGui::TreePop();
             }
 
+            if (ImGui::TreeNode("TLB")) {
+                TLBMmuIdxStats stats[16];
+                int n = tlb_mmu_idx_stats(stats, ARRAY_SIZE(stats));
+                n = MIN(n, (int)ARRAY_SIZE(stats));
+
+                size_t full, part, elide;
+                tlb_flush_counts(&full, &part, &elide);
+                ImGui::Text("Flushes: %zu full, %zu partial, %zu elided",
+                            full, part, elide);
+
+                const char *headers[] = {
+                    "MMU Index", "Entries", "Fills", "Victim Hits",
+                    "Prefills", "Flushes", "Large Page Flushes",
+                };
+                ImGui::Columns(ARRAY_SIZE(headers), "tlb", false);
+                for (int i = 0; i < (int)ARRAY_SIZE(headers); i++) {
+                    ImGui::TextUnformatted(headers[i]);
+                    ImGui::NextColumn();
+                }
+                for (int i = 0; i < n; i++) {
+                    ImGui::Text("%d", i); ImGui::NextColumn();
+                    ImGui::Text("%zu/%zu", stats[i].n_used_entries,
+                                stats[i].n_entries); ImGui::NextColumn();
+                    ImGui::Text("%zu", stats[i].fills); ImGui::NextColumn();
+                    ImGui::Text("%zu", stats[i].victim_hits); ImGui::NextColumn();
+                    ImGui::Text("%zu", stats[i].prefills); ImGui::NextColumn();
+                    ImGui::Text("%zu", stats[i].flushes); ImGui::NextColumn();
+                    ImGui::Text("%zu", stats[i].large_page_flushes);
+                    ImGui::NextColumn();
+                }
+                ImGui::Columns(1);
+                ImGui::TreePop();
+            }
+
             if (ImGui::IsWindowHovered() && ImGui::IsMouseClicked(2)) {
                 transparent = !transparent;
             }
@@ -1889,6 +2177,7 @@ static DebugApuWindow apu_window;
 static DebugVideoWindow video_window;
 static InputWindow input_window;
 static NetworkWindow network_window;
+static RewindWindow rewind_window;
 static AboutWindow about_window;
 static SettingsWindow settings_window;
 static CompatibilityReporter compatibility_reporter_window;
@@ -2007,6 +2296,30 @@ static void action_load_disc(void)
     xemu_load_disc(new_disc_path);
 }
 
+static void action_capture_frame(void)
+{
+    const char *filters = ".nv2acap Files\0*.nv2acap\0All Files\0*.*\0";
+    const char *path = paused_file_open(NOC_FILE_DIALOG_SAVE, filters, NULL,
+                                        "frame.nv2acap");
+    if (path == NULL) {
+        /* Cancelled */
+        return;
+    }
+    nv2a_capture_frames(path, 1);
+}
+
+static void action_save_shader_corpus(void)
+{
+    const char *filters = ".ini Files\0*.ini\0All Files\0*.*\0";
+    const char *path = paused_file_open(NOC_FILE_DIALOG_SAVE, filters, NULL,
+                                        "shaders.ini");
+    if (path == NULL) {
+        /* Cancelled */
+        return;
+    }
+    nv2a_save_shader_corpus(path);
+}
+
 static void action_toggle_pause(void)
 {
     if (runstate_is_running()) {
@@ -2016,6 +2329,23 @@ static void action_toggle_pause(void)
     }
 }
 
+static void action_quick_save(void)
+{
+    xemu_quicksave_save();
+}
+
+static void action_quick_load(void)
+{
+    xemu_quicksave_load();
+}
+
+static void action_rewind(void)
+{
+    if (xemu_rewind_is_enabled()) {
+        xemu_rewind_restore(1.0f);
+    }
+}
+
 static void action_reset(void)
 {
     qemu_system_reset_request(SHUTDOWN_CAUSE_GUEST_RESET);
@@ -2051,6 +2381,18 @@ static void process_keyboard_shortcuts(void)
         action_reset();
     }
 
+    if (is_shortcut_key_pressed(SDL_SCANCODE_S)) {
+        action_quick_save();
+    }
+
+    if (is_shortcut_key_pressed(SDL_SCANCODE_L)) {
+        action_quick_load();
+    }
+
+    if (is_shortcut_key_pressed(SDL_SCANCODE_Z)) {
+        action_rewind();
+    }
+
     if (is_shortcut_key_pressed(SDL_SCANCODE_Q)) {
         action_shutdown();
     }
@@ -2098,6 +2440,23 @@ static void ShowMainMenu()
             if (ImGui::MenuItem("Shutdown", SHORTCUT_MENU_TEXT(Q))) {
                 action_shutdown();
             }
+
+            ImGui::Separator();
+
+            bool quicksave_idle = !xemu_quicksave_busy();
+            if (ImGui::MenuItem("Quick Save", SHORTCUT_MENU_TEXT(S), false,
+                                running && quicksave_idle)) {
+                action_quick_save();
+            }
+            if (ImGui::MenuItem("Quick Load", SHORTCUT_MENU_TEXT(L), false,
+                                quicksave_idle)) {
+                action_quick_load();
+            }
+            if (ImGui::MenuItem("Rewind 1 Second", SHORTCUT_MENU_TEXT(Z),
+                                false, xemu_rewind_is_enabled())) {
+                action_rewind();
+            }
+            ImGui::MenuItem("Rewind...", NULL, &rewind_window.is_open);
             ImGui::EndMenu();
         }
 
@@ -2124,6 +2483,24 @@ static void ShowMainMenu()
                 xemu_settings_save();
             }
             ImGui::SameLine(); HelpMarker("Controls how the rendered content should be scaled into the window");
+
+            int pacing_mode = xemu_pacing_get_mode();
+            if (ImGui::Combo("Frame Pacing", &pacing_mode,
+                             "Guest Vblank\0Host Vsync\0Adaptive Sync\0Fixed Rate\0")) {
+                xemu_pacing_set_mode(pacing_mode);
+            }
+            ImGui::SameLine(); HelpMarker("Controls when frames are presented. Host Vsync follows the display refresh, Adaptive Sync suits variable refresh displays, Fixed Rate runs the guest at the target rate");
+            if (pacing_mode == DISPLAY_PACING_TARGET) {
+                int target_fps = xemu_pacing_get_target_fps();
+                if (ImGui::SliderInt("Target FPS", &target_fps, 10, 240)) {
+                    xemu_pacing_set_target_fps(target_fps);
+                }
+            }
+            bool skip_unchanged = xemu_pacing_get_skip_unchanged();
+            if (ImGui::Checkbox("Skip Unchanged Frames", &skip_unchanged)) {
+                xemu_pacing_set_skip_unchanged(skip_unchanged);
+            }
+            ImGui::SameLine(); HelpMarker("Leaves the last frame on screen instead of drawing it again while neither the game nor this menu has changed");
             if (ImGui::MenuItem("Fullscreen", SHORTCUT_MENU_TEXT(Alt+F), xemu_is_fullscreen(), true)) {
                 xemu_toggle_fullscreen();
             }
@@ -2136,6 +2513,13 @@ static void ShowMainMenu()
             ImGui::MenuItem("Monitor", "~", &monitor_window.is_open);
             ImGui::MenuItem("Audio", NULL, &apu_window.is_open);
             ImGui::MenuItem("Video", NULL, &video_window.is_open);
+            ImGui::Separator();
+            if (ImGui::MenuItem("Capture Frame...", NULL)) {
+                action_capture_frame();
+            }
+            if (ImGui::MenuItem("Save Shader Corpus...", NULL)) {
+                action_save_shader_corpus();
+            }
             ImGui::EndMenu();
         }
 
@@ -2313,7 +2697,29 @@ void xemu_hud_should_capture_kbd_mouse(int *kbd, int *mouse)
     if (mouse) *mouse = io.WantCaptureMouse;
 }
 
-void xemu_hud_render(void)
+/* Identifies what the HUD draws, to tell whether a frame looks any different
+ * from the last one */
+static uint64_t hash_draw_data(ImDrawData *draw_data)
+{
+    uint64_t hash = draw_data->CmdListsCount;
+
+    hash = hash * 31 + (uint64_t)draw_data->DisplaySize.x;
+    hash = hash * 31 + (uint64_t)draw_data->DisplaySize.y;
+    for (int i = 0; i < draw_data->CmdListsCount; i++) {
+        const ImDrawList *list = draw_data->CmdLists[i];
+        hash = hash * 31 + fast_hash((const uint8_t *)list->CmdBuffer.Data,
+                                     list->CmdBuffer.size_in_bytes());
+        hash = hash * 31 + fast_hash((const uint8_t *)list->VtxBuffer.Data,
+                                     list->VtxBuffer.size_in_bytes());
+        hash = hash * 31 + fast_hash((const uint8_t *)list->IdxBuffer.Data,
+                                     list->IdxBuffer.size_in_bytes());
+    }
+
+    return hash;
+}
+
+/* Build this frame's HUD, returning whether it differs from the last one */
+bool xemu_hud_update(void)
 {
     uint32_t now = SDL_GetTicks();
     bool ui_wakeup = false;
@@ -2455,6 +2861,7 @@ void xemu_hud_render(void)
     video_window.Draw();
     about_window.Draw();
     network_window.Draw();
+    rewind_window.Draw();
     compatibility_reporter_window.Draw();
     notification_manager.Draw();
 #if defined(_WIN32)
@@ -2480,6 +2887,16 @@ void xemu_hud_render(void)
     }
 
     ImGui::Render();
+
+    static uint64_t last_hash;
+    uint64_t hash = hash_draw_data(ImGui::GetDrawData());
+    bool changed = hash != last_hash;
+    last_hash = hash;
+    return changed;
+}
+
+void xemu_hud_render(void)
+{
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
 
@@ -29,6 +29,8 @@
 extern "C" {
 #endif
 
+struct ATAPIReadaheadStats;
+
 // Implemented in xemu.c
 extern int scaling_mode;
 int xemu_is_fullscreen(void);
@@ -36,10 +38,12 @@ void xemu_monitor_init(void);
 void xemu_toggle_fullscreen(void);
 void xemu_eject_disc(void);
 void xemu_load_disc(const char *path);
+bool xemu_get_disc_readahead_stats(struct ATAPIReadaheadStats *stats);
 
 // Implemented in xemu_hud.cc
 void xemu_hud_init(SDL_Window *window, void *sdl_gl_context);
 void xemu_hud_cleanup(void);
+bool xemu_hud_update(void);
 void xemu_hud_render(void);
 void xemu_hud_process_sdl_events(SDL_Event *event);
 void xemu_hud_should_capture_kbd_mouse(int *kbd, int *mouse);
@@ -28,6 +28,7 @@
 #include "qemu/option.h"
 #include "qemu/timer.h"
 #include "qemu/config-file.h"
+#include "qemu/seqlock.h"
 
 #include "xemu-input.h"
 #include "xemu-notifications.h"
@@ -43,14 +44,32 @@
     do { } while (0)
 #endif
 
-#define XEMU_INPUT_MIN_INPUT_UPDATE_INTERVAL_US  2500
 #define XEMU_INPUT_MIN_HAPTIC_UPDATE_INTERVAL_US 2500
+#define XEMU_INPUT_MIN_POLL_RATE 60
+#define XEMU_INPUT_MAX_POLL_RATE 8000
+#define XEMU_INPUT_LATENCY_HISTORY 128
 
 ControllerStateList available_controllers =
     QTAILQ_HEAD_INITIALIZER(available_controllers);
 ControllerState *bound_controllers[4] = { NULL, NULL, NULL, NULL };
 int test_mode;
 
+// Input state of each port for the guest. Only the UI thread samples SDL
+// and writes these, the XID devices read them without taking any lock.
+static struct {
+    QemuSeqLock lock;
+    ControllerSnapshot snap;
+} port_snapshots[4];
+
+static int poll_rate;
+
+// Time from a host state change being sampled to the guest reading it
+static struct {
+    float samples[XEMU_INPUT_LATENCY_HISTORY];
+    unsigned int count;
+    unsigned int ptr;
+} input_latency;
+
 static const enum xemu_settings_keys port_index_to_settings_key_map[] = {
     XEMU_SETTINGS_INPUT_CONTROLLER_1_GUID,
     XEMU_SETTINGS_INPUT_CONTROLLER_2_GUID,
@@ -60,6 +79,13 @@ static const enum xemu_settings_keys port_index_to_settings_key_map[] = {
 
 void xemu_input_init(void)
 {
+    for (int i = 0; i < 4; i++) {
+        seqlock_init(&port_snapshots[i].lock);
+    }
+    xemu_settings_get_int(XEMU_SETTINGS_INPUT_POLL_RATE, &poll_rate);
+    poll_rate = MAX(XEMU_INPUT_MIN_POLL_RATE,
+                    MIN(poll_rate, XEMU_INPUT_MAX_POLL_RATE));
+
     SDL_SetHint(SDL_HINT_JOYSTICK_ALLOW_BACKGROUND_EVENTS, "1");
 
     if (SDL_Init(SDL_INIT_GAMECONTROLLER) < 0) {
@@ -230,14 +256,44 @@ void xemu_input_process_sdl_events(const SDL_Event *event)
     }
 }
 
-void xemu_input_update_controller(ControllerState *state)
+static void xemu_input_publish_snapshot(int index, ControllerState *state)
 {
+    ControllerSnapshot *snap = &port_snapshots[index].snap;
+    uint16_t buttons = 0;
+    int16_t axis[CONTROLLER_AXIS__COUNT] = { 0 };
+
+    if (state) {
+        buttons = state->buttons;
+        memcpy(axis, state->axis, sizeof(axis));
+    }
+    bool changed = buttons != snap->buttons ||
+                   memcmp(axis, snap->axis, sizeof(axis));
+
     int64_t now = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
-    if (ABS(now - state->last_input_updated_ts) <
-        XEMU_INPUT_MIN_INPUT_UPDATE_INTERVAL_US) {
-        return;
+    seqlock_write_begin(&port_snapshots[index].lock);
+    snap->sampled_ts = now;
+    if (changed) {
+        snap->buttons = buttons;
+        memcpy(snap->axis, axis, sizeof(axis));
+        snap->changed_ts = now;
+        snap->changes++;
     }
+    seqlock_write_end(&port_snapshots[index].lock);
+}
 
+void xemu_input_get_snapshot(int index, ControllerSnapshot *snap)
+{
+    unsigned int start;
+
+    assert(index >= 0 && index < 4);
+    do {
+        start = seqlock_read_begin(&port_snapshots[index].lock);
+        *snap = port_snapshots[index].snap;
+    } while (seqlock_read_retry(&port_snapshots[index].lock, start));
+}
+
+void xemu_input_update_controller(ControllerState *state)
+{
     if (state->type == INPUT_DEVICE_SDL_KEYBOARD) {
         xemu_input_update_sdl_kbd_controller_state(state);
     } else if (state->type == INPUT_DEVICE_SDL_GAMECONTROLLER) {
@@ -245,6 +301,10 @@ void xemu_input_update_controller(ControllerState *state)
     }
 
     state->last_input_updated_ts = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
+
+    if (state->bound >= 0) {
+        xemu_input_publish_snapshot(state->bound, state);
+    }
 }
 
 void xemu_input_update_controllers(void)
@@ -258,6 +318,58 @@ void xemu_input_update_controllers(void)
     }
 }
 
+// Sample bound controllers between frames, from the UI thread while it waits
+// for the next one, so the guest is not limited to input from the last frame
+void xemu_input_poll(void)
+{
+    SDL_PumpEvents();
+
+    ControllerState *iter;
+    QTAILQ_FOREACH(iter, &available_controllers, entry) {
+        if (iter->bound >= 0) {
+            xemu_input_update_controller(iter);
+        }
+    }
+}
+
+int64_t xemu_input_get_poll_interval_ns(void)
+{
+    return NANOSECONDS_PER_SECOND / poll_rate;
+}
+
+int xemu_input_get_poll_rate(void)
+{
+    return poll_rate;
+}
+
+void xemu_input_set_poll_rate(int rate)
+{
+    poll_rate = MAX(XEMU_INPUT_MIN_POLL_RATE,
+                    MIN(rate, XEMU_INPUT_MAX_POLL_RATE));
+    xemu_settings_set_int(XEMU_SETTINGS_INPUT_POLL_RATE, poll_rate);
+    xemu_settings_save();
+}
+
+void xemu_input_record_latency(int64_t latency_us)
+{
+    input_latency.samples[input_latency.ptr] = latency_us / 1000.0f;
+    input_latency.ptr = (input_latency.ptr + 1) % XEMU_INPUT_LATENCY_HISTORY;
+    input_latency.count = MIN(input_latency.count + 1,
+                              XEMU_INPUT_LATENCY_HISTORY);
+}
+
+void xemu_input_get_latency(float *avg_ms, float *max_ms)
+{
+    float sum = 0, max = 0;
+
+    for (unsigned int i = 0; i < input_latency.count; i++) {
+        sum += input_latency.samples[i];
+        max = MAX(max, input_latency.samples[i]);
+    }
+    *avg_ms = input_latency.count ? sum / input_latency.count : 0;
+    *max_ms = max;
+}
+
 void xemu_input_update_sdl_kbd_controller_state(ControllerState *state)
 {
     state->buttons = 0;
@@ -404,6 +516,7 @@ void xemu_input_bind(int index, ControllerState *state, int save)
         bound_controllers[index]->bound = -1;
         bound_controllers[index]->device = NULL;
         bound_controllers[index] = NULL;
+        xemu_input_publish_snapshot(index, NULL);
     }
 
     // Save this controller's GUID in settings for auto re-connect
@@ -429,6 +542,7 @@ void xemu_input_bind(int index, ControllerState *state, int save)
 
         bound_controllers[index] = state;
         bound_controllers[index]->bound = index;
+        xemu_input_publish_snapshot(index, state);
 
         const int port_map[4] = {3, 4, 1, 2};
         char *tmp;
@@ -94,6 +94,15 @@ typedef struct ControllerState {
     void *device; // DeviceState opaque
 } ControllerState;
 
+/* Input state of a bound port as last published by the UI thread */
+typedef struct ControllerSnapshot {
+    uint16_t buttons;
+    int16_t  axis[CONTROLLER_AXIS__COUNT];
+    int64_t  sampled_ts; // When the host controller was last read
+    int64_t  changed_ts; // When the host controller state last changed
+    uint32_t changes;    // Number of state changes published so far
+} ControllerSnapshot;
+
 typedef QTAILQ_HEAD(, ControllerState) ControllerStateList;
 extern ControllerStateList available_controllers;
 extern ControllerState *bound_controllers[4];
@@ -105,6 +114,13 @@ extern "C" {
 void xemu_input_init(void);
 void xemu_input_process_sdl_events(const SDL_Event *event); // SDL_CONTROLLERDEVICEADDED, SDL_CONTROLLERDEVICEREMOVED
 void xemu_input_update_controllers(void);
+void xemu_input_poll(void);
+int64_t xemu_input_get_poll_interval_ns(void);
+int xemu_input_get_poll_rate(void);
+void xemu_input_set_poll_rate(int rate);
+void xemu_input_get_snapshot(int index, ControllerSnapshot *snap);
+void xemu_input_record_latency(int64_t latency_us);
+void xemu_input_get_latency(float *avg_ms, float *max_ms);
 void xemu_input_update_controller(ControllerState *state);
 void xemu_input_update_sdl_kbd_controller_state(ControllerState *state);
 void xemu_input_update_sdl_controller_state(ControllerState *state);
@@ -33,6 +33,7 @@
 #include "qemu/config-file.h"
 #include "net/net.h"
 #include "net/hub.h"
+#include "net/syslink.h"
 #if defined(_WIN32)
 #include <pcap/pcap.h>
 #endif
@@ -80,6 +81,16 @@ void xemu_net_enable(void)
         qdict_put_str(qdict, "id",        id);
         qdict_put_str(qdict, "type",      "pcap");
         qdict_put_str(qdict, "ifname",    iface);
+    } else if (backend == XEMU_NET_BACKEND_SYSLINK) {
+        const char *relay_addr;
+        int compress;
+        xemu_settings_get_string(XEMU_SETTINGS_NETWORK_RELAY_ADDR, &relay_addr);
+        xemu_settings_get_bool(XEMU_SETTINGS_NETWORK_COMPRESS, &compress);
+        qdict = qdict_new();
+        qdict_put_str(qdict, "id",        id);
+        qdict_put_str(qdict, "type",      "syslink");
+        qdict_put_str(qdict, "relay",     relay_addr);
+        qdict_put_str(qdict, "compress",  compress ? "on" : "off");
     } else {
         // Unsupported backend type
         return;
@@ -147,3 +158,8 @@ int xemu_net_is_enabled(void)
     nc = qemu_find_netdev(id);
     return (nc != NULL);
 }
+
+bool xemu_net_get_syslink_stats(SyslinkStats *stats)
+{
+    return net_syslink_get_stats(qemu_find_netdev(id), stats);
+}
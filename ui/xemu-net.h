@@ -22,14 +22,21 @@
 #ifndef XEMU_NETWORK_H
 #define XEMU_NETWORK_H
 
+#include <stdbool.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+typedef struct SyslinkStats SyslinkStats;
+
 void xemu_net_enable(void);
 void xemu_net_disable(void);
 int xemu_net_is_enabled(void);
 
+// Per-peer statistics while attached to a System Link relay
+bool xemu_net_get_syslink_stats(SyslinkStats *stats);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,262 @@
+/*
+ * xemu Frame Pacing
+ *
+ * Decides when the display loop presents and when the guest sees a vblank.
+ * Guest vblanks follow their own timeline at the rate of the guest video
+ * mode (or a user chosen rate), independent of how often the host presents,
+ * so a 50 Hz title stays at 50 Hz on a 60 Hz or 144 Hz monitor.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include <SDL.h>
+#include <epoxy/gl.h>
+
+#include "xemu-input.h"
+#include "xemu-pacing.h"
+#include "xemu-settings.h"
+
+#define FRAME_TIME_HISTORY 512
+#define FENCE_TIMEOUT_NS (100 * SCALE_MS)
+
+/* Bounds on how early to wake up before a deadline and spin the rest */
+#define SLEEP_SLACK_MIN_NS (50 * SCALE_US)
+#define SLEEP_SLACK_MAX_NS (4 * SCALE_MS)
+
+static struct {
+    int mode;
+    int target_fps;
+    int skip_unchanged;
+    bool skipped;
+    int64_t next_vblank;
+    int64_t sleep_slack;
+    int64_t last_present;
+    GLsync fence;
+    float frame_times[FRAME_TIME_HISTORY];
+    unsigned int frame_time_count;
+    unsigned int frame_time_ptr;
+} pacing;
+
+/* Note: only supports millisecond resolution on Windows */
+static void sleep_ns(int64_t ns)
+{
+#ifndef _WIN32
+    struct timespec sleep_delay, rem_delay;
+    sleep_delay.tv_sec = ns / 1000000000LL;
+    sleep_delay.tv_nsec = ns % 1000000000LL;
+    nanosleep(&sleep_delay, &rem_delay);
+#else
+    Sleep(ns / SCALE_MS);
+#endif
+}
+
+static void xemu_pacing_apply_swap_interval(void)
+{
+    switch (pacing.mode) {
+    case DISPLAY_PACING_VSYNC:
+        SDL_GL_SetSwapInterval(1);
+        break;
+    case DISPLAY_PACING_ADAPTIVE:
+        /* Late swaps tear rather than wait a whole refresh. On a variable
+         * refresh display this presents at the guest's own cadence. */
+        if (SDL_GL_SetSwapInterval(-1) < 0) {
+            SDL_GL_SetSwapInterval(1);
+        }
+        break;
+    default:
+        SDL_GL_SetSwapInterval(0);
+        break;
+    }
+}
+
+void xemu_pacing_init(void)
+{
+    xemu_settings_get_enum(XEMU_SETTINGS_DISPLAY_FRAME_PACING, &pacing.mode);
+    xemu_settings_get_int(XEMU_SETTINGS_DISPLAY_TARGET_FPS,
+                          &pacing.target_fps);
+    pacing.target_fps = MAX(10, MIN(pacing.target_fps, 240));
+    xemu_settings_get_bool(XEMU_SETTINGS_DISPLAY_SKIP_UNCHANGED,
+                           &pacing.skip_unchanged);
+#ifndef _WIN32
+    pacing.sleep_slack = 500 * SCALE_US;
+#else
+    pacing.sleep_slack = 2 * SCALE_MS;
+#endif
+    xemu_pacing_apply_swap_interval();
+}
+
+int xemu_pacing_get_mode(void)
+{
+    return pacing.mode;
+}
+
+void xemu_pacing_set_mode(int mode)
+{
+    pacing.mode = mode;
+    xemu_settings_set_enum(XEMU_SETTINGS_DISPLAY_FRAME_PACING, mode);
+    xemu_settings_save();
+    xemu_pacing_apply_swap_interval();
+}
+
+int xemu_pacing_get_target_fps(void)
+{
+    return pacing.target_fps;
+}
+
+void xemu_pacing_set_target_fps(int fps)
+{
+    pacing.target_fps = MAX(10, MIN(fps, 240));
+    xemu_settings_set_int(XEMU_SETTINGS_DISPLAY_TARGET_FPS, pacing.target_fps);
+    xemu_settings_save();
+}
+
+bool xemu_pacing_get_skip_unchanged(void)
+{
+    return pacing.skip_unchanged;
+}
+
+void xemu_pacing_set_skip_unchanged(bool skip)
+{
+    pacing.skip_unchanged = skip;
+    xemu_settings_set_bool(XEMU_SETTINGS_DISPLAY_SKIP_UNCHANGED, skip);
+    xemu_settings_save();
+}
+
+/* Wait for the GPU to finish the previous frame before starting the next,
+ * keeping at most one frame queued without stalling on glFinish() */
+void xemu_pacing_begin_frame(void)
+{
+    if (pacing.fence) {
+        glClientWaitSync(pacing.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                         FENCE_TIMEOUT_NS);
+        glDeleteSync(pacing.fence);
+        pacing.fence = 0;
+    }
+}
+
+void xemu_pacing_end_frame(void)
+{
+    pacing.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    if (pacing.last_present) {
+        pacing.frame_times[pacing.frame_time_ptr] =
+            (now - pacing.last_present) / 1e6;
+        pacing.frame_time_ptr =
+            (pacing.frame_time_ptr + 1) % FRAME_TIME_HISTORY;
+        pacing.frame_time_count =
+            MIN(pacing.frame_time_count + 1, FRAME_TIME_HISTORY);
+    }
+    pacing.last_present = now;
+    pacing.skipped = false;
+}
+
+/* Nothing changed on screen, so nothing was drawn or swapped this time */
+void xemu_pacing_skip_frame(void)
+{
+    pacing.last_present = 0;
+    pacing.skipped = true;
+}
+
+/* Advance the guest vblank timeline, returning whether one is due now */
+bool xemu_pacing_vblank_due(double guest_rate)
+{
+    double rate = (pacing.mode == DISPLAY_PACING_TARGET) ? pacing.target_fps
+                                                         : guest_rate;
+    int64_t interval = NANOSECONDS_PER_SECOND / rate;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    if (now < pacing.next_vblank) {
+        return false;
+    }
+
+    /* Keep the cadence unless we fell a whole vblank behind, e.g. after
+     * a pause or a slow frame, rather than trying to catch up */
+    pacing.next_vblank += interval;
+    if (pacing.next_vblank <= now) {
+        pacing.next_vblank = now + interval;
+    }
+
+    return true;
+}
+
+/* Sleep until the next guest vblank when the host swap does not pace us */
+void xemu_pacing_wait(void)
+{
+    if (pacing.mode == DISPLAY_PACING_VSYNC && !pacing.skipped) {
+        return;
+    }
+
+    int64_t deadline = pacing.next_vblank;
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    if (deadline - now > pacing.sleep_slack) {
+        int64_t wake = deadline - pacing.sleep_slack;
+
+        /* Keep sampling input while idle instead of once per frame */
+        int64_t poll_interval = xemu_input_get_poll_interval_ns();
+        while (wake - now > poll_interval) {
+            sleep_ns(poll_interval);
+            xemu_input_poll();
+            now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        }
+        if (wake > now) {
+            sleep_ns(wake - now);
+        }
+        now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+        /* Track how late sleeps come back: jump up to a late wakeup at
+         * once, come back down slowly */
+        int64_t late = now - wake;
+        if (late > pacing.sleep_slack) {
+            pacing.sleep_slack = late;
+        } else {
+            pacing.sleep_slack -= (pacing.sleep_slack - late) / 16;
+        }
+        pacing.sleep_slack = MAX(SLEEP_SLACK_MIN_NS,
+                                 MIN(pacing.sleep_slack, SLEEP_SLACK_MAX_NS));
+    }
+
+    /* Spin out whatever is left, at most about one slack */
+    while (now < deadline) {
+        now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    }
+}
+
+static int compare_float(const void *a, const void *b)
+{
+    float fa = *(const float *)a, fb = *(const float *)b;
+    return (fa > fb) - (fa < fb);
+}
+
+void xemu_pacing_get_frame_times(XemuFrameTimes *times)
+{
+    float sorted[FRAME_TIME_HISTORY];
+    unsigned int n = pacing.frame_time_count;
+
+    times->count = n;
+    if (n == 0) {
+        times->p50 = times->p95 = times->p99 = times->max = 0;
+        return;
+    }
+
+    memcpy(sorted, pacing.frame_times, n * sizeof(float));
+    qsort(sorted, n, sizeof(float), compare_float);
+    times->p50 = sorted[(n - 1) * 50 / 100];
+    times->p95 = sorted[(n - 1) * 95 / 100];
+    times->p99 = sorted[(n - 1) * 99 / 100];
+    times->max = sorted[n - 1];
+}
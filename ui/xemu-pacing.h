@@ -0,0 +1,52 @@
+/*
+ * xemu Frame Pacing
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef XEMU_PACING_H
+#define XEMU_PACING_H
+
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct XemuFrameTimes {
+    unsigned int count;
+    float p50, p95, p99, max; /* Milliseconds */
+} XemuFrameTimes;
+
+void xemu_pacing_init(void);
+int xemu_pacing_get_mode(void);
+void xemu_pacing_set_mode(int mode);
+int xemu_pacing_get_target_fps(void);
+void xemu_pacing_set_target_fps(int fps);
+bool xemu_pacing_get_skip_unchanged(void);
+void xemu_pacing_set_skip_unchanged(bool skip);
+
+void xemu_pacing_begin_frame(void);
+void xemu_pacing_end_frame(void);
+void xemu_pacing_skip_frame(void);
+bool xemu_pacing_vblank_due(double guest_rate);
+void xemu_pacing_wait(void);
+
+void xemu_pacing_get_frame_times(XemuFrameTimes *times);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
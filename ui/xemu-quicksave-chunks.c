@@ -0,0 +1,75 @@
+/*
+ * xemu Quick Save shadow chunks
+ *
+ * The memory side of a quick save, kept apart from the machine so it can
+ * be measured on synthetic RAM (tests/bench/benchmark-quicksave.c).
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/bitops.h"
+#include <zlib.h>
+
+#include "xemu-quicksave-chunks.h"
+
+uint64_t quicksave_copy_dirty_pages(uint8_t *shadow, QuickSaveChunk *chunks,
+                                    uint64_t offset, const uint8_t *src,
+                                    uint64_t size, const unsigned long *dirty,
+                                    size_t page_size)
+{
+    uint64_t num_pages = size / page_size;
+    uint64_t pages = 0;
+
+    for (uint64_t page = find_first_bit(dirty, num_pages); page < num_pages;
+         page = find_next_bit(dirty, num_pages, page + 1)) {
+        uint64_t addr = page * page_size;
+        memcpy(shadow + offset + addr, src + addr, page_size);
+        chunks[(offset + addr) / QUICKSAVE_CHUNK_SIZE].stale = true;
+        pages++;
+    }
+
+    return pages;
+}
+
+void quicksave_compress_chunk_data(QuickSaveChunk *c, const uint8_t *src,
+                                   size_t size)
+{
+    uLongf len = compressBound(size);
+    uint8_t *buf = g_malloc(len);
+
+    if (compress2(buf, &len, src, size, Z_BEST_SPEED) != Z_OK ||
+        len >= size) {
+        memcpy(buf, src, size);
+        len = size;
+    }
+
+    g_free(c->data);
+    c->data = g_realloc(buf, len);
+    c->len = len;
+    c->stale = false;
+}
+
+bool quicksave_decompress_chunk_data(const QuickSaveChunk *c, uint8_t *dst,
+                                     size_t size)
+{
+    uLongf len = size;
+
+    if (c->len == size) {
+        memcpy(dst, c->data, size);
+        return true;
+    }
+    return uncompress(dst, &len, c->data, c->len) == Z_OK && len == size;
+}
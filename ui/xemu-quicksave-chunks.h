@@ -0,0 +1,52 @@
+/*
+ * xemu Quick Save shadow chunks
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef XEMU_QUICKSAVE_CHUNKS_H
+#define XEMU_QUICKSAVE_CHUNKS_H
+
+#define QUICKSAVE_CHUNK_SIZE  (256 * KiB)
+
+typedef struct QuickSaveChunk {
+    uint8_t *data;  /* Compressed contents of the shadow chunk */
+    uint32_t len;
+    bool stale;     /* Shadow changed since data was compressed */
+} QuickSaveChunk;
+
+static inline size_t quicksave_chunk_size(uint64_t image_size, uint32_t i)
+{
+    return MIN(QUICKSAVE_CHUNK_SIZE,
+               image_size - (uint64_t)i * QUICKSAVE_CHUNK_SIZE);
+}
+
+/*
+ * Copy the pages of src set in dirty, one bit per page, to the shadow at
+ * offset and mark the chunks they land in stale. Returns the pages copied.
+ */
+uint64_t quicksave_copy_dirty_pages(uint8_t *shadow, QuickSaveChunk *chunks,
+                                    uint64_t offset, const uint8_t *src,
+                                    uint64_t size, const unsigned long *dirty,
+                                    size_t page_size);
+
+// Compress size bytes of src into c, stored raw if that is no larger
+void quicksave_compress_chunk_data(QuickSaveChunk *c, const uint8_t *src,
+                                   size_t size);
+
+// Returns false if c does not unpack to exactly size bytes
+bool quicksave_decompress_chunk_data(const QuickSaveChunk *c, uint8_t *dst,
+                                     size_t size);
+
+#endif
@@ -0,0 +1,625 @@
+/*
+ * xemu Quick Save
+ *
+ * A single save slot that is cheap to write while playing. Guest memory,
+ * meaning every migratable RAM block including RAMIN and the ROMs, is
+ * tracked with its own dirty memory client, so a save only stops the
+ * machine long enough to copy the pages written since the previous save
+ * into a shadow copy of it and to serialize device state. The shadow is split into
+ * chunks whose compressed form is kept between saves; worker threads
+ * recompress only the chunks that changed and the file is written in the
+ * background once the machine is running again.
+ *
+ * Like loadvm on raw disk images, disk contents are not part of the save.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qemu/main-loop.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "exec/memory.h"
+#include "exec/target_page.h"
+#include "block/block.h"
+#include "io/channel-buffer.h"
+#include "migration/migration.h"
+#include "migration/qemu-file.h"
+#include "migration/qemu-file-channel.h"
+#include "migration/savevm.h"
+#include "sysemu/runstate.h"
+
+#include "xemu-notifications.h"
+#include "xemu-quicksave.h"
+#include "xemu-quicksave-chunks.h"
+#include "xemu-ram-image.h"
+#include "xemu-settings.h"
+
+#define QUICKSAVE_MAGIC       0x58515356 /* "XQSV" */
+#define QUICKSAVE_VERSION     2
+#define QUICKSAVE_MAX_THREADS 8
+
+/*
+ * File layout, all fields big-endian: this header, num_regions region
+ * records, num_chunks compressed chunk lengths, the device state, then the
+ * chunks. A chunk whose length equals its size is stored uncompressed.
+ */
+typedef struct QEMU_PACKED QuickSaveHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t ram_size;
+    uint32_t chunk_size;
+    uint32_t num_chunks;
+    uint32_t device_len;
+    uint32_t num_regions;
+} QuickSaveHeader;
+
+/* Where each RAM block sits in the image, checked against the machine */
+typedef struct QEMU_PACKED QuickSaveRegion {
+    char name[256];
+    uint64_t size;
+} QuickSaveRegion;
+
+typedef struct QuickSaveWork {
+    void (*fn)(uint32_t chunk);
+    uint32_t *chunks;
+    uint32_t count;
+    uint32_t next;
+} QuickSaveWork;
+
+static struct {
+    XemuRamImage image;
+    unsigned long *dirty;   /* Scratch page bitmap, largest region */
+    uint32_t num_chunks;
+    int save_threads;
+    int load_threads;
+
+    uint8_t *shadow;        /* RAM as of the last save or load */
+    QuickSaveChunk *chunks;
+    bool have_base;         /* Shadow plus dirty log describe current RAM */
+    bool busy;
+    bool loading;
+    bool load_failed;
+
+    /* Handed to the background writer and back */
+    uint8_t *device_state;
+    uint32_t device_len;
+    int64_t save_start;
+    Error *error;
+    XemuQuickSaveStats pending;
+
+    XemuQuickSaveStats stats;
+} qs;
+
+static char *quicksave_get_path(void)
+{
+    g_autofree char *dir = g_path_get_dirname(xemu_settings_get_path());
+    return g_build_filename(dir, "quicksave.bin", NULL);
+}
+
+static void quicksave_vm_state_change(void *opaque, bool running,
+                                      RunState state)
+{
+    /* RAM replaced behind our back, e.g. by loadvm from the monitor */
+    if (state == RUN_STATE_RESTORE_VM && !qs.loading) {
+        qs.have_base = false;
+    }
+}
+
+static bool quicksave_init(Error **errp)
+{
+    if (qs.image.regions) {
+        return true;
+    }
+
+    if (!xemu_ram_image_init(&qs.image, errp)) {
+        return false;
+    }
+
+    uint64_t max_size = 0;
+    for (unsigned int i = 0; i < qs.image.num_regions; i++) {
+        max_size = MAX(max_size, qs.image.regions[i].size);
+    }
+    qs.dirty = bitmap_new(max_size / qemu_target_page_size());
+    qs.num_chunks = DIV_ROUND_UP(qs.image.size, QUICKSAVE_CHUNK_SIZE);
+    qs.shadow = g_malloc(qs.image.size);
+    qs.chunks = g_new0(QuickSaveChunk, qs.num_chunks);
+
+    /* Leave cores for the running machine while saving in the background */
+    int cpus = g_get_num_processors();
+    qs.save_threads = MAX(1, MIN(cpus / 2, QUICKSAVE_MAX_THREADS));
+    qs.load_threads = MAX(1, MIN(cpus, QUICKSAVE_MAX_THREADS));
+
+    xemu_ram_image_set_log(&qs.image, true, DIRTY_MEMORY_SNAPSHOT);
+    qemu_add_vm_change_state_handler(quicksave_vm_state_change, NULL);
+    return true;
+}
+
+static void *quicksave_worker(void *opaque)
+{
+    QuickSaveWork *work = opaque;
+    uint32_t i;
+
+    while ((i = qatomic_fetch_inc(&work->next)) < work->count) {
+        work->fn(work->chunks[i]);
+    }
+    return NULL;
+}
+
+/* Run fn over the listed chunks on up to max_threads, counting the caller */
+static void quicksave_run_parallel(void (*fn)(uint32_t), uint32_t *chunks,
+                                   uint32_t count, int max_threads)
+{
+    QemuThread threads[QUICKSAVE_MAX_THREADS];
+    QuickSaveWork work = {
+        .fn = fn,
+        .chunks = chunks,
+        .count = count,
+    };
+    int n = MIN(max_threads, MIN(count, QUICKSAVE_MAX_THREADS));
+
+    for (int t = 1; t < n; t++) {
+        qemu_thread_create(&threads[t], "quicksave-worker", quicksave_worker,
+                           &work, QEMU_THREAD_JOINABLE);
+    }
+    quicksave_worker(&work);
+    for (int t = 1; t < n; t++) {
+        qemu_thread_join(&threads[t]);
+    }
+}
+
+static void quicksave_compress_chunk(uint32_t i)
+{
+    quicksave_compress_chunk_data(&qs.chunks[i],
+                                  qs.shadow + (uint64_t)i * QUICKSAVE_CHUNK_SIZE,
+                                  quicksave_chunk_size(qs.image.size, i));
+}
+
+static void quicksave_decompress_chunk(uint32_t i)
+{
+    if (!quicksave_decompress_chunk_data(
+            &qs.chunks[i], qs.shadow + (uint64_t)i * QUICKSAVE_CHUNK_SIZE,
+            quicksave_chunk_size(qs.image.size, i))) {
+        qatomic_set(&qs.load_failed, true);
+    }
+}
+
+static bool quicksave_write_file(const char *path, uint64_t *bytes,
+                                 Error **errp)
+{
+    g_autofree char *tmp_path = g_strdup_printf("%s.tmp", path);
+    g_autofree uint32_t *lens = g_new(uint32_t, qs.num_chunks);
+    g_autofree QuickSaveRegion *regions =
+        g_new0(QuickSaveRegion, qs.image.num_regions);
+    QuickSaveHeader hdr = {
+        .magic       = cpu_to_be32(QUICKSAVE_MAGIC),
+        .version     = cpu_to_be32(QUICKSAVE_VERSION),
+        .ram_size    = cpu_to_be64(qs.image.size),
+        .chunk_size  = cpu_to_be32(QUICKSAVE_CHUNK_SIZE),
+        .num_chunks  = cpu_to_be32(qs.num_chunks),
+        .device_len  = cpu_to_be32(qs.device_len),
+        .num_regions = cpu_to_be32(qs.image.num_regions),
+    };
+
+    for (unsigned int i = 0; i < qs.image.num_regions; i++) {
+        pstrcpy(regions[i].name, sizeof(regions[i].name),
+                qs.image.regions[i].name);
+        regions[i].size = cpu_to_be64(qs.image.regions[i].size);
+    }
+
+    FILE *f = qemu_fopen(tmp_path, "wb");
+    if (!f) {
+        error_setg_errno(errp, errno, "Could not create %s", tmp_path);
+        return false;
+    }
+
+    *bytes = sizeof(hdr) + qs.image.num_regions * sizeof(QuickSaveRegion) +
+             qs.num_chunks * sizeof(uint32_t) + qs.device_len;
+    for (uint32_t i = 0; i < qs.num_chunks; i++) {
+        lens[i] = cpu_to_be32(qs.chunks[i].len);
+        *bytes += qs.chunks[i].len;
+    }
+
+    bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 &&
+              fwrite(regions, sizeof(QuickSaveRegion),
+                     qs.image.num_regions, f) == qs.image.num_regions &&
+              fwrite(lens, sizeof(uint32_t), qs.num_chunks, f) ==
+                  qs.num_chunks &&
+              fwrite(qs.device_state, 1, qs.device_len, f) == qs.device_len;
+    for (uint32_t i = 0; ok && i < qs.num_chunks; i++) {
+        ok = fwrite(qs.chunks[i].data, 1, qs.chunks[i].len, f) ==
+             qs.chunks[i].len;
+    }
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok) {
+        error_setg_errno(errp, errno, "Could not write %s", tmp_path);
+        unlink(tmp_path);
+        return false;
+    }
+
+#ifdef _WIN32
+    /* rename() does not replace an existing file here */
+    unlink(path);
+#endif
+    if (rename(tmp_path, path) < 0) {
+        error_setg_errno(errp, errno, "Could not replace %s", path);
+        unlink(tmp_path);
+        return false;
+    }
+
+    return true;
+}
+
+static void quicksave_save_done_bh(void *opaque)
+{
+    qs.pending.save_ms =
+        (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - qs.save_start) / 1e6;
+    g_free(qs.device_state);
+    qs.device_state = NULL;
+    qs.busy = false;
+
+    if (qs.error) {
+        xemu_queue_error_message(error_get_pretty(qs.error));
+        error_free(qs.error);
+        qs.error = NULL;
+        return;
+    }
+
+    float load_ms = qs.stats.load_ms;
+    qs.stats = qs.pending;
+    qs.stats.have_save = true;
+    qs.stats.load_ms = load_ms;
+
+    char msg[64];
+    snprintf(msg, sizeof(msg), "Quick saved in %.0f ms (paused %.1f ms)",
+             qs.stats.save_ms, qs.stats.pause_ms);
+    xemu_queue_notification(msg);
+}
+
+/* Runs while the machine does; owns the chunk cache until it is done */
+static void *quicksave_writer_thread(void *opaque)
+{
+    g_autofree uint32_t *stale = g_new(uint32_t, qs.num_chunks);
+    g_autofree char *path = quicksave_get_path();
+    uint32_t num_stale = 0;
+
+    for (uint32_t i = 0; i < qs.num_chunks; i++) {
+        if (qs.chunks[i].stale) {
+            stale[num_stale++] = i;
+        }
+    }
+
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    quicksave_run_parallel(quicksave_compress_chunk, stale, num_stale,
+                           qs.save_threads);
+    qs.pending.compress_ms =
+        (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start) / 1e6;
+    qs.pending.chunks_compressed = num_stale;
+    qs.pending.chunks_total = qs.num_chunks;
+
+    quicksave_write_file(path, &qs.pending.file_bytes, &qs.error);
+
+    aio_bh_schedule_oneshot(qemu_get_aio_context(), quicksave_save_done_bh,
+                            NULL);
+    return NULL;
+}
+
+/*
+ * Copy the pages written since the last save into the shadow, returning
+ * how many there were.
+ */
+static uint64_t quicksave_copy_dirty(void)
+{
+    size_t page_size = qemu_target_page_size();
+    uint64_t pages = 0;
+
+    for (unsigned int i = 0; i < qs.image.num_regions; i++) {
+        XemuRamRegion *r = &qs.image.regions[i];
+        uint64_t num_pages = r->size / page_size;
+        DirtyBitmapSnapshot *snap =
+            memory_region_snapshot_and_clear_dirty(r->mr, 0, r->size,
+                                                   DIRTY_MEMORY_SNAPSHOT);
+
+        if (qs.have_base) {
+            bitmap_zero(qs.dirty, num_pages);
+            for (uint64_t page = 0; page < num_pages; page++) {
+                if (memory_region_snapshot_get_dirty(r->mr, snap,
+                                                     page * page_size,
+                                                     page_size)) {
+                    set_bit(page, qs.dirty);
+                }
+            }
+            pages += quicksave_copy_dirty_pages(qs.shadow, qs.chunks,
+                                                r->offset, r->host, r->size,
+                                                qs.dirty, page_size);
+        }
+        g_free(snap);
+    }
+
+    if (!qs.have_base) {
+        xemu_ram_image_read(&qs.image, qs.shadow);
+        for (uint32_t i = 0; i < qs.num_chunks; i++) {
+            qs.chunks[i].stale = true;
+        }
+        pages = qs.image.size / page_size;
+    }
+
+    return pages;
+}
+
+static void quicksave_save_bh(void *opaque)
+{
+    Error *err = NULL;
+
+    /* nv2a only writes back its surfaces on the transition to SAVE_VM */
+    if (!runstate_is_running()) {
+        error_setg(&err, "Resume the machine to quick save");
+    } else if (quicksave_init(&err)) {
+        qemu_savevm_state_blocked(&err);
+    }
+    if (err) {
+        xemu_queue_error_message(error_get_pretty(err));
+        error_free(err);
+        qs.busy = false;
+        return;
+    }
+
+    memset(&qs.pending, 0, sizeof(qs.pending));
+    int64_t pause_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    vm_stop(RUN_STATE_SAVE_VM);
+
+    qs.pending.dirty_pages = quicksave_copy_dirty();
+    qs.have_base = true;
+
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(4 * MiB);
+    QEMUFile *f = qemu_fopen_channel_output(QIO_CHANNEL(bioc));
+    int ret = qemu_save_device_state(f);
+    if (qemu_fclose(f) < 0 && ret == 0) {
+        ret = -EIO;
+    }
+
+    vm_start();
+    qs.pending.pause_ms =
+        (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - pause_start) / 1e6;
+
+    if (ret < 0) {
+        object_unref(OBJECT(bioc));
+        xemu_queue_error_message("Failed to save device state");
+        qs.busy = false;
+        return;
+    }
+
+    qs.device_state = g_memdup(bioc->data, bioc->usage);
+    qs.device_len = bioc->usage;
+    object_unref(OBJECT(bioc));
+
+    QemuThread thread;
+    qemu_thread_create(&thread, "quicksave", quicksave_writer_thread, NULL,
+                       QEMU_THREAD_DETACHED);
+}
+
+/*
+ * Check a save file read into memory and take its chunks into the cache,
+ * returning where the device state starts.
+ */
+static const uint8_t *quicksave_parse(const uint8_t *buf, size_t len,
+                                      uint32_t *device_len, Error **errp)
+{
+    QuickSaveHeader hdr;
+
+    if (len < sizeof(hdr)) {
+        error_setg(errp, "Quick save file is truncated");
+        return NULL;
+    }
+    memcpy(&hdr, buf, sizeof(hdr));
+
+    if (be32_to_cpu(hdr.magic) != QUICKSAVE_MAGIC ||
+        be32_to_cpu(hdr.version) != QUICKSAVE_VERSION ||
+        be32_to_cpu(hdr.chunk_size) != QUICKSAVE_CHUNK_SIZE) {
+        error_setg(errp, "Not a quick save file, or from another version");
+        return NULL;
+    }
+    if (be64_to_cpu(hdr.ram_size) != qs.image.size ||
+        be32_to_cpu(hdr.num_chunks) != qs.num_chunks ||
+        be32_to_cpu(hdr.num_regions) != qs.image.num_regions) {
+        error_setg(errp, "Quick save was made with a different memory size");
+        return NULL;
+    }
+
+    const uint8_t *regions = buf + sizeof(hdr);
+    if (qs.image.num_regions * sizeof(QuickSaveRegion) > len - sizeof(hdr)) {
+        error_setg(errp, "Quick save file is truncated");
+        return NULL;
+    }
+    for (unsigned int i = 0; i < qs.image.num_regions; i++) {
+        QuickSaveRegion region;
+        memcpy(&region, regions + i * sizeof(region), sizeof(region));
+        if (strncmp(region.name, qs.image.regions[i].name,
+                    sizeof(region.name)) ||
+            be64_to_cpu(region.size) != qs.image.regions[i].size) {
+            error_setg(errp, "Quick save was made with a different "
+                       "memory layout");
+            return NULL;
+        }
+    }
+
+    const uint8_t *lens = regions +
+                          qs.image.num_regions * sizeof(QuickSaveRegion);
+    const uint8_t *device_state = lens + qs.num_chunks * sizeof(uint32_t);
+    const uint8_t *end = buf + len;
+    *device_len = be32_to_cpu(hdr.device_len);
+    if (device_state > end || *device_len > end - device_state) {
+        error_setg(errp, "Quick save file is truncated");
+        return NULL;
+    }
+
+    const uint8_t *p = device_state + *device_len;
+    for (uint32_t i = 0; i < qs.num_chunks; i++) {
+        uint32_t chunk_len = ldl_be_p(lens + i * sizeof(uint32_t));
+        if (chunk_len == 0 ||
+            chunk_len > quicksave_chunk_size(qs.image.size, i) ||
+            chunk_len > end - p) {
+            error_setg(errp, "Quick save file is corrupt");
+            return NULL;
+        }
+        p += chunk_len;
+    }
+
+    /* Nothing can fail from here on, so the cache is safe to replace */
+    p = device_state + *device_len;
+    for (uint32_t i = 0; i < qs.num_chunks; i++) {
+        QuickSaveChunk *c = &qs.chunks[i];
+        g_free(c->data);
+        c->len = ldl_be_p(lens + i * sizeof(uint32_t));
+        c->data = g_memdup(p, c->len);
+        c->stale = false;
+        p += c->len;
+    }
+
+    return device_state;
+}
+
+static int quicksave_load_device_state(const uint8_t *buf, uint32_t len)
+{
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(len);
+    memcpy(bioc->data, buf, len);
+    bioc->usage = len;
+
+    QEMUFile *f = qemu_fopen_channel_input(QIO_CHANNEL(bioc));
+    object_unref(OBJECT(bioc));
+
+    int ret = -EINVAL;
+    if (qemu_get_be32(f) == QEMU_VM_FILE_MAGIC &&
+        qemu_get_be32(f) == QEMU_VM_FILE_VERSION) {
+        ret = qemu_load_device_state(f);
+    }
+    qemu_fclose(f);
+    migration_incoming_state_destroy();
+    return ret;
+}
+
+static void quicksave_load_bh(void *opaque)
+{
+    g_autofree char *path = quicksave_get_path();
+    g_autofree uint8_t *buf = NULL;
+    g_autofree uint32_t *all = NULL;
+    GError *gerr = NULL;
+    Error *err = NULL;
+    gsize len;
+
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    if (!quicksave_init(&err)) {
+        goto fail;
+    }
+    if (!g_file_get_contents(path, (gchar **)&buf, &len, &gerr)) {
+        error_setg(&err, "Could not read quick save: %s", gerr->message);
+        g_error_free(gerr);
+        goto fail;
+    }
+
+    uint32_t device_len;
+    const uint8_t *device_state = quicksave_parse(buf, len, &device_len,
+                                                  &err);
+    if (!device_state) {
+        goto fail;
+    }
+
+    /* Unpack into the shadow first so a bad file leaves the machine alone */
+    all = g_new(uint32_t, qs.num_chunks);
+    for (uint32_t i = 0; i < qs.num_chunks; i++) {
+        all[i] = i;
+    }
+    qs.have_base = false;
+    qs.load_failed = false;
+    quicksave_run_parallel(quicksave_decompress_chunk, all, qs.num_chunks,
+                           qs.load_threads);
+    if (qs.load_failed) {
+        for (uint32_t i = 0; i < qs.num_chunks; i++) {
+            qs.chunks[i].stale = true;
+        }
+        error_setg(&err, "Quick save file is corrupt");
+        goto fail;
+    }
+
+    bool was_running = runstate_is_running();
+    qs.loading = true;
+    vm_stop(RUN_STATE_RESTORE_VM);
+    bdrv_drain_all_begin();
+    qemu_system_reset(SHUTDOWN_CAUSE_NONE);
+
+    xemu_ram_image_write(&qs.image, qs.shadow, DIRTY_MEMORY_SNAPSHOT);
+    qs.have_base = true;
+
+    int ret = quicksave_load_device_state(device_state, device_len);
+    bdrv_drain_all_end();
+    qs.loading = false;
+
+    if (ret < 0) {
+        /* RAM is already replaced, so leave the machine stopped */
+        error_setg(&err, "Failed to load device state: %d", ret);
+        goto fail;
+    }
+    if (was_running) {
+        vm_start();
+    }
+
+    qs.stats.load_ms = (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start) / 1e6;
+    qs.stats.have_save = true;
+    qs.busy = false;
+
+    char msg[64];
+    snprintf(msg, sizeof(msg), "Quick loaded in %.0f ms", qs.stats.load_ms);
+    xemu_queue_notification(msg);
+    return;
+
+fail:
+    xemu_queue_error_message(error_get_pretty(err));
+    error_free(err);
+    qs.busy = false;
+}
+
+void xemu_quicksave_save(void)
+{
+    if (qs.busy) {
+        xemu_queue_notification("Quick save or load already in progress");
+        return;
+    }
+    qs.busy = true;
+    qs.save_start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    aio_bh_schedule_oneshot(qemu_get_aio_context(), quicksave_save_bh, NULL);
+}
+
+void xemu_quicksave_load(void)
+{
+    if (qs.busy) {
+        xemu_queue_notification("Quick save or load already in progress");
+        return;
+    }
+    qs.busy = true;
+    aio_bh_schedule_oneshot(qemu_get_aio_context(), quicksave_load_bh, NULL);
+}
+
+bool xemu_quicksave_busy(void)
+{
+    return qs.busy;
+}
+
+void xemu_quicksave_get_stats(XemuQuickSaveStats *stats)
+{
+    *stats = qs.stats;
+}
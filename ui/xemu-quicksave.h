@@ -0,0 +1,50 @@
+/*
+ * xemu Quick Save
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef XEMU_QUICKSAVE_H
+#define XEMU_QUICKSAVE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct XemuQuickSaveStats {
+    bool     have_save;       /* A save or load has completed */
+    float    save_ms;         /* Request until the file was written */
+    float    pause_ms;        /* Time the machine was stopped for a save */
+    float    compress_ms;     /* Background compression of changed chunks */
+    float    load_ms;
+    uint64_t dirty_pages;     /* Pages copied during the last save */
+    uint32_t chunks_compressed;
+    uint32_t chunks_total;
+    uint64_t file_bytes;
+} XemuQuickSaveStats;
+
+// Both complete asynchronously and report through a notification
+void xemu_quicksave_save(void);
+void xemu_quicksave_load(void);
+bool xemu_quicksave_busy(void);
+void xemu_quicksave_get_stats(XemuQuickSaveStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
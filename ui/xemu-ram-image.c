@@ -0,0 +1,103 @@
+/*
+ * xemu guest RAM image
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qapi/error.h"
+#include "exec/memory.h"
+#include "migration/migration.h"
+
+#include "xemu-ram-image.h"
+
+/* Clients told about a restore, other than the one doing it */
+static const unsigned xemu_ram_image_clients[] = {
+    DIRTY_MEMORY_VGA,
+    DIRTY_MEMORY_NV2A,
+    DIRTY_MEMORY_NV2A_TEX,
+    DIRTY_MEMORY_SNAPSHOT,
+    DIRTY_MEMORY_REWIND,
+};
+
+static int xemu_ram_image_add_block(RAMBlock *rb, void *opaque)
+{
+    GArray *regions = opaque;
+    void *host = qemu_ram_get_host_addr(rb);
+    ram_addr_t offset;
+    XemuRamRegion r = {
+        .mr = memory_region_from_host(host, &offset),
+        .host = host,
+        .name = g_strdup(qemu_ram_get_idstr(rb)),
+        .size = qemu_ram_get_used_length(rb),
+    };
+
+    memory_region_ref(r.mr);
+    g_array_append_val(regions, r);
+    return 0;
+}
+
+bool xemu_ram_image_init(XemuRamImage *img, Error **errp)
+{
+    GArray *regions = g_array_new(false, false, sizeof(XemuRamRegion));
+
+    foreach_not_ignored_block(xemu_ram_image_add_block, regions);
+    if (!regions->len) {
+        g_array_free(regions, true);
+        error_setg(errp, "Machine has no RAM to save");
+        return false;
+    }
+
+    img->num_regions = regions->len;
+    img->regions = (XemuRamRegion *)g_array_free(regions, false);
+    img->size = 0;
+    for (unsigned int i = 0; i < img->num_regions; i++) {
+        img->regions[i].offset = img->size;
+        img->size += img->regions[i].size;
+    }
+    return true;
+}
+
+void xemu_ram_image_set_log(XemuRamImage *img, bool log, unsigned client)
+{
+    for (unsigned int i = 0; i < img->num_regions; i++) {
+        memory_region_set_log(img->regions[i].mr, log, client);
+    }
+}
+
+void xemu_ram_image_read(XemuRamImage *img, uint8_t *dst)
+{
+    for (unsigned int i = 0; i < img->num_regions; i++) {
+        XemuRamRegion *r = &img->regions[i];
+        memcpy(dst + r->offset, r->host, r->size);
+    }
+}
+
+void xemu_ram_image_write(XemuRamImage *img, const uint8_t *src,
+                          unsigned client)
+{
+    for (unsigned int i = 0; i < img->num_regions; i++) {
+        XemuRamRegion *r = &img->regions[i];
+
+        memcpy(r->host, src + r->offset, r->size);
+        g_free(memory_region_snapshot_and_clear_dirty(r->mr, 0, r->size,
+                                                      client));
+        for (int j = 0; j < ARRAY_SIZE(xemu_ram_image_clients); j++) {
+            if (xemu_ram_image_clients[j] != client) {
+                memory_region_set_client_dirty(r->mr, 0, r->size,
+                                               xemu_ram_image_clients[j]);
+            }
+        }
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ * xemu guest RAM image
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef XEMU_RAM_IMAGE_H
+#define XEMU_RAM_IMAGE_H
+
+#include "exec/memory.h"
+
+typedef struct XemuRamRegion {
+    MemoryRegion *mr;
+    uint8_t *host;
+    char *name;         /* RAM block id, stable across runs */
+    uint64_t offset;    /* Within the image */
+    uint64_t size;
+} XemuRamRegion;
+
+/*
+ * Every migratable RAM block laid out back to back. Besides system RAM this
+ * holds RAMIN and the ROMs, which device state alone does not restore.
+ * Region sizes are page multiples, so no page straddles two regions.
+ */
+typedef struct XemuRamImage {
+    XemuRamRegion *regions;
+    unsigned int num_regions;
+    uint64_t size;
+} XemuRamImage;
+
+bool xemu_ram_image_init(XemuRamImage *img, Error **errp);
+void xemu_ram_image_set_log(XemuRamImage *img, bool log, unsigned client);
+
+// Copy the whole image out of guest memory
+void xemu_ram_image_read(XemuRamImage *img, uint8_t *dst);
+
+/*
+ * Replace guest memory with src. The caller's own dirty log is cleared and
+ * every other client sees the whole image as written.
+ */
+void xemu_ram_image_write(XemuRamImage *img, const uint8_t *src,
+                          unsigned client);
+
+#endif
@@ -0,0 +1,725 @@
+/*
+ * xemu Rewind
+ *
+ * Keeps the last stretch of machine state in memory so play can be wound
+ * back. The state at the newest capture is kept whole as the keyframe: a
+ * shadow copy of guest memory (every migratable RAM block, so RAMIN and
+ * the ROMs too) plus the serialized device state, NV2A and APU included.
+ * Each older capture is stored as the XOR of the pages that changed
+ * between it and the next newer capture, plus its device state XORed
+ * against the newer one, and compressed by a background thread.
+ * Going back applies deltas to the keyframe newest first, so the oldest
+ * capture can be dropped at any time without touching the rest.
+ *
+ * Captures use their own dirty memory client, so each one only stops the
+ * machine long enough to XOR the pages written over the last interval and
+ * save device state. While that takes longer than the budget, the interval
+ * backs off. Stopping is not free: vm_stop() drains and flushes every
+ * block device, which fsyncs the HDD image, and runs the run state
+ * handlers, where NV2A downloads its dirty surfaces into guest RAM.
+ *
+ * Disk contents are not rewound. Captures record how many writes the guest
+ * has made to its disks, captures from before the latest write are
+ * dropped, and a restore is refused while writes since the newest capture
+ * are outstanding, so the machine never goes back across a disk write.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/main-loop.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "exec/memory.h"
+#include "exec/target_page.h"
+#include "block/accounting.h"
+#include "block/block.h"
+#include "io/channel-buffer.h"
+#include "migration/migration.h"
+#include "migration/qemu-file.h"
+#include "migration/qemu-file-channel.h"
+#include "migration/savevm.h"
+#include "sysemu/block-backend.h"
+#include "sysemu/runstate.h"
+#include <zlib.h>
+
+#include "xemu-notifications.h"
+#include "xemu-ram-image.h"
+#include "xemu-rewind.h"
+#include "xemu-settings.h"
+
+#define REWIND_MAX_BACKOFF 8
+
+typedef struct RewindFrame {
+    int64_t time;            /* QEMU_CLOCK_VIRTUAL at capture */
+    uint64_t disk_writes;    /* rewind_disk_writes() at capture */
+
+    /*
+     * How to get here from the next newer frame. Empty on the newest
+     * frame, whose state is the keyframe. Stored lengths equal to the
+     * uncompressed ones mean the data is stored as is.
+     */
+    uint32_t num_pages;
+    uint32_t *pages;         /* Image pages that differ */
+    uint8_t *delta;          /* Those pages XORed with the newer frame's */
+    size_t delta_len;
+    uint8_t *device;         /* Device state, XORed with the newer if xor */
+    uint32_t device_len;     /* Uncompressed */
+    size_t device_stored_len;
+    bool device_xor;
+    bool packed;
+
+    QTAILQ_ENTRY(RewindFrame) entry;
+    QSIMPLEQ_ENTRY(RewindFrame) pack_entry;
+} RewindFrame;
+
+static struct {
+    bool enabled;
+    int seconds;
+    int interval_ms;
+    int budget_ms;
+    int backoff;
+
+    XemuRamImage image;
+    size_t page_size;
+    uint32_t *dirty;         /* Scratch list of dirty image pages */
+
+    uint8_t *shadow;         /* Guest memory at the newest frame */
+    uint8_t *device;         /* Device state at the newest frame */
+    uint32_t device_len;
+    QTAILQ_HEAD(, RewindFrame) frames; /* Oldest first */
+    int num_frames;
+    bool restoring;
+    float restore_seconds;
+
+    QEMUTimer *timer;
+    QEMUBH *capture_bh;
+    XemuRewindStats stats;
+
+    /* Packer thread state, and frame lengths it updates */
+    QemuThread packer;
+    QemuMutex lock;
+    QemuCond cond;
+    QSIMPLEQ_HEAD(, RewindFrame) pack_queue;
+    bool packing;
+    float pack_ms;
+} rw;
+
+/* dst = a ^ b */
+static void rewind_xor(uint8_t *dst, const uint8_t *a, const uint8_t *b,
+                       size_t len)
+{
+    size_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        stq_he_p(dst + i, ldq_he_p(a + i) ^ ldq_he_p(b + i));
+    }
+    for (; i < len; i++) {
+        dst[i] = a[i] ^ b[i];
+    }
+}
+
+/* Returns the compressed length, or len with *out unset if not worth it */
+static size_t rewind_compress(const uint8_t *src, size_t len, uint8_t **out)
+{
+    uLongf out_len = compressBound(len);
+
+    *out = NULL;
+    if (len == 0) {
+        return len;
+    }
+
+    uint8_t *buf = g_malloc(out_len);
+    if (compress2(buf, &out_len, src, len, Z_BEST_SPEED) != Z_OK ||
+        out_len >= len) {
+        g_free(buf);
+        return len;
+    }
+
+    *out = g_realloc(buf, out_len);
+    return out_len;
+}
+
+static bool rewind_unpack(const uint8_t *src, size_t stored, size_t len,
+                          const uint8_t **data, uint8_t **buf)
+{
+    uLongf out_len = len;
+
+    if (stored == len) {
+        *data = src;
+        return true;
+    }
+
+    *buf = g_malloc(len);
+    if (uncompress(*buf, &out_len, src, stored) != Z_OK || out_len != len) {
+        return false;
+    }
+    *data = *buf;
+    return true;
+}
+
+static void *rewind_packer_thread(void *opaque)
+{
+    qemu_mutex_lock(&rw.lock);
+    for (;;) {
+        while (QSIMPLEQ_EMPTY(&rw.pack_queue)) {
+            qemu_cond_wait(&rw.cond, &rw.lock);
+        }
+        RewindFrame *f = QSIMPLEQ_FIRST(&rw.pack_queue);
+        QSIMPLEQ_REMOVE_HEAD(&rw.pack_queue, pack_entry);
+        rw.packing = true;
+        qemu_mutex_unlock(&rw.lock);
+
+        int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        uint8_t *delta, *device;
+        size_t delta_len = rewind_compress(f->delta, f->delta_len, &delta);
+        size_t device_len = rewind_compress(f->device, f->device_len,
+                                            &device);
+        float ms = (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start) / 1e6;
+
+        qemu_mutex_lock(&rw.lock);
+        if (delta) {
+            g_free(f->delta);
+            f->delta = delta;
+            f->delta_len = delta_len;
+        }
+        if (device) {
+            g_free(f->device);
+            f->device = device;
+            f->device_stored_len = device_len;
+        }
+        f->packed = true;
+        rw.packing = false;
+        rw.pack_ms = ms;
+        qemu_cond_broadcast(&rw.cond);
+    }
+    return NULL;
+}
+
+static void rewind_wait_packer(void)
+{
+    qemu_mutex_lock(&rw.lock);
+    while (rw.packing || !QSIMPLEQ_EMPTY(&rw.pack_queue)) {
+        qemu_cond_wait(&rw.cond, &rw.lock);
+    }
+    qemu_mutex_unlock(&rw.lock);
+}
+
+static void rewind_frame_clear_delta(RewindFrame *f)
+{
+    g_free(f->pages);
+    g_free(f->delta);
+    g_free(f->device);
+    f->pages = NULL;
+    f->delta = NULL;
+    f->device = NULL;
+    f->num_pages = 0;
+    f->delta_len = 0;
+    f->device_len = 0;
+    f->device_stored_len = 0;
+    f->device_xor = false;
+}
+
+static void rewind_frame_free(RewindFrame *f)
+{
+    rewind_frame_clear_delta(f);
+    g_free(f);
+}
+
+static void rewind_clear(void)
+{
+    RewindFrame *f, *next;
+
+    rewind_wait_packer();
+    QTAILQ_FOREACH_SAFE(f, &rw.frames, entry, next) {
+        QTAILQ_REMOVE(&rw.frames, f, entry);
+        rewind_frame_free(f);
+    }
+    rw.num_frames = 0;
+    g_free(rw.device);
+    rw.device = NULL;
+    rw.device_len = 0;
+}
+
+/* Drop captures that have fallen out of the window */
+static void rewind_trim(void)
+{
+    RewindFrame *newest = QTAILQ_LAST(&rw.frames);
+    int64_t window = (int64_t)rw.seconds * NANOSECONDS_PER_SECOND;
+
+    qemu_mutex_lock(&rw.lock);
+    for (;;) {
+        RewindFrame *oldest = QTAILQ_FIRST(&rw.frames);
+        if (oldest == newest || !oldest->packed ||
+            (newest->time - oldest->time <= window &&
+             oldest->disk_writes == newest->disk_writes)) {
+            break;
+        }
+        QTAILQ_REMOVE(&rw.frames, oldest, entry);
+        rewind_frame_free(oldest);
+        rw.num_frames--;
+    }
+    qemu_mutex_unlock(&rw.lock);
+}
+
+static int rewind_save_device_state(uint8_t **data, uint32_t *len)
+{
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(4 * MiB);
+    QEMUFile *f = qemu_fopen_channel_output(QIO_CHANNEL(bioc));
+    int ret = qemu_save_device_state(f);
+
+    if (qemu_fclose(f) < 0 && ret == 0) {
+        ret = -EIO;
+    }
+    if (ret == 0) {
+        *data = g_memdup(bioc->data, bioc->usage);
+        *len = bioc->usage;
+    }
+    object_unref(OBJECT(bioc));
+    return ret;
+}
+
+static int rewind_load_device_state(void)
+{
+    QIOChannelBuffer *bioc = qio_channel_buffer_new(rw.device_len);
+    memcpy(bioc->data, rw.device, rw.device_len);
+    bioc->usage = rw.device_len;
+
+    QEMUFile *f = qemu_fopen_channel_input(QIO_CHANNEL(bioc));
+    object_unref(OBJECT(bioc));
+
+    int ret = -EINVAL;
+    if (qemu_get_be32(f) == QEMU_VM_FILE_MAGIC &&
+        qemu_get_be32(f) == QEMU_VM_FILE_VERSION) {
+        ret = qemu_load_device_state(f);
+    }
+    qemu_fclose(f);
+    migration_incoming_state_destroy();
+    return ret;
+}
+
+/*
+ * Writes the guest has completed to its disks, failed ones included as
+ * they may have changed the image. vm_stop() drains, so none are in flight
+ * at a capture.
+ */
+static uint64_t rewind_disk_writes(void)
+{
+    BlockBackend *blk = NULL;
+    uint64_t writes = 0;
+
+    while ((blk = blk_all_next(blk))) {
+        BlockAcctStats *stats = blk_get_stats(blk);
+        writes += stats->nr_ops[BLOCK_ACCT_WRITE] +
+                  stats->failed_ops[BLOCK_ACCT_WRITE];
+    }
+    return writes;
+}
+
+/* Collect the image pages written since the last capture into rw.dirty */
+static uint32_t rewind_collect_dirty(void)
+{
+    uint32_t n = 0;
+
+    for (unsigned int i = 0; i < rw.image.num_regions; i++) {
+        XemuRamRegion *r = &rw.image.regions[i];
+        uint64_t block = 64 * rw.page_size;
+        DirtyBitmapSnapshot *snap =
+            memory_region_snapshot_and_clear_dirty(r->mr, 0, r->size,
+                                                   DIRTY_MEMORY_REWIND);
+
+        for (uint64_t start = 0; start < r->size; start += block) {
+            uint64_t end = MIN(start + block, r->size);
+
+            if (!memory_region_snapshot_get_dirty(r->mr, snap, start,
+                                                  end - start)) {
+                continue;
+            }
+            for (uint64_t addr = start; addr < end; addr += rw.page_size) {
+                if (memory_region_snapshot_get_dirty(r->mr, snap, addr,
+                                                     rw.page_size)) {
+                    rw.dirty[n++] = (r->offset + addr) / rw.page_size;
+                }
+            }
+        }
+        g_free(snap);
+    }
+
+    return n;
+}
+
+static void rewind_capture(void)
+{
+    RewindFrame *newest = QTAILQ_LAST(&rw.frames);
+    uint32_t num_pages = 0;
+    uint8_t *delta = NULL;
+    uint8_t *device;
+    uint32_t device_len;
+
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    /* Drains and flushes the disks and has NV2A write back its surfaces,
+     * which is most of the pause on a busy frame */
+    vm_stop(RUN_STATE_SAVE_VM);
+    uint64_t disk_writes = rewind_disk_writes();
+
+    num_pages = rewind_collect_dirty();
+    if (!newest) {
+        xemu_ram_image_read(&rw.image, rw.shadow);
+        num_pages = 0;
+    } else {
+        /* Pages come in image order, so the region only moves forward */
+        XemuRamRegion *r = rw.image.regions;
+        delta = g_malloc(num_pages * rw.page_size);
+        for (uint32_t i = 0; i < num_pages; i++) {
+            uint64_t offset = (uint64_t)rw.dirty[i] * rw.page_size;
+            while (offset >= r->offset + r->size) {
+                r++;
+            }
+            const uint8_t *host = r->host + (offset - r->offset);
+            rewind_xor(delta + i * rw.page_size, rw.shadow + offset, host,
+                       rw.page_size);
+            memcpy(rw.shadow + offset, host, rw.page_size);
+        }
+    }
+
+    int ret = rewind_save_device_state(&device, &device_len);
+
+    vm_start();
+    float pause_ms = (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start) / 1e6;
+
+    if (ret < 0) {
+        /* The keyframe already moved on, so the history is no good */
+        g_free(delta);
+        rewind_clear();
+        xemu_queue_error_message("Rewind failed to save device state");
+        return;
+    }
+
+    if (newest) {
+        newest->num_pages = num_pages;
+        newest->pages = g_memdup(rw.dirty, num_pages * sizeof(uint32_t));
+        newest->delta = delta;
+        newest->delta_len = num_pages * rw.page_size;
+        if (device_len == rw.device_len) {
+            rewind_xor(rw.device, rw.device, device, device_len);
+            newest->device_xor = true;
+        }
+        newest->device = rw.device;
+        newest->device_len = rw.device_len;
+        newest->device_stored_len = rw.device_len;
+
+        qemu_mutex_lock(&rw.lock);
+        newest->packed = false;
+        QSIMPLEQ_INSERT_TAIL(&rw.pack_queue, newest, pack_entry);
+        qemu_cond_broadcast(&rw.cond);
+        qemu_mutex_unlock(&rw.lock);
+    }
+    rw.device = device;
+    rw.device_len = device_len;
+
+    RewindFrame *frame = g_new0(RewindFrame, 1);
+    frame->time = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    frame->disk_writes = disk_writes;
+    frame->packed = true;
+    QTAILQ_INSERT_TAIL(&rw.frames, frame, entry);
+    rw.num_frames++;
+    rewind_trim();
+
+    if (pause_ms > rw.budget_ms) {
+        rw.backoff = MIN(rw.backoff * 2, REWIND_MAX_BACKOFF);
+    } else if (pause_ms < rw.budget_ms / 2.0 && rw.backoff > 1) {
+        rw.backoff /= 2;
+    }
+
+    rw.stats.capture_avg_ms = rw.stats.capture_ms ?
+        rw.stats.capture_avg_ms + (pause_ms - rw.stats.capture_avg_ms) / 8 :
+        pause_ms;
+    rw.stats.capture_ms = pause_ms;
+    rw.stats.dirty_pages = newest ? num_pages
+                                  : rw.image.size / rw.page_size;
+    rw.stats.interval_ms = rw.interval_ms * rw.backoff;
+}
+
+static void rewind_schedule(void)
+{
+    timer_mod(rw.timer, qemu_clock_get_ms(QEMU_CLOCK_VIRTUAL) +
+                        rw.interval_ms * rw.backoff);
+}
+
+static void rewind_capture_bh(void *opaque)
+{
+    if (!rw.enabled) {
+        return;
+    }
+    /* The virtual clock stops with the machine, so this can wait */
+    if (runstate_is_running()) {
+        rewind_capture();
+    }
+    rewind_schedule();
+}
+
+static void rewind_timer_cb(void *opaque)
+{
+    qemu_bh_schedule(rw.capture_bh);
+}
+
+/* Turn the keyframe back into the state of the next older frame */
+static bool rewind_step_back(RewindFrame *f)
+{
+    g_autofree uint8_t *delta_buf = NULL;
+    g_autofree uint8_t *device_buf = NULL;
+    const uint8_t *delta, *device;
+
+    if (!rewind_unpack(f->delta, f->delta_len, f->num_pages * rw.page_size,
+                       &delta, &delta_buf) ||
+        !rewind_unpack(f->device, f->device_stored_len, f->device_len,
+                       &device, &device_buf)) {
+        return false;
+    }
+
+    for (uint32_t i = 0; i < f->num_pages; i++) {
+        uint8_t *page = rw.shadow + (uint64_t)f->pages[i] * rw.page_size;
+        rewind_xor(page, page, delta + i * rw.page_size, rw.page_size);
+    }
+
+    if (f->device_xor) {
+        rewind_xor(rw.device, rw.device, device, f->device_len);
+    } else {
+        g_free(rw.device);
+        rw.device = g_memdup(device, f->device_len);
+        rw.device_len = f->device_len;
+    }
+
+    return true;
+}
+
+static void rewind_restore_bh(void *opaque)
+{
+    if (!rw.enabled || QTAILQ_EMPTY(&rw.frames)) {
+        xemu_queue_notification("Nothing to rewind to yet");
+        return;
+    }
+
+    /* The disks would be left ahead of everything else */
+    if (QTAILQ_LAST(&rw.frames)->disk_writes != rewind_disk_writes()) {
+        xemu_queue_notification("Can't rewind across a disk write, "
+                                "try again shortly");
+        return;
+    }
+
+    int64_t start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    int64_t now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    int64_t target = now - rw.restore_seconds * NANOSECONDS_PER_SECOND;
+
+    RewindFrame *f = QTAILQ_LAST(&rw.frames);
+    while (f->time > target && QTAILQ_PREV(f, entry) &&
+           QTAILQ_PREV(f, entry)->disk_writes == f->disk_writes) {
+        f = QTAILQ_PREV(f, entry);
+    }
+
+    /* Rebuild the target state in the keyframe before touching the machine */
+    rewind_wait_packer();
+    RewindFrame *cur = QTAILQ_LAST(&rw.frames);
+    while (cur != f) {
+        RewindFrame *older = QTAILQ_PREV(cur, entry);
+        bool ok = rewind_step_back(older);
+        QTAILQ_REMOVE(&rw.frames, cur, entry);
+        rewind_frame_free(cur);
+        rw.num_frames--;
+        if (!ok) {
+            rewind_clear();
+            xemu_queue_error_message("Rewind buffer is corrupt, cleared it");
+            return;
+        }
+        cur = older;
+    }
+    rewind_frame_clear_delta(f);
+
+    bool was_running = runstate_is_running();
+    rw.restoring = true;
+    vm_stop(RUN_STATE_RESTORE_VM);
+    bdrv_drain_all_begin();
+    qemu_system_reset(SHUTDOWN_CAUSE_NONE);
+
+    xemu_ram_image_write(&rw.image, rw.shadow, DIRTY_MEMORY_REWIND);
+
+    int ret = rewind_load_device_state();
+    bdrv_drain_all_end();
+    rw.restoring = false;
+
+    if (ret < 0) {
+        /* RAM is already replaced, so leave the machine stopped */
+        rewind_clear();
+        xemu_queue_error_message("Rewind failed to load device state");
+        return;
+    }
+    if (was_running) {
+        vm_start();
+    }
+    rewind_schedule();
+
+    char msg[64];
+    snprintf(msg, sizeof(msg), "Rewound %.1f s in %.0f ms",
+             (now - f->time) / 1e9,
+             (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start) / 1e6);
+    xemu_queue_notification(msg);
+}
+
+static void rewind_vm_state_change(void *opaque, bool running,
+                                   RunState state)
+{
+    /* Another kind of load took the machine to a different timeline */
+    if (state == RUN_STATE_RESTORE_VM && !rw.restoring) {
+        rewind_clear();
+    }
+}
+
+static bool rewind_start(void)
+{
+    if (!rw.image.regions) {
+        if (!xemu_ram_image_init(&rw.image, NULL)) {
+            return false;
+        }
+        rw.page_size = qemu_target_page_size();
+        rw.dirty = g_new(uint32_t, rw.image.size / rw.page_size);
+    }
+
+    rw.shadow = g_malloc(rw.image.size);
+    rw.backoff = 1;
+    memset(&rw.stats, 0, sizeof(rw.stats));
+    xemu_ram_image_set_log(&rw.image, true, DIRTY_MEMORY_REWIND);
+    rewind_schedule();
+    return true;
+}
+
+static void rewind_stop(void)
+{
+    timer_del(rw.timer);
+    rewind_clear();
+    xemu_ram_image_set_log(&rw.image, false, DIRTY_MEMORY_REWIND);
+    g_free(rw.shadow);
+    rw.shadow = NULL;
+}
+
+void xemu_rewind_init(void)
+{
+    int enabled;
+
+    xemu_settings_get_bool(XEMU_SETTINGS_REWIND_ENABLED, &enabled);
+    xemu_settings_get_int(XEMU_SETTINGS_REWIND_SECONDS, &rw.seconds);
+    xemu_settings_get_int(XEMU_SETTINGS_REWIND_INTERVAL, &rw.interval_ms);
+    xemu_settings_get_int(XEMU_SETTINGS_REWIND_BUDGET, &rw.budget_ms);
+    rw.seconds = MAX(1, MIN(rw.seconds, 600));
+    rw.interval_ms = MAX(100, MIN(rw.interval_ms, 10000));
+    rw.budget_ms = MAX(1, MIN(rw.budget_ms, 100));
+
+    QTAILQ_INIT(&rw.frames);
+    QSIMPLEQ_INIT(&rw.pack_queue);
+    qemu_mutex_init(&rw.lock);
+    qemu_cond_init(&rw.cond);
+    qemu_thread_create(&rw.packer, "rewind-packer", rewind_packer_thread,
+                       NULL, QEMU_THREAD_DETACHED);
+
+    rw.timer = timer_new_ms(QEMU_CLOCK_VIRTUAL, rewind_timer_cb, NULL);
+    rw.capture_bh = qemu_bh_new(rewind_capture_bh, NULL);
+    qemu_add_vm_change_state_handler(rewind_vm_state_change, NULL);
+
+    if (enabled) {
+        rw.enabled = rewind_start();
+    }
+}
+
+bool xemu_rewind_is_enabled(void)
+{
+    return rw.enabled;
+}
+
+void xemu_rewind_set_enabled(bool enabled)
+{
+    if (enabled == rw.enabled) {
+        return;
+    }
+
+    if (enabled) {
+        rw.enabled = rewind_start();
+    } else {
+        rw.enabled = false;
+        rewind_stop();
+    }
+
+    xemu_settings_set_bool(XEMU_SETTINGS_REWIND_ENABLED, rw.enabled);
+    xemu_settings_save();
+}
+
+void xemu_rewind_get_config(int *seconds, int *interval_ms, int *budget_ms)
+{
+    *seconds = rw.seconds;
+    *interval_ms = rw.interval_ms;
+    *budget_ms = rw.budget_ms;
+}
+
+void xemu_rewind_set_config(int seconds, int interval_ms, int budget_ms)
+{
+    rw.seconds = MAX(1, MIN(seconds, 600));
+    rw.interval_ms = MAX(100, MIN(interval_ms, 10000));
+    rw.budget_ms = MAX(1, MIN(budget_ms, 100));
+
+    xemu_settings_set_int(XEMU_SETTINGS_REWIND_SECONDS, rw.seconds);
+    xemu_settings_set_int(XEMU_SETTINGS_REWIND_INTERVAL, rw.interval_ms);
+    xemu_settings_set_int(XEMU_SETTINGS_REWIND_BUDGET, rw.budget_ms);
+    xemu_settings_save();
+
+    if (rw.enabled) {
+        if (!QTAILQ_EMPTY(&rw.frames)) {
+            rewind_trim();
+        }
+        rewind_schedule();
+    }
+}
+
+void xemu_rewind_restore(float seconds)
+{
+    rw.restore_seconds = seconds;
+    aio_bh_schedule_oneshot(qemu_get_aio_context(), rewind_restore_bh, NULL);
+}
+
+void xemu_rewind_get_stats(XemuRewindStats *stats)
+{
+    RewindFrame *f;
+
+    *stats = rw.stats;
+    stats->frames = rw.num_frames;
+    stats->seconds = 0;
+    stats->memory_bytes = 0;
+    stats->delta_bytes = 0;
+    if (!rw.enabled) {
+        return;
+    }
+
+    if (!QTAILQ_EMPTY(&rw.frames)) {
+        stats->seconds = (QTAILQ_LAST(&rw.frames)->time -
+                          QTAILQ_FIRST(&rw.frames)->time) / 1e9;
+    }
+
+    qemu_mutex_lock(&rw.lock);
+    QTAILQ_FOREACH(f, &rw.frames, entry) {
+        stats->delta_bytes += f->delta_len + f->device_stored_len +
+                              f->num_pages * sizeof(uint32_t);
+    }
+    stats->pack_ms = rw.pack_ms;
+    qemu_mutex_unlock(&rw.lock);
+
+    stats->memory_bytes = rw.image.size + rw.device_len + stats->delta_bytes;
+}
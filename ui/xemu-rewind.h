@@ -0,0 +1,54 @@
+/*
+ * xemu Rewind
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef XEMU_REWIND_H
+#define XEMU_REWIND_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct XemuRewindStats {
+    int      frames;
+    float    seconds;        /* Guest time covered by the buffer */
+    uint64_t memory_bytes;   /* Keyframe plus every delta */
+    uint64_t delta_bytes;    /* Compressed deltas alone */
+    float    capture_ms;     /* Machine stopped for the last capture */
+    float    capture_avg_ms;
+    float    pack_ms;        /* Compressing the last delta off-thread */
+    uint64_t dirty_pages;    /* Pages changed over the last interval */
+    int      interval_ms;    /* Effective interval, after backing off */
+} XemuRewindStats;
+
+void xemu_rewind_init(void);
+bool xemu_rewind_is_enabled(void);
+void xemu_rewind_set_enabled(bool enabled);
+void xemu_rewind_get_config(int *seconds, int *interval_ms, int *budget_ms);
+void xemu_rewind_set_config(int seconds, int interval_ms, int budget_ms);
+
+// Go back at least this much guest time; completes asynchronously
+void xemu_rewind_restore(float seconds);
+void xemu_rewind_get_stats(XemuRewindStats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
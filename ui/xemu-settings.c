@@ -47,6 +47,9 @@ struct xemu_settings {
 	int   memory;
 	int   short_animation; // Boolean
 	int   hard_fpu; // Boolean
+	int   dvd_readahead; // KiB, 0 to disable (the default)
+	int   dvd_seek_timing; // Percent of a real drive's, 0 to disable
+	int   dvd_mmap; // Boolean, read errors on the image raise SIGBUS
 
 	// [audio]
 	int use_dsp; // Boolean
@@ -55,12 +58,17 @@ struct xemu_settings {
 	int scale;
 	int ui_scale;
 	int render_scale;
+	int renderer;
+	int frame_pacing;
+	int target_fps;
+	int skip_unchanged;
 
 	// [input]
 	char *controller_1_guid;
 	char *controller_2_guid;
 	char *controller_3_guid;
 	char *controller_4_guid;
+	int   poll_rate;
 
 	// [network]
 	int   net_enabled; // Boolean
@@ -68,6 +76,14 @@ struct xemu_settings {
 	char *net_local_addr;
 	char *net_remote_addr;
 	char *net_pcap_iface;
+	char *net_relay_addr;
+	int   net_compress; // Boolean
+
+	// [rewind]
+	int rewind_enabled; // Boolean
+	int rewind_seconds;
+	int rewind_interval; // Milliseconds
+	int rewind_budget; // Milliseconds
 
 	// [misc]
 	char *user_token;
@@ -88,10 +104,25 @@ static const struct enum_str_map display_scale_map[DISPLAY_SCALE__COUNT+1] = {
 	{ 0,                     NULL      },
 };
 
+static const struct enum_str_map display_renderer_map[DISPLAY_RENDERER__COUNT+1] = {
+	{ DISPLAY_RENDERER_OPENGL, "opengl" },
+	{ DISPLAY_RENDERER_NULL,   "null"   },
+	{ 0,                       NULL     },
+};
+
+static const struct enum_str_map display_pacing_map[DISPLAY_PACING__COUNT+1] = {
+	{ DISPLAY_PACING_GUEST,    "guest"    },
+	{ DISPLAY_PACING_VSYNC,    "vsync"    },
+	{ DISPLAY_PACING_ADAPTIVE, "adaptive" },
+	{ DISPLAY_PACING_TARGET,   "target"   },
+	{ 0,                       NULL       },
+};
+
 static const struct enum_str_map net_backend_map[XEMU_NET_BACKEND__COUNT+1] = {
 	{ XEMU_NET_BACKEND_USER,       "user" },
 	{ XEMU_NET_BACKEND_SOCKET_UDP, "udp"  },
 	{ XEMU_NET_BACKEND_PCAP,       "pcap"  },
+	{ XEMU_NET_BACKEND_SYSLINK,    "syslink" },
 	{ 0,                           NULL   },
 };
 
@@ -116,23 +147,38 @@ struct config_offset_table {
 	[XEMU_SETTINGS_SYSTEM_MEMORY]       = { CONFIG_TYPE_INT,    "system", "memory",       offsetof(struct xemu_settings, memory),          { .default_int  = 64 } },
 	[XEMU_SETTINGS_SYSTEM_SHORTANIM]    = { CONFIG_TYPE_BOOL,   "system", "shortanim",    offsetof(struct xemu_settings, short_animation), { .default_bool = 0  } },
 	[XEMU_SETTINGS_SYSTEM_HARD_FPU]     = { CONFIG_TYPE_BOOL,   "system", "hard_fpu",     offsetof(struct xemu_settings, hard_fpu),        { .default_bool = 1  } },
+	[XEMU_SETTINGS_SYSTEM_DVD_READAHEAD] = { CONFIG_TYPE_INT,  "system", "dvd_readahead", offsetof(struct xemu_settings, dvd_readahead), { .default_int = 0 } },
+	[XEMU_SETTINGS_SYSTEM_DVD_SEEK_TIMING] = { CONFIG_TYPE_INT, "system", "dvd_seek_timing", offsetof(struct xemu_settings, dvd_seek_timing), { .default_int = 0 } },
+	[XEMU_SETTINGS_SYSTEM_DVD_MMAP] = { CONFIG_TYPE_BOOL, "system", "dvd_mmap", offsetof(struct xemu_settings, dvd_mmap), { .default_bool = 0 } },
 
 	[XEMU_SETTINGS_AUDIO_USE_DSP] = { CONFIG_TYPE_BOOL, "audio", "use_dsp", offsetof(struct xemu_settings, use_dsp), { .default_bool = 0  } },
 
 	[XEMU_SETTINGS_DISPLAY_SCALE]        = { CONFIG_TYPE_ENUM, "display", "scale",        offsetof(struct xemu_settings, scale),        { .default_int = DISPLAY_SCALE_SCALE }, display_scale_map },
 	[XEMU_SETTINGS_DISPLAY_UI_SCALE]     = { CONFIG_TYPE_INT,  "display", "ui_scale",     offsetof(struct xemu_settings, ui_scale),     { .default_int = 1                   }                    },
 	[XEMU_SETTINGS_DISPLAY_RENDER_SCALE] = { CONFIG_TYPE_INT,  "display", "render_scale", offsetof(struct xemu_settings, render_scale), { .default_int = 1                   }                    },
+	[XEMU_SETTINGS_DISPLAY_RENDERER]     = { CONFIG_TYPE_ENUM, "display", "renderer",     offsetof(struct xemu_settings, renderer),     { .default_int = DISPLAY_RENDERER_OPENGL }, display_renderer_map },
+	[XEMU_SETTINGS_DISPLAY_FRAME_PACING] = { CONFIG_TYPE_ENUM, "display", "frame_pacing", offsetof(struct xemu_settings, frame_pacing), { .default_int = DISPLAY_PACING_GUEST }, display_pacing_map },
+	[XEMU_SETTINGS_DISPLAY_TARGET_FPS]   = { CONFIG_TYPE_INT,  "display", "target_fps",   offsetof(struct xemu_settings, target_fps),   { .default_int = 60 } },
+	[XEMU_SETTINGS_DISPLAY_SKIP_UNCHANGED] = { CONFIG_TYPE_BOOL, "display", "skip_unchanged", offsetof(struct xemu_settings, skip_unchanged), { .default_bool = 1 } },
 
 	[XEMU_SETTINGS_INPUT_CONTROLLER_1_GUID] = { CONFIG_TYPE_STRING,   "input", "controller_1_guid", offsetof(struct xemu_settings, controller_1_guid), { .default_str = "" } },
 	[XEMU_SETTINGS_INPUT_CONTROLLER_2_GUID] = { CONFIG_TYPE_STRING,   "input", "controller_2_guid", offsetof(struct xemu_settings, controller_2_guid), { .default_str = "" } },
 	[XEMU_SETTINGS_INPUT_CONTROLLER_3_GUID] = { CONFIG_TYPE_STRING,   "input", "controller_3_guid", offsetof(struct xemu_settings, controller_3_guid), { .default_str = "" } },
 	[XEMU_SETTINGS_INPUT_CONTROLLER_4_GUID] = { CONFIG_TYPE_STRING,   "input", "controller_4_guid", offsetof(struct xemu_settings, controller_4_guid), { .default_str = "" } },
+	[XEMU_SETTINGS_INPUT_POLL_RATE]         = { CONFIG_TYPE_INT,      "input", "poll_rate",         offsetof(struct xemu_settings, poll_rate),         { .default_int = 1000 } },
 
 	[XEMU_SETTINGS_NETWORK_ENABLED]     = { CONFIG_TYPE_BOOL,   "network", "enabled",     offsetof(struct xemu_settings, net_enabled),     { .default_bool = 0              } },
 	[XEMU_SETTINGS_NETWORK_BACKEND]     = { CONFIG_TYPE_ENUM,   "network", "backend",     offsetof(struct xemu_settings, net_backend),     { .default_int = XEMU_NET_BACKEND_USER }, net_backend_map },
 	[XEMU_SETTINGS_NETWORK_LOCAL_ADDR]  = { CONFIG_TYPE_STRING, "network", "local_addr",  offsetof(struct xemu_settings, net_local_addr),  { .default_str  = "0.0.0.0:9368" } },
 	[XEMU_SETTINGS_NETWORK_REMOTE_ADDR] = { CONFIG_TYPE_STRING, "network", "remote_addr", offsetof(struct xemu_settings, net_remote_addr), { .default_str  = "1.2.3.4:9368" } },
 	[XEMU_SETTINGS_NETWORK_PCAP_INTERFACE] = { CONFIG_TYPE_STRING, "network", "pcap_iface", offsetof(struct xemu_settings, net_pcap_iface), { .default_str  = "" } },
+	[XEMU_SETTINGS_NETWORK_RELAY_ADDR]  = { CONFIG_TYPE_STRING, "network", "relay_addr",  offsetof(struct xemu_settings, net_relay_addr),  { .default_str  = "127.0.0.1:9369" } },
+	[XEMU_SETTINGS_NETWORK_COMPRESS]    = { CONFIG_TYPE_BOOL,   "network", "compress",    offsetof(struct xemu_settings, net_compress),    { .default_bool = 0 } },
+
+	[XEMU_SETTINGS_REWIND_ENABLED]  = { CONFIG_TYPE_BOOL, "rewind", "enabled",  offsetof(struct xemu_settings, rewind_enabled),  { .default_bool = 0    } },
+	[XEMU_SETTINGS_REWIND_SECONDS]  = { CONFIG_TYPE_INT,  "rewind", "seconds",  offsetof(struct xemu_settings, rewind_seconds),  { .default_int  = 30   } },
+	[XEMU_SETTINGS_REWIND_INTERVAL] = { CONFIG_TYPE_INT,  "rewind", "interval", offsetof(struct xemu_settings, rewind_interval), { .default_int  = 1000 } },
+	[XEMU_SETTINGS_REWIND_BUDGET]   = { CONFIG_TYPE_INT,  "rewind", "budget",   offsetof(struct xemu_settings, rewind_budget),   { .default_int  = 8    } },
 
 	[XEMU_SETTINGS_MISC_USER_TOKEN]       = { CONFIG_TYPE_STRING, "misc", "user_token", offsetof(struct xemu_settings, user_token), { .default_str  = "" } },
 	[XEMU_SETTINGS_MISC_CHECK_FOR_UPDATE] = { CONFIG_TYPE_BOOL,   "misc", "check_for_update", offsetof(struct xemu_settings, check_for_update), { .default_bool = -1  } },
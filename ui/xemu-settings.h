@@ -37,19 +37,33 @@ enum xemu_settings_keys {
 	XEMU_SETTINGS_SYSTEM_MEMORY,
 	XEMU_SETTINGS_SYSTEM_SHORTANIM,
 	XEMU_SETTINGS_SYSTEM_HARD_FPU,
+	XEMU_SETTINGS_SYSTEM_DVD_READAHEAD,
+	XEMU_SETTINGS_SYSTEM_DVD_SEEK_TIMING,
+	XEMU_SETTINGS_SYSTEM_DVD_MMAP,
 	XEMU_SETTINGS_AUDIO_USE_DSP,
 	XEMU_SETTINGS_DISPLAY_SCALE,
 	XEMU_SETTINGS_DISPLAY_UI_SCALE,
 	XEMU_SETTINGS_DISPLAY_RENDER_SCALE,
+	XEMU_SETTINGS_DISPLAY_RENDERER,
+	XEMU_SETTINGS_DISPLAY_FRAME_PACING,
+	XEMU_SETTINGS_DISPLAY_TARGET_FPS,
+	XEMU_SETTINGS_DISPLAY_SKIP_UNCHANGED,
 	XEMU_SETTINGS_INPUT_CONTROLLER_1_GUID,
 	XEMU_SETTINGS_INPUT_CONTROLLER_2_GUID,
 	XEMU_SETTINGS_INPUT_CONTROLLER_3_GUID,
 	XEMU_SETTINGS_INPUT_CONTROLLER_4_GUID,
+	XEMU_SETTINGS_INPUT_POLL_RATE,
 	XEMU_SETTINGS_NETWORK_ENABLED,
 	XEMU_SETTINGS_NETWORK_BACKEND,
 	XEMU_SETTINGS_NETWORK_LOCAL_ADDR,
 	XEMU_SETTINGS_NETWORK_REMOTE_ADDR,
 	XEMU_SETTINGS_NETWORK_PCAP_INTERFACE,
+	XEMU_SETTINGS_NETWORK_RELAY_ADDR,
+	XEMU_SETTINGS_NETWORK_COMPRESS,
+	XEMU_SETTINGS_REWIND_ENABLED,
+	XEMU_SETTINGS_REWIND_SECONDS,
+	XEMU_SETTINGS_REWIND_INTERVAL,
+	XEMU_SETTINGS_REWIND_BUDGET,
 	XEMU_SETTINGS_MISC_USER_TOKEN,
 	XEMU_SETTINGS_MISC_CHECK_FOR_UPDATE,
 	XEMU_SETTINGS__COUNT,
@@ -67,10 +81,29 @@ enum DISPLAY_SCALE
     DISPLAY_SCALE_INVALID = -1
 };
 
+enum DISPLAY_RENDERER
+{
+    DISPLAY_RENDERER_OPENGL,
+    DISPLAY_RENDERER_NULL,
+    DISPLAY_RENDERER__COUNT,
+    DISPLAY_RENDERER_INVALID = -1
+};
+
+enum DISPLAY_PACING
+{
+    DISPLAY_PACING_GUEST,
+    DISPLAY_PACING_VSYNC,
+    DISPLAY_PACING_ADAPTIVE,
+    DISPLAY_PACING_TARGET,
+    DISPLAY_PACING__COUNT,
+    DISPLAY_PACING_INVALID = -1
+};
+
 enum xemu_net_backend {
 	XEMU_NET_BACKEND_USER,
 	XEMU_NET_BACKEND_SOCKET_UDP,
 	XEMU_NET_BACKEND_PCAP,
+	XEMU_NET_BACKEND_SYSLINK,
 	XEMU_NET_BACKEND__COUNT,
 	XEMU_NET_BACKEND_INVALID = -1
 };
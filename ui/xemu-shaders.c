@@ -92,10 +92,10 @@ struct decal_shader *create_decal_shader(enum SHADER_TYPE type)
     const char *image_gamma_frag_src =
         "#version 400 core\n"
         "uniform sampler2D tex;\n"
-        "uniform uint palette[256];\n"
+        "uniform sampler2D palette;\n"
         "float gamma_ch(int ch, float col)\n"
         "{\n"
-        "    return float(bitfieldExtract(palette[uint(col * 255.0)], ch*8, 8)) / 255.0;\n"
+        "    return texelFetch(palette, ivec2(int(col * 255.0), 0), 0)[ch];\n"
         "}\n"
         "\n"
         "vec4 gamma(vec4 col)\n"
@@ -165,11 +165,7 @@ struct decal_shader *create_decal_shader(enum SHADER_TYPE type)
     s->ColorFill_loc      = glGetUniformLocation(s->prog, "in_ColorFill");
     s->time_loc           = glGetUniformLocation(s->prog, "iTime");
     s->scale_loc          = glGetUniformLocation(s->prog, "scale");
-    for (int i = 0; i < 256; i++) {
-        char name[64];
-        snprintf(name, sizeof(name), "palette[%d]", i);
-        s->palette_loc[i] = glGetUniformLocation(s->prog, name);
-    }
+    s->palette_loc        = glGetUniformLocation(s->prog, "palette");
 
     // Create a vertex array object
     glGenVertexArrays(1, &s->vao);
@@ -55,7 +55,7 @@ struct decal_shader
     GLint ColorFill_loc;
     GLint time_loc;
     GLint scale_loc;
-    GLint palette_loc[256];
+    GLint palette_loc;
 };
 
 struct fbo {
@@ -43,17 +43,20 @@
 #include "sysemu/runstate.h"
 #include "sysemu/runstate-action.h"
 #include "sysemu/sysemu.h"
+#include "sysemu/block-backend.h"
 #include "xemu-hud.h"
 #include "xemu-input.h"
 #include "xemu-settings.h"
 #include "xemu-shaders.h"
 #include "xemu-version.h"
 #include "xemu-os-utils.h"
+#include "xemu-pacing.h"
 
 #include "data/xemu_64x64.png.h"
 
 #include "hw/xbox/smbus.h" // For eject, drive tray
 #include "hw/xbox/nv2a/nv2a.h"
+#include "hw/ide/atapi-readahead.h"
 
 #ifdef _WIN32
 // Provide hint to prefer high-performance graphics for hybrid systems
@@ -90,8 +93,6 @@ void xb_surface_gl_create_texture(DisplaySurface *surface);
 void xb_surface_gl_update_texture(DisplaySurface *surface, int x, int y, int w, int h);
 void xb_surface_gl_destroy_texture(DisplaySurface *surface);
 
-static void sleep_ns(int64_t ns);
-
 static int sdl2_num_outputs;
 static struct sdl2_console *sdl2_console;
 static SDL_Surface *guest_sprite_surface;
@@ -110,6 +111,9 @@ static SDL_Window *m_window;
 static SDL_GLContext m_context;
 int scaling_mode = 1;
 struct decal_shader *blit;
+static GLuint palette_tex;
+static uint8_t palette_cache[256 * 3];
+static bool palette_valid;
 
 static QemuSemaphore display_init_sem;
 
@@ -905,9 +909,20 @@ static void sdl2_display_early_init(DisplayOptions *o)
     display_opengl = 1;
 
     SDL_GL_MakeCurrent(m_window, m_context);
-    SDL_GL_SetSwapInterval(0);
+    xemu_pacing_init();
     xemu_hud_init(m_window, m_context);
     blit = create_decal_shader(SHADER_TYPE_BLIT_GAMMA);
+
+    glGenTextures(1, &palette_tex);
+    glBindTexture(GL_TEXTURE_2D, palette_tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 256, 1, 0, GL_RGB,
+                 GL_UNSIGNED_BYTE, NULL);
+    glUseProgram(blit->prog);
+    glUniform1i(blit->palette_loc, 1);
+    glUseProgram(0);
 }
 
 static void sdl2_display_init(DisplayState *ds, DisplayOptions *o)
@@ -1108,54 +1123,9 @@ static void update_fps(void)
     fps = 1000.0/avg;
 }
 
-void sdl2_gl_refresh(DisplayChangeListener *dcl)
+/* Draw the bound framebuffer texture into the window */
+static void render_framebuffer(int tw, int th, int ww, int wh, bool flip)
 {
-    struct sdl2_console *scon = container_of(dcl, struct sdl2_console, dcl);
-    assert(scon->opengl);
-    bool flip_required = false;
-
-    SDL_GL_MakeCurrent(scon->real_window, scon->winctx);
-    update_fps();
-
-    /* XXX: Note that this bypasses the usual VGA path in order to quickly
-     * get the surface. This is simple and fast, at the cost of accuracy.
-     * Ideally, this should go through the VGA code and opportunistically pull
-     * the surface like this, but handle the VGA logic as well. For now, just
-     * use this fast path to handle the common case.
-     *
-     * In the event the surface is not found in the surface cache, e.g. when
-     * the guest code isn't using HW accelerated rendering, but just blitting
-     * to the framebuffer, fall back to the VGA path.
-     */
-    GLuint tex = nv2a_get_framebuffer_surface();
-    if (tex == 0) {
-        xb_surface_gl_create_texture(scon->surface);
-        scon->updates++;
-        tex = scon->surface->texture;
-        flip_required = true;
-    }
-
-    /* FIXME: Finer locking. Event handlers in segments of the code expect
-     * to be running on the main thread with the BQL. For now, acquire the
-     * lock and perform rendering, but release before swap to avoid
-     * possible lengthy blocking (for vsync).
-     */
-    qemu_mutex_lock_main_loop();
-    qemu_mutex_lock_iothread();
-    sdl2_poll_events(scon);
-
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, tex);
-
-    // Get texture dimensions
-    int tw, th;
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &tw);
-    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &th);
-
-    // Get window dimensions
-    int ww, wh;
-    SDL_GL_GetDrawableSize(scon->real_window, &ww, &wh);
-
     // Calculate scaling factors
     float scale[2];
     if (scaling_mode == DISPLAY_SCALE_STRETCH) {
@@ -1188,9 +1158,8 @@ void sdl2_gl_refresh(DisplayChangeListener *dcl)
         }
     }
 
-    // Render framebuffer and GUI
     struct decal_shader *s = blit;
-    s->flip = flip_required;
+    s->flip = flip;
     glViewport(0, 0, ww, wh);
     glUseProgram(s->prog);
     glBindVertexArray(s->vao);
@@ -1199,72 +1168,122 @@ void sdl2_gl_refresh(DisplayChangeListener *dcl)
     glUniform4f(s->TexScaleOffset_loc, 1.0, 1.0, 0, 0);
     glUniform1i(s->tex_loc, 0);
 
-    const uint8_t *palette = nv2a_get_dac_palette();
-    for (int i = 0; i < 256; i++) {
-        uint32_t e = (palette[i * 3 + 2] << 16) | (palette[i * 3 + 1] << 8) |
-                     palette[i * 3];
-        glUniform1ui(s->palette_loc[i], e);
-    }
-
     glClearColor(0, 0, 0, 0);
     glClear(GL_COLOR_BUFFER_BIT);
     glDrawElements(GL_TRIANGLE_FAN, 4, GL_UNSIGNED_INT, NULL);
+}
 
-    xemu_hud_render();
+/* The DAC palette rarely changes, so only upload it when it does */
+static bool update_palette(void)
+{
+    const uint8_t *palette = nv2a_get_dac_palette();
+    if (palette_valid && !memcmp(palette, palette_cache, sizeof(palette_cache))) {
+        return false;
+    }
 
-    // Release BQL before swapping (which may sleep if swap interval is not immediate)
-    qemu_mutex_unlock_iothread();
-    qemu_mutex_unlock_main_loop();
+    memcpy(palette_cache, palette, sizeof(palette_cache));
+    palette_valid = true;
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, palette_tex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 256, 1, GL_RGB, GL_UNSIGNED_BYTE,
+                    palette_cache);
+    glActiveTexture(GL_TEXTURE0);
+    return true;
+}
 
-    glFinish();
-    SDL_GL_SwapWindow(scon->real_window);
+void sdl2_gl_refresh(DisplayChangeListener *dcl)
+{
+    struct sdl2_console *scon = container_of(dcl, struct sdl2_console, dcl);
+    assert(scon->opengl);
+    bool flip_required = false;
 
-    /* VGA update (see note above) + vblank */
+    SDL_GL_MakeCurrent(scon->real_window, scon->winctx);
+    update_fps();
+    xemu_pacing_begin_frame();
+
+    /* XXX: Note that this bypasses the usual VGA path in order to quickly
+     * get the surface. This is simple and fast, at the cost of accuracy.
+     * Ideally, this should go through the VGA code and opportunistically pull
+     * the surface like this, but handle the VGA logic as well. For now, just
+     * use this fast path to handle the common case.
+     *
+     * In the event the surface is not found in the surface cache, e.g. when
+     * the guest code isn't using HW accelerated rendering, but just blitting
+     * to the framebuffer, fall back to the VGA path.
+     */
+    int tw, th;
+    bool fb_updated;
+    GLuint tex = nv2a_get_framebuffer_surface(&tw, &th, &fb_updated);
+    if (tex == 0) {
+        xb_surface_gl_create_texture(scon->surface);
+        scon->updates++;
+        tex = scon->surface->texture;
+        tw = surface_width(scon->surface);
+        th = surface_height(scon->surface);
+        flip_required = true;
+        fb_updated = true;
+    }
+
+    /* FIXME: Finer locking. Event handlers in segments of the code expect
+     * to be running on the main thread with the BQL. For now, acquire the
+     * lock and perform rendering, but release before swap to avoid
+     * possible lengthy blocking (for vsync).
+     */
     qemu_mutex_lock_main_loop();
     qemu_mutex_lock_iothread();
-    graphic_hw_update(scon->dcl.con);
-    if (scon->updates && scon->surface) {
-        scon->updates = 0;
+    sdl2_poll_events(scon);
+    bool hud_updated = xemu_hud_update();
+    bool palette_updated = update_palette();
+
+    // Get window dimensions
+    int ww, wh;
+    SDL_GL_GetDrawableSize(scon->real_window, &ww, &wh);
+
+    /* Leave the last frame on screen while nothing in it would change */
+    static GLuint last_tex;
+    static int last_ww, last_wh, last_scaling_mode;
+    bool present = !xemu_pacing_get_skip_unchanged() || fb_updated ||
+                   hud_updated || palette_updated || tex != last_tex ||
+                   ww != last_ww || wh != last_wh ||
+                   scaling_mode != last_scaling_mode;
+    last_tex = tex;
+    last_ww = ww;
+    last_wh = wh;
+    last_scaling_mode = scaling_mode;
+
+    if (present) {
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, palette_tex);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, tex);
+        render_framebuffer(tw, th, ww, wh, flip_required);
+        xemu_hud_render();
     }
+
+    // Release BQL before swapping (which may sleep if swap interval is not immediate)
     qemu_mutex_unlock_iothread();
     qemu_mutex_unlock_main_loop();
 
-    /*
-     * Throttle to make sure swaps happen at 60Hz
-     */
-    static int64_t last_update = 0;
-    int64_t deadline = last_update + 16666666;
-
-    int64_t sleep_acc = 0;
-    int64_t spin_acc = 0;
-
-#ifndef _WIN32
-    const int64_t sleep_threshold = 2000000;
-#else
-    const int64_t sleep_threshold = 250000;
-#endif
+    if (present) {
+        SDL_GL_SwapWindow(scon->real_window);
+        xemu_pacing_end_frame();
+    } else {
+        xemu_pacing_skip_frame();
+    }
 
-    while (1) {
-        int64_t now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
-        int64_t time_remaining = deadline - now;
-        if (now < deadline) {
-            if (time_remaining > sleep_threshold) {
-                // Try to sleep until the until reaching the sleep threshold.
-                sleep_ns(time_remaining - sleep_threshold);
-                sleep_acc += qemu_clock_get_ns(QEMU_CLOCK_REALTIME)-now;
-            } else {
-                // Simply spin to avoid extra delays incurred with swapping to
-                // another process and back in the event of being within
-                // threshold to desired event.
-                spin_acc++;
-            }
-        } else {
-            DPRINTF("zzZz %g %ld\n", (double)sleep_acc/1000000.0, spin_acc);
-            last_update = now;
-            break;
+    /* VGA update (see note above) + vblank */
+    qemu_mutex_lock_main_loop();
+    qemu_mutex_lock_iothread();
+    if (xemu_pacing_vblank_due(nv2a_get_refresh_rate())) {
+        graphic_hw_update(scon->dcl.con);
+        if (scon->updates && scon->surface) {
+            scon->updates = 0;
         }
     }
+    qemu_mutex_unlock_iothread();
+    qemu_mutex_unlock_main_loop();
 
+    xemu_pacing_wait();
 }
 
 void sdl2_gl_redraw(struct sdl2_console *scon)
@@ -1455,19 +1474,6 @@ static void *call_qemu_main(void *opaque)
     exit(status);
 }
 
-/* Note: only supports millisecond resolution on Windows */
-static void sleep_ns(int64_t ns)
-{
-#ifndef _WIN32
-        struct timespec sleep_delay, rem_delay;
-        sleep_delay.tv_sec = ns / 1000000000LL;
-        sleep_delay.tv_nsec = ns % 1000000000LL;
-        nanosleep(&sleep_delay, &rem_delay);
-#else
-        Sleep(ns / SCALE_MS);
-#endif
-}
-
 int main(int argc, char **argv)
 {
     QemuThread thread;
@@ -1551,10 +1557,21 @@ void xemu_load_disc(const char *path)
     // Ensure an eject sequence is always triggered so Xbox software reloads
     xbox_smc_eject_button();
 
+    int dvd_mmap;
+    xemu_settings_get_bool(XEMU_SETTINGS_SYSTEM_DVD_MMAP, &dvd_mmap);
+    char *filename = dvd_mmap ? g_strdup_printf("mmap:%s", path)
+                              : g_strdup(path);
+
     Error *err = NULL;
-    qmp_blockdev_change_medium(true, "ide0-cd1", false, NULL, path,
+    qmp_blockdev_change_medium(true, "ide0-cd1", false, NULL, filename,
                                false, "", false, 0,
                                &err);
+    g_free(filename);
 
     xbox_smc_update_tray_state();
 }
+
+bool xemu_get_disc_readahead_stats(ATAPIReadaheadStats *stats)
+{
+    return ide_cd_get_readahead_stats(blk_by_name("ide0-cd1"), stats);
+}